@@ -0,0 +1,272 @@
+#include "stdafx.h"
+#include <stdlib.h>
+#include <new>
+#include "AllocationAudit.h"
+
+bool AllocationAudit::s_enabled = false;
+
+static volatile LONG s_allocations[AuditStageCount];
+static volatile LONGLONG s_allocatedBytes[AuditStageCount];
+static volatile LONGLONG s_copiedBytes[AuditStageCount];
+
+static __declspec(thread) int t_stage = AuditStageOther;
+
+static const char* s_stageNames[AuditStageCount] =
+{
+	"other",
+	"ingest",
+	"sync",
+	"map",
+	"composite",
+	"detection",
+	"midi",
+	"render_prep",
+	"draw",
+};
+
+static bool s_heapHooked = false;
+
+#ifdef _WIN32
+
+typedef LPVOID (WINAPI* HeapAllocFunction)(HANDLE heap, DWORD flags, SIZE_T bytes);
+typedef LPVOID (WINAPI* HeapReAllocFunction)(HANDLE heap, DWORD flags, LPVOID p, SIZE_T bytes);
+
+// the CRT's own imports, called on by the hooks; set once, before the first hook can run
+static HeapAllocFunction s_heapAlloc = NULL;
+static HeapReAllocFunction s_heapReAlloc = NULL;
+
+/// <summary>
+/// Sees every allocation the CRT makes: malloc, calloc and operator new. Must not allocate
+/// </summary>
+static LPVOID WINAPI AuditHeapAlloc(HANDLE heap, DWORD flags, SIZE_T bytes)
+{
+	AllocationAudit::RecordAllocation(bytes);
+	return s_heapAlloc(heap, flags, bytes);
+}
+
+/// <summary>
+/// Sees every reallocation the CRT makes. Must not allocate
+/// </summary>
+static LPVOID WINAPI AuditHeapReAlloc(HANDLE heap, DWORD flags, LPVOID p, SIZE_T bytes)
+{
+	AllocationAudit::RecordAllocation(bytes);
+	return s_heapReAlloc(heap, flags, p, bytes);
+}
+
+/// <summary>
+/// Points a module's import of a KERNEL32 function at a replacement
+/// </summary>
+/// <param name="module">module whose import address table is patched</param>
+/// <param name="name">the function imported</param>
+/// <param name="replacement">what to call instead</param>
+/// <param name="original">receives the function the import pointed at, before any call can reach the replacement</param>
+/// <returns>true if the import was found and patched</returns>
+static bool PatchImport(HMODULE module, const char* name, void* replacement, void** original)
+{
+	BYTE* base = reinterpret_cast<BYTE*>(module);
+	IMAGE_DOS_HEADER* pDosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(base);
+	IMAGE_NT_HEADERS* pNtHeaders = reinterpret_cast<IMAGE_NT_HEADERS*>(base + pDosHeader->e_lfanew);
+	IMAGE_DATA_DIRECTORY& imports = pNtHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+	if ( 0 == imports.VirtualAddress )
+	{
+		return false;
+	}
+
+	for ( IMAGE_IMPORT_DESCRIPTOR* pImport = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*>(base + imports.VirtualAddress); pImport->Name; ++pImport )
+	{
+		// without the names there is no telling which slot is which
+		if ( 0 != _stricmp(reinterpret_cast<const char*>(base + pImport->Name), "KERNEL32.dll") || 0 == pImport->OriginalFirstThunk )
+		{
+			continue;
+		}
+
+		IMAGE_THUNK_DATA* pName = reinterpret_cast<IMAGE_THUNK_DATA*>(base + pImport->OriginalFirstThunk);
+		IMAGE_THUNK_DATA* pSlot = reinterpret_cast<IMAGE_THUNK_DATA*>(base + pImport->FirstThunk);
+		for ( ; pName->u1.AddressOfData; ++pName, ++pSlot )
+		{
+			if ( IMAGE_SNAP_BY_ORDINAL(pName->u1.Ordinal) ||
+				0 != strcmp(reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(base + pName->u1.AddressOfData)->Name, name) )
+			{
+				continue;
+			}
+
+			DWORD protect;
+			if ( !VirtualProtect(&pSlot->u1.Function, sizeof(pSlot->u1.Function), PAGE_READWRITE, &protect) )
+			{
+				return false;
+			}
+			*original = reinterpret_cast<void*>(pSlot->u1.Function);
+			InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&pSlot->u1.Function), replacement);
+			VirtualProtect(&pSlot->u1.Function, sizeof(pSlot->u1.Function), protect, &protect);
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
+
+/// <summary>
+/// Hooks the heap calls of whichever module holds the CRT: the executable when it is linked
+/// statically, its DLL otherwise. Every malloc, calloc and realloc ends in one of them, in any build
+/// </summary>
+void AllocationAudit::Install()
+{
+#ifdef _WIN32
+	if ( s_heapHooked )
+	{
+		return;
+	}
+
+	HMODULE crt = NULL;
+	if ( !GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		reinterpret_cast<LPCSTR>(&malloc), &crt) )
+	{
+		return;
+	}
+
+	if ( PatchImport(crt, "HeapAlloc", reinterpret_cast<void*>(AuditHeapAlloc), reinterpret_cast<void**>(&s_heapAlloc)) )
+	{
+		PatchImport(crt, "HeapReAlloc", reinterpret_cast<void*>(AuditHeapReAlloc), reinterpret_cast<void**>(&s_heapReAlloc));
+		s_heapHooked = true;
+	}
+#endif
+}
+
+void AllocationAudit::Enable()
+{
+	for ( int i = 0; i < AuditStageCount; ++i )
+	{
+		s_allocations[i] = 0;
+		s_allocatedBytes[i] = 0;
+		s_copiedBytes[i] = 0;
+	}
+
+	MemoryBarrier();
+	s_enabled = true;
+}
+
+bool AllocationAudit::CountsHeap()
+{
+	return s_heapHooked;
+}
+
+void AllocationAudit::Disable()
+{
+	s_enabled = false;
+	MemoryBarrier();
+}
+
+void AllocationAudit::RecordAllocation(size_t bytes)
+{
+	if ( !s_enabled )
+	{
+		return;
+	}
+
+	InterlockedIncrement(&s_allocations[t_stage]);
+	InterlockedExchangeAdd64(&s_allocatedBytes[t_stage], (LONGLONG)bytes);
+}
+
+void AllocationAudit::RecordCopy(size_t bytes)
+{
+	if ( !s_enabled )
+	{
+		return;
+	}
+
+	InterlockedExchangeAdd64(&s_copiedBytes[t_stage], (LONGLONG)bytes);
+}
+
+void AllocationAudit::Snapshot(AuditStageCounters counters[AuditStageCount])
+{
+	for ( int i = 0; i < AuditStageCount; ++i )
+	{
+		counters[i].allocations = s_allocations[i];
+		counters[i].allocatedBytes = s_allocatedBytes[i];
+		counters[i].copiedBytes = s_copiedBytes[i];
+	}
+}
+
+LONG AllocationAudit::TotalAllocations()
+{
+	LONG allocations = 0;
+	for ( int i = 0; i < AuditStageCount; ++i )
+	{
+		allocations += s_allocations[i];
+	}
+	return allocations;
+}
+
+const char* AllocationAudit::StageName(AuditStage stage)
+{
+	return s_stageNames[stage];
+}
+
+AuditStage AllocationAudit::CurrentStage()
+{
+	return (AuditStage)t_stage;
+}
+
+void AllocationAudit::SetCurrentStage(AuditStage stage)
+{
+	t_stage = stage;
+}
+
+// The global allocation functions. Their malloc is counted by the heap hook; they only count
+// themselves if the CRT's imports could not be hooked
+#define AUDIT_NEW(bytes) if ( !s_heapHooked ) AllocationAudit::RecordAllocation(bytes)
+
+void* operator new(size_t bytes)
+{
+	AUDIT_NEW(bytes);
+	void* p = malloc(bytes > 0 ? bytes : 1);
+	if ( NULL == p )
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t bytes)
+{
+	AUDIT_NEW(bytes);
+	void* p = malloc(bytes > 0 ? bytes : 1);
+	if ( NULL == p )
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) throw()
+{
+	AUDIT_NEW(bytes);
+	return malloc(bytes > 0 ? bytes : 1);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) throw()
+{
+	AUDIT_NEW(bytes);
+	return malloc(bytes > 0 ? bytes : 1);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	free(p);
+}
@@ -0,0 +1,138 @@
+/*
+
+Allocation and copy auditing
+
+Counts every allocation, calls and bytes, against the pipeline stage the
+allocating thread is in. Install points the CRT's imports of HeapAlloc and
+HeapReAlloc at hooks, in debug and release builds alike:
+malloc, calloc, realloc and the global operator new, which is replaced here
+and goes through malloc, all end in one of them. If the imports cannot be
+patched, and off Windows, where there are none, operator new counts itself.
+Stages are marked with AUDIT_SCOPE, and code that copies frame data reports
+the bytes with AllocationAudit::RecordCopy, so the same counters show what
+each stage copies.
+
+Counting is off until Enable; when it is off an allocation or a scope costs
+one predictable branch on a global flag, like tracing. Only the audit
+session installs the hooks, before it starts any thread, so the application
+itself runs with the CRT's heap untouched.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+typedef enum
+{
+	AuditStageOther,		// outside any audited scope
+	AuditStageIngest,		// sensor frames copied into the rings
+	AuditStageSync,			// frames paired up, submitted to the pipeline and retired
+	AuditStageMap,			// player pixels collected and mapped to colour
+	AuditStageComposite,	// players composited into the output image
+	AuditStageDetection,	// feet tested against the floor
+	AuditStageMidi,			// notes queued for the MIDI thread
+	AuditStageRenderPrep,	// frames handed over to the render thread and taken by it
+	AuditStageDraw,			// the render thread drawing
+	AuditStageCount
+} AuditStage;
+
+/// <summary>
+/// Counters for one stage since Enable
+/// </summary>
+typedef struct
+{
+	LONG		allocations;
+	LONGLONG	allocatedBytes;
+	LONGLONG	copiedBytes;
+} AuditStageCounters;
+
+class AllocationAudit
+{
+public:
+	/// <summary>
+	/// Hooks the CRT's heap imports. Call before any other thread is started, as the imports are
+	/// patched in place; without it only operator new is counted
+	/// </summary>
+	static void Install();
+
+	/// <summary>
+	/// Zeroes the counters and starts counting
+	/// </summary>
+	static void Enable();
+
+	/// <summary>
+	/// Stops counting; the counters keep their values
+	/// </summary>
+	static void Disable();
+
+	static bool IsEnabled() { return s_enabled; }
+
+	/// <summary>
+	/// Whether Install hooked the heap, so malloc and the CRT's own allocations are counted; when it
+	/// did not, and always off Windows, only operator new is
+	/// </summary>
+	static bool CountsHeap();
+
+	/// <summary>
+	/// Counts an allocation against the calling thread's stage. Called by the hooks
+	/// </summary>
+	static void RecordAllocation(size_t bytes);
+
+	/// <summary>
+	/// Counts bytes of frame data copied by the calling thread's stage
+	/// </summary>
+	static void RecordCopy(size_t bytes);
+
+	/// <summary>
+	/// Copies out every stage's counters
+	/// </summary>
+	static void Snapshot(AuditStageCounters counters[AuditStageCount]);
+
+	/// <summary>
+	/// Allocations since Enable, every stage's and those outside any
+	/// </summary>
+	static LONG TotalAllocations();
+
+	static const char* StageName(AuditStage stage);
+
+	/// <summary>
+	/// Stage of the calling thread; AuditScope sets it
+	/// </summary>
+	static AuditStage CurrentStage();
+	static void SetCurrentStage(AuditStage stage);
+
+	static bool s_enabled;
+};
+
+class AuditScope
+{
+public:
+	explicit AuditScope(AuditStage stage) :
+		m_enabled(AllocationAudit::s_enabled),
+		m_previous(AuditStageOther)
+	{
+		if ( m_enabled )
+		{
+			m_previous = AllocationAudit::CurrentStage();
+			AllocationAudit::SetCurrentStage(stage);
+		}
+	}
+
+	~AuditScope()
+	{
+		if ( m_enabled )
+		{
+			AllocationAudit::SetCurrentStage(m_previous);
+		}
+	}
+
+private:
+	bool		m_enabled;
+	AuditStage	m_previous;
+};
+
+#define AUDIT_CONCAT_INNER(a, b) a##b
+#define AUDIT_CONCAT(a, b) AUDIT_CONCAT_INNER(a, b)
+
+#define AUDIT_SCOPE(stage) AuditScope AUDIT_CONCAT(auditScope, __LINE__)(stage)
@@ -0,0 +1,251 @@
+#include "stdafx.h"
+#include <fstream>
+#include <vector>
+#include "NuiApi.h"
+#include "AllocationAuditSession.h"
+#include "AllocationAudit.h"
+#include "GreenScreen.h"
+#include "SyntheticFrameSource.h"
+#include "SimpleMIDIPlayer.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const int g_warmupFrames = 30;
+static const int g_steadyFrames = 600;
+
+// enough session for the walk to cross the view, when there is no capture
+static const int g_syntheticFrames = 150;
+static const int g_colorFrames = 4;
+
+// longest capture replayed, to bound the memory the session takes
+static const int g_maxCaptureFrames = 300;
+
+// frames are stamped at the sensor's rate, and each waits this long at most to be drawn
+static const LONGLONG g_frameIntervalMs = 33;
+static const double g_drawTimeoutMs = 250.0;
+
+// each foot is down for half of every step
+static const int g_stepFrames = 24;
+static const float g_floorHeightM = 1.0f;
+
+/// <summary>
+/// Reads the depth frames of a registration capture; the colour coordinates are skipped
+/// </summary>
+/// <returns>number of frames read</returns>
+static int LoadCapture(const char* path, CompositeLayout& layout, vector<USHORT>& depth)
+{
+	ifstream capture(path, ios::binary);
+	int frames = 0;
+
+	CompositeLayout frameLayout;
+	while ( frames < g_maxCaptureFrames && capture.read(reinterpret_cast<char*>(&frameLayout), sizeof(frameLayout)) )
+	{
+		if ( frames > 0 && 0 != memcmp(&frameLayout, &layout, sizeof(layout)) )
+		{
+			break;
+		}
+		layout = frameLayout;
+
+		LONG depthPixels = layout.depthWidth * layout.depthHeight;
+		size_t offset = depth.size();
+		depth.resize(offset + depthPixels);
+		capture.read(reinterpret_cast<char*>(&depth[offset]), depthPixels * sizeof(USHORT));
+		capture.seekg(depthPixels * 2 * sizeof(LONG), ios::cur);
+		if ( !capture )
+		{
+			depth.resize(offset);
+			break;
+		}
+		++frames;
+	}
+
+	return frames;
+}
+
+/// <summary>
+/// The stream resolution of a frame width, as the application selects them
+/// </summary>
+/// <returns>false if no resolution has that width</returns>
+static bool ResolutionOfWidth(LONG width, NUI_IMAGE_RESOLUTION& resolution)
+{
+	switch ( width )
+	{
+	case 80:	resolution = NUI_IMAGE_RESOLUTION_80x60; return true;
+	case 320:	resolution = NUI_IMAGE_RESOLUTION_320x240; return true;
+	case 640:	resolution = NUI_IMAGE_RESOLUTION_640x480; return true;
+	case 1280:	resolution = NUI_IMAGE_RESOLUTION_1280x960; return true;
+	default:	return false;
+	}
+}
+
+/// <summary>
+/// A tracked skeleton walking across the view and stepping on the floor
+/// </summary>
+static void MakeSkeleton(int frame, NUI_SKELETON_FRAME& skeleton)
+{
+	ZeroMemory(&skeleton, sizeof(skeleton));
+
+	// floor plane y = -g_floorHeightM, as the tracker reports it
+	skeleton.vFloorClipPlane.y = 1.0f;
+	skeleton.vFloorClipPlane.w = g_floorHeightM;
+
+	NUI_SKELETON_DATA& data = skeleton.SkeletonData[0];
+	data.eTrackingState = NUI_SKELETON_TRACKED;
+
+	float across = (frame % g_syntheticFrames) / (float)g_syntheticFrames;
+	bool rightDown = (frame / g_stepFrames) % 2 == 0;
+
+	for ( int foot = 0; foot < 2; ++foot )
+	{
+		bool down = (foot == 0) == rightDown;
+		NUI_SKELETON_POSITION_INDEX joint = (foot == 0) ? NUI_SKELETON_POSITION_FOOT_RIGHT : NUI_SKELETON_POSITION_FOOT_LEFT;
+		Vector4& position = data.SkeletonPositions[joint];
+		position.x = across * 2.0f - 1.0f + foot * 0.2f;
+		position.y = -g_floorHeightM + (down ? 0.02f : 0.2f);
+		position.z = 2.5f;
+		position.w = 1.0f;
+		data.eSkeletonPositionTrackingState[joint] = NUI_SKELETON_POSITION_TRACKED;
+	}
+}
+
+HRESULT RunAllocationAudit(const char* capturePath, const char* csvPath)
+{
+	ofstream csv(csvPath);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	// the heap imports are patched while this is the only thread
+	AllocationAudit::Install();
+
+	// the session: recorded depth if there is a capture, otherwise the synthetic player
+	CompositeLayout layout;
+	vector<USHORT> session;
+	int sessionFrames = LoadCapture(capturePath, layout, session);
+	bool recorded = sessionFrames > 0;
+	if ( !recorded )
+	{
+		layout.depthWidth = 320;
+		layout.depthHeight = 240;
+		layout.colorWidth = 640;
+		layout.colorHeight = 480;
+		layout.colorToDepthDivisor = layout.colorWidth / layout.depthWidth;
+	}
+
+	NUI_IMAGE_RESOLUTION depthResolution;
+	NUI_IMAGE_RESOLUTION colorResolution;
+	if ( !ResolutionOfWidth(layout.depthWidth, depthResolution) || !ResolutionOfWidth(layout.colorWidth, colorResolution) )
+	{
+		return E_INVALIDARG;
+	}
+
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	size_t colorBytes = layout.colorWidth * layout.colorHeight * 4;
+
+	if ( !recorded )
+	{
+		sessionFrames = g_syntheticFrames;
+		session.resize(sessionFrames * depthPixels);
+		for ( int i = 0; i < sessionFrames; ++i )
+		{
+			source.GenerateDepth(i, &session[i * depthPixels]);
+		}
+	}
+
+	vector<BYTE> colorFrames(g_colorFrames * colorBytes);
+	for ( int i = 0; i < g_colorFrames; ++i )
+	{
+		source.GenerateColor(i, &colorFrames[i * colorBytes]);
+	}
+
+	vector<NUI_SKELETON_FRAME> skeletons(g_syntheticFrames);
+	for ( int i = 0; i < g_syntheticFrames; ++i )
+	{
+		MakeSkeleton(i, skeletons[i]);
+	}
+
+	// the application itself, started as it is with a sensor, but fed here
+	SimpleMIDIPlayer player;
+	CGreenScreen application(depthResolution, colorResolution, false);
+	HRESULT hr = application.StartReplay(&player, &source);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	AuditStageCounters warmup[AuditStageCount];
+	AuditStageCounters total[AuditStageCount];
+	ZeroMemory(warmup, sizeof(warmup));
+	int undrawn = 0;
+
+	AllocationAudit::Enable();
+
+	for ( int frame = 0; frame < g_warmupFrames + g_steadyFrames; ++frame )
+	{
+		if ( frame == g_warmupFrames )
+		{
+			AllocationAudit::Snapshot(warmup);
+		}
+
+		LONG drawn = application.DrawnFrames();
+		application.InjectFrames(&session[(frame % sessionFrames) * depthPixels],
+			&colorFrames[(frame % g_colorFrames) * colorBytes],
+			skeletons[frame % g_syntheticFrames],
+			frame * g_frameIntervalMs);
+
+		// one frame at a time, so none is dropped for arriving faster than the pipeline runs
+		LONGLONG start = HighResClock::Now();
+		while ( application.DrawnFrames() == drawn )
+		{
+			if ( HighResClock::TicksToMilliseconds(HighResClock::Now() - start) > g_drawTimeoutMs )
+			{
+				++undrawn;
+				break;
+			}
+			Sleep(1);
+		}
+	}
+
+	AllocationAudit::Snapshot(total);
+	AllocationAudit::Disable();
+
+	csv << "stage,warmup_allocations,warmup_bytes,steady_allocations,steady_bytes,steady_copied_bytes_per_frame" << endl;
+
+	AuditStageCounters steadyTotal;
+	ZeroMemory(&steadyTotal, sizeof(steadyTotal));
+	LONG warmupAllocations = 0;
+	LONGLONG warmupBytes = 0;
+	for ( int stage = 0; stage < AuditStageCount; ++stage )
+	{
+		LONG allocations = total[stage].allocations - warmup[stage].allocations;
+		warmupAllocations += warmup[stage].allocations;
+		warmupBytes += warmup[stage].allocatedBytes;
+		steadyTotal.allocations += allocations;
+		steadyTotal.allocatedBytes += total[stage].allocatedBytes - warmup[stage].allocatedBytes;
+		steadyTotal.copiedBytes += total[stage].copiedBytes - warmup[stage].copiedBytes;
+
+		csv << AllocationAudit::StageName((AuditStage)stage) << ","
+			<< warmup[stage].allocations << ","
+			<< warmup[stage].allocatedBytes << ","
+			<< allocations << ","
+			<< total[stage].allocatedBytes - warmup[stage].allocatedBytes << ","
+			<< (total[stage].copiedBytes - warmup[stage].copiedBytes) / g_steadyFrames << endl;
+	}
+
+	csv << "total," << warmupAllocations << "," << warmupBytes << ","
+		<< steadyTotal.allocations << "," << steadyTotal.allocatedBytes << ","
+		<< steadyTotal.copiedBytes / g_steadyFrames << endl;
+
+	// frames the pipeline dropped were not audited all the way to the screen
+	csv << "undrawn_frames," << undrawn << endl;
+
+	// off Windows, or if the CRT's imports could not be hooked, malloc is not in the counts
+	csv << "counted," << (AllocationAudit::CountsHeap() ? "heap" : "new only") << endl;
+
+	return (steadyTotal.allocations == 0 && undrawn == 0) ? S_OK : S_FALSE;
+}
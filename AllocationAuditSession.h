@@ -0,0 +1,44 @@
+/*
+
+Steady-state allocation audit
+
+Runs the application's own pipeline over a session with the allocation
+audit on. CGreenScreen is started without a sensor or window and the session
+is handed to its acquisition in place of the sensor's frames; from there
+every frame takes the path it takes live: the copy into the frame rings with
+the player mask stabilized, pairing and submission on the processing thread,
+mapping and compositing on the work pool, retirement, foot detection with the
+floor piano and its MIDI enqueue, the overlay and mailbox hand-over, and the
+render thread drawing offscreen, or with the software renderer where there is
+no OpenGL. With no sensor to ask, the synthetic source's fixed camera offset
+stands in for the runtime's mapping. Each frame is injected
+once the last has been drawn, so none is dropped for arriving early.
+
+The session is the depth of registration_capture.bin, looped, if
+/recordregistration has made one, otherwise the synthetic player walking
+past; colour is synthetic, and the skeleton steps each foot onto the floor
+in turn so notes are played.
+
+The first frames warm up. After them the audit fails if any stage, or any
+thread outside one, allocates at all, or if a frame was never drawn. The CSV
+has one row per stage with its allocations in both phases and the bytes it
+copied per steady-state frame, then the frames not drawn, then what was
+counted: "heap" where the CRT's heap was hooked, "new only" where only
+operator new could be, as off Windows.
+
+Run with /auditalloc on the command line; results go to alloc_audit.csv and
+the exit code is 0 only if the steady state made no allocations.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the audit and writes one CSV row per stage
+/// </summary>
+/// <param name="capturePath">registration capture to replay, if it exists</param>
+/// <param name="csvPath">CSV file to write</param>
+/// <returns>S_OK if the steady state made no allocations, S_FALSE if it did, otherwise failure code</returns>
+HRESULT RunAllocationAudit(const char* capturePath, const char* csvPath);
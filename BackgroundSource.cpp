@@ -0,0 +1,339 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+#include "BackgroundSource.h"
+#include "ImageLoader.h"
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+static const char g_y4mSignature[] = "YUV4MPEG2 ";
+static const char g_y4mFrameHeader[] = "FRAME\n";
+static const int g_y4mFrameHeaderBytes = sizeof(g_y4mFrameHeader) - 1;
+
+// raw frames carry no rate; the recorder writes them at the sensor's
+static const double g_rawFramesPerSecond = 30.0;
+
+static BYTE ClampToByte(int value)
+{
+	return ( value < 0 ) ? 0 : ( value > 255 ) ? 255 : (BYTE)value;
+}
+
+/// <summary>
+/// I420 to BGRA, BT.601 studio range as the recorder converts, each chroma sample covering 2x2 pixels
+/// </summary>
+static void ConvertFromI420(const BYTE* pY, const BYTE* pU, const BYTE* pV, int width, int height, BYTE* bgra)
+{
+	int chromaWidth = (width + 1) / 2;
+	for ( int y = 0; y < height; ++y )
+	{
+		const BYTE* luma = pY + (size_t)y * width;
+		const BYTE* u = pU + (size_t)(y / 2) * chromaWidth;
+		const BYTE* v = pV + (size_t)(y / 2) * chromaWidth;
+		BYTE* out = bgra + (size_t)y * width * 4;
+		for ( int x = 0; x < width; ++x, out += 4 )
+		{
+			int c = 298 * (luma[x] - 16) + 128;
+			int d = u[x / 2] - 128;
+			int e = v[x / 2] - 128;
+			out[0] = ClampToByte((c + 516 * d) >> 8);
+			out[1] = ClampToByte((c - 100 * d - 208 * e) >> 8);
+			out[2] = ClampToByte((c + 409 * e) >> 8);
+			out[3] = 255;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+VideoFileSource::VideoFileSource(const char* path) :
+	m_path(path),
+	m_bY4m(false),
+	m_width(0),
+	m_height(0),
+	m_fileWidth(0),
+	m_fileHeight(0),
+	m_frameCount(0),
+	m_framesPerSecond(g_rawFramesPerSecond),
+	m_firstFrame(0),
+	m_frameBytes(0)
+{
+}
+
+HRESULT VideoFileSource::Open(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+
+	m_file.open(m_path.c_str(), ios::binary);
+	if ( !m_file )
+	{
+		return E_FAIL;
+	}
+	m_file.seekg(0, ios::end);
+	streamoff fileBytes = m_file.tellg();
+	m_file.seekg(0, ios::beg);
+
+	char signature[sizeof(g_y4mSignature) - 1];
+	m_bY4m = m_file.read(signature, sizeof(signature)) && memcmp(signature, g_y4mSignature, sizeof(signature)) == 0;
+	m_file.clear();
+	m_file.seekg(0, ios::beg);
+
+	if ( m_bY4m )
+	{
+		HRESULT hr = OpenY4m();
+		if ( FAILED(hr) )
+		{
+			return hr;
+		}
+	}
+	else
+	{
+		// raw frames say nothing about themselves, so they must be the drawn size
+		m_fileWidth = width;
+		m_fileHeight = height;
+		m_firstFrame = 0;
+		m_frameBytes = (streamoff)width * height * 4;
+		if ( fileBytes % m_frameBytes != 0 )
+		{
+			return E_FAIL;
+		}
+	}
+
+	m_frameCount = (LONG)((fileBytes - m_firstFrame) / m_frameBytes);
+	if ( m_frameCount <= 0 )
+	{
+		return E_FAIL;
+	}
+
+	m_encoded.resize((size_t)m_frameBytes);
+	if ( m_fileWidth != m_width || m_fileHeight != m_height )
+	{
+		m_converted.resize((size_t)m_fileWidth * m_fileHeight * 4);
+	}
+	return S_OK;
+}
+
+HRESULT VideoFileSource::OpenY4m()
+{
+	string header;
+	if ( !getline(m_file, header) )
+	{
+		return E_FAIL;
+	}
+
+	// W and H are required; the rate defaults to the recorder's and the chroma to 4:2:0
+	m_fileWidth = m_fileHeight = 0;
+	istringstream parameters(header.substr(sizeof(g_y4mSignature) - 1));
+	string parameter;
+	while ( parameters >> parameter )
+	{
+		const char* value = parameter.c_str() + 1;
+		switch ( parameter[0] )
+		{
+		case 'W':
+			m_fileWidth = atoi(value);
+			break;
+		case 'H':
+			m_fileHeight = atoi(value);
+			break;
+		case 'F':
+			{
+				int numerator = 0, denominator = 0;
+				if ( sscanf(value, "%d:%d", &numerator, &denominator) == 2 && numerator > 0 && denominator > 0 )
+				{
+					m_framesPerSecond = (double)numerator / denominator;
+				}
+			}
+			break;
+		case 'C':
+			if ( strncmp(value, "420", 3) != 0 )
+			{
+				return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+			}
+			break;
+		}
+	}
+	if ( m_fileWidth <= 0 || m_fileHeight <= 0 )
+	{
+		return E_FAIL;
+	}
+
+	// frames are found by offset, so their headers must all be bare
+	m_firstFrame = m_file.tellg();
+	char frameHeader[g_y4mFrameHeaderBytes];
+	if ( !m_file.read(frameHeader, g_y4mFrameHeaderBytes) || memcmp(frameHeader, g_y4mFrameHeader, g_y4mFrameHeaderBytes) != 0 )
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	}
+
+	streamoff lumaBytes = (streamoff)m_fileWidth * m_fileHeight;
+	streamoff chromaBytes = (streamoff)((m_fileWidth + 1) / 2) * ((m_fileHeight + 1) / 2);
+	m_frameBytes = g_y4mFrameHeaderBytes + lumaBytes + chromaBytes * 2;
+	return S_OK;
+}
+
+HRESULT VideoFileSource::ReadFrame(LONG index, BYTE* pixels)
+{
+	TRACE_SCOPE("VideoFileSource::ReadFrame");
+	m_file.clear();
+	m_file.seekg(m_firstFrame + (index % m_frameCount) * m_frameBytes);
+	if ( !m_file.read(reinterpret_cast<char*>(&m_encoded[0]), m_frameBytes) )
+	{
+		return E_FAIL;
+	}
+
+	if ( !m_bY4m )
+	{
+		// the recorder's frames may carry the player mask in their alpha; a background is opaque
+		DWORD* out = reinterpret_cast<DWORD*>(pixels);
+		const DWORD* in = reinterpret_cast<const DWORD*>(&m_encoded[0]);
+		size_t count = (size_t)m_width * m_height;
+		for ( size_t i = 0; i < count; ++i )
+		{
+			out[i] = in[i] | 0xff000000;
+		}
+		return S_OK;
+	}
+
+	if ( memcmp(&m_encoded[0], g_y4mFrameHeader, g_y4mFrameHeaderBytes) != 0 )
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	}
+
+	size_t lumaBytes = (size_t)m_fileWidth * m_fileHeight;
+	size_t chromaBytes = (size_t)((m_fileWidth + 1) / 2) * ((m_fileHeight + 1) / 2);
+	const BYTE* pY = &m_encoded[g_y4mFrameHeaderBytes];
+	const BYTE* pU = pY + lumaBytes;
+	const BYTE* pV = pU + chromaBytes;
+
+	if ( m_converted.empty() )
+	{
+		ConvertFromI420(pY, pU, pV, m_width, m_height, pixels);
+	}
+	else
+	{
+		ConvertFromI420(pY, pU, pV, m_fileWidth, m_fileHeight, &m_converted[0]);
+		ScaleImage(&m_converted[0], m_fileWidth, m_fileHeight, pixels, m_width, m_height);
+	}
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------
+
+ImageSequenceSource::ImageSequenceSource(const char* directory) :
+	m_directory(directory),
+	m_width(0),
+	m_height(0)
+{
+}
+
+static bool IsPng(const string& name)
+{
+	if ( name.size() < 4 )
+	{
+		return false;
+	}
+	string extension = name.substr(name.size() - 4);
+	transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".png";
+}
+
+HRESULT ImageSequenceSource::Open(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_files.clear();
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE hFind = FindFirstFileA((m_directory + "\\*").c_str(), &found);
+	if ( INVALID_HANDLE_VALUE != hFind )
+	{
+		do
+		{
+			if ( !(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsPng(found.cFileName) )
+			{
+				m_files.push_back(m_directory + "\\" + found.cFileName);
+			}
+		}
+		while ( FindNextFileA(hFind, &found) );
+		FindClose(hFind);
+	}
+#else
+	DIR* pDirectory = opendir(m_directory.c_str());
+	if ( pDirectory )
+	{
+		struct dirent* pEntry;
+		while ( (pEntry = readdir(pDirectory)) != NULL )
+		{
+			if ( IsPng(pEntry->d_name) )
+			{
+				m_files.push_back(m_directory + "/" + pEntry->d_name);
+			}
+		}
+		closedir(pDirectory);
+	}
+#endif
+
+	// numbered frames sort in order as long as the numbers are padded to one width
+	sort(m_files.begin(), m_files.end());
+	return m_files.empty() ? E_FAIL : S_OK;
+}
+
+HRESULT ImageSequenceSource::ReadFrame(LONG index, BYTE* pixels)
+{
+	TRACE_SCOPE("ImageSequenceSource::ReadFrame");
+	ifstream file(m_files[index % m_files.size()].c_str(), ios::binary);
+	if ( !file )
+	{
+		return E_FAIL;
+	}
+	file.seekg(0, ios::end);
+	m_encoded.resize((size_t)file.tellg());
+	file.seekg(0, ios::beg);
+	if ( m_encoded.empty() || !file.read(reinterpret_cast<char*>(&m_encoded[0]), m_encoded.size()) )
+	{
+		return E_FAIL;
+	}
+
+	// not cached: a sequence is read through once per loop, and its frames would fill the disk
+	return LoadImageScaled(&m_encoded[0], m_encoded.size(), m_width, m_height, NULL, pixels, NULL);
+}
+
+//------------------------------------------------------------------------------
+
+HRESULT CreateBackgroundSource(const char* path, BackgroundSource** ppSource)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	if ( INVALID_FILE_ATTRIBUTES == attributes )
+	{
+		return E_FAIL;
+	}
+	bool directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	struct stat status;
+	if ( stat(path, &status) != 0 )
+	{
+		return E_FAIL;
+	}
+	bool directory = S_ISDIR(status.st_mode);
+#endif
+
+	if ( directory )
+	{
+		*ppSource = new ImageSequenceSource(path);
+	}
+	else
+	{
+		*ppSource = new VideoFileSource(path);
+	}
+	return S_OK;
+}
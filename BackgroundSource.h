@@ -0,0 +1,121 @@
+/*
+
+Background sources
+
+Where the frames of a moving background come from. A source is opened at
+the size the background is drawn at and then asked for frames by index, on
+a BackgroundStream's decode thread, ahead of when they are shown; it never
+runs on the drawing thread, so a source may take a good part of a frame's
+time per frame. Frames are premultiplied BGRA, top row first, as the still
+background is.
+
+Two kinds are read from disk:
+
+- A video file: YUV4MPEG2 4:2:0, as the recorder writes it, at any size and
+  scaled on decode, or raw BGRA frames back to back at the drawn size (the
+  recorder's raw format). Both play at the file's rate, 30 fps for raw.
+- A directory of PNG images, shown in name order at 30 fps, each scaled to
+  the drawn size as the still background is.
+
+Frame indices wrap, so every source loops.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <fstream>
+#include <vector>
+#include <string>
+
+class BackgroundSource
+{
+public:
+	virtual ~BackgroundSource() {}
+
+	/// <summary>
+	/// Gets ready to produce frames of the given size
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	virtual HRESULT Open(int width, int height) = 0;
+
+	/// <summary>
+	/// Frames before the source loops, once open
+	/// </summary>
+	virtual LONG FrameCount() const = 0;
+
+	/// <summary>
+	/// Rate the frames are meant to be shown at, once open
+	/// </summary>
+	virtual double FramesPerSecond() const = 0;
+
+	/// <summary>
+	/// Produces frame index % FrameCount, width * height * 4 bytes, on the decode thread
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	virtual HRESULT ReadFrame(LONG index, BYTE* pixels) = 0;
+};
+
+/// <summary>
+/// YUV4MPEG2 4:2:0 or raw BGRA frames from one file
+/// </summary>
+class VideoFileSource : public BackgroundSource
+{
+public:
+	explicit VideoFileSource(const char* path);
+
+	virtual HRESULT Open(int width, int height);
+	virtual LONG FrameCount() const { return m_frameCount; }
+	virtual double FramesPerSecond() const { return m_framesPerSecond; }
+	virtual HRESULT ReadFrame(LONG index, BYTE* pixels);
+
+private:
+	std::string			m_path;
+	std::ifstream		m_file;
+	bool				m_bY4m;
+
+	int					m_width;
+	int					m_height;
+	int					m_fileWidth;
+	int					m_fileHeight;
+	LONG				m_frameCount;
+	double				m_framesPerSecond;
+
+	// where frame 0 starts, and the bytes from one frame to the next, header and all
+	std::streamoff		m_firstFrame;
+	std::streamoff		m_frameBytes;
+
+	// a frame as read, and converted at the file's size when that is not the drawn size
+	std::vector<BYTE>	m_encoded;
+	std::vector<BYTE>	m_converted;
+
+	HRESULT OpenY4m();
+};
+
+/// <summary>
+/// The PNG images in a directory, in name order
+/// </summary>
+class ImageSequenceSource : public BackgroundSource
+{
+public:
+	explicit ImageSequenceSource(const char* directory);
+
+	virtual HRESULT Open(int width, int height);
+	virtual LONG FrameCount() const { return (LONG)m_files.size(); }
+	virtual double FramesPerSecond() const { return 30.0; }
+	virtual HRESULT ReadFrame(LONG index, BYTE* pixels);
+
+private:
+	std::string					m_directory;
+	std::vector<std::string>	m_files;
+	int							m_width;
+	int							m_height;
+	std::vector<BYTE>			m_encoded;
+};
+
+/// <summary>
+/// A directory is an image sequence, anything else a video file
+/// </summary>
+/// <param name="ppSource">the source, not yet open, for the caller to delete</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT CreateBackgroundSource(const char* path, BackgroundSource** ppSource);
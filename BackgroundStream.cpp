@@ -0,0 +1,265 @@
+#include "stdafx.h"
+#include "BackgroundStream.h"
+#include "HighResClock.h"
+#include "Trace.h"
+
+BackgroundStream::BackgroundStream() :
+	m_pSource(NULL),
+	m_bHaveNext(false),
+	m_clockTicks(0),
+	m_clockSequence(0),
+	m_ticksPerFrame(1.0),
+	m_lastDue(0),
+	m_lastLate(-1),
+	m_hThread(NULL),
+	m_decodedCount(0),
+	m_errors(0),
+	m_decodeTicks(0),
+	m_shown(0),
+	m_skipped(0),
+	m_undrawn(0),
+	m_late(0)
+{
+	m_current.slot = 0;
+	m_current.sequence = 0;
+	m_next = m_current;
+	m_hSlotFreed = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hDecoded = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+BackgroundStream::~BackgroundStream()
+{
+	Stop();
+
+	CloseHandle(m_hSlotFreed);
+	CloseHandle(m_hDecoded);
+	CloseHandle(m_hStop);
+}
+
+HRESULT BackgroundStream::Start(BackgroundSource* pSource, int width, int height, FrameArena* pArena)
+{
+	if ( m_hThread )
+	{
+		return E_UNEXPECTED;
+	}
+
+	HRESULT hr = pSource->Open(width, height);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	hr = m_ring.Initialize(*pArena, cRingFrames, (size_t)width * height * 4);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	return StartDecoding(pSource);
+}
+
+HRESULT BackgroundStream::Start(BackgroundSource* pSource, int width, int height, BYTE* const slotMemory[cRingFrames])
+{
+	if ( m_hThread )
+	{
+		return E_UNEXPECTED;
+	}
+
+	HRESULT hr = pSource->Open(width, height);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	hr = m_ring.Initialize(cRingFrames, (size_t)width * height * 4);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	for ( int i = 0; i < cRingFrames; ++i )
+	{
+		m_ring.SetSlot(i, slotMemory[i]);
+	}
+	return StartDecoding(pSource);
+}
+
+HRESULT BackgroundStream::StartDecoding(BackgroundSource* pSource)
+{
+	m_pSource = pSource;
+	m_ticksPerFrame = HighResClock::Frequency() / pSource->FramesPerSecond();
+	m_bHaveNext = false;
+	m_decodedCount = 0;
+	m_errors = 0;
+	m_decodeTicks = 0;
+	m_skipped = 0;
+	m_undrawn = 0;
+	m_late = 0;
+
+	ResetEvent(m_hStop);
+	m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	if ( NULL == m_hThread )
+	{
+		return E_FAIL;
+	}
+
+	// the first frame, or the decoder giving up on it
+	HANDLE handles[2] = { m_hDecoded, m_hThread };
+	while ( !m_decoded.Pop(m_current) )
+	{
+		if ( WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 )
+		{
+			Stop();
+			return E_FAIL;
+		}
+	}
+	m_shown = 1;
+	Resume(HighResClock::Now());
+	return S_OK;
+}
+
+void BackgroundStream::Stop()
+{
+	if ( NULL == m_hThread )
+	{
+		return;
+	}
+
+	SetEvent(m_hStop);
+	WaitForSingleObject(m_hThread, INFINITE);
+	CloseHandle(m_hThread);
+	m_hThread = NULL;
+
+	// the next Start frees every slot of the ring again
+	DecodedFrame frame;
+	while ( m_decoded.Pop(frame) )
+	{
+	}
+	m_bHaveNext = false;
+}
+
+void BackgroundStream::Resume(LONGLONG nowTicks)
+{
+	m_clockTicks = nowTicks;
+	m_clockSequence = m_current.sequence;
+	m_lastDue = m_current.sequence;
+	m_lastLate = m_current.sequence;
+}
+
+const BYTE* BackgroundStream::Frame(LONGLONG nowTicks, bool& changed)
+{
+	LONG due = m_clockSequence + (LONG)((nowTicks - m_clockTicks) / m_ticksPerFrame);
+
+	// every frame due by now comes off the queue; only the last of them is shown
+	changed = false;
+	for ( ;; )
+	{
+		if ( !m_bHaveNext )
+		{
+			if ( !m_decoded.Pop(m_next) )
+			{
+				break;
+			}
+			m_bHaveNext = true;
+		}
+		if ( m_next.sequence > due )
+		{
+			break;
+		}
+
+		// overtaken: the ring's miss if the last draw was already due for it, otherwise the draws' pace
+		if ( changed && m_current.sequence <= m_lastDue )
+		{
+			++m_skipped;
+		}
+		else if ( changed )
+		{
+			++m_undrawn;
+		}
+		Release(m_current.slot);
+		m_current = m_next;
+		m_bHaveNext = false;
+		changed = true;
+	}
+
+	if ( changed )
+	{
+		++m_shown;
+	}
+
+	// a frame is late once however many draws it is late for
+	if ( m_current.sequence < due && !m_bHaveNext && due != m_lastLate )
+	{
+		++m_late;
+		m_lastLate = due;
+	}
+	m_lastDue = due;
+
+	return m_ring.Slot(m_current.slot);
+}
+
+void BackgroundStream::GetStats(BackgroundStreamStats& stats) const
+{
+	stats.decoded = m_decodedCount;
+	stats.shown = m_shown;
+	stats.skipped = m_skipped;
+	stats.undrawn = m_undrawn;
+	stats.late = m_late;
+	stats.errors = m_errors;
+	stats.decodeMs = ( m_decodedCount > 0 ) ? HighResClock::TicksToMilliseconds(m_decodeTicks) / m_decodedCount : 0.0;
+}
+
+void BackgroundStream::Release(int slot)
+{
+	m_ring.Release(slot);
+	SetEvent(m_hSlotFreed);
+}
+
+DWORD WINAPI BackgroundStream::ThreadProc(LPVOID lpParameter)
+{
+	static_cast<BackgroundStream*>(lpParameter)->Decode();
+	return 0;
+}
+
+void BackgroundStream::Decode()
+{
+	HANDLE handles[2] = { m_hStop, m_hSlotFreed };
+	LONG sequence = 0;
+	for ( ;; )
+	{
+		// a full ring waits for the drawing thread to move on
+		int slot = m_ring.Acquire();
+		if ( slot < 0 )
+		{
+			if ( WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 )
+			{
+				break;
+			}
+			continue;
+		}
+		if ( WaitForSingleObject(m_hStop, 0) == WAIT_OBJECT_0 )
+		{
+			m_ring.Release(slot);
+			break;
+		}
+
+		LONGLONG start = HighResClock::Now();
+		HRESULT hr;
+		{
+			TRACE_SCOPE("BackgroundStream decode");
+			hr = m_pSource->ReadFrame(sequence % m_pSource->FrameCount(), m_ring.Slot(slot));
+		}
+		if ( FAILED(hr) )
+		{
+			// what was decoded before stays up
+			InterlockedIncrement(&m_errors);
+			m_ring.Release(slot);
+			break;
+		}
+		m_decodeTicks += HighResClock::Now() - start;
+
+		DecodedFrame frame;
+		frame.slot = slot;
+		frame.sequence = sequence++;
+		m_decoded.Push(frame);
+		InterlockedIncrement(&m_decodedCount);
+		SetEvent(m_hDecoded);
+	}
+}
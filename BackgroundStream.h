@@ -0,0 +1,163 @@
+/*
+
+Background stream
+
+Plays a BackgroundSource without ever holding up the drawing thread. A
+decode thread fills a ring of frames ahead of playback and blocks when every
+slot is full; the drawing thread
+asks for the frame due at the time it draws, takes it off the queue, and
+hands the slot of the one it replaces back to the decoder. If the decoder
+has fallen behind, the frame already on show stays up and the miss is
+counted; frames that are decoded too late to be shown are skipped, so
+playback keeps to the source's clock. Frames that were ready in time but had
+no draw while they were due, as when drawing is slower than the source's
+rate, are counted apart from those, as they are no fault of the ring.
+
+A stream that is not being drawn stops asking, its ring fills and its
+decoder sleeps, with the next frames ready: switching to it shows them at
+once, and Resume restarts its clock where it stopped.
+
+The ring is allocated from the frame arena once, for the software renderer,
+which blends from the frames where they are. For OpenGL it is given pixel
+buffers instead, mapped on the drawing thread, so the decoder writes each
+frame straight into memory the GPU uploads it from. Once the drawing thread
+has unmapped the frame on show to upload it, it maps the buffer again, and
+gives the slot the new memory before the decoder can have it back.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "BackgroundSource.h"
+#include "FrameRing.h"
+#include "FrameArena.h"
+#include "SpscQueue.h"
+#include "CacheAligned.h"
+
+/// <summary>
+/// Stream counters
+/// </summary>
+typedef struct
+{
+	LONG		decoded;		// frames the decoder put in the ring
+	LONG		shown;			// frames handed to the drawing thread
+	LONG		skipped;		// frames decoded after a draw they were due at, and overtaken by the next draw
+	LONG		undrawn;		// frames decoded in time, but with no draw while they were due
+	LONG		late;			// frames due before they were decoded, the one before staying up
+	LONG		errors;			// frames the source failed to produce; the decoder stops at the first
+	double		decodeMs;		// average time the source took per frame
+} BackgroundStreamStats;
+
+class BackgroundStream : public CacheAligned
+{
+public:
+	// frames in the ring: the one on show, the next, and up to six decoded ahead
+	static const int cRingFrames = 8;
+
+	BackgroundStream();
+	~BackgroundStream();
+
+	/// <summary>
+	/// Opens the source at the given size, allocates the ring and starts decoding. Returns once the
+	/// first frame is decoded, so that it can be shown straight away
+	/// </summary>
+	/// <param name="pSource">source to play, kept by the caller</param>
+	/// <param name="pArena">arena the ring is allocated from</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(BackgroundSource* pSource, int width, int height, FrameArena* pArena);
+
+	/// <summary>
+	/// Opens the source and starts decoding into memory the caller maps, one buffer per slot of the
+	/// ring. Returns once the first frame is decoded
+	/// </summary>
+	/// <param name="pSource">source to play, kept by the caller</param>
+	/// <param name="slotMemory">cRingFrames buffers of width * height * 4 bytes, mapped until Stop</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(BackgroundSource* pSource, int width, int height, BYTE* const slotMemory[cRingFrames]);
+
+	/// <summary>
+	/// Stops the decoder; the frames in the ring are dropped
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// Restarts the clock at the frame on show, on the drawing thread, as when switching back to
+	/// the stream after drawing something else
+	/// </summary>
+	void Resume(LONGLONG nowTicks);
+
+	/// <summary>
+	/// The frame due at the given time, on the drawing thread, without waiting. It stays valid until
+	/// the next call
+	/// </summary>
+	/// <param name="changed">set if it is another frame than the last call returned</param>
+	const BYTE* Frame(LONGLONG nowTicks, bool& changed);
+
+	/// <summary>
+	/// The frame on show, as the last Frame returned or the first one after Start
+	/// </summary>
+	const BYTE* Current() const { return m_ring.Slot(m_current.slot); }
+
+	/// <summary>
+	/// The slot of the frame on show, which the drawing thread holds until a later frame replaces it
+	/// </summary>
+	int CurrentSlot() const { return m_current.slot; }
+
+	/// <summary>
+	/// Gives the slot of the frame on show other memory to decode into once it is replaced, on the
+	/// drawing thread, when the caller has unmapped its own. Current returns the new memory from then on
+	/// </summary>
+	void RemapCurrent(BYTE* pMemory) { m_ring.SetSlot(m_current.slot, pMemory); }
+
+	void GetStats(BackgroundStreamStats& stats) const;
+
+private:
+	typedef struct
+	{
+		int		slot;
+		LONG	sequence;		// frames since the start; the source's index wraps it
+	} DecodedFrame;
+
+	BackgroundSource*	m_pSource;
+	FrameRing			m_ring;
+	SpscQueue<DecodedFrame, cRingFrames>	m_decoded;
+
+	// Drawing thread: the frame on show, and the one after it once taken off the queue but not yet due
+	DecodedFrame		m_current;
+	DecodedFrame		m_next;
+	bool				m_bHaveNext;
+
+	// the clock: frame m_clockSequence was due at m_clockTicks
+	LONGLONG			m_clockTicks;
+	LONG				m_clockSequence;
+	double				m_ticksPerFrame;
+	LONG				m_lastDue;		// the frame due at the last Frame
+	LONG				m_lastLate;
+
+	HANDLE				m_hSlotFreed;
+	HANDLE				m_hDecoded;
+	HANDLE				m_hStop;
+	HANDLE				m_hThread;
+
+	volatile LONG		m_decodedCount;
+	volatile LONG		m_errors;
+	LONGLONG			m_decodeTicks;
+	LONG				m_shown;
+	LONG				m_skipped;
+	LONG				m_undrawn;
+	LONG				m_late;
+
+	/// <summary>
+	/// Hands a slot back to the decoder
+	/// </summary>
+	void Release(int slot);
+
+	/// <summary>
+	/// Starts the decoder on the ring as initialized, and waits for its first frame
+	/// </summary>
+	HRESULT StartDecoding(BackgroundSource* pSource);
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Decode();
+};
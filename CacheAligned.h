@@ -0,0 +1,39 @@
+/*
+
+Cache-line aligned allocation
+
+SpscQueue keeps its indices on cache lines of their own, which makes any
+class holding one over-aligned; new honours that only from C++17, so before
+it such an object from the heap can start anywhere and the lines the layout
+keeps apart end up shared. Classes that hold one and are made with new
+derive from CacheAligned, whose new and delete over-allocate from the global
+ones, which the allocation audit counts, and align inside the block.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+static const size_t cCacheLineBytes = 64;
+
+class CacheAligned
+{
+public:
+	static void* operator new(size_t bytes)
+	{
+		// the global new aligns to at least 8 bytes, so the step to the line always has room for the block's address
+		BYTE* pBlock = static_cast<BYTE*>(::operator new(bytes + cCacheLineBytes));
+		BYTE* pObject = pBlock + cCacheLineBytes - ((size_t)pBlock & (cCacheLineBytes - 1));
+		reinterpret_cast<void**>(pObject)[-1] = pBlock;
+		return pObject;
+	}
+
+	static void operator delete(void* pObject)
+	{
+		if ( NULL != pObject )
+		{
+			::operator delete(static_cast<void**>(pObject)[-1]);
+		}
+	}
+};
@@ -0,0 +1,223 @@
+#include "stdafx.h"
+#include "NuiApi.h"
+#include "Compositor.h"
+#include "ImageRenderer.h"
+
+// depth width and colour-to-depth ratio of each FixedLayout, in the order of the kernel tables
+static const LONG g_specializedLayouts[cSpecializedLayouts][2] =
+{
+	{ 80, 8 },		// 80x60 depth, 640x480 colour
+	{ 80, 16 },		// 80x60 depth, 1280x960 colour
+	{ 320, 2 },		// 320x240 depth, 640x480 colour
+	{ 320, 4 },		// 320x240 depth, 1280x960 colour
+	{ 640, 1 },		// 640x480 depth, 640x480 colour
+	{ 640, 2 },		// 640x480 depth, 1280x960 colour
+};
+
+int SpecializedLayoutIndex(const CompositeLayout& layout)
+{
+	for ( int i = 0; i < cSpecializedLayouts; ++i )
+	{
+		LONG depthWidth = g_specializedLayouts[i][0];
+		LONG divisor = g_specializedLayouts[i][1];
+
+		if ( layout.depthWidth == depthWidth && layout.depthHeight == depthWidth * 3 / 4 &&
+			layout.colorToDepthDivisor == divisor &&
+			layout.colorWidth == depthWidth * divisor && layout.colorHeight == layout.depthHeight * divisor )
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void SpecializedLayoutSize(int index, LONG& depthWidth, LONG& divisor)
+{
+	depthWidth = g_specializedLayouts[index][0];
+	divisor = g_specializedLayouts[index][1];
+}
+
+template <class Layout>
+static void CompositePlayersKernel(const CompositeLayout& layout,
+	const USHORT* depthD16, const ColorCoordinate* colorCoordinates, const BYTE* colorRGBX,
+	BYTE* outputRGBX, LONG firstRow, LONG endRow)
+{
+	// the output could alias the layout as far as the compiler knows, so keep it in locals
+	const LONG colorWidth = Layout::ColorWidth(layout);
+	const LONG colorHeight = Layout::ColorHeight(layout);
+	const LONG depthWidth = Layout::DepthWidth(layout);
+	const LONG divisor = Layout::Divisor(layout);
+
+	int outputIndex = firstRow * colorWidth;
+	LONG* pDest;
+	const LONG* pSrc;
+	bool transparent;
+
+	// loop over each row and column of the color
+	for ( LONG y = firstRow; y < endRow; ++y )
+	{
+		for ( LONG x = 0; x < colorWidth; ++x )
+		{
+			// calculate index into depth array
+			int depthIndex = x/divisor + y/divisor * depthWidth;
+
+			USHORT depth  = depthD16[depthIndex];
+			USHORT player = NuiDepthPixelToPlayerIndex(depth);
+
+			// Changed this to use a 'transparency' flag
+			pSrc = NULL;
+			transparent = true;
+
+			// if we're tracking a player for the current pixel, draw from the color camera
+			if ( player > 0 )
+			{
+				// retrieve the depth to color mapping for the current depth pixel
+				LONG colorInDepthX = colorCoordinates[depthIndex].x;
+				LONG colorInDepthY = colorCoordinates[depthIndex].y;
+
+				// make sure the depth pixel maps to a valid point in color space
+				if ( colorInDepthX >= 0 && colorInDepthX < colorWidth && colorInDepthY >= 0 && colorInDepthY < colorHeight )
+				{
+					// calculate index into color array
+					LONG colorIndex = colorInDepthX + colorInDepthY * colorWidth;
+
+					// set source for copy to the color pixel
+					pSrc = (const LONG *)colorRGBX + colorIndex;
+					transparent = false;
+				}
+			}
+
+			// calculate output pixel location
+			pDest = (LONG *)outputRGBX + outputIndex++;
+
+			// write output. If the pixel is transparent, set it to the TRANSPARENCY macro
+			if ( !transparent )
+				*pDest = *pSrc;
+			else
+				*pDest = TRANSPARENCY;
+		}
+	}
+}
+
+template <class Layout>
+static LONG CollectPlayerPixelsKernel(const CompositeLayout& layout, const USHORT* depthD16, PlayerPixel* pixels)
+{
+	const LONG depthWidth = Layout::DepthWidth(layout);
+	const LONG depthHeight = Layout::DepthHeight(layout);
+	LONG count = 0;
+
+	for ( LONG y = 0; y < depthHeight; ++y )
+	{
+		const USHORT* pRow = depthD16 + y * depthWidth;
+		for ( LONG x = 0; x < depthWidth; ++x )
+		{
+			if ( NuiDepthPixelToPlayerIndex(pRow[x]) > 0 )
+			{
+				pixels[count].depthX = (USHORT)x;
+				pixels[count].depthY = (USHORT)y;
+				++count;
+			}
+		}
+	}
+
+	return count;
+}
+
+template <class Layout>
+static void CompositePlayerPixelsKernel(const CompositeLayout& layout,
+	const PlayerPixel* pixels, LONG count, const BYTE* colorRGBX,
+	BYTE* outputRGBX)
+{
+	const LONG colorWidth = Layout::ColorWidth(layout);
+	const LONG colorHeight = Layout::ColorHeight(layout);
+	const LONG divisor = Layout::Divisor(layout);
+
+	LONG* pOutput = (LONG *)outputRGBX;
+	const LONG* pColor = (const LONG *)colorRGBX;
+
+	// everything is transparent except where a player pixel lands
+	LONG outputPixels = colorWidth * colorHeight;
+	for ( LONG i = 0; i < outputPixels; ++i )
+	{
+		pOutput[i] = (LONG)TRANSPARENCY;
+	}
+
+	for ( LONG i = 0; i < count; ++i )
+	{
+		const PlayerPixel& pixel = pixels[i];
+
+		// make sure the depth pixel maps to a valid point in color space
+		if ( pixel.color.x < 0 || pixel.color.x >= colorWidth || pixel.color.y < 0 || pixel.color.y >= colorHeight )
+		{
+			continue;
+		}
+
+		// each depth pixel covers a divisor x divisor block of output pixels, all from the same colour pixel
+		LONG source = pColor[pixel.color.x + pixel.color.y * colorWidth];
+		LONG* pBlock = pOutput + pixel.depthX * divisor + pixel.depthY * divisor * colorWidth;
+		for ( LONG by = 0; by < divisor; ++by )
+		{
+			for ( LONG bx = 0; bx < divisor; ++bx )
+			{
+				pBlock[bx] = source;
+			}
+			pBlock += colorWidth;
+		}
+	}
+}
+
+template <class Layout>
+static void LayoutKernels(CompositeKernels& kernels)
+{
+	kernels.compositePlayers = CompositePlayersKernel<Layout>;
+	kernels.collectPlayerPixels = CollectPlayerPixelsKernel<Layout>;
+	kernels.compositePlayerPixels = CompositePlayerPixelsKernel<Layout>;
+}
+
+void GenericCompositeKernels(CompositeKernels& kernels)
+{
+	LayoutKernels<RuntimeLayout>(kernels);
+}
+
+bool SelectCompositeKernels(const CompositeLayout& layout, CompositeKernels& kernels)
+{
+	// in the order of g_specializedLayouts
+	switch ( SpecializedLayoutIndex(layout) )
+	{
+	case 0:		LayoutKernels< FixedLayout<80, 8> >(kernels);		return true;
+	case 1:		LayoutKernels< FixedLayout<80, 16> >(kernels);		return true;
+	case 2:		LayoutKernels< FixedLayout<320, 2> >(kernels);		return true;
+	case 3:		LayoutKernels< FixedLayout<320, 4> >(kernels);		return true;
+	case 4:		LayoutKernels< FixedLayout<640, 1> >(kernels);		return true;
+	case 5:		LayoutKernels< FixedLayout<640, 2> >(kernels);		return true;
+	}
+
+	GenericCompositeKernels(kernels);
+	return false;
+}
+
+void CompositePlayers(const CompositeLayout& layout,
+	const USHORT* depthD16, const ColorCoordinate* colorCoordinates, const BYTE* colorRGBX,
+	BYTE* outputRGBX, LONG firstRow, LONG endRow)
+{
+	CompositeKernels kernels;
+	SelectCompositeKernels(layout, kernels);
+	kernels.compositePlayers(layout, depthD16, colorCoordinates, colorRGBX, outputRGBX, firstRow, endRow);
+}
+
+LONG CollectPlayerPixels(const CompositeLayout& layout, const USHORT* depthD16, PlayerPixel* pixels)
+{
+	CompositeKernels kernels;
+	SelectCompositeKernels(layout, kernels);
+	return kernels.collectPlayerPixels(layout, depthD16, pixels);
+}
+
+void CompositePlayerPixels(const CompositeLayout& layout,
+	const PlayerPixel* pixels, LONG count, const BYTE* colorRGBX,
+	BYTE* outputRGBX)
+{
+	CompositeKernels kernels;
+	SelectCompositeKernels(layout, kernels);
+	kernels.compositePlayerPixels(layout, pixels, count, colorRGBX, outputRGBX);
+}
@@ -0,0 +1,165 @@
+/*
+
+Player compositing
+
+Copies the colour pixel behind every depth pixel that belongs to a player
+into an RGBX image the size of the colour frame, and writes the renderer's
+TRANSPARENCY value everywhere else. Works on a band of output rows so a frame
+can be split across threads or pipeline stages.
+
+The sparse path does the same from a list of just the player pixels, so only
+those need mapping to colour: collect the list, fill in each entry's colour
+coordinates, then composite from it.
+
+Each kernel is written once against a layout policy. RuntimeLayout reads the
+sizes from the CompositeLayout; FixedLayout makes them compile-time
+constants, so strides fold into the addressing and the per-pixel divide by
+the colour-to-depth ratio becomes a shift. The public functions dispatch to
+a FixedLayout instantiation for each supported depth/colour pair and fall
+back to RuntimeLayout for anything else.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Frame sizes the compositor works with
+/// </summary>
+typedef struct
+{
+	LONG	depthWidth;
+	LONG	depthHeight;
+	LONG	colorWidth;
+	LONG	colorHeight;
+	LONG	colorToDepthDivisor;	// colorWidth / depthWidth
+} CompositeLayout;
+
+/// <summary>
+/// Sizes read from the layout at run time, for any depth/colour pair
+/// </summary>
+struct RuntimeLayout
+{
+	static LONG DepthWidth(const CompositeLayout& layout) { return layout.depthWidth; }
+	static LONG DepthHeight(const CompositeLayout& layout) { return layout.depthHeight; }
+	static LONG ColorWidth(const CompositeLayout& layout) { return layout.colorWidth; }
+	static LONG ColorHeight(const CompositeLayout& layout) { return layout.colorHeight; }
+	static LONG Divisor(const CompositeLayout& layout) { return layout.colorToDepthDivisor; }
+};
+
+/// <summary>
+/// Sizes fixed at compile time for a 4:3 depth width and colour-to-depth ratio
+/// </summary>
+template <LONG DepthWidthT, LONG DivisorT>
+struct FixedLayout
+{
+	static LONG DepthWidth(const CompositeLayout&) { return DepthWidthT; }
+	static LONG DepthHeight(const CompositeLayout&) { return DepthWidthT * 3 / 4; }
+	static LONG ColorWidth(const CompositeLayout&) { return DepthWidthT * DivisorT; }
+	static LONG ColorHeight(const CompositeLayout&) { return DepthWidthT * DivisorT * 3 / 4; }
+	static LONG Divisor(const CompositeLayout&) { return DivisorT; }
+};
+
+// depth/colour pairs with FixedLayout kernels: 80x60, 320x240 and 640x480 depth
+// against 640x480 and 1280x960 colour, where the colour is at least as wide
+static const int cSpecializedLayouts = 6;
+
+/// <summary>
+/// Which FixedLayout a layout matches, in the order of SpecializedLayoutSize
+/// </summary>
+/// <returns>index below cSpecializedLayouts, or -1 if only the RuntimeLayout kernels handle it</returns>
+int SpecializedLayoutIndex(const CompositeLayout& layout);
+
+/// <summary>
+/// Depth width and colour-to-depth ratio of a specialized layout
+/// </summary>
+void SpecializedLayoutSize(int index, LONG& depthWidth, LONG& divisor);
+
+/// <summary>
+/// Colour pixel behind a depth pixel. Four bytes rather than the runtime's pair of LONGs,
+/// which halves what the mapper writes and the compositor reads every frame
+/// </summary>
+typedef struct
+{
+	SHORT	x;
+	SHORT	y;
+} ColorCoordinate;
+
+/// <summary>
+/// Narrows a coordinate to a SHORT, saturating so anything off the colour frame stays off it
+/// </summary>
+inline SHORT PackCoordinate(LONG value)
+{
+	return (SHORT)(value < -32768 ? -32768 : (value > 32767 ? 32767 : value));
+}
+
+/// <summary>
+/// A depth pixel that belongs to a player, and the colour pixel behind it
+/// </summary>
+typedef struct
+{
+	USHORT			depthX;
+	USHORT			depthY;
+	ColorCoordinate	color;
+} PlayerPixel;
+
+/// <summary>
+/// Composites the players for output rows [firstRow, endRow)
+/// </summary>
+/// <param name="layout">frame sizes</param>
+/// <param name="depthD16">depth frame with player indices</param>
+/// <param name="colorCoordinates">colour coordinate for each depth pixel</param>
+/// <param name="colorRGBX">colour frame</param>
+/// <param name="outputRGBX">composited image, colorWidth x colorHeight</param>
+/// <param name="firstRow">first output row</param>
+/// <param name="endRow">one past the last output row</param>
+void CompositePlayers(const CompositeLayout& layout,
+	const USHORT* depthD16, const ColorCoordinate* colorCoordinates, const BYTE* colorRGBX,
+	BYTE* outputRGBX, LONG firstRow, LONG endRow);
+
+/// <summary>
+/// Lists the depth pixels that belong to a player, leaving their colour coordinates to the mapper
+/// </summary>
+/// <param name="layout">frame sizes</param>
+/// <param name="depthD16">depth frame with player indices</param>
+/// <param name="pixels">receives the list, room for depthWidth x depthHeight entries</param>
+/// <returns>number of player pixels</returns>
+LONG CollectPlayerPixels(const CompositeLayout& layout, const USHORT* depthD16, PlayerPixel* pixels);
+
+/// <summary>
+/// Composites the whole output from a mapped player pixel list
+/// </summary>
+/// <param name="layout">frame sizes</param>
+/// <param name="pixels">player pixels with their colour coordinates</param>
+/// <param name="count">number of player pixels</param>
+/// <param name="colorRGBX">colour frame</param>
+/// <param name="outputRGBX">composited image, colorWidth x colorHeight</param>
+void CompositePlayerPixels(const CompositeLayout& layout,
+	const PlayerPixel* pixels, LONG count, const BYTE* colorRGBX,
+	BYTE* outputRGBX);
+
+/// <summary>
+/// One implementation of each compositing kernel, with the parameters of the functions above
+/// </summary>
+typedef struct
+{
+	void (*compositePlayers)(const CompositeLayout& layout,
+		const USHORT* depthD16, const ColorCoordinate* colorCoordinates, const BYTE* colorRGBX,
+		BYTE* outputRGBX, LONG firstRow, LONG endRow);
+	LONG (*collectPlayerPixels)(const CompositeLayout& layout, const USHORT* depthD16, PlayerPixel* pixels);
+	void (*compositePlayerPixels)(const CompositeLayout& layout,
+		const PlayerPixel* pixels, LONG count, const BYTE* colorRGBX,
+		BYTE* outputRGBX);
+} CompositeKernels;
+
+/// <summary>
+/// The kernels the functions above dispatch to for a layout
+/// </summary>
+/// <returns>true if they are a FixedLayout specialization</returns>
+bool SelectCompositeKernels(const CompositeLayout& layout, CompositeKernels& kernels);
+
+/// <summary>
+/// The RuntimeLayout kernels, which handle any layout; the baseline for the specializations
+/// </summary>
+void GenericCompositeKernels(CompositeKernels& kernels);
@@ -0,0 +1,226 @@
+#include "stdafx.h"
+#include <fstream>
+#include "NuiApi.h"
+#include "CoordinateMapBenchmark.h"
+#include "SyntheticFrameSource.h"
+#include "ImageRenderer.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+typedef struct
+{
+	LONG	depthWidth;
+	LONG	depthHeight;
+	LONG	colorWidth;
+	LONG	colorHeight;
+} MapResolution;
+
+static const MapResolution g_resolutions[] =
+{
+	{ 320, 240, 640, 480 },
+	{ 320, 240, 1280, 960 },
+	{ 640, 480, 640, 480 },
+	{ 640, 480, 1280, 960 },
+};
+static const int g_resolutionCount = sizeof(g_resolutions) / sizeof(g_resolutions[0]);
+
+static const int g_iterations = 100;
+
+/// <summary>
+/// Writes a whole map in the runtime's layout
+/// </summary>
+static void WriteWideMap(const CompositeLayout& layout, const ColorCoordinate* source, LONG* colorCoordinates)
+{
+	LONG pixels = layout.depthWidth * layout.depthHeight;
+	for ( LONG i = 0; i < pixels; ++i )
+	{
+		colorCoordinates[i * 2] = source[i].x;
+		colorCoordinates[i * 2 + 1] = source[i].y;
+	}
+}
+
+/// <summary>
+/// Writes a whole map in the packed layout
+/// </summary>
+static void WritePackedMap(const CompositeLayout& layout, const ColorCoordinate* source, ColorCoordinate* colorCoordinates)
+{
+	LONG pixels = layout.depthWidth * layout.depthHeight;
+	for ( LONG i = 0; i < pixels; ++i )
+	{
+		colorCoordinates[i].x = PackCoordinate(source[i].x);
+		colorCoordinates[i].y = PackCoordinate(source[i].y);
+	}
+}
+
+/// <summary>
+/// The generic CompositePlayers kernel reading the runtime's layout, kept here as the baseline
+/// </summary>
+static void CompositeWide(const CompositeLayout& layout,
+	const USHORT* depthD16, const LONG* colorCoordinates, const BYTE* colorRGBX, BYTE* outputRGBX)
+{
+	const LONG colorWidth = layout.colorWidth;
+	const LONG colorHeight = layout.colorHeight;
+	const LONG depthWidth = layout.depthWidth;
+	const LONG divisor = layout.colorToDepthDivisor;
+
+	int outputIndex = 0;
+	LONG* pDest;
+	const LONG* pSrc;
+	bool transparent;
+
+	for ( LONG y = 0; y < colorHeight; ++y )
+	{
+		for ( LONG x = 0; x < colorWidth; ++x )
+		{
+			int depthIndex = x/divisor + y/divisor * depthWidth;
+
+			USHORT depth  = depthD16[depthIndex];
+			USHORT player = NuiDepthPixelToPlayerIndex(depth);
+
+			pSrc = NULL;
+			transparent = true;
+
+			if ( player > 0 )
+			{
+				LONG colorInDepthX = colorCoordinates[depthIndex * 2];
+				LONG colorInDepthY = colorCoordinates[depthIndex * 2 + 1];
+
+				if ( colorInDepthX >= 0 && colorInDepthX < colorWidth && colorInDepthY >= 0 && colorInDepthY < colorHeight )
+				{
+					LONG colorIndex = colorInDepthX + colorInDepthY * colorWidth;
+					pSrc = (const LONG *)colorRGBX + colorIndex;
+					transparent = false;
+				}
+			}
+
+			pDest = (LONG *)outputRGBX + outputIndex++;
+
+			if ( !transparent )
+				*pDest = *pSrc;
+			else
+				*pDest = TRANSPARENCY;
+		}
+	}
+}
+
+/// <summary>
+/// Gigabytes per second for moving bytes once per iteration in ticks
+/// </summary>
+static double Throughput(size_t bytes, LONGLONG ticks)
+{
+	double seconds = HighResClock::TicksToMilliseconds(ticks) / 1000.0;
+	return seconds > 0.0 ? (double)bytes * g_iterations / seconds / 1e9 : 0.0;
+}
+
+HRESULT RunCoordinateMapBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	csv << "depth_width,depth_height,color_width,color_height,wide_map_bytes,packed_map_bytes,"
+		"wide_write_ms,packed_write_ms,wide_write_gbps,packed_write_gbps,"
+		"wide_composite_ms,packed_composite_ms,composite_speedup,mismatches" << endl;
+
+	for ( int r = 0; r < g_resolutionCount; ++r )
+	{
+		const MapResolution& resolution = g_resolutions[r];
+
+		CompositeLayout layout;
+		layout.depthWidth = resolution.depthWidth;
+		layout.depthHeight = resolution.depthHeight;
+		layout.colorWidth = resolution.colorWidth;
+		layout.colorHeight = resolution.colorHeight;
+		layout.colorToDepthDivisor = layout.colorWidth / layout.depthWidth;
+
+		SyntheticFrameSource source;
+		source.Initialize(layout);
+
+		LONG depthPixels = layout.depthWidth * layout.depthHeight;
+		LONG colorPixels = layout.colorWidth * layout.colorHeight;
+		size_t wideBytes = depthPixels * 2 * sizeof(LONG);
+		size_t packedBytes = depthPixels * sizeof(ColorCoordinate);
+
+		USHORT* depthD16 = new USHORT[depthPixels];
+		BYTE* colorRGBX = new BYTE[colorPixels * 4];
+		ColorCoordinate* mapped = new ColorCoordinate[depthPixels];
+		LONG* wide = new LONG[depthPixels * 2];
+		ColorCoordinate* packed = new ColorCoordinate[depthPixels];
+		BYTE* wideRGBX = new BYTE[colorPixels * 4];
+		BYTE* packedRGBX = new BYTE[colorPixels * 4];
+
+		// every pixel a player pixel, so the composite reads the whole map
+		source.GenerateColor(0, colorRGBX);
+		source.GenerateCoverage(1.0f, depthD16);
+		source.MapColorCoordinates(depthD16, mapped, 0, layout.depthHeight);
+
+		// the generic kernel, so the layout of the map is the only difference
+		CompositeKernels kernels;
+		GenericCompositeKernels(kernels);
+
+		LONGLONG wideWrite = 0;
+		LONGLONG packedWrite = 0;
+		LONGLONG wideComposite = 0;
+		LONGLONG packedComposite = 0;
+
+		for ( int i = 0; i < g_iterations; ++i )
+		{
+			LONGLONG t0 = HighResClock::Now();
+			WriteWideMap(layout, mapped, wide);
+			LONGLONG t1 = HighResClock::Now();
+			WritePackedMap(layout, mapped, packed);
+			LONGLONG t2 = HighResClock::Now();
+			CompositeWide(layout, depthD16, wide, colorRGBX, wideRGBX);
+			LONGLONG t3 = HighResClock::Now();
+			kernels.compositePlayers(layout, depthD16, packed, colorRGBX, packedRGBX, 0, layout.colorHeight);
+			LONGLONG t4 = HighResClock::Now();
+
+			wideWrite += t1 - t0;
+			packedWrite += t2 - t1;
+			wideComposite += t3 - t2;
+			packedComposite += t4 - t3;
+		}
+
+		LONG mismatches = 0;
+		const LONG* pWide = (const LONG *)wideRGBX;
+		const LONG* pPacked = (const LONG *)packedRGBX;
+		for ( LONG i = 0; i < colorPixels; ++i )
+		{
+			if ( pWide[i] != pPacked[i] )
+			{
+				++mismatches;
+			}
+		}
+
+		double wideCompositeMs = HighResClock::TicksToMilliseconds(wideComposite) / g_iterations;
+		double packedCompositeMs = HighResClock::TicksToMilliseconds(packedComposite) / g_iterations;
+
+		csv << layout.depthWidth << ","
+			<< layout.depthHeight << ","
+			<< layout.colorWidth << ","
+			<< layout.colorHeight << ","
+			<< wideBytes << ","
+			<< packedBytes << ","
+			<< HighResClock::TicksToMilliseconds(wideWrite) / g_iterations << ","
+			<< HighResClock::TicksToMilliseconds(packedWrite) / g_iterations << ","
+			<< Throughput(wideBytes, wideWrite) << ","
+			<< Throughput(packedBytes, packedWrite) << ","
+			<< wideCompositeMs << ","
+			<< packedCompositeMs << ","
+			<< (packedCompositeMs > 0.0 ? wideCompositeMs / packedCompositeMs : 0.0) << ","
+			<< mismatches << endl;
+
+		delete[] depthD16;
+		delete[] colorRGBX;
+		delete[] mapped;
+		delete[] wide;
+		delete[] packed;
+		delete[] wideRGBX;
+		delete[] packedRGBX;
+	}
+
+	return S_OK;
+}
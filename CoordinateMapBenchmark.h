@@ -0,0 +1,26 @@
+/*
+
+Colour coordinate map benchmark
+
+Measures the memory traffic of the depth-to-colour map in the runtime's
+layout (a pair of LONGs per depth pixel) against the packed ColorCoordinate
+layout (a pair of SHORTs). For each depth/colour resolution pair it times
+writing a whole map, as the mapper does, and compositing a full-coverage
+frame from it, as the dense path does, in both layouts. The two composites
+must produce the same image; the mismatch column counts output pixels where
+they differ.
+
+Run with /benchcoordinates on the command line; results go to coordinate_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per resolution pair
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunCoordinateMapBenchmark(const char* path);
@@ -0,0 +1,271 @@
+#include "stdafx.h"
+#include <malloc.h>
+#include "NuiApi.h"
+#include "DepthRegistration.h"
+
+#ifdef DEPTH_REGISTRATION_SSE2
+#include <emmintrin.h>
+#endif
+
+// nominal distance between the depth and colour cameras
+static const float g_baselineMm = 25.0f;
+
+// keeps each table on its own cache lines, and the SSE2 loads aligned
+static const size_t g_tableAlignment = 64;
+
+DepthRegistration::DepthRegistration() :
+	m_pRays(NULL),
+	m_pRayX(NULL),
+	m_pRayY(NULL),
+	m_pRayZ(NULL),
+	m_pInverseDepth(NULL),
+	m_specializedLayout(-1)
+{
+	ZeroMemory(&m_layout, sizeof(m_layout));
+	ZeroMemory(&m_calibration, sizeof(m_calibration));
+}
+
+DepthRegistration::~DepthRegistration()
+{
+	Free();
+}
+
+void DepthRegistration::Free()
+{
+	_aligned_free(m_pRays);
+	_aligned_free(m_pInverseDepth);
+	m_pRays = NULL;
+	m_pRayX = NULL;
+	m_pRayY = NULL;
+	m_pRayZ = NULL;
+	m_pInverseDepth = NULL;
+}
+
+void DepthRegistration::DefaultCalibration(const CompositeLayout& layout, RegistrationCalibration& calibration)
+{
+	ZeroMemory(&calibration, sizeof(calibration));
+
+	// the nominal focal lengths are for 320x240 depth and 640x480 colour
+	calibration.depthFocalX = NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS * layout.depthWidth / 320.0f;
+	calibration.depthFocalY = calibration.depthFocalX;
+	calibration.depthCenterX = layout.depthWidth * 0.5f;
+	calibration.depthCenterY = layout.depthHeight * 0.5f;
+	calibration.colorFocalX = NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS * layout.colorWidth / 640.0f;
+	calibration.colorFocalY = calibration.colorFocalX;
+	calibration.colorCenterX = layout.colorWidth * 0.5f;
+	calibration.colorCenterY = layout.colorHeight * 0.5f;
+
+	calibration.rotation[0] = 1.0f;
+	calibration.rotation[4] = 1.0f;
+	calibration.rotation[8] = 1.0f;
+	calibration.translation[0] = g_baselineMm;
+}
+
+HRESULT DepthRegistration::Initialize(const CompositeLayout& layout, const RegistrationCalibration& calibration)
+{
+	if ( IsInitialized() &&
+		0 == memcmp(&m_layout, &layout, sizeof(layout)) &&
+		0 == memcmp(&m_calibration, &calibration, sizeof(calibration)) )
+	{
+		return S_OK;
+	}
+
+	Free();
+	m_layout = layout;
+	m_calibration = calibration;
+	m_specializedLayout = SpecializedLayoutIndex(layout);
+
+	// one block for the three ray tables, each rounded up to whole cache lines
+	LONG pixels = layout.depthWidth * layout.depthHeight;
+	size_t tableFloats = ((pixels * sizeof(float) + g_tableAlignment - 1) & ~(g_tableAlignment - 1)) / sizeof(float);
+	m_pRays = static_cast<float*>(_aligned_malloc(3 * tableFloats * sizeof(float), g_tableAlignment));
+	m_pInverseDepth = static_cast<float*>(_aligned_malloc(cDepthBins * sizeof(float), g_tableAlignment));
+	if ( NULL == m_pRays || NULL == m_pInverseDepth )
+	{
+		Free();
+		return E_OUTOFMEMORY;
+	}
+	m_pRayX = m_pRays;
+	m_pRayY = m_pRays + tableFloats;
+	m_pRayZ = m_pRays + 2 * tableFloats;
+
+	const float* R = calibration.rotation;
+	for ( LONG y = 0; y < layout.depthHeight; ++y )
+	{
+		for ( LONG x = 0; x < layout.depthWidth; ++x )
+		{
+			float rayX = (x - calibration.depthCenterX) / calibration.depthFocalX;
+			float rayY = (y - calibration.depthCenterY) / calibration.depthFocalY;
+
+			LONG index = x + y * layout.depthWidth;
+			m_pRayX[index] = R[0] * rayX + R[1] * rayY + R[2];
+			m_pRayY[index] = R[3] * rayX + R[4] * rayY + R[5];
+			m_pRayZ[index] = R[6] * rayX + R[7] * rayY + R[8];
+		}
+	}
+
+	m_pInverseDepth[0] = 0.0f;
+	for ( int bin = 1; bin < cDepthBins; ++bin )
+	{
+		m_pInverseDepth[bin] = 1.0f / bin;
+	}
+
+	return S_OK;
+}
+
+void DepthRegistration::MapPixel(LONG index, LONG x, LONG y, USHORT depthPixel, ColorCoordinate& color) const
+{
+	USHORT depth = NuiDepthPixelToDepth(depthPixel);
+	if ( depth == 0 )
+	{
+		// no depth, the runtime maps these straight across
+		color.x = PackCoordinate(x * m_layout.colorToDepthDivisor);
+		color.y = PackCoordinate(y * m_layout.colorToDepthDivisor);
+		return;
+	}
+
+	Project(index, depth, color);
+}
+
+void DepthRegistration::Project(LONG index, USHORT depth, ColorCoordinate& color) const
+{
+	const float* T = m_calibration.translation;
+	float w = m_pInverseDepth[depth];
+	float scale = 1.0f / (m_pRayZ[index] + T[2] * w);
+
+	color.x = PackCoordinate((LONG)(m_calibration.colorFocalX * ((m_pRayX[index] + T[0] * w) * scale) + m_calibration.colorCenterX));
+	color.y = PackCoordinate((LONG)(m_calibration.colorFocalY * ((m_pRayY[index] + T[1] * w) * scale) + m_calibration.colorCenterY));
+}
+
+void DepthRegistration::MapFrameScalar(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const
+{
+	for ( LONG y = firstRow; y < endRow; ++y )
+	{
+		for ( LONG x = 0; x < m_layout.depthWidth; ++x )
+		{
+			LONG index = x + y * m_layout.depthWidth;
+			MapPixel(index, x, y, depthD16[index], colorCoordinates[index]);
+		}
+	}
+}
+
+template <class Layout>
+void DepthRegistration::MapPlayerPixelsKernel(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const
+{
+	const LONG depthWidth = Layout::DepthWidth(m_layout);
+	const LONG divisor = Layout::Divisor(m_layout);
+
+	for ( LONG i = 0; i < count; ++i )
+	{
+		PlayerPixel& pixel = pixels[i];
+		LONG index = pixel.depthX + pixel.depthY * depthWidth;
+		USHORT depth = NuiDepthPixelToDepth(depthD16[index]);
+
+		if ( depth == 0 )
+		{
+			pixel.color.x = PackCoordinate(pixel.depthX * divisor);
+			pixel.color.y = PackCoordinate(pixel.depthY * divisor);
+		}
+		else
+		{
+			Project(index, depth, pixel.color);
+		}
+	}
+}
+
+void DepthRegistration::MapPlayerPixels(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const
+{
+	// in the order of the compositor's specialized layouts
+	switch ( m_specializedLayout )
+	{
+	case 0:		MapPlayerPixelsKernel< FixedLayout<80, 8> >(depthD16, pixels, count);		return;
+	case 1:		MapPlayerPixelsKernel< FixedLayout<80, 16> >(depthD16, pixels, count);		return;
+	case 2:		MapPlayerPixelsKernel< FixedLayout<320, 2> >(depthD16, pixels, count);		return;
+	case 3:		MapPlayerPixelsKernel< FixedLayout<320, 4> >(depthD16, pixels, count);		return;
+	case 4:		MapPlayerPixelsKernel< FixedLayout<640, 1> >(depthD16, pixels, count);		return;
+	case 5:		MapPlayerPixelsKernel< FixedLayout<640, 2> >(depthD16, pixels, count);		return;
+	}
+
+	MapPlayerPixelsGeneric(depthD16, pixels, count);
+}
+
+void DepthRegistration::MapPlayerPixelsGeneric(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const
+{
+	MapPlayerPixelsKernel<RuntimeLayout>(depthD16, pixels, count);
+}
+
+#ifdef DEPTH_REGISTRATION_SSE2
+
+void DepthRegistration::MapFrame(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const
+{
+	const float* T = m_calibration.translation;
+	const __m128 translationX = _mm_set1_ps(T[0]);
+	const __m128 translationY = _mm_set1_ps(T[1]);
+	const __m128 translationZ = _mm_set1_ps(T[2]);
+	const __m128 focalX = _mm_set1_ps(m_calibration.colorFocalX);
+	const __m128 focalY = _mm_set1_ps(m_calibration.colorFocalY);
+	const __m128 centerX = _mm_set1_ps(m_calibration.colorCenterX);
+	const __m128 centerY = _mm_set1_ps(m_calibration.colorCenterY);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	LONG divisor = m_layout.colorToDepthDivisor;
+	const __m128i straightStep = _mm_set1_epi32(4 * divisor);
+	LONG vectorWidth = m_layout.depthWidth & ~3;
+
+	for ( LONG y = firstRow; y < endRow; ++y )
+	{
+		LONG rowStart = y * m_layout.depthWidth;
+		__m128i straightX = _mm_setr_epi32(0, divisor, 2 * divisor, 3 * divisor);
+		const __m128i straightY = _mm_set1_epi32(y * divisor);
+
+		for ( LONG x = 0; x < vectorWidth; x += 4 )
+		{
+			LONG index = rowStart + x;
+
+			// four depth pixels, player index shifted out
+			__m128i depth = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(depthD16 + index));
+			depth = _mm_srli_epi32(_mm_unpacklo_epi16(depth, zero), NUI_IMAGE_PLAYER_INDEX_SHIFT);
+
+			// SSE2 has no gather, so the depth bins are looked up one at a time
+			__declspec(align(16)) int bins[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(bins), depth);
+			__m128 w = _mm_setr_ps(m_pInverseDepth[bins[0]], m_pInverseDepth[bins[1]], m_pInverseDepth[bins[2]], m_pInverseDepth[bins[3]]);
+
+			__m128 rayX = _mm_loadu_ps(m_pRayX + index);
+			__m128 rayY = _mm_loadu_ps(m_pRayY + index);
+			__m128 rayZ = _mm_loadu_ps(m_pRayZ + index);
+
+			__m128 scale = _mm_div_ps(one, _mm_add_ps(rayZ, _mm_mul_ps(translationZ, w)));
+			__m128 colorX = _mm_add_ps(_mm_mul_ps(focalX, _mm_mul_ps(_mm_add_ps(rayX, _mm_mul_ps(translationX, w)), scale)), centerX);
+			__m128 colorY = _mm_add_ps(_mm_mul_ps(focalY, _mm_mul_ps(_mm_add_ps(rayY, _mm_mul_ps(translationY, w)), scale)), centerY);
+
+			// pixels with no depth go straight across
+			__m128i hasDepth = _mm_cmpgt_epi32(depth, zero);
+			__m128i mappedX = _mm_cvttps_epi32(colorX);
+			__m128i mappedY = _mm_cvttps_epi32(colorY);
+			mappedX = _mm_or_si128(_mm_and_si128(hasDepth, mappedX), _mm_andnot_si128(hasDepth, straightX));
+			mappedY = _mm_or_si128(_mm_and_si128(hasDepth, mappedY), _mm_andnot_si128(hasDepth, straightY));
+			straightX = _mm_add_epi32(straightX, straightStep);
+
+			// interleave into x,y pairs and narrow them to SHORTs, saturating like PackCoordinate
+			__m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(mappedX, mappedY), _mm_unpackhi_epi32(mappedX, mappedY));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(colorCoordinates + index), packed);
+		}
+
+		for ( LONG x = vectorWidth; x < m_layout.depthWidth; ++x )
+		{
+			LONG index = rowStart + x;
+			MapPixel(index, x, y, depthD16[index], colorCoordinates[index]);
+		}
+	}
+}
+
+#else
+
+void DepthRegistration::MapFrame(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const
+{
+	MapFrameScalar(depthD16, colorCoordinates, firstRow, endRow);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+
+Built-in depth to colour registration
+
+Maps depth pixels to colour pixels from the cameras' intrinsics and the
+depth-to-colour extrinsics instead of the runtime's closed mapping call, so
+the cost can be profiled and the mapping works without the Kinect runtime.
+
+A depth pixel (u, v) at depth z lies at z * r in the depth camera, where r is
+the pixel's ray ((u - cx) / fx, (v - cy) / fy, 1). In the colour camera that
+is z * R r + T, which projects to
+
+	x = fx' (Rr.x + T.x / z) / (Rr.z + T.z / z) + cx'
+
+and likewise for y. Rr is fixed per pixel and 1/z per depth value, so both
+are tables built once and kept across frames: a per-pixel table of rotated
+rays and a table of inverse depth indexed by the depth bin (one per
+millimetre, the sensor's own quantization). A frame is then a lookup, a
+reciprocal and a few multiply-adds per pixel, done four pixels at a time
+with SSE2 where it is available. Player pixel lists are mapped by a kernel
+specialized for the layout, like the compositor's.
+
+Output is a packed ColorCoordinate per depth pixel, with pixels that have no
+depth mapped straight across as the runtime does.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "Compositor.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define DEPTH_REGISTRATION_SSE2 1
+#endif
+
+/// <summary>
+/// Camera model for the layout's resolutions; lengths in pixels, distances in millimetres
+/// </summary>
+typedef struct
+{
+	float	depthFocalX;
+	float	depthFocalY;
+	float	depthCenterX;
+	float	depthCenterY;
+	float	colorFocalX;
+	float	colorFocalY;
+	float	colorCenterX;
+	float	colorCenterY;
+	float	rotation[9];		// depth camera to colour camera, row major
+	float	translation[3];		// depth camera origin in the colour camera
+} RegistrationCalibration;
+
+class DepthRegistration
+{
+public:
+	// depth values are 13 bits of millimetres once the player index is shifted out
+	static const int cDepthBins = 1 << 13;
+
+	DepthRegistration();
+	~DepthRegistration();
+
+	/// <summary>
+	/// The runtime's nominal focal lengths with the colour camera 25 mm beside the depth camera; not a
+	/// particular unit's calibration, so expect pixels of error against the runtime's mapping
+	/// </summary>
+	static void DefaultCalibration(const CompositeLayout& layout, RegistrationCalibration& calibration);
+
+	/// <summary>
+	/// Builds the tables; does nothing if they were already built for the same layout and calibration
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(const CompositeLayout& layout, const RegistrationCalibration& calibration);
+
+	/// <summary>
+	/// Maps depth rows [firstRow, endRow) into colorCoordinates, using SSE2 where available
+	/// </summary>
+	void MapFrame(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const;
+
+	/// <summary>
+	/// MapFrame one pixel at a time, the reference for the SIMD path
+	/// </summary>
+	void MapFrameScalar(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const;
+
+	/// <summary>
+	/// Maps just the pixels of a player pixel list, with the layout's FixedLayout kernel if it has one
+	/// </summary>
+	void MapPlayerPixels(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const;
+
+	/// <summary>
+	/// MapPlayerPixels with the RuntimeLayout kernel, the baseline for the specializations
+	/// </summary>
+	void MapPlayerPixelsGeneric(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const;
+
+	bool IsInitialized() const { return NULL != m_pRays; }
+
+private:
+	// per pixel: the rotated ray's x, y and z, each depthWidth x depthHeight
+	float*					m_pRays;
+	float*					m_pRayX;
+	float*					m_pRayY;
+	float*					m_pRayZ;
+
+	// per depth bin: 1/z, with 0 for no depth
+	float*					m_pInverseDepth;
+
+	CompositeLayout			m_layout;
+	RegistrationCalibration	m_calibration;
+	int						m_specializedLayout;	// SpecializedLayoutIndex of m_layout
+
+	void MapPixel(LONG index, LONG x, LONG y, USHORT depthPixel, ColorCoordinate& color) const;
+	void Project(LONG index, USHORT depth, ColorCoordinate& color) const;
+	void Free();
+
+	template <class Layout>
+	void MapPlayerPixelsKernel(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const;
+};
@@ -0,0 +1,194 @@
+#include "stdafx.h"
+#include "FloorPiano.h"
+
+// height of the foot joint above the floor plane, in metres. The gap between the two
+// thresholds stops a foot resting near the floor from retriggering the key
+static const float g_FootDownHeight = 0.07f;
+static const float g_FootUpHeight = 0.11f;
+
+// the first key is middle C
+static const int g_BaseOctave = 5;
+
+FloorPiano::FloorPiano() :
+	m_pPlayer(NULL),
+	m_pLatency(NULL),
+	m_viewWidth(0),
+	m_viewHeight(0),
+	m_deferredReleases(0)
+{
+	for ( int i = 0; i < cFeet; i++ )
+	{
+		m_footDown[i] = false;
+		m_footKey[i] = -1;
+		m_footOverKey[i] = -1;
+	}
+	for ( int key = 0; key < cKeyCount; key++ )
+	{
+		m_releasePending[key] = false;
+	}
+}
+
+void FloorPiano::Initialize(SimpleMIDIPlayer* player, LatencyMonitor* latency)
+{
+	m_pPlayer = player;
+	m_pLatency = latency;
+}
+
+void FloorPiano::SetViewSize(int width, int height)
+{
+	m_viewWidth = width;
+	m_viewHeight = height;
+}
+
+int FloorPiano::KeyAt(float x) const
+{
+	if ( m_viewWidth <= 0 )
+	{
+		return -1;
+	}
+
+	int key = static_cast<int>(x * cKeyCount / m_viewWidth);
+	if ( key < 0 || key >= cKeyCount )
+	{
+		return -1;
+	}
+	return key;
+}
+
+bool FloorPiano::IsKeyDown(int key) const
+{
+	for ( int i = 0; i < cFeet; i++ )
+	{
+		if ( m_footDown[i] && m_footKey[i] == key )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FloorPiano::GetKeyStates(BYTE states[cKeyCount]) const
+{
+	for ( int key = 0; key < cKeyCount; key++ )
+	{
+		states[key] = KeyStateUp;
+	}
+
+	for ( int i = 0; i < cFeet; i++ )
+	{
+		if ( m_footOverKey[i] >= 0 && states[m_footOverKey[i]] == KeyStateUp )
+		{
+			states[m_footOverKey[i]] = KeyStateUnderFoot;
+		}
+	}
+
+	// a pressed key shows as pressed whatever other feet are over it
+	for ( int i = 0; i < cFeet; i++ )
+	{
+		if ( m_footDown[i] )
+		{
+			states[m_footKey[i]] = KeyStateDown;
+		}
+	}
+}
+
+void FloorPiano::Update(const NUI_SKELETON_FRAME& skeletonFrame, const Point2f feetPoints[cFeet], LONGLONG sensorTicks)
+{
+	const Vector4& floor = skeletonFrame.vFloorClipPlane;
+
+	// the tracker reports a zero plane until it has found the floor
+	bool haveFloor = floor.x != 0.0f || floor.y != 0.0f || floor.z != 0.0f || floor.w != 0.0f;
+
+	// note-offs the queue had no room for last time go first
+	for ( int key = 0; key < cKeyCount; key++ )
+	{
+		if ( m_releasePending[key] )
+		{
+			QueueRelease(key, sensorTicks);
+		}
+	}
+
+	for ( int foot = 0; foot < cFeet; foot++ )
+	{
+		// same layout as m_feetPoints: right foot then left foot of each skeleton
+		const NUI_SKELETON_DATA& skel = skeletonFrame.SkeletonData[foot / 2];
+		NUI_SKELETON_POSITION_INDEX joint = (foot % 2 == 0) ? NUI_SKELETON_POSITION_FOOT_RIGHT : NUI_SKELETON_POSITION_FOOT_LEFT;
+
+		// as in ProcessSkeleton, an inferred foot counts; (0,0) is a real view position, so the point says nothing
+		bool tracked = skel.eTrackingState == NUI_SKELETON_TRACKED &&
+			skel.eSkeletonPositionTrackingState[joint] != NUI_SKELETON_POSITION_NOT_TRACKED;
+		m_footOverKey[foot] = tracked ? KeyAt(feetPoints[foot].x) : -1;
+
+		if ( !tracked || !haveFloor )
+		{
+			ReleaseKey(foot, sensorTicks);
+			continue;
+		}
+
+		const Vector4& p = skel.SkeletonPositions[joint];
+		float height = floor.x * p.x + floor.y * p.y + floor.z * p.z + floor.w;
+
+		if ( !m_footDown[foot] && height < g_FootDownHeight )
+		{
+			int key = KeyAt(feetPoints[foot].x);
+			if ( key >= 0 )
+			{
+				PressKey(foot, key, sensorTicks);
+			}
+		}
+		else if ( m_footDown[foot] && height > g_FootUpHeight )
+		{
+			ReleaseKey(foot, sensorTicks);
+		}
+	}
+}
+
+void FloorPiano::PressKey(int foot, int key, LONGLONG sensorTicks)
+{
+	m_footDown[foot] = true;
+	m_footKey[foot] = key;
+
+	// the note is still sounding from before, the new note-on restarts it
+	m_releasePending[key] = false;
+
+	if ( m_pLatency )
+	{
+		m_pLatency->Stamp(LatencyStageHit, sensorTicks);
+	}
+
+	if ( m_pPlayer && m_pPlayer->queueNote((SimpleMIDIPlayer::NotesEnum)key, g_BaseOctave, true, sensorTicks) )
+	{
+		if ( m_pLatency )
+		{
+			m_pLatency->Stamp(LatencyStageEnqueue, sensorTicks);
+		}
+	}
+}
+
+void FloorPiano::ReleaseKey(int foot, LONGLONG sensorTicks)
+{
+	if ( !m_footDown[foot] )
+	{
+		return;
+	}
+
+	int key = m_footKey[foot];
+	m_footDown[foot] = false;
+	m_footKey[foot] = -1;
+
+	// another foot may still be holding the same key
+	if ( !IsKeyDown(key) )
+	{
+		QueueRelease(key, sensorTicks);
+	}
+}
+
+void FloorPiano::QueueRelease(int key, LONGLONG sensorTicks)
+{
+	bool queued = !m_pPlayer || m_pPlayer->queueNote((SimpleMIDIPlayer::NotesEnum)key, g_BaseOctave, false, sensorTicks);
+	if ( !queued && !m_releasePending[key] )
+	{
+		++m_deferredReleases;
+	}
+	m_releasePending[key] = !queued;
+}
@@ -0,0 +1,94 @@
+/*
+
+Floor piano: turns feet touching the floor into notes
+
+The keys are laid out left to right across the video view. A foot presses the
+key under it when it comes within a few centimetres of the floor plane reported
+by the skeleton tracker, and releases it when it lifts again. A note-off that
+finds the MIDI queue full is kept and sent on the next update, as a dropped
+one would leave the note sounding.
+
+*/
+
+#pragma once
+
+#include "NuiApi.h"
+#include "types.h"
+#include "SimpleMIDIPlayer.h"
+#include "LatencyMonitor.h"
+
+// What the keyboard overlay shows for a key
+typedef enum
+{
+	KeyStateUp,			// no foot on or over it
+	KeyStateUnderFoot,	// a tracked foot is above it
+	KeyStateDown		// a foot is pressing it
+} KeyState;
+
+class FloorPiano
+{
+public:
+	// hardcoded in ProcessSkeleton, two skeletons tracked with two feet each
+	static const int cFeet = 4;
+	static const int cKeyCount = 12;
+
+	FloorPiano();
+
+	/// <summary>
+	/// Connects the piano to its output and instrumentation
+	/// </summary>
+	/// <param name="player">MIDI player notes are queued to</param>
+	/// <param name="latency">latency monitor hits are stamped in, may be NULL</param>
+	void Initialize(SimpleMIDIPlayer* player, LatencyMonitor* latency);
+
+	/// <summary>
+	/// Sets the size of the view the feet points are expressed in
+	/// </summary>
+	void SetViewSize(int width, int height);
+
+	/// <summary>
+	/// Detects feet hitting or leaving the floor and plays the keys under them
+	/// </summary>
+	/// <param name="skeletonFrame">smoothed skeleton frame</param>
+	/// <param name="feetPoints">feet in view space, as computed by ProcessSkeleton</param>
+	/// <param name="sensorTicks">capture time of the frame, for latency stamps</param>
+	void Update(const NUI_SKELETON_FRAME& skeletonFrame, const Point2f feetPoints[cFeet], LONGLONG sensorTicks);
+
+	/// <summary>
+	/// Index of the key under a horizontal view position
+	/// </summary>
+	int KeyAt(float x) const;
+
+	/// <summary>
+	/// Whether any foot is currently pressing the key
+	/// </summary>
+	bool IsKeyDown(int key) const;
+
+	/// <summary>
+	/// The KeyState of every key, as of the last Update
+	/// </summary>
+	void GetKeyStates(BYTE states[cKeyCount]) const;
+
+	/// <summary>
+	/// Note-offs that found the MIDI queue full and had to wait for a later update
+	/// </summary>
+	LONG DeferredReleases() const { return m_deferredReleases; }
+
+private:
+	SimpleMIDIPlayer*	m_pPlayer;
+	LatencyMonitor*		m_pLatency;
+
+	int					m_viewWidth;
+	int					m_viewHeight;
+
+	bool				m_footDown[cFeet];
+	int					m_footKey[cFeet];		// key pressed while m_footDown
+	int					m_footOverKey[cFeet];	// key under the foot, -1 if not tracked
+
+	bool				m_releasePending[cKeyCount];	// note-off still to be queued
+	LONG				m_deferredReleases;
+
+	void PressKey(int foot, int key, LONGLONG sensorTicks);
+	void ReleaseKey(int foot, LONGLONG sensorTicks);
+	void QueueRelease(int key, LONGLONG sensorTicks);
+};
@@ -0,0 +1,302 @@
+#include "stdafx.h"
+#include "FrameAcquisition.h"
+#include "HighResClock.h"
+#include "Trace.h"
+#include "AllocationAudit.h"
+
+static const char* g_threadNames[SensorStreamCount] = { "Depth acquisition", "Color acquisition", "Skeleton acquisition" };
+
+FrameAcquisition::FrameAcquisition() :
+	m_pNuiSensor(NULL),
+	m_pFrameTimer(NULL),
+	m_pMaskStabilizer(NULL),
+	m_hStop(NULL),
+	m_hFrameReady(NULL)
+{
+	for ( int i = 0; i < SensorStreamCount; ++i )
+	{
+		m_streams[i] = INVALID_HANDLE_VALUE;
+		m_events[i] = INVALID_HANDLE_VALUE;
+		m_threads[i] = NULL;
+		m_frames[i] = 0;
+	}
+	m_ringDrops[SensorStreamDepth] = 0;
+	m_ringDrops[SensorStreamColor] = 0;
+
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_hFrameReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+FrameAcquisition::~FrameAcquisition()
+{
+	Stop();
+
+	CloseHandle(m_hStop);
+	CloseHandle(m_hFrameReady);
+}
+
+HRESULT FrameAcquisition::Start(INuiSensor* pNuiSensor,
+	HANDLE depthStream, HANDLE depthEvent, size_t depthFrameBytes,
+	HANDLE colorStream, HANDLE colorEvent, size_t colorFrameBytes,
+	HANDLE skeletonEvent, FrameTimer* pFrameTimer, MaskStabilizer* pMaskStabilizer, FrameArena* pArena)
+{
+	if ( NULL == pArena )
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = m_rings[SensorStreamDepth].Initialize(*pArena, cImageSlots, depthFrameBytes);
+	if ( SUCCEEDED(hr) )
+	{
+		hr = m_rings[SensorStreamColor].Initialize(*pArena, cImageSlots, colorFrameBytes);
+	}
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	m_pNuiSensor = pNuiSensor;
+	m_pFrameTimer = pFrameTimer;
+	m_pMaskStabilizer = pMaskStabilizer;
+	if ( m_pMaskStabilizer )
+	{
+		// frames from before a restart are no guide to the next
+		m_pMaskStabilizer->Reset();
+	}
+	m_streams[SensorStreamDepth] = depthStream;
+	m_streams[SensorStreamColor] = colorStream;
+	m_events[SensorStreamDepth] = depthEvent;
+	m_events[SensorStreamColor] = colorEvent;
+	m_events[SensorStreamSkeleton] = skeletonEvent;
+
+	ResetEvent(m_hStop);
+
+	// without a sensor the frames are injected
+	for ( int i = 0; m_pNuiSensor && i < SensorStreamCount; ++i )
+	{
+		m_contexts[i].pThis = this;
+		m_contexts[i].stream = (SensorStream)i;
+		m_threads[i] = CreateThread(NULL, 0, ThreadProc, &m_contexts[i], 0, NULL);
+		if ( NULL == m_threads[i] )
+		{
+			Stop();
+			return E_FAIL;
+		}
+
+		// acquisition only moves handles around, it should never wait behind processing
+		SetThreadPriority(m_threads[i], THREAD_PRIORITY_ABOVE_NORMAL);
+	}
+
+	return S_OK;
+}
+
+void FrameAcquisition::Stop()
+{
+	SetEvent(m_hStop);
+
+	for ( int i = 0; i < SensorStreamCount; ++i )
+	{
+		if ( m_threads[i] )
+		{
+			WaitForSingleObject(m_threads[i], INFINITE);
+			CloseHandle(m_threads[i]);
+			m_threads[i] = NULL;
+		}
+	}
+
+	// the threads are gone, so we can act as the consumer to return what's left
+	AcquiredImageFrame image;
+	while ( m_depthQueue.Pop(image) )
+	{
+		ReleaseImageFrame(SensorStreamDepth, image);
+	}
+	while ( m_colorQueue.Pop(image) )
+	{
+		ReleaseImageFrame(SensorStreamColor, image);
+	}
+	AcquiredSkeletonFrame skeleton;
+	while ( m_skeletonQueue.Pop(skeleton) )
+	{
+	}
+}
+
+void FrameAcquisition::GetStats(SensorStream stream, SensorStreamStats& stats) const
+{
+	stats.frames = m_frames[stream];
+	switch ( stream )
+	{
+	case SensorStreamDepth:
+		stats.queued = m_depthQueue.Depth();
+		stats.drops = m_depthQueue.Drops() + m_ringDrops[SensorStreamDepth];
+		break;
+	case SensorStreamColor:
+		stats.queued = m_colorQueue.Depth();
+		stats.drops = m_colorQueue.Drops() + m_ringDrops[SensorStreamColor];
+		break;
+	default:
+		stats.queued = m_skeletonQueue.Depth();
+		stats.drops = m_skeletonQueue.Drops();
+		break;
+	}
+}
+
+DWORD WINAPI FrameAcquisition::ThreadProc(LPVOID lpParameter)
+{
+	ThreadContext* context = static_cast<ThreadContext*>(lpParameter);
+	Trace::SetThreadName(g_threadNames[context->stream]);
+
+	if ( context->stream == SensorStreamSkeleton )
+	{
+		context->pThis->AcquireSkeletons();
+	}
+	else
+	{
+		context->pThis->AcquireImages(context->stream);
+	}
+	return 0;
+}
+
+void FrameAcquisition::AcquireImages(SensorStream stream)
+{
+	HANDLE events[2] = { m_hStop, m_events[stream] };
+
+	while ( WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+	{
+		AcquiredImageFrame image;
+		NUI_IMAGE_FRAME frame;
+		image.arrivalTicks = HighResClock::Now();
+
+		if ( FAILED(m_pNuiSensor->NuiImageStreamGetNextFrame(m_streams[stream], 0, &frame)) )
+		{
+			continue;
+		}
+
+		image.timeStamp = frame.liTimeStamp;
+
+		// copy the pixels out so the runtime gets its buffer back before the next frame is due
+		INuiFrameTexture* pTexture = frame.pFrameTexture;
+		NUI_LOCKED_RECT lockedRect;
+		pTexture->LockRect(0, &lockedRect, NULL, 0);
+		image.slot = (lockedRect.Pitch != 0) ? CopyImage(stream, lockedRect.pBits, lockedRect.size) : -1;
+		pTexture->UnlockRect(0);
+
+		m_pNuiSensor->NuiImageStreamReleaseFrame(m_streams[stream], &frame);
+
+		if ( stream == SensorStreamDepth && m_pFrameTimer )
+		{
+			m_pFrameTimer->End(FrameStageDepth, image.arrivalTicks);
+		}
+
+		if ( image.slot >= 0 )
+		{
+			QueueImage(stream, image);
+		}
+	}
+}
+
+bool FrameAcquisition::InjectImage(SensorStream stream, const BYTE* pixels, size_t bytes, LARGE_INTEGER timeStamp)
+{
+	AcquiredImageFrame image;
+	image.arrivalTicks = HighResClock::Now();
+	image.timeStamp = timeStamp;
+	image.slot = CopyImage(stream, pixels, bytes);
+
+	if ( stream == SensorStreamDepth && m_pFrameTimer )
+	{
+		m_pFrameTimer->End(FrameStageDepth, image.arrivalTicks);
+	}
+
+	return image.slot >= 0 && QueueImage(stream, image);
+}
+
+bool FrameAcquisition::InjectSkeleton(const NUI_SKELETON_FRAME& frame)
+{
+	AcquiredSkeletonFrame skeleton;
+	skeleton.arrivalTicks = HighResClock::Now();
+	skeleton.frame = frame;
+	return QueueSkeleton(skeleton);
+}
+
+int FrameAcquisition::CopyImage(SensorStream stream, const BYTE* pixels, size_t bytes)
+{
+	TRACE_SCOPE("CopyFrame");
+	AUDIT_SCOPE(AuditStageIngest);
+
+	FrameRing& ring = m_rings[stream];
+	int slot = ring.Acquire();
+	if ( slot < 0 )
+	{
+		// every slot is still queued or in the pipeline
+		InterlockedIncrement(&m_ringDrops[stream]);
+		return -1;
+	}
+
+	if ( bytes > ring.SlotBytes() )
+	{
+		ring.Release(slot);
+		return -1;
+	}
+
+	// the player mask is stabilized in the same pass over the frame
+	if ( stream == SensorStreamDepth && m_pMaskStabilizer && bytes == m_pMaskStabilizer->Pixels() * sizeof(USHORT) )
+	{
+		MaskStabilizerStats maskStats;
+		m_pMaskStabilizer->Ingest(reinterpret_cast<const USHORT*>(pixels), reinterpret_cast<USHORT*>(ring.Slot(slot)), maskStats);
+	}
+	else
+	{
+		memcpy(ring.Slot(slot), pixels, bytes);
+	}
+	AllocationAudit::RecordCopy(bytes);
+
+	return slot;
+}
+
+bool FrameAcquisition::QueueImage(SensorStream stream, const AcquiredImageFrame& image)
+{
+	AUDIT_SCOPE(AuditStageIngest);
+
+	SpscQueue<AcquiredImageFrame, cImageQueueCapacity>& queue = (stream == SensorStreamDepth) ? m_depthQueue : m_colorQueue;
+	if ( !queue.Push(image) )
+	{
+		// processing is behind, this frame would only add latency
+		m_rings[stream].Release(image.slot);
+		return false;
+	}
+
+	InterlockedIncrement(&m_frames[stream]);
+	SetEvent(m_hFrameReady);
+	return true;
+}
+
+bool FrameAcquisition::QueueSkeleton(const AcquiredSkeletonFrame& skeleton)
+{
+	AUDIT_SCOPE(AuditStageIngest);
+
+	if ( !m_skeletonQueue.Push(skeleton) )
+	{
+		return false;
+	}
+
+	InterlockedIncrement(&m_frames[SensorStreamSkeleton]);
+	SetEvent(m_hFrameReady);
+	return true;
+}
+
+void FrameAcquisition::AcquireSkeletons()
+{
+	HANDLE events[2] = { m_hStop, m_events[SensorStreamSkeleton] };
+
+	while ( WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+	{
+		AcquiredSkeletonFrame skeleton;
+		skeleton.arrivalTicks = HighResClock::Now();
+
+		if ( FAILED(m_pNuiSensor->NuiSkeletonGetNextFrame(0, &skeleton.frame)) )
+		{
+			continue;
+		}
+
+		QueueSkeleton(skeleton);
+	}
+}
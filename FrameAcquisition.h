@@ -0,0 +1,171 @@
+/*
+
+Sensor frame acquisition
+
+Each Kinect stream gets its own thread that waits on the stream's event, takes
+the frame from the runtime and hands it to the processing thread through a
+single-producer/single-consumer queue. Image frames are copied into a slot of
+the stream's frame ring and returned to the runtime at once; the consumer owns
+the slot and releases it. Depth frames go through the mask stabilizer, if
+there is one, as they are copied. Skeleton frames are copied into the queue. When a
+queue or ring is full the new frame is released straight away and counted as a
+drop.
+
+Started without a sensor, there are no threads; frames recorded or made up
+are handed in with InjectImage and InjectSkeleton, and take the same path
+from the copy on.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "NuiApi.h"
+#include "SpscQueue.h"
+#include "FrameRing.h"
+#include "FrameTimer.h"
+#include "MaskStabilizer.h"
+
+typedef enum
+{
+	SensorStreamDepth,
+	SensorStreamColor,
+	SensorStreamSkeleton,
+	SensorStreamCount
+} SensorStream;
+
+typedef struct
+{
+	LARGE_INTEGER		timeStamp;		// sensor timestamp, in milliseconds
+	int					slot;			// frame ring slot holding the pixels
+	LONGLONG			arrivalTicks;	// when the acquisition thread got the frame
+} AcquiredImageFrame;
+
+typedef struct
+{
+	NUI_SKELETON_FRAME	frame;
+	LONGLONG			arrivalTicks;
+} AcquiredSkeletonFrame;
+
+typedef struct
+{
+	LONG	queued;		// frames waiting for the processing thread
+	LONG	frames;		// frames handed over since Start
+	LONG	drops;		// frames released because the queue or frame ring was full
+} SensorStreamStats;
+
+class FrameAcquisition
+{
+public:
+	// frames are copied out as soon as they arrive, so the runtime only needs its usual double buffer
+	static const int cImageQueueCapacity = 2;
+	static const int cImageStreamFrameLimit = 2;
+	// enough for the queue, the synchronizer's ring and every frame in the processing pipeline
+	static const int cImageSlots = 16;
+	static const int cSkeletonQueueCapacity = 4;
+
+	FrameAcquisition();
+	~FrameAcquisition();
+
+	/// <summary>
+	/// Allocates the frame rings from pArena and starts one acquisition thread per stream
+	/// </summary>
+	/// <param name="pNuiSensor">the sensor, or NULL to start no threads and take injected frames</param>
+	/// <param name="pMaskStabilizer">stabilizes the depth frames' player indices as they are copied, or NULL</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(INuiSensor* pNuiSensor,
+		HANDLE depthStream, HANDLE depthEvent, size_t depthFrameBytes,
+		HANDLE colorStream, HANDLE colorEvent, size_t colorFrameBytes,
+		HANDLE skeletonEvent, FrameTimer* pFrameTimer, MaskStabilizer* pMaskStabilizer, FrameArena* pArena);
+
+	/// <summary>
+	/// Stops the threads and releases any frames still queued
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// Copies and queues an image frame as its stream's thread would, when started without a sensor
+	/// </summary>
+	/// <param name="stream">SensorStreamDepth or SensorStreamColor</param>
+	/// <param name="pixels">the frame, as the runtime would give it</param>
+	/// <param name="bytes">size of the frame</param>
+	/// <param name="timeStamp">sensor timestamp, in milliseconds</param>
+	/// <returns>true if the frame was queued, false if it was dropped</returns>
+	bool InjectImage(SensorStream stream, const BYTE* pixels, size_t bytes, LARGE_INTEGER timeStamp);
+
+	/// <summary>
+	/// Queues a skeleton frame as the skeleton thread would, when started without a sensor
+	/// </summary>
+	/// <returns>true if the frame was queued, false if it was dropped</returns>
+	bool InjectSkeleton(const NUI_SKELETON_FRAME& frame);
+
+	/// <summary>
+	/// Auto-reset event signalled whenever any stream queues a frame
+	/// </summary>
+	HANDLE FrameReadyEvent() const { return m_hFrameReady; }
+
+	/// <summary>
+	/// Consumer side. The caller owns an image frame's slot and must release it with ReleaseImageFrame
+	/// </summary>
+	bool PopDepth(AcquiredImageFrame& frame) { return m_depthQueue.Pop(frame); }
+	bool PopColor(AcquiredImageFrame& frame) { return m_colorQueue.Pop(frame); }
+	bool PopSkeleton(AcquiredSkeletonFrame& frame) { return m_skeletonQueue.Pop(frame); }
+
+	/// <summary>
+	/// Pixels of a popped image frame, valid until it is released
+	/// </summary>
+	BYTE* ImageData(SensorStream stream, const AcquiredImageFrame& image) const { return m_rings[stream].Slot(image.slot); }
+
+	/// <summary>
+	/// Returns a popped image frame's slot to its ring, from any thread
+	/// </summary>
+	void ReleaseImageFrame(SensorStream stream, const AcquiredImageFrame& image) { m_rings[stream].Release(image.slot); }
+
+	/// <summary>
+	/// Queue depth and drop counters for a stream
+	/// </summary>
+	void GetStats(SensorStream stream, SensorStreamStats& stats) const;
+
+private:
+	struct ThreadContext
+	{
+		FrameAcquisition*	pThis;
+		SensorStream		stream;
+	};
+
+	INuiSensor*			m_pNuiSensor;
+	FrameTimer*			m_pFrameTimer;	// the depth thread records FrameStageDepth
+	MaskStabilizer*		m_pMaskStabilizer;	// only the depth thread uses it
+	HANDLE				m_streams[SensorStreamCount];
+	HANDLE				m_events[SensorStreamCount];
+
+	HANDLE				m_hStop;
+	HANDLE				m_hFrameReady;
+	HANDLE				m_threads[SensorStreamCount];
+	ThreadContext		m_contexts[SensorStreamCount];
+
+	SpscQueue<AcquiredImageFrame, cImageQueueCapacity>			m_depthQueue;
+	SpscQueue<AcquiredImageFrame, cImageQueueCapacity>			m_colorQueue;
+	SpscQueue<AcquiredSkeletonFrame, cSkeletonQueueCapacity>	m_skeletonQueue;
+
+	FrameRing			m_rings[SensorStreamSkeleton];	// depth and color
+
+	volatile LONG		m_frames[SensorStreamCount];
+	volatile LONG		m_ringDrops[SensorStreamSkeleton];
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void AcquireImages(SensorStream stream);
+	void AcquireSkeletons();
+
+	/// <summary>
+	/// Copies an image frame into a free slot of its stream's ring
+	/// </summary>
+	/// <returns>the slot, or -1 if none was free or the frame does not fit</returns>
+	int CopyImage(SensorStream stream, const BYTE* pixels, size_t bytes);
+
+	/// <summary>
+	/// Hands a copied image frame to the processing thread, or releases its slot if the queue is full
+	/// </summary>
+	bool QueueImage(SensorStream stream, const AcquiredImageFrame& image);
+	bool QueueSkeleton(const AcquiredSkeletonFrame& skeleton);
+};
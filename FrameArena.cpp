@@ -0,0 +1,191 @@
+#include "stdafx.h"
+#include "FrameArena.h"
+#include "AllocationAudit.h"
+
+#ifdef _WIN32
+
+/// <summary>
+/// Large pages need SeLockMemoryPrivilege enabled in the process token
+/// </summary>
+static bool EnableLockMemoryPrivilege()
+{
+	HANDLE token = NULL;
+	if ( !OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token) )
+	{
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	// AdjustTokenPrivileges succeeds without the privilege, and only says so through the last error
+	bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+		GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(token);
+	return enabled;
+}
+
+/// <summary>
+/// Commits a block, on large pages if asked for; NULL if there are none free
+/// </summary>
+static BYTE* MapBlock(size_t bytes, bool largePages)
+{
+	DWORD flags = MEM_RESERVE | MEM_COMMIT | ( largePages ? MEM_LARGE_PAGES : 0 );
+	return static_cast<BYTE*>(VirtualAlloc(NULL, bytes, flags, PAGE_READWRITE));
+}
+
+static void UnmapBlock(BYTE* pBase, size_t)
+{
+	VirtualFree(pBase, 0, MEM_RELEASE);
+}
+
+#else
+
+#include <sys/mman.h>
+
+// the usual huge page on x86-64 and arm64
+static const size_t g_hugePageBytes = 2 * 1024 * 1024;
+
+/// <summary>
+/// Maps a block, on huge pages if asked for; NULL if the pool set aside for them has none free
+/// </summary>
+static BYTE* MapBlock(size_t bytes, bool largePages)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | ( largePages ? MAP_HUGETLB : 0 );
+	void* pBase = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+	return ( MAP_FAILED == pBase ) ? NULL : static_cast<BYTE*>(pBase);
+}
+
+static void UnmapBlock(BYTE* pBase, size_t bytes)
+{
+	munmap(pBase, bytes);
+}
+
+#endif
+
+FrameArena::FrameArena() :
+	m_blockCount(0),
+	m_bLargePages(false),
+	m_bSealed(false)
+{
+	InitializeCriticalSection(&m_lock);
+	ZeroMemory(m_blocks, sizeof(m_blocks));
+	ZeroMemory(&m_stats, sizeof(m_stats));
+}
+
+FrameArena::~FrameArena()
+{
+	for ( int i = 0; i < m_blockCount; ++i )
+	{
+		UnmapBlock(m_blocks[i].pBase, m_blocks[i].size);
+	}
+	DeleteCriticalSection(&m_lock);
+}
+
+void FrameArena::UseLargePages()
+{
+	EnterCriticalSection(&m_lock);
+#ifdef _WIN32
+	m_bLargePages = GetLargePageMinimum() > 0 && EnableLockMemoryPrivilege();
+#else
+	// huge pages need no privilege, only the pool, which a failed map falls back from
+	m_bLargePages = true;
+#endif
+	LeaveCriticalSection(&m_lock);
+}
+
+void* FrameArena::AllocateBytes(size_t bytes)
+{
+	EnterCriticalSection(&m_lock);
+
+	size_t aligned = (bytes + cAlignment - 1) & ~(cAlignment - 1);
+
+	Block* pBlock = m_blockCount > 0 ? &m_blocks[m_blockCount - 1] : NULL;
+	if ( NULL == pBlock || pBlock->size - pBlock->used < aligned )
+	{
+		if ( !AddBlock(aligned) )
+		{
+			LeaveCriticalSection(&m_lock);
+			return NULL;
+		}
+		pBlock = &m_blocks[m_blockCount - 1];
+	}
+
+	// blocks start on a page, and every allocation is a whole number of cache lines
+	void* pData = pBlock->pBase + pBlock->used;
+	pBlock->used += aligned;
+
+	++m_stats.allocations;
+	m_stats.allocatedBytes += bytes;
+	if ( m_bSealed )
+	{
+		++m_stats.steadyStateAllocations;
+		AllocationAudit::RecordAllocation(bytes);
+	}
+
+	LeaveCriticalSection(&m_lock);
+	return pData;
+}
+
+bool FrameArena::AddBlock(size_t bytes)
+{
+	if ( m_blockCount == cMaxBlocks )
+	{
+		return false;
+	}
+
+	size_t size = bytes > cBlockBytes ? bytes : cBlockBytes;
+	BYTE* pBase = NULL;
+
+	if ( m_bLargePages )
+	{
+#ifdef _WIN32
+		size_t largePage = GetLargePageMinimum();
+#else
+		size_t largePage = g_hugePageBytes;
+#endif
+		size_t largeSize = (size + largePage - 1) & ~(largePage - 1);
+		pBase = MapBlock(largeSize, true);
+		if ( NULL != pBase )
+		{
+			size = largeSize;
+			++m_stats.largePageBlocks;
+		}
+	}
+
+	// no large pages, or none free: physical memory is often too fragmented for them after a while
+	if ( NULL == pBase )
+	{
+		pBase = MapBlock(size, false);
+		if ( NULL == pBase )
+		{
+			return false;
+		}
+	}
+
+	Block& block = m_blocks[m_blockCount++];
+	block.pBase = pBase;
+	block.size = size;
+	block.used = 0;
+
+	++m_stats.blocks;
+	m_stats.reservedBytes += size;
+	return true;
+}
+
+void FrameArena::Seal()
+{
+	EnterCriticalSection(&m_lock);
+	m_bSealed = true;
+	LeaveCriticalSection(&m_lock);
+}
+
+void FrameArena::GetStats(FrameArenaStats& stats)
+{
+	EnterCriticalSection(&m_lock);
+	stats = m_stats;
+	LeaveCriticalSection(&m_lock);
+}
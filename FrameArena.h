@@ -0,0 +1,124 @@
+/*
+
+Frame memory arena
+
+Every buffer a frame passes through is carved out of one arena while the
+application starts: the acquisition ring slots, the mapping and player pixel
+buffers, the composited images and the background. Buffers start on 64-byte
+cache lines, so SIMD loads never straddle one and no two buffers share one.
+The arena takes memory from the system in large blocks, optionally backed
+by large pages, which keeps the TLB from thrashing as whole frames stream
+through. Nothing is freed before the arena is; a buffer lives as long as
+its owner.
+
+Once start-up is over the owner seals the arena. Any allocation after that
+happens in the steady-state frame loop; it is counted here, and reported to
+the allocation audit with the heap allocations its hooks see, against the
+stage that made it.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Arena counters
+/// </summary>
+typedef struct
+{
+	LONG		allocations;			// buffers handed out
+	LONGLONG	allocatedBytes;			// their total size, before alignment
+	LONGLONG	reservedBytes;			// memory taken from the system
+	LONG		blocks;					// blocks it was taken in
+	LONG		largePageBlocks;		// blocks backed by large pages
+	LONG		steadyStateAllocations;	// arena allocations after Seal, which should stay 0
+} FrameArenaStats;
+
+/// <summary>
+/// A typed buffer in the arena. Converts to a plain pointer, so it indexes like one
+/// </summary>
+template <class T>
+class ArenaView
+{
+public:
+	ArenaView() : m_pData(NULL), m_count(0)
+	{
+	}
+
+	ArenaView(T* pData, size_t count) : m_pData(pData), m_count(count)
+	{
+	}
+
+	operator T*() const { return m_pData; }
+	T* Data() const { return m_pData; }
+	size_t Count() const { return m_count; }
+	size_t Bytes() const { return m_count * sizeof(T); }
+
+private:
+	T*		m_pData;
+	size_t	m_count;
+};
+
+class FrameArena
+{
+public:
+	static const size_t cAlignment = 64;
+
+	// blocks are at least this big, so start-up takes a handful of them
+	static const size_t cBlockBytes = 16 << 20;
+	static const int cMaxBlocks = 64;
+
+	FrameArena();
+	~FrameArena();
+
+	/// <summary>
+	/// Backs blocks allocated from here on with large pages where the system allows it,
+	/// which needs the lock pages in memory privilege; falls back to normal pages otherwise
+	/// </summary>
+	void UseLargePages();
+
+	/// <summary>
+	/// Allocates an aligned buffer, from any thread
+	/// </summary>
+	/// <returns>the buffer, or NULL if out of memory</returns>
+	void* AllocateBytes(size_t bytes);
+
+	/// <summary>
+	/// Allocates an aligned buffer of count Ts, uninitialized
+	/// </summary>
+	/// <returns>the view, with a NULL pointer if out of memory</returns>
+	template <class T>
+	ArenaView<T> Allocate(size_t count)
+	{
+		T* pData = static_cast<T*>(AllocateBytes(count * sizeof(T)));
+		return ArenaView<T>(pData, NULL == pData ? 0 : count);
+	}
+
+	/// <summary>
+	/// Ends start-up; every allocation after this is counted as a steady-state allocation
+	/// </summary>
+	void Seal();
+
+	void GetStats(FrameArenaStats& stats);
+
+private:
+	struct Block
+	{
+		BYTE*	pBase;
+		size_t	size;
+		size_t	used;
+	};
+
+	CRITICAL_SECTION	m_lock;
+	Block				m_blocks[cMaxBlocks];
+	int					m_blockCount;
+	bool				m_bLargePages;
+	bool				m_bSealed;
+	FrameArenaStats		m_stats;
+
+	/// <summary>
+	/// Takes a new block with room for bytes from the system
+	/// </summary>
+	bool AddBlock(size_t bytes);
+};
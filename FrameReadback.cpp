@@ -0,0 +1,227 @@
+#include "stdafx.h"
+#include "FrameReadback.h"
+#include "Trace.h"
+
+FrameReadback::FrameReadback() :
+	m_first(0),
+	m_nextMap(0),
+	m_inUse(0),
+	m_reading(0),
+	m_hThread(NULL),
+	m_stalls(0),
+	m_delivered(0)
+{
+	ZeroMemory(m_slots, sizeof(m_slots));
+	m_hMapped = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hReturned = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+FrameReadback::~FrameReadback()
+{
+	// the GL objects went with the context; only the thread is left if Release was not called
+	if ( m_hThread )
+	{
+		SetEvent(m_hStop);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+	}
+
+	CloseHandle(m_hMapped);
+	CloseHandle(m_hReturned);
+	CloseHandle(m_hStop);
+}
+
+HRESULT FrameReadback::Initialize(int width, int height)
+{
+	for ( int i = 0; i < cSlots; ++i )
+	{
+		m_slots[i].capacity = width * height * 4;
+		glGenBuffers(1, &m_slots[i].buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_slots[i].buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, m_slots[i].capacity, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if ( glGetError() != GL_NO_ERROR )
+	{
+		return E_FAIL;
+	}
+
+	ResetEvent(m_hStop);
+	m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	return m_hThread ? S_OK : E_FAIL;
+}
+
+void FrameReadback::Queue(LONG frame, LONGLONG presentTicks, int width, int height, const FrameTarget* targets, int targetCount)
+{
+	Reclaim();
+
+	// every buffer is being read or delivered: wait for the oldest to come back
+	if ( m_inUse == cSlots )
+	{
+		++m_stalls;
+		while ( m_inUse == cSlots )
+		{
+			if ( m_reading > 0 )
+			{
+				MapOldest(true);
+			}
+			WaitForSingleObject(m_hReturned, INFINITE);
+			Reclaim();
+		}
+	}
+
+	ReadbackSlot& slot = m_slots[(m_first + m_inUse) % cSlots];
+	slot.frame = frame;
+	slot.presentTicks = presentTicks;
+	slot.width = width;
+	slot.height = height;
+	slot.targetCount = ( targetCount < cMaxTargets ) ? targetCount : cMaxTargets;
+	for ( int i = 0; i < slot.targetCount; ++i )
+	{
+		slot.targets[i] = targets[i];
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+
+	// the view grew since the buffer was made
+	int bytes = width * height * 4;
+	if ( bytes > slot.capacity )
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		slot.capacity = bytes;
+	}
+
+	// with a pack buffer bound this returns once the copy is queued
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	++m_inUse;
+	++m_reading;
+}
+
+void FrameReadback::Collect(bool wait)
+{
+	Reclaim();
+	while ( m_reading > 0 && MapOldest(wait) )
+	{
+	}
+
+	while ( wait && m_inUse > 0 )
+	{
+		WaitForSingleObject(m_hReturned, INFINITE);
+		Reclaim();
+	}
+}
+
+bool FrameReadback::MapOldest(bool wait)
+{
+	int index = m_nextMap;
+	ReadbackSlot& slot = m_slots[index];
+
+	if ( !wait )
+	{
+		GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if ( status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED )
+		{
+			return false;
+		}
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = NULL;
+
+	// mapping waits for the copy if it has not finished; the mapping stays valid on the delivery thread
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	slot.pixels = (const BYTE*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.width * slot.height * 4, GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_nextMap = (m_nextMap + 1) % cSlots;
+	--m_reading;
+
+	// there is always room: no more slots than the queue holds
+	m_mapped.Push(index);
+	SetEvent(m_hMapped);
+	return true;
+}
+
+void FrameReadback::Reclaim()
+{
+	int index;
+	while ( m_returned.Pop(index) )
+	{
+		// slots come back in the order they went
+		ReadbackSlot& slot = m_slots[index];
+		if ( slot.pixels )
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.pixels = NULL;
+		}
+
+		m_first = (m_first + 1) % cSlots;
+		--m_inUse;
+	}
+}
+
+void FrameReadback::Release()
+{
+	Collect(true);
+
+	if ( m_hThread )
+	{
+		SetEvent(m_hStop);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+	}
+
+	for ( int i = 0; i < cSlots; ++i )
+	{
+		if ( m_slots[i].buffer )
+		{
+			glDeleteBuffers(1, &m_slots[i].buffer);
+		}
+	}
+	ZeroMemory(m_slots, sizeof(m_slots));
+	m_first = 0;
+	m_nextMap = 0;
+}
+
+DWORD WINAPI FrameReadback::ThreadProc(LPVOID lpParameter)
+{
+	static_cast<FrameReadback*>(lpParameter)->Deliver();
+	return 0;
+}
+
+void FrameReadback::Deliver()
+{
+	Trace::SetThreadName("Readback");
+
+	HANDLE events[2] = { m_hStop, m_hMapped };
+	while ( WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+	{
+		int index;
+		while ( m_mapped.Pop(index) )
+		{
+			ReadbackSlot& slot = m_slots[index];
+			if ( slot.pixels )
+			{
+				TRACE_SCOPE("FrameReadback::Deliver");
+				int stride = slot.width * 4;
+				const BYTE* pTop = slot.pixels + (slot.height - 1) * stride;
+
+				for ( int i = 0; i < slot.targetCount; ++i )
+				{
+					slot.targets[i].sink(slot.targets[i].context, pTop, slot.width, slot.height, -stride, slot.frame, slot.presentTicks);
+				}
+				InterlockedIncrement(&m_delivered);
+			}
+
+			m_returned.Push(index);
+			SetEvent(m_hReturned);
+		}
+	}
+}
@@ -0,0 +1,134 @@
+/*
+
+Asynchronous framebuffer readback
+
+Reads finished frames back to memory without stalling the drawing thread.
+Each frame is read with glReadPixels into the next of a ring of pixel pack
+buffers, which only queues the copy, and a fence goes in after it. Once the
+fence has signalled, a frame or two later, the drawing thread maps the
+buffer and hands it to the delivery thread, which calls the frame's sinks on
+the mapped pixels; the buffer is unmapped on the drawing thread once they
+return. Nothing is copied on the way. Only when every buffer is still in
+flight, read or being delivered, does queueing another frame wait.
+
+Initialize, Queue, Collect and Release run on the thread the GL context is
+current on.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "GlApi.h"
+#include "SpscQueue.h"
+
+// Receives a frame read back, on the delivery thread: BGRA rows starting with the top one, stride
+// bytes apart (negative, as GL stores them bottom up), and the HighResClock time it was presented.
+// The pixels are only valid for the call
+typedef void (*FrameSink)(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks);
+
+// A sink and the context it is called with
+typedef struct
+{
+	FrameSink	sink;
+	void*		context;
+} FrameTarget;
+
+class FrameReadback
+{
+public:
+	// pack buffers in the ring: one being read, one waiting for its fence, one being delivered and a spare
+	static const int cSlots = 4;
+
+	// sinks a frame can go to: the renderer's streams and a snapshot
+	static const int cMaxTargets = 4;
+
+	FrameReadback();
+	~FrameReadback();
+
+	/// <summary>
+	/// Creates the pack buffers for frames up to the given size, on the current context, and starts the delivery thread
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(int width, int height);
+
+	/// <summary>
+	/// Queues a read of the bound read framebuffer for the targets, waiting for the oldest read first if
+	/// every buffer is in flight
+	/// </summary>
+	/// <param name="frame">number handed to the sinks with the pixels</param>
+	/// <param name="presentTicks">when the frame was presented, handed to the sinks too</param>
+	/// <param name="targets">sinks to hand the pixels to, in order</param>
+	/// <param name="targetCount">up to cMaxTargets; 0 reads the frame back and discards it</param>
+	void Queue(LONG frame, LONGLONG presentTicks, int width, int height, const FrameTarget* targets, int targetCount);
+
+	/// <summary>
+	/// Hands every read that has finished to the delivery thread, oldest first, and unmaps the ones it has delivered
+	/// </summary>
+	/// <param name="wait">wait until every read in flight has been delivered</param>
+	void Collect(bool wait);
+
+	/// <summary>
+	/// Delivers what is in flight, stops the delivery thread and deletes the buffers and fences, on the current context
+	/// </summary>
+	void Release();
+
+	/// <summary>
+	/// Times Queue had to wait for a buffer
+	/// </summary>
+	LONG Stalls() const { return m_stalls; }
+
+	/// <summary>
+	/// Frames handed to their sinks
+	/// </summary>
+	LONG Delivered() const { return m_delivered; }
+
+private:
+	typedef struct
+	{
+		GLuint			buffer;
+		int				capacity;		// bytes
+		GLsync			fence;
+		LONG			frame;
+		LONGLONG		presentTicks;
+		int				width;
+		int				height;
+		FrameTarget		targets[cMaxTargets];
+		int				targetCount;
+		const BYTE*		pixels;			// while mapped
+	} ReadbackSlot;
+
+	ReadbackSlot	m_slots[cSlots];
+
+	// drawing thread's ring positions: oldest slot in use, oldest read not yet mapped, and slots in use
+	int				m_first;
+	int				m_nextMap;
+	int				m_inUse;
+	int				m_reading;
+
+	// mapped slots go to the delivery thread and come back once delivered
+	SpscQueue<int, cSlots>	m_mapped;
+	SpscQueue<int, cSlots>	m_returned;
+	HANDLE			m_hMapped;
+	HANDLE			m_hReturned;
+	HANDLE			m_hStop;
+	HANDLE			m_hThread;
+
+	LONG			m_stalls;
+	volatile LONG	m_delivered;
+
+	/// <summary>
+	/// Maps the oldest unmapped read and passes it to the delivery thread
+	/// </summary>
+	/// <param name="wait">if false, only if its fence has signalled</param>
+	/// <returns>true if it was passed on</returns>
+	bool MapOldest(bool wait);
+
+	/// <summary>
+	/// Unmaps the slots the delivery thread has finished with
+	/// </summary>
+	void Reclaim();
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Deliver();
+};
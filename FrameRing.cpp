@@ -0,0 +1,57 @@
+#include "stdafx.h"
+#include "FrameRing.h"
+
+FrameRing::FrameRing() :
+	m_pStorage(NULL),
+	m_storageBytes(0),
+	m_slotBytes(0),
+	m_stride(0)
+{
+	ZeroMemory(m_slots, sizeof(m_slots));
+}
+
+HRESULT FrameRing::Initialize(FrameArena& arena, int slotCount, size_t slotBytes)
+{
+	if ( slotCount <= 0 || slotCount > cMaxSlots )
+	{
+		return E_INVALIDARG;
+	}
+
+	m_free.Reset(0);
+
+	size_t stride = (slotBytes + cAlignment - 1) & ~(cAlignment - 1);
+	if ( slotCount * stride > m_storageBytes )
+	{
+		m_pStorage = static_cast<BYTE*>(arena.AllocateBytes(slotCount * stride));
+		if ( NULL == m_pStorage )
+		{
+			m_storageBytes = 0;
+			return E_OUTOFMEMORY;
+		}
+		m_storageBytes = slotCount * stride;
+	}
+
+	m_slotBytes = slotBytes;
+	m_stride = stride;
+	for ( int i = 0; i < slotCount; ++i )
+	{
+		m_slots[i] = m_pStorage + i * stride;
+	}
+	m_free.Reset(slotCount);
+	return S_OK;
+}
+
+HRESULT FrameRing::Initialize(int slotCount, size_t slotBytes)
+{
+	if ( slotCount <= 0 || slotCount > cMaxSlots )
+	{
+		return E_INVALIDARG;
+	}
+
+	m_free.Reset(0);
+	ZeroMemory(m_slots, sizeof(m_slots));
+	m_slotBytes = slotBytes;
+	m_stride = 0;
+	m_free.Reset(slotCount);
+	return S_OK;
+}
@@ -0,0 +1,78 @@
+/*
+
+Preallocated image slots
+
+Each image stream gets a ring of slots the size of one frame, allocated once
+from the frame arena and aligned to cache lines. The acquisition thread copies each frame into a
+free slot and gives the runtime its buffer back straight away; from then on
+the slot index travels with the frame through the queue, the synchronizer and
+the pipeline, and whoever drops or retires the frame returns the slot. A slot
+has one owner at a time, so it is never written while it is being read.
+
+A ring can also be handed its memory slot by slot instead, by an owner that
+maps it from elsewhere, such as GL pixel buffers; the owner may move a slot
+to other memory whenever it holds the slot.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "SlotPool.h"
+#include "FrameArena.h"
+
+class FrameRing
+{
+public:
+	static const int cMaxSlots = SlotPool::cMaxSlots;
+	static const size_t cAlignment = FrameArena::cAlignment;
+
+	FrameRing();
+
+	/// <summary>
+	/// Allocates the slots from the arena and marks them all free. Slots allocated
+	/// before are reused if they are big enough, so restarting allocates nothing
+	/// </summary>
+	/// <param name="arena">arena the slots live in, which must outlive the ring</param>
+	/// <param name="slotCount">number of slots, at most cMaxSlots</param>
+	/// <param name="slotBytes">size of one frame</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(FrameArena& arena, int slotCount, size_t slotBytes);
+
+	/// <summary>
+	/// Marks the slots free, with no memory of their own: each is given its memory with SetSlot
+	/// before it is first acquired
+	/// </summary>
+	/// <param name="slotCount">number of slots, at most cMaxSlots</param>
+	/// <param name="slotBytes">size of one frame</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(int slotCount, size_t slotBytes);
+
+	/// <summary>
+	/// Points a slot at other memory, by whoever holds the slot; whoever acquires it next after it
+	/// is released writes there
+	/// </summary>
+	void SetSlot(int slot, BYTE* pMemory) { m_slots[slot] = pMemory; }
+
+	/// <summary>
+	/// Takes a free slot, from any thread
+	/// </summary>
+	/// <returns>slot index, or -1 if every slot is in use</returns>
+	int Acquire() { return m_free.Acquire(); }
+
+	/// <summary>
+	/// Returns a slot taken with Acquire, from any thread
+	/// </summary>
+	void Release(int slot) { m_free.Release(slot); }
+
+	BYTE* Slot(int slot) const { return m_slots[slot]; }
+	size_t SlotBytes() const { return m_slotBytes; }
+
+private:
+	SlotPool	m_free;
+	BYTE*		m_pStorage;
+	size_t		m_storageBytes;
+	size_t		m_slotBytes;
+	size_t		m_stride;		// slot size rounded up to a whole number of cache lines
+	BYTE*		m_slots[cMaxSlots];
+};
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "FrameSynchronizer.h"
+#include "HighResClock.h"
+
+FrameSynchronizer::FrameSynchronizer() :
+	m_pAcquisition(NULL),
+	m_toleranceMs(0),
+	m_pairs(0)
+{
+	ZeroMemory(m_rings, sizeof(m_rings));
+	ZeroMemory(m_unmatched, sizeof(m_unmatched));
+}
+
+void FrameSynchronizer::Initialize(FrameAcquisition* pAcquisition, LONGLONG toleranceMs)
+{
+	m_pAcquisition = pAcquisition;
+	m_toleranceMs = toleranceMs;
+}
+
+void FrameSynchronizer::Add(SensorStream stream, const AcquiredImageFrame& image)
+{
+	Ring& ring = m_rings[stream];
+
+	if ( ring.count == cRingCapacity )
+	{
+		Discard(stream, 1);
+	}
+
+	ring.At(ring.count) = image;
+	++ring.count;
+}
+
+bool FrameSynchronizer::Match(AcquiredImageFrame& depth, AcquiredImageFrame& color)
+{
+	DiscardUnmatchable(SensorStreamDepth, SensorStreamColor);
+	DiscardUnmatchable(SensorStreamColor, SensorStreamDepth);
+
+	Ring& depthRing = m_rings[SensorStreamDepth];
+	Ring& colorRing = m_rings[SensorStreamColor];
+
+	// newest depth frame first, an older pair would only add latency
+	for ( int d = depthRing.count - 1; d >= 0; --d )
+	{
+		LONGLONG depthTime = TimeStamp(depthRing.At(d));
+
+		int best = -1;
+		LONGLONG bestSkew = 0;
+		for ( int c = 0; c < colorRing.count; ++c )
+		{
+			LONGLONG skew = TimeStamp(colorRing.At(c)) - depthTime;
+			if ( skew < 0 )
+			{
+				skew = -skew;
+			}
+			if ( skew <= m_toleranceMs && (best < 0 || skew < bestSkew) )
+			{
+				best = c;
+				bestSkew = skew;
+			}
+		}
+
+		if ( best < 0 )
+		{
+			continue;
+		}
+
+		// anything older than the pair has missed its chance
+		Discard(SensorStreamDepth, d);
+		Discard(SensorStreamColor, best);
+
+		depth = depthRing.At(0);
+		color = colorRing.At(0);
+		depthRing.PopFront();
+		colorRing.PopFront();
+
+		LONGLONG firstArrival = depth.arrivalTicks < color.arrivalTicks ? depth.arrivalTicks : color.arrivalTicks;
+		m_skew.Record(bestSkew * 1000);
+		m_wait.Record(HighResClock::TicksToMicroseconds(HighResClock::Now() - firstArrival));
+		++m_pairs;
+
+		return true;
+	}
+
+	return false;
+}
+
+void FrameSynchronizer::ReleaseAll()
+{
+	for ( int stream = SensorStreamDepth; stream <= SensorStreamColor; ++stream )
+	{
+		Ring& ring = m_rings[stream];
+		while ( ring.count > 0 )
+		{
+			m_pAcquisition->ReleaseImageFrame((SensorStream)stream, ring.At(0));
+			ring.PopFront();
+		}
+	}
+}
+
+void FrameSynchronizer::GetStats(FrameSyncStats& stats)
+{
+	stats.pairs = m_pairs;
+	stats.unmatchedDepth = m_unmatched[SensorStreamDepth];
+	stats.unmatchedColor = m_unmatched[SensorStreamColor];
+	m_skew.Snapshot(stats.skew);
+	m_wait.Snapshot(stats.wait);
+}
+
+void FrameSynchronizer::Discard(SensorStream stream, int count)
+{
+	Ring& ring = m_rings[stream];
+
+	for ( int i = 0; i < count; ++i )
+	{
+		m_pAcquisition->ReleaseImageFrame(stream, ring.At(0));
+		ring.PopFront();
+		++m_unmatched[stream];
+	}
+}
+
+void FrameSynchronizer::DiscardUnmatchable(SensorStream stream, SensorStream other)
+{
+	Ring& ring = m_rings[stream];
+	Ring& otherRing = m_rings[other];
+
+	if ( otherRing.count == 0 )
+	{
+		return;
+	}
+
+	// the other stream only moves forward, so once its newest frame is past the tolerance
+	// only the frames it already has could still match
+	LONGLONG otherNewest = TimeStamp(otherRing.At(otherRing.count - 1));
+	while ( ring.count > 0 )
+	{
+		LONGLONG time = TimeStamp(ring.At(0));
+		if ( otherNewest - time <= m_toleranceMs )
+		{
+			return;
+		}
+
+		for ( int i = 0; i < otherRing.count; ++i )
+		{
+			LONGLONG skew = TimeStamp(otherRing.At(i)) - time;
+			if ( skew >= -m_toleranceMs && skew <= m_toleranceMs )
+			{
+				return;
+			}
+		}
+
+		Discard(stream, 1);
+	}
+}
@@ -0,0 +1,109 @@
+/*
+
+Depth/colour frame synchronizer
+
+The Kinect's depth and colour cameras run on separate clocks, so the newest
+frame of each stream is often half a frame apart. Frames from both streams go
+into small rings ordered by sensor timestamp, and the matcher pairs the newest
+depth frame with the colour frame closest to it in time, if that is within the
+tolerance. Frames older than a pair, and frames nothing can match any more
+(the other stream has already moved past them), are released as unmatched.
+
+Frames in the rings hold frame ring slots, which the acquisition threads
+have plenty of, so a ring can bridge a few frames of drift between the
+clocks. Only the processing thread uses the synchronizer.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "FrameAcquisition.h"
+#include "LatencyMonitor.h"
+
+/// <summary>
+/// Synchronizer counters; the summaries cover the time since the previous GetStats
+/// </summary>
+typedef struct
+{
+	LONG			pairs;				// pairs handed out
+	LONG			unmatchedDepth;		// depth frames released without a partner
+	LONG			unmatchedColor;		// colour frames released without a partner
+	LatencySummary	skew;				// sensor timestamp difference within each pair
+	LatencySummary	wait;				// how long the first frame of each pair waited for the second
+} FrameSyncStats;
+
+class FrameSynchronizer
+{
+public:
+	// about a tenth of a second of each stream
+	static const int cRingCapacity = 4;
+
+	FrameSynchronizer();
+
+	/// <summary>
+	/// Sets where unmatched frames are released to, and how far apart a pair may be
+	/// </summary>
+	/// <param name="pAcquisition">releases the slots of unmatched frames</param>
+	/// <param name="toleranceMs">largest sensor timestamp difference within a pair</param>
+	void Initialize(FrameAcquisition* pAcquisition, LONGLONG toleranceMs);
+
+	/// <summary>
+	/// Takes a frame popped from the acquisition queue. When the ring is full the oldest frame is released
+	/// </summary>
+	/// <param name="stream">depth or color</param>
+	/// <param name="image">frame, owned by the synchronizer from here on</param>
+	void Add(SensorStream stream, const AcquiredImageFrame& image);
+
+	/// <summary>
+	/// Finds the newest depth frame with a colour frame within the tolerance
+	/// </summary>
+	/// <param name="depth">receives the depth frame, which the caller must release</param>
+	/// <param name="color">receives the colour frame, which the caller must release</param>
+	/// <returns>true if a pair was found</returns>
+	bool Match(AcquiredImageFrame& depth, AcquiredImageFrame& color);
+
+	/// <summary>
+	/// Releases every frame still in the rings
+	/// </summary>
+	void ReleaseAll();
+
+	/// <summary>
+	/// Counters and the skew and wait summaries since the previous call
+	/// </summary>
+	void GetStats(FrameSyncStats& stats);
+
+private:
+	// frames in arrival order, which for one stream is also timestamp order
+	struct Ring
+	{
+		AcquiredImageFrame	frames[cRingCapacity];
+		int					head;
+		int					count;
+
+		AcquiredImageFrame& At(int i) { return frames[(head + i) % cRingCapacity]; }
+		void PopFront() { head = (head + 1) % cRingCapacity; --count; }
+	};
+
+	FrameAcquisition*	m_pAcquisition;
+	LONGLONG			m_toleranceMs;
+
+	Ring				m_rings[2];		// indexed by SensorStreamDepth and SensorStreamColor
+
+	LONG				m_pairs;
+	LONG				m_unmatched[2];
+	LatencyHistogram	m_skew;
+	LatencyHistogram	m_wait;
+
+	static LONGLONG TimeStamp(const AcquiredImageFrame& image) { return image.timeStamp.QuadPart; }
+
+	/// <summary>
+	/// Removes the first count frames of a ring, releasing them as unmatched
+	/// </summary>
+	void Discard(SensorStream stream, int count);
+
+	/// <summary>
+	/// Releases frames the other stream has moved too far past to ever match
+	/// </summary>
+	void DiscardUnmatchable(SensorStream stream, SensorStream other);
+};
@@ -0,0 +1,76 @@
+#include "stdafx.h"
+#include <fstream>
+#include "FrameTimer.h"
+
+using namespace std;
+
+static const char* g_stageNames[FrameStageCount] = { "depth_ms", "mapping_ms", "composite_ms", "draw_ms", "swap_ms", "frame_ms" };
+
+FrameTimer::FrameTimer()
+{
+	ZeroMemory(m_rings, sizeof(m_rings));
+}
+
+float FrameTimer::Sample(FrameStage stage, int age) const
+{
+	const Ring& ring = m_rings[stage];
+	LONG next = ring.next;
+	if ( age < 0 || age >= cSamples || age >= next )
+	{
+		return 0.0f;
+	}
+
+	MemoryBarrier();
+	return static_cast<float>(HighResClock::TicksToMilliseconds(ring.ticks[(next - 1 - age) & (cSamples - 1)]));
+}
+
+float FrameTimer::Average(FrameStage stage, int frames) const
+{
+	LONG available = Count(stage);
+	if ( frames > available ) frames = available;
+	if ( frames > cSamples ) frames = cSamples;
+	if ( frames <= 0 )
+	{
+		return 0.0f;
+	}
+
+	float total = 0.0f;
+	for ( int i = 0; i < frames; ++i )
+	{
+		total += Sample(stage, i);
+	}
+	return total / frames;
+}
+
+HRESULT FrameTimer::WriteCsv(const char* path) const
+{
+	ofstream csv(path, ios::out | ios::trunc);
+	if ( !csv.is_open() )
+	{
+		return E_FAIL;
+	}
+
+	csv << "frame";
+	for ( int s = 0; s < FrameStageCount; ++s )
+	{
+		csv << ',' << g_stageNames[s];
+	}
+	csv << '\n';
+
+	// stages can be skipped on some frames (no new depth, say), so align the rings on their latest sample
+	for ( int age = cSamples - 1; age >= 0; --age )
+	{
+		csv << (cSamples - 1 - age);
+		for ( int s = 0; s < FrameStageCount; ++s )
+		{
+			csv << ',';
+			if ( age < Count((FrameStage)s) )
+			{
+				csv << Sample((FrameStage)s, age);
+			}
+		}
+		csv << '\n';
+	}
+
+	return csv.good() ? S_OK : E_FAIL;
+}
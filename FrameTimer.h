@@ -0,0 +1,114 @@
+/*
+
+Per-stage frame timing
+
+Each stage of a frame keeps its own fixed-size ring of durations. A stage is
+only ever recorded from one thread, so recording is a clock read and two
+plain stores; readers (the HUD and the CSV export) tolerate seeing a sample
+that is being overwritten.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "HighResClock.h"
+
+typedef enum
+{
+	FrameStageDepth,		// depth acquisition: get, copy with the player mask stabilized, and release the depth frame
+	FrameStageMapping,		// depth to color coordinate mapping
+	FrameStageComposite,	// the compositing loop in Update
+	FrameStageDraw,			// ImageRenderer::Draw up to the swap
+	FrameStageSwap,			// SwapBuffers
+	FrameStageFrame,		// time between consecutive presented frames
+	FrameStageCount
+} FrameStage;
+
+class FrameTimer
+{
+public:
+	static const int cSamples = 256;
+
+	FrameTimer();
+
+	/// <summary>
+	/// Records the duration of a stage that started at startTicks and ends now
+	/// </summary>
+	/// <returns>the current time, so consecutive stages can chain</returns>
+	LONGLONG End(FrameStage stage, LONGLONG startTicks)
+	{
+		LONGLONG now = HighResClock::Now();
+		Record(stage, now - startTicks);
+		return now;
+	}
+
+	/// <summary>
+	/// Records a stage duration in ticks
+	/// </summary>
+	void Record(FrameStage stage, LONGLONG ticks)
+	{
+		Ring& ring = m_rings[stage];
+		ring.ticks[ring.next & (cSamples - 1)] = static_cast<LONG>(ticks);
+		MemoryBarrier();
+		ring.next++;
+	}
+
+	/// <summary>
+	/// Number of samples recorded for a stage since startup
+	/// </summary>
+	LONG Count(FrameStage stage) const { return m_rings[stage].next; }
+
+	/// <summary>
+	/// Duration of a past sample in milliseconds, age 0 being the latest
+	/// </summary>
+	float Sample(FrameStage stage, int age) const;
+
+	/// <summary>
+	/// Mean duration of the last frames samples in milliseconds
+	/// </summary>
+	float Average(FrameStage stage, int frames) const;
+
+	/// <summary>
+	/// Writes the contents of all the rings as CSV, one row per frame
+	/// </summary>
+	/// <param name="path">file to write</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT WriteCsv(const char* path) const;
+
+private:
+	struct Ring
+	{
+		volatile LONG	next;
+		LONG			ticks[cSamples];
+	};
+
+	Ring	m_rings[FrameStageCount];
+};
+
+/// <summary>
+/// Times the enclosing scope as one stage
+/// </summary>
+class FrameTimerScope
+{
+public:
+	FrameTimerScope(FrameTimer* timer, FrameStage stage) :
+		m_timer(timer),
+		m_stage(stage),
+		m_start(HighResClock::Now())
+	{
+	}
+
+	~FrameTimerScope()
+	{
+		if ( m_timer )
+		{
+			m_timer->End(m_stage, m_start);
+		}
+	}
+
+private:
+	FrameTimer*	m_timer;
+	FrameStage	m_stage;
+	LONGLONG	m_start;
+};
@@ -0,0 +1,20 @@
+/*
+
+OpenGL entry points
+
+On Windows, opengl32 only exports OpenGL 1.1, and GLEW loads the rest once a
+context is current. Elsewhere the GL vendor-neutral dispatch library
+(libOpenGL) exports every entry point, routed to whichever context is
+current, so the prototypes are declared as they are and nothing is loaded.
+
+*/
+
+#pragma once
+
+#ifdef _WIN32
+#include "gl/glew.h"
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "GlApi.h"
+#include "GlContext.h"
+
+#ifdef _WIN32
+#include "gl/wglew.h"
+
+static const WCHAR* g_offscreenWindowClass = L"GreenScreenOffscreen";
+
+HGLRC CreateCoreContext(HDC hDC)
+{
+	PIXELFORMATDESCRIPTOR pfd;
+	ZeroMemory( &pfd, sizeof( pfd ) );
+	pfd.nSize = sizeof( pfd );
+	pfd.nVersion = 1;
+	pfd.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
+	pfd.iPixelType = PFD_TYPE_RGBA;
+	pfd.cColorBits = 24;
+	pfd.cAlphaBits = 8;
+	pfd.cDepthBits = 16;
+	pfd.iLayerType = PFD_MAIN_PLANE;
+	int format = ChoosePixelFormat( hDC, &pfd );
+	SetPixelFormat( hDC, format, &pfd );
+
+	HGLRC hRC = wglCreateContext( hDC );
+	if ( NULL == hRC )
+	{
+		return NULL;
+	}
+	wglMakeCurrent( hDC, hRC );
+
+	// GLEW only loads the core profile's entry points when told to
+	glewExperimental = GL_TRUE;
+	glewInit();
+
+	if ( WGLEW_ARB_create_context )
+	{
+		const int attributes[] = {
+			WGL_CONTEXT_MAJOR_VERSION_ARB, 3,
+			WGL_CONTEXT_MINOR_VERSION_ARB, 3,
+			WGL_CONTEXT_PROFILE_MASK_ARB, WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
+			0
+		};
+		HGLRC hCoreRC = wglCreateContextAttribsARB( hDC, NULL, attributes );
+
+		// without it the legacy context is kept, which is enough if the driver gives it 3.3
+		if ( hCoreRC )
+		{
+			wglMakeCurrent( hDC, hCoreRC );
+			wglDeleteContext( hRC );
+			hRC = hCoreRC;
+			glewInit();
+		}
+	}
+
+	return hRC;
+}
+
+OffscreenContext::OffscreenContext() :
+	m_hWnd(NULL),
+	m_hDC(NULL),
+	m_hRC(NULL)
+{
+}
+
+HRESULT OffscreenContext::Create()
+{
+	// a window is the only way to a wgl context, but it is never shown
+	WNDCLASSW wc = {0};
+	wc.lpfnWndProc = DefWindowProcW;
+	wc.hInstance = GetModuleHandleW(NULL);
+	wc.lpszClassName = g_offscreenWindowClass;
+	RegisterClassW(&wc);
+
+	m_hWnd = CreateWindowExW(0, g_offscreenWindowClass, L"", WS_POPUP, 0, 0, 1, 1, NULL, NULL, wc.hInstance, NULL);
+	if ( NULL == m_hWnd )
+	{
+		return E_FAIL;
+	}
+
+	m_hDC = GetDC( m_hWnd );
+	m_hRC = CreateCoreContext( m_hDC );
+	return m_hRC ? S_OK : E_FAIL;
+}
+
+void OffscreenContext::MakeCurrent()
+{
+	wglMakeCurrent( m_hDC, m_hRC );
+}
+
+void OffscreenContext::Release()
+{
+	wglMakeCurrent( NULL, NULL );
+}
+
+void OffscreenContext::Destroy()
+{
+	if ( m_hRC )
+	{
+		wglMakeCurrent( NULL, NULL );
+		wglDeleteContext( m_hRC );
+		m_hRC = NULL;
+	}
+	if ( m_hWnd )
+	{
+		ReleaseDC( m_hWnd, m_hDC );
+		DestroyWindow( m_hWnd );
+		m_hWnd = NULL;
+	}
+}
+
+#else
+
+OffscreenContext::OffscreenContext() :
+	m_display(EGL_NO_DISPLAY),
+	m_context(EGL_NO_CONTEXT)
+{
+}
+
+HRESULT OffscreenContext::Create()
+{
+	// the surfaceless platform needs no display server or GPU device; fall back to the default display
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if ( getPlatformDisplay )
+	{
+		m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if ( EGL_NO_DISPLAY == m_display )
+	{
+		m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major;
+	EGLint minor;
+	if ( EGL_NO_DISPLAY == m_display || !eglInitialize(m_display, &major, &minor) )
+	{
+		return E_FAIL;
+	}
+
+	// no surface is made from the config, but one with none asked for would be a window one
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint configs = 0;
+	if ( !eglChooseConfig(m_display, configAttributes, &config, 1, &configs) || configs == 0 || !eglBindAPI(EGL_OPENGL_API) )
+	{
+		return E_FAIL;
+	}
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttributes);
+	if ( EGL_NO_CONTEXT == m_context || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context) )
+	{
+		return E_FAIL;
+	}
+
+	// the entry points are exported by libOpenGL, so there is nothing to load
+	return S_OK;
+}
+
+void OffscreenContext::MakeCurrent()
+{
+	eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context);
+}
+
+void OffscreenContext::Release()
+{
+	eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void OffscreenContext::Destroy()
+{
+	if ( EGL_NO_DISPLAY != m_display )
+	{
+		eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if ( EGL_NO_CONTEXT != m_context )
+		{
+			eglDestroyContext(m_display, m_context);
+			m_context = EGL_NO_CONTEXT;
+		}
+		eglTerminate(m_display);
+		m_display = EGL_NO_DISPLAY;
+	}
+}
+
+#endif
+
+OffscreenContext::~OffscreenContext()
+{
+	Destroy();
+}
@@ -0,0 +1,71 @@
+/*
+
+OpenGL contexts
+
+The renderer draws with the 3.3 core profile. On Windows that takes two
+contexts: a legacy one to load wglCreateContextAttribsARB through, then the
+core context it creates. CreateCoreContext does both for a window's DC, and
+keeps the legacy context if the driver has nothing newer.
+
+OffscreenContext is a context with no window, for drawing into a framebuffer
+object on machines without a display (test and benchmark runs). It uses EGL
+on the surfaceless platform where there is EGL (Mesa on Linux, including its
+software rasterizer), and a hidden window on Windows.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef _WIN32
+/// <summary>
+/// Sets a pixel format on the DC and makes a core profile context current on it, loading GLEW
+/// </summary>
+/// <returns>the context, or NULL on failure</returns>
+HGLRC CreateCoreContext(HDC hDC);
+#endif
+
+class OffscreenContext
+{
+public:
+	OffscreenContext();
+	~OffscreenContext();
+
+	/// <summary>
+	/// Creates the context and makes it current on the calling thread, loading GLEW.
+	/// It has no default framebuffer to draw to
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Create();
+
+	/// <summary>
+	/// Makes the context current on the calling thread
+	/// </summary>
+	void MakeCurrent();
+
+	/// <summary>
+	/// Releases the context from the calling thread
+	/// </summary>
+	void Release();
+
+	/// <summary>
+	/// Destroys the context, current or not
+	/// </summary>
+	void Destroy();
+
+private:
+#ifdef _WIN32
+	HWND		m_hWnd;
+	HDC			m_hDC;
+	HGLRC		m_hRC;
+#else
+	EGLDisplay	m_display;
+	EGLContext	m_context;
+#endif
+};
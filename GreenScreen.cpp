@@ -6,9 +6,62 @@
 
 #include "stdafx.h"
 #include <strsafe.h>
+#include <fstream>
 #include "GreenScreen.h"
 #include "resource.h"
 #include "SimpleMIDIPlayer.h"
+#include "Trace.h"
+#include "AllocationAudit.h"
+#include "PipelineBenchmark.h"
+#include "SparseMappingBenchmark.h"
+#include "RegistrationBenchmark.h"
+#include "CoordinateMapBenchmark.h"
+#include "ResolutionBenchmark.h"
+#include "AllocationAuditSession.h"
+#include "OffscreenRender.h"
+#include "SharedFrameBenchmark.h"
+#include "ImageLoaderBenchmark.h"
+#include "MaskStabilizerBenchmark.h"
+
+// a frame that has waited this long for a pipeline stage is a frame and a half old, a newer one is already behind it
+static const double g_stageLatencyBoundMs = 50.0;
+
+// Depth is 30 fps and never slower than color, so a pair within half a depth frame is as close as the streams allow
+static const LONGLONG g_pairToleranceMs = (1000 / 30) / 2;
+
+// beyond this fraction of player pixels the built-in registration's player pixel kernel is slower than mapping the
+// whole frame with SIMD and reading the pixels from it; /benchsparse puts the crossing between 0.2 and 0.35
+static const float g_builtinSparseMappingCoverage = 0.3f;
+
+// the runtime's mapping calls are timed when processing starts, as their cost is the runtime's and the driver's;
+// until then, or if they can't be timed, one call per pixel is taken to stop paying off beyond this fraction
+static const float g_sparseMappingCoverage = 0.25f;
+
+// /recordregistration records this many frames of the runtime's mapping for /benchregistration, one in every
+// g_registrationCaptureInterval so the player has moved between them; 3 MB at 320x240
+static const LONG g_registrationCaptureFrames = 4;
+static const LONG g_registrationCaptureInterval = 30;
+static const char* g_registrationCapturePath = "registration_capture.bin";
+
+// stream resolutions /depth: and /color: can select
+typedef struct
+{
+    const wchar_t*          name;
+    NUI_IMAGE_RESOLUTION    resolution;
+} ResolutionOption;
+
+static const ResolutionOption g_depthResolutions[] =
+{
+    { L"80x60", NUI_IMAGE_RESOLUTION_80x60 },
+    { L"320x240", NUI_IMAGE_RESOLUTION_320x240 },
+    { L"640x480", NUI_IMAGE_RESOLUTION_640x480 },
+};
+
+static const ResolutionOption g_colorResolutions[] =
+{
+    { L"640x480", NUI_IMAGE_RESOLUTION_640x480 },
+    { L"1280x960", NUI_IMAGE_RESOLUTION_1280x960 },
+};
 
 // FROM SKELETONBASICS
 static const float g_JointThickness = 3.0f;
@@ -18,6 +71,34 @@ static const float g_InferredBoneThickness = 1.0f;
 // Global MIDI player
 SimpleMIDIPlayer* midiPlayer;
 
+/// <summary>
+/// Reads a resolution option such as /depth:80x60 from the command line
+/// </summary>
+/// <param name="lpCmdLine">command line arguments</param>
+/// <param name="option">option prefix, including the colon</param>
+/// <param name="options">resolutions the option accepts</param>
+/// <param name="count">number of entries in options</param>
+/// <param name="resolution">receives the resolution; left alone if the option is missing or not one of options</param>
+static void ParseResolution(LPCWSTR lpCmdLine, LPCWSTR option, const ResolutionOption* options, int count, NUI_IMAGE_RESOLUTION& resolution)
+{
+    LPCWSTR value = wcsstr(lpCmdLine, option);
+    if (NULL == value)
+    {
+        return;
+    }
+    value += wcslen(option);
+
+    for (int i = 0; i < count; ++i)
+    {
+        size_t length = wcslen(options[i].name);
+        if (0 == wcsncmp(value, options[i].name, length) && (value[length] == L'\0' || value[length] == L' '))
+        {
+            resolution = options[i].resolution;
+            return;
+        }
+    }
+}
+
 /// <summary>
 /// Entry point for the application
 /// </summary>
@@ -28,15 +109,150 @@ SimpleMIDIPlayer* midiPlayer;
 /// <returns>status</returns>
 int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
 {
-    CGreenScreen application;
+    // /benchpipeline measures the stage graph on synthetic frames and exits, no sensor needed
+    if (NULL != wcsstr(lpCmdLine, L"/benchpipeline"))
+    {
+        return SUCCEEDED(RunPipelineBenchmark("pipeline_bench.csv")) ? 0 : 1;
+    }
+
+    // /benchsparse compares whole-frame and player-only mapping on synthetic frames and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchsparse"))
+    {
+        return SUCCEEDED(RunSparseMappingBenchmark("sparse_bench.csv")) ? 0 : 1;
+    }
+
+    // /benchregistration checks the built-in registration against a recording of the runtime's and exits,
+    // non-zero if there was no recording to check it against
+    if (NULL != wcsstr(lpCmdLine, L"/benchregistration"))
+    {
+        return (S_OK == RunRegistrationBenchmark(g_registrationCapturePath, "registration_bench.csv")) ? 0 : 1;
+    }
+
+    // /benchcoordinates measures the colour coordinate map's memory traffic in both layouts and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchcoordinates"))
+    {
+        return SUCCEEDED(RunCoordinateMapBenchmark("coordinate_bench.csv")) ? 0 : 1;
+    }
+
+    // /benchresolutions times each resolution-specialized kernel against the generic one and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchresolutions"))
+    {
+        return SUCCEEDED(RunResolutionBenchmark("resolution_bench.csv")) ? 0 : 1;
+    }
+
+    // /auditalloc replays a session through the application's pipeline, with no sensor or window, counting
+    // allocations and copies, and exits non-zero if the steady state allocated
+    if (NULL != wcsstr(lpCmdLine, L"/auditalloc"))
+    {
+        return (S_OK == RunAllocationAudit(g_registrationCapturePath, "alloc_audit.csv")) ? 0 : 1;
+    }
+
+    // /headless renders synthetic frames offscreen, with no window or sensor, reports the frame rate and exits;
+    // /headless:frames also writes the frames read back
+    if (NULL != wcsstr(lpCmdLine, L"/headless"))
+    {
+        return SUCCEEDED(RunOffscreenRender("headless_render.csv", NULL != wcsstr(lpCmdLine, L"/headless:frames"))) ? 0 : 1;
+    }
+
+    // /benchshared measures publishing frames to shared memory, with and without a reader, and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchshared"))
+    {
+        return SUCCEEDED(RunSharedFrameBenchmark("shared_bench.csv")) ? 0 : 1;
+    }
+
+    // /readshared follows the frames a running /shared instance publishes for a few seconds and exits
+    if (NULL != wcsstr(lpCmdLine, L"/readshared"))
+    {
+        return SUCCEEDED(RunSharedFrameReader(g_sharedFrameName, "shared_reader.csv")) ? 0 : 1;
+    }
+
+    // /benchbackground times loading the background with the cache cold and warm, and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchbackground"))
+    {
+        return SUCCEEDED(RunImageLoaderBenchmark("background_bench.csv")) ? 0 : 1;
+    }
+
+    // /benchmask times the player mask stabilizer on a flickering synthetic player and exits
+    if (NULL != wcsstr(lpCmdLine, L"/benchmask"))
+    {
+        return SUCCEEDED(RunMaskStabilizerBenchmark("mask_bench.csv")) ? 0 : 1;
+    }
+
+    // /trace records the processing pipeline for chrome://tracing or Perfetto
+    if (NULL != wcsstr(lpCmdLine, L"/trace"))
+    {
+        Trace::Enable();
+    }
+
+    // /depth: and /color: pick the stream resolutions, 320x240 depth and 640x480 color by default;
+    // every pair has compositing and mapping kernels specialized for it
+    NUI_IMAGE_RESOLUTION depthResolution = NUI_IMAGE_RESOLUTION_320x240;
+    NUI_IMAGE_RESOLUTION colorResolution = NUI_IMAGE_RESOLUTION_640x480;
+    ParseResolution(lpCmdLine, L"/depth:", g_depthResolutions, sizeof(g_depthResolutions) / sizeof(g_depthResolutions[0]), depthResolution);
+    ParseResolution(lpCmdLine, L"/color:", g_colorResolutions, sizeof(g_colorResolutions) / sizeof(g_colorResolutions[0]), colorResolution);
+
+    // /largepages backs the frame buffers with large pages, which needs the lock pages in memory privilege
+    bool bLargePages = (NULL != wcsstr(lpCmdLine, L"/largepages"));
+
+    CGreenScreen application(depthResolution, colorResolution, bLargePages);
+
+    // /builtinregistration maps depth to colour without the runtime's mapping calls, from nominal
+    // intrinsics and extrinsics rather than this sensor's calibration, so it is off unless asked for
+    if (NULL != wcsstr(lpCmdLine, L"/builtinregistration"))
+    {
+        application.UseBuiltinRegistration();
+    }
+
+    // /recordregistration appends the runtime's mapping of a frame a second to the capture file
+    if (NULL != wcsstr(lpCmdLine, L"/recordregistration"))
+    {
+        application.RecordRegistration(g_registrationCaptureFrames, g_registrationCaptureInterval);
+    }
+
+    // /shared publishes the frames drawn to shared memory for other processes
+    if (NULL != wcsstr(lpCmdLine, L"/shared"))
+    {
+        application.PublishSharedFrames();
+    }
+
+    // /software draws on the CPU instead of with OpenGL, as happens anyway when OpenGL fails to start
+    if (NULL != wcsstr(lpCmdLine, L"/software"))
+    {
+        application.UseSoftwareRenderer();
+    }
+
+    // /video: adds a moving background, shown from the start; the Background button switches to the still one and back
+    LPCWSTR videoBackground = wcsstr(lpCmdLine, L"/video:");
+    if (NULL != videoBackground)
+    {
+        application.UseVideoBackground(videoBackground + wcslen(L"/video:"));
+    }
+
+    // /maskhold: sets the frames a new player index must be seen before it is composited, 2 by default;
+    // /maskhold:1 composites the runtime's mask as it is
+    LPCWSTR maskHold = wcsstr(lpCmdLine, L"/maskhold:");
+    if (NULL != maskHold)
+    {
+        int frames = _wtoi(maskHold + wcslen(L"/maskhold:"));
+        if (frames >= 1 && frames <= MaskStabilizer::cMaxHoldFrames)
+        {
+            application.HoldPlayerMask(frames);
+        }
+    }
 	midiPlayer = new SimpleMIDIPlayer();
     application.Run(hInstance, nCmdShow);
+
+	// stops the MIDI thread
+	delete midiPlayer;
+
+    Trace::Write("trace.json");
 }
 
 /// <summary>
 /// Constructor
 /// </summary>
-CGreenScreen::CGreenScreen() :
+CGreenScreen::CGreenScreen(NUI_IMAGE_RESOLUTION depthResolution, NUI_IMAGE_RESOLUTION colorResolution, bool bLargePages) :
+    m_hWnd(NULL),
     m_pDrawGreenScreen(NULL),
     m_hNextDepthFrameEvent(INVALID_HANDLE_VALUE),
     m_hNextColorFrameEvent(INVALID_HANDLE_VALUE),
@@ -46,34 +262,87 @@ CGreenScreen::CGreenScreen() :
 	m_hNextSkeletonEvent(INVALID_HANDLE_VALUE),
     m_pSkeletonStreamHandle(INVALID_HANDLE_VALUE),
     m_bSeatedMode(false),
-    m_pNuiSensor(NULL)
+    m_pNuiSensor(NULL),
+    m_depthResolution(depthResolution),
+    m_colorResolution(colorResolution),
+    m_hProcessingThread(NULL),
+    m_pipelineDrops(0),
+    m_bBuiltinRegistration(false),
+    m_registrationCaptureFrames(0),
+    m_registrationCaptureInterval(1),
+    m_sparseMappingCoverage(g_sparseMappingCoverage),
+    m_maskHoldFrames(MaskStabilizer::cDefaultHoldFrames),
+    m_bSharedOutput(false),
+    m_bSoftwareRenderer(false),
+    m_bReplay(false),
+    m_pReplayMapping(NULL),
+    m_selectedBackground(0),
+    m_skeletonSensorTicks(0)
 {
 	// BELOW ZEROMEMORY FROM SKELETONBASICS
 	ZeroMemory(m_Points,sizeof(m_Points));
 
+    // the renderer starts with every key up
+    ZeroMemory(m_publishedKeyStates, sizeof(m_publishedKeyStates));
+    m_videoBackgroundPath[0] = 0;
+
     // get resolution as DWORDS, but store as LONGs to avoid casts later
     DWORD width = 0;
     DWORD height = 0;
 
-    NuiImageResolutionToSize(cDepthResolution, width, height);
+    NuiImageResolutionToSize(m_depthResolution, width, height);
     m_depthWidth  = static_cast<LONG>(width);
     m_depthHeight = static_cast<LONG>(height);
 
-    NuiImageResolutionToSize(cColorResolution, width, height);
+    NuiImageResolutionToSize(m_colorResolution, width, height);
     m_colorWidth  = static_cast<LONG>(width);
     m_colorHeight = static_cast<LONG>(height);
 
     m_colorToDepthDivisor = m_colorWidth/m_depthWidth;
 
-    m_depthTimeStamp.QuadPart = 0;
-    m_colorTimeStamp.QuadPart = 0;
+    m_compositeLayout.depthWidth = m_depthWidth;
+    m_compositeLayout.depthHeight = m_depthHeight;
+    m_compositeLayout.colorWidth = m_colorWidth;
+    m_compositeLayout.colorHeight = m_colorHeight;
+    m_compositeLayout.colorToDepthDivisor = m_colorToDepthDivisor;
+    SelectCompositeKernels(m_compositeLayout, m_compositeKernels);
+
+    m_synchronizer.Initialize(&m_acquisition, g_pairToleranceMs);
 
-    // create heap storage for depth pixel data in RGBX format
-    m_depthD16 = new USHORT[m_depthWidth*m_depthHeight];
-    m_colorCoordinates = new LONG[m_depthWidth*m_depthHeight*2];
+    m_hStopProcessing = CreateEvent(NULL, TRUE, FALSE, NULL);
+    InitializeCriticalSection(&m_statusLock);
+    m_postedStatus[0] = L'\0';
 
-    m_colorRGBX = new BYTE[m_colorWidth*m_colorHeight*cBytesPerPixel];
-    m_outputRGBX = new BYTE[m_colorWidth*m_colorHeight*cBytesPerPixel];
+    if (bLargePages)
+    {
+        m_frameArena.UseLargePages();
+    }
+
+    // arena storage for the mapping of every frame the pipeline can hold, the pixels are read in place
+    for (int i = 0; i < cPipelineFrames; ++i)
+    {
+        PipelineFrame& frame = m_pipelineFrames[i];
+        frame.depthD16 = NULL;
+        frame.colorRGBX = NULL;
+        frame.runtimeCoordinates = m_frameArena.Allocate<LONG>(m_depthWidth*m_depthHeight*2);
+        frame.colorCoordinates = m_frameArena.Allocate<ColorCoordinate>(m_depthWidth*m_depthHeight);
+        frame.playerPixels = m_frameArena.Allocate<PlayerPixel>(m_depthWidth*m_depthHeight);
+        frame.playerPixelCount = 0;
+    }
+    m_freePipelineFrames.Reset(cPipelineFrames);
+
+    // while one frame is composited the next is mapped, the queues hold one frame each
+    m_pipeline.AddStage("MapColorCoordinates", MapStage, this, 1, g_stageLatencyBoundMs);
+    m_pipeline.AddStage("Composite", CompositeStage, this, 1, g_stageLatencyBoundMs);
+    m_pipeline.SetRetire(RetireFrame, this);
+
+    // one output image per mailbox slot: being composited, waiting, being drawn
+    for (int i = 0; i < 3; ++i)
+    {
+        RenderFrame& frame = m_renderMailbox.Slot(i);
+        frame.pImage = m_frameArena.Allocate<BYTE>(m_colorWidth*m_colorHeight*cBytesPerPixel);
+        ZeroMemory(frame.pImage, m_colorWidth*m_colorHeight*cBytesPerPixel);
+    }
 }
 
 /// <summary>
@@ -81,6 +350,11 @@ CGreenScreen::CGreenScreen() :
 /// </summary>
 CGreenScreen::~CGreenScreen()
 {
+    // the threads use the sensor, stop them first
+    StopProcessing();
+    CloseHandle(m_hStopProcessing);
+    DeleteCriticalSection(&m_statusLock);
+
     if (m_pNuiSensor)
     {
         m_pNuiSensor->NuiShutdown();
@@ -105,13 +379,6 @@ CGreenScreen::~CGreenScreen()
     delete m_pDrawGreenScreen;
     m_pDrawGreenScreen = NULL;
 
-    // done with pixel data
-    delete[] m_depthD16;
-    delete[] m_colorCoordinates;
-
-    delete[] m_colorRGBX;
-    delete[] m_outputRGBX;
-
     SafeRelease(m_pNuiSensor);
 }
 
@@ -152,42 +419,219 @@ int CGreenScreen::Run(HINSTANCE hInstance, int nCmdShow)
     // Show window
     ShowWindow(hWndApp, nCmdShow);
 
-    //const int eventCount = 2;
-	const int eventCount = 3;
-    HANDLE hEvents[eventCount];
+    Trace::SetThreadName("UI");
+
+    // Feet hitting the floor play notes, and the MIDI thread stamps when they're sent
+    midiPlayer->setLatencyMonitor(&m_latency);
+    m_piano.Initialize(midiPlayer, &m_latency);
+
+    // Sensor frames are acquired and processed on their own threads, this one only pumps messages
+    StartProcessing();
 
     // Main message loop
-    while (WM_QUIT != msg.message)
+    while (GetMessageW(&msg, NULL, 0, 0) > 0)
     {
-        hEvents[0] = m_hNextDepthFrameEvent;
-        hEvents[1] = m_hNextColorFrameEvent;
-		hEvents[2] = m_hNextSkeletonEvent;
+        // If a dialog message will be taken care of by the dialog proc
+        if ((hWndApp != NULL) && IsDialogMessageW(hWndApp, &msg))
+        {
+            continue;
+        }
+
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+
+    StopProcessing();
 
-        // Check to see if we have either a message (by passing in QS_ALLINPUT)
-        // Or a Kinect event (hEvents)
-        // Update() will check for Kinect events individually, in case more than one are signalled
-        DWORD dwEvent = MsgWaitForMultipleObjects(eventCount, hEvents, FALSE, INFINITE, QS_ALLINPUT);
+    return static_cast<int>(msg.wParam);
+}
 
-        // Check if this is an event we're waiting on and not a timeout or message
-        if (WAIT_OBJECT_0 == dwEvent || WAIT_OBJECT_0 + 1 == dwEvent || WAIT_OBJECT_0 + 2 == dwEvent)
+/// <summary>
+/// Starts processing with no sensor or window, fed by InjectFrames
+/// </summary>
+/// <param name="pPlayer">plays the notes the feet hit</param>
+/// <param name="pMapping">maps the injected depth to colour; must outlive processing</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT CGreenScreen::StartReplay(SimpleMIDIPlayer* pPlayer, const SyntheticFrameSource* pMapping)
+{
+    m_bReplay = true;
+
+    // the runtime's mapping needs the sensor, and the built-in registration's nominal calibration
+    // has not been checked against it, so the source maps its own frames
+    m_pReplayMapping = pMapping;
+    m_bBuiltinRegistration = false;
+    m_registrationCaptureFrames = 0;
+
+    // drawn the size of the colour stream, as there is no video view
+    m_pDrawGreenScreen = new ImageRenderer();
+    HRESULT hr = E_FAIL;
+    if (!m_bSoftwareRenderer)
+    {
+        hr = m_pDrawGreenScreen->InitializeOffscreen(m_colorWidth, m_colorHeight, m_colorWidth, m_colorHeight, m_colorWidth * sizeof(long), &m_frameArena);
+    }
+    if (FAILED(hr))
+    {
+        delete m_pDrawGreenScreen;
+        m_pDrawGreenScreen = new ImageRenderer();
+        hr = m_pDrawGreenScreen->InitializeSoftware(NULL, m_colorWidth, m_colorHeight, m_colorWidth * sizeof(long), &m_frameArena);
+        if (FAILED(hr))
         {
-            Update();
+            return hr;
         }
+    }
+    m_pDrawGreenScreen->SetFrameTimer(&m_frameTimer);
+    m_pDrawGreenScreen->SetKeyboard(FloorPiano::cKeyCount, SimpleMIDIPlayer::C);
 
-        if (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE))
-        {
-            // If a dialog message will be taken care of by the dialog proc
-            if ((hWndApp != NULL) && IsDialogMessageW(hWndApp, &msg))
-            {
-                continue;
-            }
+    pPlayer->setLatencyMonitor(&m_latency);
+    m_piano.Initialize(pPlayer, &m_latency);
+    m_piano.SetViewSize(m_colorWidth, m_colorHeight);
 
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
+    return StartProcessing();
+}
+
+/// <summary>
+/// Hands a depth/colour pair and a skeleton frame to acquisition, as the sensor would
+/// </summary>
+/// <param name="depthD16">depth frame at the depth resolution</param>
+/// <param name="colorRGBX">colour frame at the colour resolution</param>
+/// <param name="skeleton">skeleton frame</param>
+/// <param name="timeStampMs">sensor timestamp of all three</param>
+void CGreenScreen::InjectFrames(const USHORT* depthD16, const BYTE* colorRGBX, const NUI_SKELETON_FRAME& skeleton, LONGLONG timeStampMs)
+{
+    LARGE_INTEGER timeStamp;
+    timeStamp.QuadPart = timeStampMs;
+
+    NUI_SKELETON_FRAME skeletonFrame = skeleton;
+    skeletonFrame.liTimeStamp = timeStamp;
+
+    m_acquisition.InjectImage(SensorStreamDepth, reinterpret_cast<const BYTE*>(depthD16), m_depthWidth*m_depthHeight*sizeof(USHORT), timeStamp);
+    m_acquisition.InjectImage(SensorStreamColor, colorRGBX, m_colorWidth*m_colorHeight*cBytesPerPixel, timeStamp);
+    m_acquisition.InjectSkeleton(skeletonFrame);
+}
+
+/// <summary>
+/// Starts the acquisition threads and the processing thread
+/// </summary>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT CGreenScreen::StartProcessing()
+{
+    if (NULL == m_pNuiSensor && !m_bReplay)
+    {
+        return E_FAIL;
+    }
+
+    HRESULT hr = m_maskStabilizer.Initialize(m_frameArena, m_depthWidth*m_depthHeight, m_maskHoldFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_acquisition.Start(m_pNuiSensor,
+        m_pDepthStreamHandle, m_hNextDepthFrameEvent, m_depthWidth*m_depthHeight*sizeof(USHORT),
+        m_pColorStreamHandle, m_hNextColorFrameEvent, m_colorWidth*m_colorHeight*cBytesPerPixel,
+        m_hNextSkeletonEvent, &m_frameTimer, &m_maskStabilizer, &m_frameArena);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // The render thread takes over the OpenGL context
+    if (m_pDrawGreenScreen)
+    {
+        m_pDrawGreenScreen->DetachContext();
+        m_renderThread.Start(m_pDrawGreenScreen, &m_renderMailbox, &m_overlayMailbox);
+    }
+
+    // the tables are built once and kept for every frame
+    if (m_bBuiltinRegistration)
+    {
+        RegistrationCalibration calibration;
+        DepthRegistration::DefaultCalibration(m_compositeLayout, calibration);
+        hr = m_registration.Initialize(m_compositeLayout, calibration);
+        if (FAILED(hr))
+        {
+            m_renderThread.Stop();
+            m_acquisition.Stop();
+            return hr;
+        }
+    }
+    else if (NULL != m_pNuiSensor)
+    {
+        // where one runtime call per player pixel stops paying off against the whole-frame call
+        double frameMs = 0.0;
+        double pixelMs = 0.0;
+        if (SUCCEEDED(MeasureRuntimeMapping(m_pNuiSensor, m_colorResolution, m_depthResolution, m_compositeLayout, frameMs, pixelMs)))
+        {
+            m_sparseMappingCoverage = SparseMappingCrossover(frameMs, pixelMs, m_depthWidth*m_depthHeight);
         }
     }
 
-    return static_cast<int>(msg.wParam);
+    // Mapping and compositing run on a worker per core
+    hr = m_workPool.Start(0);
+    if (FAILED(hr))
+    {
+        m_renderThread.Stop();
+        m_acquisition.Stop();
+        return hr;
+    }
+    m_pipeline.Start(&m_workPool);
+
+    ResetEvent(m_hStopProcessing);
+    m_hProcessingThread = CreateThread(NULL, 0, ProcessingThread, this, 0, NULL);
+    if (NULL == m_hProcessingThread)
+    {
+        m_workPool.Stop();
+        m_renderThread.Stop();
+        m_acquisition.Stop();
+        return E_FAIL;
+    }
+
+    // every frame buffer exists by now, anything the arena hands out from here on is a per-frame
+    // allocation, counted for the status bar; the heap is only watched by the allocation audit
+    m_frameArena.Seal();
+
+    return S_OK;
+}
+
+/// <summary>
+/// Stops processing, the pipeline, rendering and acquisition, in that order
+/// </summary>
+void CGreenScreen::StopProcessing()
+{
+    if (m_hProcessingThread)
+    {
+        SetEvent(m_hStopProcessing);
+        WaitForSingleObject(m_hProcessingThread, INFINITE);
+        CloseHandle(m_hProcessingThread);
+        m_hProcessingThread = NULL;
+    }
+
+    // nothing is submitted any more, let the frames in flight reach the render thread
+    m_pipeline.WaitIdle();
+    m_workPool.Stop();
+
+    m_renderThread.Stop();
+    m_acquisition.Stop();
+}
+
+/// <summary>
+/// Processing thread entry point, runs Update whenever a stream has queued a frame
+/// </summary>
+/// <param name="lpParameter">the CGreenScreen instance</param>
+DWORD WINAPI CGreenScreen::ProcessingThread(LPVOID lpParameter)
+{
+    CGreenScreen* pThis = static_cast<CGreenScreen*>(lpParameter);
+    Trace::SetThreadName("Processing");
+
+    HANDLE hEvents[2] = { pThis->m_hStopProcessing, pThis->m_acquisition.FrameReadyEvent() };
+    while (WAIT_OBJECT_0 + 1 == WaitForMultipleObjects(2, hEvents, FALSE, INFINITE))
+    {
+        pThis->Update();
+    }
+
+    pThis->m_synchronizer.ReleaseAll();
+
+    return 0;
 }
 
 /// <summary>
@@ -195,112 +639,303 @@ int CGreenScreen::Run(HINSTANCE hInstance, int nCmdShow)
 /// </summary>
 void CGreenScreen::Update()
 {
-    if (NULL == m_pNuiSensor)
+    TRACE_SCOPE("Update");
+
+    if (NULL == m_pNuiSensor && !m_bReplay)
     {
         return;
     }
 
-    bool needToDraw = false;
 	handleSkeletons = false;
 
-    if ( WAIT_OBJECT_0 == WaitForSingleObject(m_hNextDepthFrameEvent, 0) )
+    AcquiredImageFrame image;
+
+    // depth and color frames wait in the synchronizer until they can be paired up
     {
-        // if we have received any valid new depth data we may need to draw
-        if ( SUCCEEDED(ProcessDepth()) )
+        AUDIT_SCOPE(AuditStageSync);
+        while (m_acquisition.PopDepth(image))
         {
-            needToDraw = true;
+            m_synchronizer.Add(SensorStreamDepth, image);
         }
-    }
 
-    if ( WAIT_OBJECT_0 == WaitForSingleObject(m_hNextColorFrameEvent, 0) )
-    {
-        // if we have received any valid new color data we may need to draw
-        if ( SUCCEEDED(ProcessColor()) )
+        while (m_acquisition.PopColor(image))
         {
-            needToDraw = true;
+            m_synchronizer.Add(SensorStreamColor, image);
         }
     }
 
-    if ( WAIT_OBJECT_0 == WaitForSingleObject(m_hNextSkeletonEvent, 0) )
+    // every skeleton frame is processed, a foot can touch the floor for only a frame or two
+    AcquiredSkeletonFrame skeleton;
+    bool haveSkeleton = false;
+    while ( m_acquisition.PopSkeleton(skeleton) )
     {
-        ProcessSkeleton();
+        AUDIT_SCOPE(AuditStageDetection);
+        if ( SUCCEEDED(ProcessSkeleton(skeleton)) )
+        {
+            m_latency.Stamp(LatencyStageSkeleton, m_skeletonSensorTicks);
+
+            // play the keys under any foot that just touched the floor
+            TRACE_SCOPE("DetectHits");
+            m_piano.Update(tempSkeletonFrame, m_feetPoints, m_skeletonSensorTicks);
+        }
 		handleSkeletons = true;
-		needToDraw = true;
+        haveSkeleton = true;
     }
 
-    // Depth is 30 fps.  For any given combination of FPS, we should ensure we are within half a frame of the more frequent of the two.  
-    // But depth is always the greater (or equal) of the two, so just use depth FPS.
-    const int depthFps = 30;
-    const int halfADepthFrameMs = (1000 / depthFps) / 2;
+    // the overlay is redrawn on its own, over the players already on screen, and only if it changed
+    BYTE keyStates[FloorPiano::cKeyCount];
+    m_piano.GetKeyStates(keyStates);
+    if (haveSkeleton && (0 != memcmp(m_publishedFeetPoints, m_feetPoints, sizeof(m_feetPoints)) ||
+        0 != memcmp(m_publishedKeyStates, keyStates, sizeof(keyStates))))
+    {
+        AUDIT_SCOPE(AuditStageRenderPrep);
+        OverlayFrame& overlay = m_overlayMailbox.Back();
+        for (int i = 0; i < 4; ++i)
+        {
+            overlay.feetPoints[i] = m_feetPoints[i];
+            m_publishedFeetPoints[i] = m_feetPoints[i];
+        }
+        memcpy(overlay.keyStates, keyStates, sizeof(keyStates));
+        memcpy(m_publishedKeyStates, keyStates, sizeof(keyStates));
+        AllocationAudit::RecordCopy(sizeof(overlay.feetPoints) + sizeof(keyStates));
+        m_overlayMailbox.Publish();
+        m_renderThread.Notify();
+    }
 
-    // If we have not yet received any data for either color or depth since we started up, we shouldn't draw
-    if (m_colorTimeStamp.QuadPart == 0 || m_depthTimeStamp.QuadPart == 0)
+    if (m_latency.Report())
     {
-        needToDraw = false;
+        SensorStreamStats depthStats, colorStats, skeletonStats;
+        m_acquisition.GetStats(SensorStreamDepth, depthStats);
+        m_acquisition.GetStats(SensorStreamColor, colorStats);
+        m_acquisition.GetStats(SensorStreamSkeleton, skeletonStats);
+
+        FrameSyncStats syncStats;
+        m_synchronizer.GetStats(syncStats);
+
+        FrameArenaStats arenaStats;
+        m_frameArena.GetStats(arenaStats);
+
+        LONG late = 0;
+        for (int i = 0; i < m_pipeline.StageCount(); ++i)
+        {
+            StageStats stats;
+            m_pipeline.GetStageStats(i, stats);
+            late += stats.late;
+        }
+
+        // latency summary, queued/dropped frames per stream, pair skew p99, pair wait p50 and unmatched frames,
+        // pipeline frames dropped as full or late, composites replaced before they were drawn,
+        // then presents with a new composite and overlay-only ones and the draw calls in the last, arena
+        // allocations since processing started, frames recorded and dropped by the recorder, player mask changes
+        // and note-offs that found the MIDI queue full and went out an update late
+        VideoRecorderStats recorderStats;
+        m_recorder.GetStats(recorderStats);
+
+        // the share of the last depth frame whose raw player index changed, and whose composited one did
+        MaskStabilizerStats maskStats;
+        m_maskStabilizer.GetStats(maskStats);
+        double maskPercent = (maskStats.pixels > 0) ? 100.0 / maskStats.pixels : 0.0;
+
+        WCHAR status[cStatusMessageMaxLen];
+        StringCchPrintfW(status, cStatusMessageMaxLen, L"%s  |  queued/dropped depth %d/%d color %d/%d skel %d/%d  |  skew %.0fms wait %.0fms unmatched %d/%d  |  pipeline full %d late %d  |  stale %d  |  full/overlay %d/%d draws %d  |  arena allocs %d  |  rec %d/%d  |  mask raw/held %.1f%%/%.1f%%  |  note-off late %d",
+            m_latency.GetSummary(),
+            depthStats.queued, depthStats.drops,
+            colorStats.queued, colorStats.drops,
+            skeletonStats.queued, skeletonStats.drops,
+            syncStats.skew.p99, syncStats.wait.p50, syncStats.unmatchedDepth, syncStats.unmatchedColor,
+            m_pipelineDrops + m_pipeline.Rejected(), late,
+            m_renderMailbox.Dropped(),
+            m_renderThread.FullFrames(), m_renderThread.OverlayFrames(),
+            m_pDrawGreenScreen ? m_pDrawGreenScreen->DrawCalls() : 0,
+            arenaStats.steadyStateAllocations,
+            recorderStats.recorded, recorderStats.dropped,
+            maskStats.rawChanged * maskPercent, maskStats.maskChanged * maskPercent,
+            m_piano.DeferredReleases());
+        PostStatusMessage(status);
     }
 
-    // If the color frame is more than half a depth frame ahead of the depth frame we have,
-    // then we should wait for another depth frame.  Otherwise, just go with what we have.
-    if (m_colorTimeStamp.QuadPart - m_depthTimeStamp.QuadPart > halfADepthFrameMs)
+    AUDIT_SCOPE(AuditStageSync);
+    AcquiredImageFrame depth;
+    AcquiredImageFrame color;
+    if (m_synchronizer.Match(depth, color))
     {
-        needToDraw = false;
+        SubmitFrames(depth, color);
     }
+}
 
-    if (needToDraw)
+/// <summary>
+/// Ingests a matched depth/colour pair into a free pipeline frame and submits it
+/// </summary>
+/// <param name="depth">depth frame, released here or when the pipeline frame retires</param>
+/// <param name="color">color frame, released here or when the pipeline frame retires</param>
+void CGreenScreen::SubmitFrames(AcquiredImageFrame& depth, AcquiredImageFrame& color)
+{
+    int slot = m_freePipelineFrames.Acquire();
+    if (slot < 0)
     {
-        int outputIndex = 0;
-        LONG* pDest;
-        LONG* pSrc;
-		bool transparent;
+        // every frame is in the pipeline, this pair would only add latency
+        InterlockedIncrement(&m_pipelineDrops);
+        m_acquisition.ReleaseImageFrame(SensorStreamDepth, depth);
+        m_acquisition.ReleaseImageFrame(SensorStreamColor, color);
+        return;
+    }
 
-        // loop over each row and column of the color
-        for (LONG y = 0; y < m_colorHeight; ++y)
-        {
-            for (LONG x = 0; x < m_colorWidth; ++x)
-            {
-                // calculate index into depth array
-                int depthIndex = x/m_colorToDepthDivisor + y/m_colorToDepthDivisor * m_depthWidth;
+    // the acquisition threads already copied the pixels out of the runtime, the stages read them where they are
+    PipelineFrame& frame = m_pipelineFrames[slot];
+    frame.depth = depth;
+    frame.color = color;
+    frame.depthD16 = reinterpret_cast<USHORT*>(m_acquisition.ImageData(SensorStreamDepth, depth));
+    frame.colorRGBX = m_acquisition.ImageData(SensorStreamColor, color);
 
-                USHORT depth  = m_depthD16[depthIndex];
-                USHORT player = NuiDepthPixelToPlayerIndex(depth);
+    if (!m_pipeline.Submit(&frame))
+    {
+        RetireFrame(this, &frame, false);
+    }
+}
 
-                // Changed this to use a 'transparency' flag
-                pSrc  = NULL;
-				transparent = true;
+/// <summary>
+/// Pipeline stage: lists the player pixels and maps them to colour
+/// </summary>
+/// <param name="context">the CGreenScreen instance</param>
+/// <param name="item">the PipelineFrame</param>
+void CGreenScreen::MapStage(void* context, void* item)
+{
+    CGreenScreen* pThis = static_cast<CGreenScreen*>(context);
+    PipelineFrame* pFrame = static_cast<PipelineFrame*>(item);
+    AUDIT_SCOPE(AuditStageMap);
 
-                // if we're tracking a player for the current pixel, draw from the color camera
-                if ( player > 0 )
-                {
-                    // retrieve the depth to color mapping for the current depth pixel
-                    LONG colorInDepthX = m_colorCoordinates[depthIndex * 2];
-                    LONG colorInDepthY = m_colorCoordinates[depthIndex * 2 + 1];
+    LONGLONG mappingStart = HighResClock::Now();
 
-                    // make sure the depth pixel maps to a valid point in color space
-                    if ( colorInDepthX >= 0 && colorInDepthX < m_colorWidth && colorInDepthY >= 0 && colorInDepthY < m_colorHeight )
-                    {
-                        // calculate index into color array
-                        LONG colorIndex = colorInDepthX + colorInDepthY * m_colorWidth;
+    // only player pixels are composited, so only they need mapping
+    LONG depthPixels = pThis->m_depthWidth*pThis->m_depthHeight;
+    LONG count = pThis->m_compositeKernels.collectPlayerPixels(pThis->m_compositeLayout, pFrame->depthD16, pFrame->playerPixels);
+    pFrame->playerPixelCount = count;
 
-                        // set source for copy to the color pixel
-                        pSrc  = (LONG *)m_colorRGBX + colorIndex;
-						transparent = false;
-                    }
-                }
+    // stages run one frame at a time, so the countdown needs no lock
+    if (pThis->m_registrationCaptureFrames > 0 && 0 == --pThis->m_registrationCaptureFrames % pThis->m_registrationCaptureInterval)
+    {
+        pThis->m_pNuiSensor->NuiImageGetColorPixelCoordinateFrameFromDepthPixelFrameAtResolution(
+            pThis->m_colorResolution,
+            pThis->m_depthResolution,
+            depthPixels,
+            pFrame->depthD16,
+            depthPixels*2,
+            pFrame->runtimeCoordinates
+            );
+        AppendRegistrationCapture(g_registrationCapturePath, pThis->m_compositeLayout, pFrame->depthD16, pFrame->runtimeCoordinates);
+    }
 
-                // calculate output pixel location
-				pDest = (LONG *)m_outputRGBX + outputIndex++;
+    float sparseCoverage = pThis->m_bBuiltinRegistration ? g_builtinSparseMappingCoverage : pThis->m_sparseMappingCoverage;
+    bool bSparse = (count <= depthPixels * sparseCoverage);
 
-                // write output. If the pixel is transparent, set it to the TRANSPARENCY macro
-				if ( !transparent )
-					*pDest = *pSrc;
-				else
-					*pDest = TRANSPARENCY;
-            }
+    if (NULL != pThis->m_pReplayMapping)
+    {
+        pThis->m_pReplayMapping->MapPlayerPixels(pFrame->depthD16, pFrame->playerPixels, count);
+    }
+    else if (bSparse && pThis->m_bBuiltinRegistration)
+    {
+        pThis->m_registration.MapPlayerPixels(pFrame->depthD16, pFrame->playerPixels, count);
+    }
+    else if (bSparse)
+    {
+        for (LONG i = 0; i < count; ++i)
+        {
+            PlayerPixel& pixel = pFrame->playerPixels[i];
+            LONG colorX = 0;
+            LONG colorY = 0;
+            pThis->m_pNuiSensor->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+                pThis->m_colorResolution,
+                pThis->m_depthResolution,
+                NULL,
+                pixel.depthX,
+                pixel.depthY,
+                pFrame->depthD16[pixel.depthX + pixel.depthY * pThis->m_depthWidth],
+                &colorX,
+                &colorY
+                );
+            pixel.color.x = PackCoordinate(colorX);
+            pixel.color.y = PackCoordinate(colorY);
         }
+    }
+    else if (pThis->m_bBuiltinRegistration)
+    {
+        pThis->m_registration.MapFrame(pFrame->depthD16, pFrame->colorCoordinates, 0, pThis->m_depthHeight);
 
-        // Draw the data with Direct2D
-        m_pDrawGreenScreen->Draw(m_outputRGBX, m_feetPoints );
+        for (LONG i = 0; i < count; ++i)
+        {
+            PlayerPixel& pixel = pFrame->playerPixels[i];
+            pixel.color = pFrame->colorCoordinates[pixel.depthX + pixel.depthY * pThis->m_depthWidth];
+        }
     }
+    else
+    {
+        // Get of x, y coordinates for color in depth space
+        // This will allow us to later compensate for the differences in location, angle, etc between the depth and color cameras
+        pThis->m_pNuiSensor->NuiImageGetColorPixelCoordinateFrameFromDepthPixelFrameAtResolution(
+            pThis->m_colorResolution,
+            pThis->m_depthResolution,
+            depthPixels,
+            pFrame->depthD16,
+            depthPixels*2,
+            pFrame->runtimeCoordinates
+            );
+
+        for (LONG i = 0; i < count; ++i)
+        {
+            PlayerPixel& pixel = pFrame->playerPixels[i];
+            LONG depthIndex = pixel.depthX + pixel.depthY * pThis->m_depthWidth;
+            pixel.color.x = PackCoordinate(pFrame->runtimeCoordinates[depthIndex * 2]);
+            pixel.color.y = PackCoordinate(pFrame->runtimeCoordinates[depthIndex * 2 + 1]);
+        }
+    }
+
+    pThis->m_frameTimer.End(FrameStageMapping, mappingStart);
+}
+
+/// <summary>
+/// Pipeline stage: composites the players and publishes the result to the render thread
+/// </summary>
+/// <param name="context">the CGreenScreen instance</param>
+/// <param name="item">the PipelineFrame</param>
+void CGreenScreen::CompositeStage(void* context, void* item)
+{
+    CGreenScreen* pThis = static_cast<CGreenScreen*>(context);
+    PipelineFrame* pFrame = static_cast<PipelineFrame*>(item);
+    AUDIT_SCOPE(AuditStageComposite);
+
+    LONGLONG compositeStart = HighResClock::Now();
+
+    // composite straight into the mailbox slot the render thread isn't using
+    RenderFrame& output = pThis->m_renderMailbox.Back();
+
+    pThis->m_compositeKernels.compositePlayerPixels(pThis->m_compositeLayout,
+        pFrame->playerPixels, pFrame->playerPixelCount, pFrame->colorRGBX,
+        output.pImage);
+    AllocationAudit::RecordCopy(pFrame->playerPixelCount * pThis->m_colorToDepthDivisor * pThis->m_colorToDepthDivisor * cBytesPerPixel);
+
+    pThis->m_frameTimer.End(FrameStageComposite, compositeStart);
+
+    // Hand the frame to the render thread, replacing any frame it hasn't drawn yet
+    AUDIT_SCOPE(AuditStageRenderPrep);
+    pThis->m_renderMailbox.Publish();
+    pThis->m_renderThread.Notify();
+}
+
+/// <summary>
+/// Returns a pipeline frame to the free pool once it leaves the pipeline
+/// </summary>
+/// <param name="context">the CGreenScreen instance</param>
+/// <param name="item">the PipelineFrame</param>
+/// <param name="completed">false if the frame was dropped as stale</param>
+void CGreenScreen::RetireFrame(void* context, void* item, bool completed)
+{
+    CGreenScreen* pThis = static_cast<CGreenScreen*>(context);
+    PipelineFrame* pFrame = static_cast<PipelineFrame*>(item);
+    AUDIT_SCOPE(AuditStageSync);
+
+    pThis->m_acquisition.ReleaseImageFrame(SensorStreamDepth, pFrame->depth);
+    pThis->m_acquisition.ReleaseImageFrame(SensorStreamColor, pFrame->color);
+    pThis->m_freePipelineFrames.Release(static_cast<int>(pFrame - pThis->m_pipelineFrames));
 }
 
 /// <summary>
@@ -354,10 +989,72 @@ LRESULT CALLBACK CGreenScreen::DlgProc(HWND hWnd, UINT message, WPARAM wParam, L
             // We'll use this to draw the data we receive from the Kinect to the screen
             m_pDrawGreenScreen = new ImageRenderer();
 
-            HRESULT hr = m_pDrawGreenScreen->Initialize(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), m_colorWidth, m_colorHeight, m_colorWidth * sizeof(long) );
+            HRESULT hr = E_FAIL;
+            if (!m_bSoftwareRenderer)
+            {
+                hr = m_pDrawGreenScreen->Initialize(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), m_colorWidth, m_colorHeight, m_colorWidth * sizeof(long), &m_frameArena );
+            }
+
+            // without a usable OpenGL driver, draw on the CPU; the half-built renderer deletes what it
+            // made and its context, which is left current on no thread
             if (FAILED(hr))
             {
-                SetStatusMessage(L"Failed to initialize the OpenGL draw device.");
+                delete m_pDrawGreenScreen;
+                m_pDrawGreenScreen = new ImageRenderer();
+                hr = m_pDrawGreenScreen->InitializeSoftware(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), m_colorWidth, m_colorHeight, m_colorWidth * sizeof(long), &m_frameArena );
+                if (FAILED(hr))
+                {
+                    SetStatusMessage(L"Failed to initialize the draw device.");
+                }
+            }
+            m_pDrawGreenScreen->SetFrameTimer(&m_frameTimer);
+            m_pDrawGreenScreen->SetKeyboard(FloorPiano::cKeyCount, SimpleMIDIPlayer::C);
+
+            // the moving background is preloaded here, while the context is still on this thread
+            if (m_videoBackgroundPath[0])
+            {
+                BackgroundSource* pSource = NULL;
+                int index = 0;
+                if (SUCCEEDED(CreateBackgroundSource(m_videoBackgroundPath, &pSource)) &&
+                    SUCCEEDED(m_pDrawGreenScreen->AddBackground(pSource, index)))
+                {
+                    m_pDrawGreenScreen->SelectBackground(index);
+                    m_selectedBackground = index;
+                }
+                else
+                {
+                    SetStatusMessage(L"Failed to open the video background.");
+                }
+            }
+            EnableWindow(GetDlgItem(m_hWnd, IDC_BUTTON_BACKGROUND), m_pDrawGreenScreen->BackgroundCount() > 1);
+
+            // The piano keys span the video view, same space as the feet points
+            RECT rct;
+            GetClientRect(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), &rct);
+            m_piano.SetViewSize(rct.right, rct.bottom);
+
+            // frames are drawn the size of the video view, or of the colour stream by the software renderer
+            LONG frameWidth = m_pDrawGreenScreen->IsSoftware() ? m_colorWidth : rct.right;
+            LONG frameHeight = m_pDrawGreenScreen->IsSoftware() ? m_colorHeight : rct.bottom;
+
+            // recordings are of the frames drawn, so its buffers are sized for them
+            if (FAILED(m_recorder.Initialize(&m_frameArena, frameWidth, frameHeight)))
+            {
+                EnableWindow(GetDlgItem(m_hWnd, IDC_CHECK_RECORD), FALSE);
+            }
+
+            // shared frames are too, and carry the player mask for compositing elsewhere
+            if (m_bSharedOutput)
+            {
+                if (SUCCEEDED(m_sharedOutput.Create(g_sharedFrameName, frameWidth, frameHeight, true)))
+                {
+                    m_pDrawGreenScreen->SetMaskInAlpha(true);
+                    m_pDrawGreenScreen->AddFrameSink(SharedFrameOutput::OnFrame, &m_sharedOutput);
+                }
+                else
+                {
+                    SetStatusMessage(L"Failed to create the shared frame output.");
+                }
             }
 
             // Look for a connected Kinect, and create it if found
@@ -365,8 +1062,17 @@ LRESULT CALLBACK CGreenScreen::DlgProc(HWND hWnd, UINT message, WPARAM wParam, L
         }
         break;
 
+        // Status text posted by the processing thread
+        case WM_APP_STATUSMESSAGE:
+            EnterCriticalSection(&m_statusLock);
+            SetStatusMessage(m_postedStatus);
+            LeaveCriticalSection(&m_statusLock);
+            break;
+
         // If the titlebar X is clicked, destroy app
         case WM_CLOSE:
+            // the render thread draws into the window, stop it before the window goes away
+            StopProcessing();
             DestroyWindow(hWnd);
             break;
 
@@ -389,12 +1095,118 @@ LRESULT CALLBACK CGreenScreen::DlgProc(HWND hWnd, UINT message, WPARAM wParam, L
                     m_pNuiSensor->NuiImageStreamSetImageFrameFlags(m_pDepthStreamHandle, m_bNearMode ? NUI_IMAGE_STREAM_FLAG_ENABLE_NEAR_MODE : 0);
                 }
             }
+
+            // Show or hide the frame timing overlay
+            if (IDC_CHECK_TIMINGHUD == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                m_pDrawGreenScreen->SetTimingHudVisible(BST_CHECKED == IsDlgButtonChecked(m_hWnd, IDC_CHECK_TIMINGHUD));
+            }
+
+            // Record what is drawn, from the renderer's readback, until unchecked
+            if (IDC_CHECK_RECORD == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                if (BST_CHECKED == IsDlgButtonChecked(m_hWnd, IDC_CHECK_RECORD))
+                {
+                    if (SUCCEEDED(m_recorder.Start("greenscreen.y4m", RecordFormatY4M)) &&
+                        m_pDrawGreenScreen->AddFrameSink(VideoRecorder::OnFrame, &m_recorder))
+                    {
+                        SetStatusMessage(L"Recording to greenscreen.y4m");
+                    }
+                    else
+                    {
+                        m_recorder.Stop();
+                        CheckDlgButton(m_hWnd, IDC_CHECK_RECORD, BST_UNCHECKED);
+                        SetStatusMessage(L"Failed to start recording to greenscreen.y4m.");
+                    }
+                }
+                else
+                {
+                    // frames already being read back still go to the recorder, which ignores them once stopped
+                    m_pDrawGreenScreen->RemoveFrameSink(VideoRecorder::OnFrame, &m_recorder);
+                    m_recorder.Stop();
+
+                    VideoRecorderStats stats;
+                    m_recorder.GetStats(stats);
+                    WCHAR status[cStatusMessageMaxLen];
+                    StringCchPrintfW(status, cStatusMessageMaxLen, L"Recorded %d frames to greenscreen.y4m, dropped %d", stats.recorded, stats.dropped);
+                    SetStatusMessage(status);
+                }
+            }
+
+            // On to the next background of the set; each is preloaded, so it shows with the next frame
+            if (IDC_BUTTON_BACKGROUND == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                m_selectedBackground = (m_selectedBackground + 1) % m_pDrawGreenScreen->BackgroundCount();
+                m_pDrawGreenScreen->SelectBackground(m_selectedBackground);
+            }
+
+            // Grab the next frame drawn; it is written out on the readback thread
+            if (IDC_BUTTON_SNAPSHOT == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                m_pDrawGreenScreen->RequestSnapshot(SnapshotReady, this);
+            }
+
+            // Dump the timing rings for offline analysis
+            if (IDC_BUTTON_SAVETIMINGS == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                if (SUCCEEDED(m_frameTimer.WriteCsv("frame_timings.csv")))
+                {
+                    SetStatusMessage(L"Frame timings saved to frame_timings.csv");
+                }
+                else
+                {
+                    SetStatusMessage(L"Failed to save frame timings.");
+                }
+            }
             break;
     }
 
     return FALSE;
 }
 
+/// <summary>
+/// Keeps the path of the moving background for WM_INITDIALOG to add once the renderer is up
+/// </summary>
+/// <param name="path">path, ending at a space or the end of the command line</param>
+void CGreenScreen::UseVideoBackground(LPCWSTR path)
+{
+    int length = (int)wcscspn(path, L" ");
+    int bytes = WideCharToMultiByte(CP_ACP, 0, path, length, m_videoBackgroundPath, MAX_PATH - 1, NULL, NULL);
+    m_videoBackgroundPath[bytes] = 0;
+}
+
+void CGreenScreen::SnapshotReady(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks)
+{
+    CGreenScreen* pThis = static_cast<CGreenScreen*>(context);
+
+    // a top-down 32 bit bitmap takes the rows as they come
+    BITMAPINFOHEADER info = {0};
+    info.biSize = sizeof(info);
+    info.biWidth = width;
+    info.biHeight = -height;
+    info.biPlanes = 1;
+    info.biBitCount = 32;
+    info.biCompression = BI_RGB;
+    info.biSizeImage = width * height * 4;
+
+    BITMAPFILEHEADER header = {0};
+    header.bfType = 0x4D42;    // "BM"
+    header.bfOffBits = sizeof(header) + sizeof(info);
+    header.bfSize = header.bfOffBits + info.biSizeImage;
+
+    std::ofstream file("snapshot.bmp", std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&info, sizeof(info));
+    for (int y = 0; y < height; ++y)
+    {
+        file.write((const char*)(pixels + y * stride), width * 4);
+    }
+
+    WCHAR status[cStatusMessageMaxLen];
+    StringCchPrintfW(status, cStatusMessageMaxLen, file ? L"Frame %d saved to snapshot.bmp" : L"Failed to save frame %d.", frame);
+    pThis->PostStatusMessage(status);
+}
+
 /// <summary>
 /// Create the first connected Kinect found 
 /// </summary>
@@ -444,11 +1256,12 @@ HRESULT CGreenScreen::CreateFirstConnected()
             m_hNextDepthFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
             // Open a depth image stream to receive depth frames
+            // The runtime buffers enough frames for the acquisition queue plus the ones in flight
             hr = m_pNuiSensor->NuiImageStreamOpen(
                 NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX,
-                cDepthResolution,
+                m_depthResolution,
                 0,
-                2,
+                FrameAcquisition::cImageStreamFrameLimit,
                 m_hNextDepthFrameEvent,
                 &m_pDepthStreamHandle);
 
@@ -458,9 +1271,9 @@ HRESULT CGreenScreen::CreateFirstConnected()
             // Open a color image stream to receive depth frames
             hr = m_pNuiSensor->NuiImageStreamOpen(
                 NUI_IMAGE_TYPE_COLOR,
-                cColorResolution,
+                m_colorResolution,
                 0,
-                2,
+                FrameAcquisition::cImageStreamFrameLimit,
                 m_hNextColorFrameEvent,
                 &m_pColorStreamHandle);
 
@@ -484,102 +1297,29 @@ HRESULT CGreenScreen::CreateFirstConnected()
 }
 
 /// <summary>
-/// Handle new depth data
+/// Set the status bar message
 /// </summary>
-/// <returns>S_OK on success, otherwise failure code</returns>
-HRESULT CGreenScreen::ProcessDepth()
+/// <param name="szMessage">message to display</param>
+void CGreenScreen::SetStatusMessage(WCHAR * szMessage)
 {
-    HRESULT hr = S_OK;
-    NUI_IMAGE_FRAME imageFrame;
-
-    // Attempt to get the depth frame
-    hr = m_pNuiSensor->NuiImageStreamGetNextFrame(m_pDepthStreamHandle, 0, &imageFrame);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    m_depthTimeStamp = imageFrame.liTimeStamp;
-
-    INuiFrameTexture * pTexture = imageFrame.pFrameTexture;
-    NUI_LOCKED_RECT LockedRect;
-
-    // Lock the frame data so the Kinect knows not to modify it while we're reading it
-    pTexture->LockRect(0, &LockedRect, NULL, 0);
-
-    // Make sure we've received valid data
-    if (LockedRect.Pitch != 0)
-    {
-        memcpy(m_depthD16, LockedRect.pBits, LockedRect.size);
-    }
-
-    // We're done with the texture so unlock it
-    pTexture->UnlockRect(0);
-
-    // Release the frame
-    m_pNuiSensor->NuiImageStreamReleaseFrame(m_pDepthStreamHandle, &imageFrame);
-
-    // Get of x, y coordinates for color in depth space
-    // This will allow us to later compensate for the differences in location, angle, etc between the depth and color cameras
-    m_pNuiSensor->NuiImageGetColorPixelCoordinateFrameFromDepthPixelFrameAtResolution(
-        cColorResolution,
-        cDepthResolution,
-        m_depthWidth*m_depthHeight,
-        m_depthD16,
-        m_depthWidth*m_depthHeight*2,
-        m_colorCoordinates
-        );
-
-    return hr;
+    SendDlgItemMessageW(m_hWnd, IDC_STATUS, WM_SETTEXT, 0, (LPARAM)szMessage);
 }
 
 /// <summary>
-/// Handle new color data
+/// Set the status bar message from a thread other than the UI thread
 /// </summary>
-/// <returns>S_OK for success or error code</returns>
-HRESULT CGreenScreen::ProcessColor()
+/// <param name="szMessage">message to display, copied</param>
+void CGreenScreen::PostStatusMessage(const WCHAR * szMessage)
 {
-    HRESULT hr = S_OK;
-    NUI_IMAGE_FRAME imageFrame;
-
-    // Attempt to get the depth frame
-    hr = m_pNuiSensor->NuiImageStreamGetNextFrame(m_pColorStreamHandle, 0, &imageFrame);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    m_colorTimeStamp = imageFrame.liTimeStamp;
-
-    INuiFrameTexture * pTexture = imageFrame.pFrameTexture;
-    NUI_LOCKED_RECT LockedRect;
-
-    // Lock the frame data so the Kinect knows not to modify it while we're reading it
-    pTexture->LockRect(0, &LockedRect, NULL, 0);
+    // SendMessage would block the caller on the UI thread, which may itself be waiting for the caller to stop
+    EnterCriticalSection(&m_statusLock);
+    StringCchCopyW(m_postedStatus, cStatusMessageMaxLen, szMessage);
+    LeaveCriticalSection(&m_statusLock);
 
-    // Make sure we've received valid data
-    if (LockedRect.Pitch != 0)
+    if (m_hWnd)
     {
-        memcpy(m_colorRGBX, LockedRect.pBits, LockedRect.size);
+        PostMessageW(m_hWnd, WM_APP_STATUSMESSAGE, 0, 0);
     }
-
-    // We're done with the texture so unlock it
-    pTexture->UnlockRect(0);
-
-    // Release the frame
-    m_pNuiSensor->NuiImageStreamReleaseFrame(m_pColorStreamHandle, &imageFrame);
-
-    return hr;
-}
-
-
-/// <summary>
-/// Set the status bar message
-/// </summary>
-/// <param name="szMessage">message to display</param>
-void CGreenScreen::SetStatusMessage(WCHAR * szMessage)
-{
-    SendDlgItemMessageW(m_hWnd, IDC_STATUS, WM_SETTEXT, 0, (LPARAM)szMessage);
 }
 
 
@@ -587,24 +1327,34 @@ void CGreenScreen::SetStatusMessage(WCHAR * szMessage)
 /// <summary>
 /// Handle new skeleton data
 /// </summary>
-void CGreenScreen::ProcessSkeleton()
+/// <param name="skeleton">frame popped from the skeleton queue</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT CGreenScreen::ProcessSkeleton(AcquiredSkeletonFrame& skeleton)
 {
-	RECT rct;
-	GetClientRect(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), &rct);
+	TRACE_SCOPE("ProcessSkeleton");
+
+	// replayed, there is no video view and frames are drawn the size of the colour stream
+	RECT rct = { 0, 0, m_colorWidth, m_colorHeight };
+	if ( !m_bReplay )
+	{
+		GetClientRect(GetDlgItem(m_hWnd, IDC_VIDEOVIEW), &rct);
+	}
 	int windowWidth = rct.right;
 	int windowHeight = rct.bottom;
 
-    NUI_SKELETON_FRAME skeletonFrame = {0};
+    NUI_SKELETON_FRAME& skeletonFrame = skeleton.frame;
+    HRESULT hr = S_OK;
 
-    HRESULT hr = m_pNuiSensor->NuiSkeletonGetNextFrame(0, &skeletonFrame);
-    if ( FAILED(hr) )
+    // when the frame left the sensor, and how long it took the acquisition thread to wake up for it
+    m_skeletonSensorTicks = m_latency.SensorTimeToTicks(skeletonFrame.liTimeStamp, skeleton.arrivalTicks);
+    m_latency.Stamp(LatencyStageWake, m_skeletonSensorTicks, skeleton.arrivalTicks);
+
+    // smooth out the skeleton data; replayed frames are taken as they are
+    if (m_pNuiSensor)
     {
-        return;
+        m_pNuiSensor->NuiTransformSmooth(&skeletonFrame, NULL);
     }
 
-    // smooth out the skeleton data
-    m_pNuiSensor->NuiTransformSmooth(&skeletonFrame, NULL);
-
 	// ASSIGN SKELETONS SO IT CAN BE PASSED TO DRAW AND HANDLE FUNCTION
 	tempSkeletonFrame = skeletonFrame;
 
@@ -643,6 +1393,8 @@ void CGreenScreen::ProcessSkeleton()
 		}
 		
 	}
+
+	return hr;
 }
 
 /// <summary>
@@ -666,4 +1418,4 @@ Point2f CGreenScreen::SkeletonToScreen(Vector4 skeletonPoint, int width, int hei
     pt.y = static_cast<float>(y * height) / cScreenHeight;
 
     return pt;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -12,18 +12,35 @@
 
 #include <gl/GL.h>
 #include "types.h"
+#include "LatencyMonitor.h"
+#include "FrameTimer.h"
+#include "FrameAcquisition.h"
+#include "FrameSynchronizer.h"
+#include "RenderThread.h"
+#include "WorkPool.h"
+#include "StageGraph.h"
+#include "SlotPool.h"
+#include "Compositor.h"
+#include "DepthRegistration.h"
+#include "MaskStabilizer.h"
+#include "FrameArena.h"
+#include "VideoRecorder.h"
+#include "SharedFrameOutput.h"
+#include "FloorPiano.h"
+#include "SyntheticFrameSource.h"
+
+// Posted by the processing thread when it has new status bar text
+#define WM_APP_STATUSMESSAGE    (WM_APP + 1)
 
 class CGreenScreen
 {
     static const int        cBytesPerPixel    = 4;
 
-    static const NUI_IMAGE_RESOLUTION cDepthResolution = NUI_IMAGE_RESOLUTION_320x240;
-    
-    // green screen background will also be scaled to this resolution
-    static const NUI_IMAGE_RESOLUTION cColorResolution = NUI_IMAGE_RESOLUTION_640x480;
-
     static const int        cStatusMessageMaxLen = MAX_PATH*2;
 
+    // frames the pipeline can hold: one being ingested, plus one waiting and one running per stage
+    static const int        cPipelineFrames = 5;
+
 	// FROM SKELETONBASICS.H
     static const int        cScreenWidth  = 320;
     static const int        cScreenHeight = 240;
@@ -32,7 +49,10 @@ public:
     /// <summary>
     /// Constructor
     /// </summary>
-    CGreenScreen();
+    /// <param name="depthResolution">depth stream resolution, 80x60, 320x240 or 640x480</param>
+    /// <param name="colorResolution">color stream resolution, 640x480 or 1280x960; the background is scaled to it</param>
+    /// <param name="bLargePages">back the frame buffers with large pages if the system allows it</param>
+    CGreenScreen(NUI_IMAGE_RESOLUTION depthResolution, NUI_IMAGE_RESOLUTION colorResolution, bool bLargePages);
 
     /// <summary>
     /// Destructor
@@ -66,6 +86,64 @@ public:
     /// <param name="nCmdShow"></param>
     int                     Run(HINSTANCE hInstance, int nCmdShow);
 
+    /// <summary>
+    /// Maps depth to colour with the built-in registration instead of the runtime's mapping
+    /// </summary>
+    void                    UseBuiltinRegistration() { m_bBuiltinRegistration = true; }
+
+    /// <summary>
+    /// Records the runtime's mapping of some of the first frames, for /benchregistration
+    /// </summary>
+    /// <param name="frames">number of frames to record</param>
+    /// <param name="interval">one frame is recorded in every this many</param>
+    void                    RecordRegistration(LONG frames, LONG interval) { m_registrationCaptureFrames = frames * interval; m_registrationCaptureInterval = interval; }
+
+    /// <summary>
+    /// Publishes every frame drawn, with the player mask in its alpha, to shared memory for other processes
+    /// </summary>
+    void                    PublishSharedFrames() { m_bSharedOutput = true; }
+
+    /// <summary>
+    /// Draws on the CPU instead of with OpenGL
+    /// </summary>
+    void                    UseSoftwareRenderer() { m_bSoftwareRenderer = true; }
+
+    /// <summary>
+    /// Adds a moving background to the renderer's set and shows it from the start
+    /// </summary>
+    /// <param name="path">a .y4m or raw BGRA video, or a directory of PNG frames, ending at a space</param>
+    void                    UseVideoBackground(LPCWSTR path);
+
+    /// <summary>
+    /// Sets how many frames running a pixel's new player index must be seen before it is composited
+    /// </summary>
+    /// <param name="frames">1 to composite the runtime's mask as it is, up to MaskStabilizer::cMaxHoldFrames</param>
+    void                    HoldPlayerMask(int frames) { m_maskHoldFrames = frames; }
+
+    /// <summary>
+    /// Starts processing with no sensor or window: frames come from InjectFrames, are mapped with the
+    /// source's own mapping in place of the runtime's and drawn offscreen, or by the software renderer
+    /// without OpenGL
+    /// </summary>
+    /// <param name="pPlayer">plays the notes the feet hit</param>
+    /// <param name="pMapping">maps the injected depth to colour; must outlive processing</param>
+    /// <returns>S_OK on success, otherwise failure code</returns>
+    HRESULT                 StartReplay(SimpleMIDIPlayer* pPlayer, const SyntheticFrameSource* pMapping);
+
+    /// <summary>
+    /// Hands a depth/colour pair and a skeleton frame to acquisition, as the sensor would, after StartReplay
+    /// </summary>
+    /// <param name="depthD16">depth frame at the depth resolution</param>
+    /// <param name="colorRGBX">colour frame at the colour resolution</param>
+    /// <param name="skeleton">skeleton frame</param>
+    /// <param name="timeStampMs">sensor timestamp of all three</param>
+    void                    InjectFrames(const USHORT* depthD16, const BYTE* colorRGBX, const NUI_SKELETON_FRAME& skeleton, LONGLONG timeStampMs);
+
+    /// <summary>
+    /// Frames the render thread has drawn with a new composite
+    /// </summary>
+    LONG                    DrawnFrames() const { return m_renderThread.FullFrames(); }
+
 private:
     HWND                    m_hWnd;
 
@@ -96,6 +174,9 @@ private:
 	HANDLE                  m_pSkeletonStreamHandle;
     HANDLE                  m_hNextSkeletonEvent;
 
+    NUI_IMAGE_RESOLUTION    m_depthResolution;
+    NUI_IMAGE_RESOLUTION    m_colorResolution;
+
     LONG                    m_depthWidth;
     LONG                    m_depthHeight;
 
@@ -104,29 +185,117 @@ private:
 
     LONG                    m_colorToDepthDivisor;
 
-    USHORT*                 m_depthD16;
-    BYTE*                   m_colorRGBX;
-    BYTE*                   m_outputRGBX;
-
-    LONG*                   m_colorCoordinates;
+    CompositeLayout         m_compositeLayout;
+    CompositeKernels        m_compositeKernels;     // specialized for m_compositeLayout
+
+    // every frame buffer, allocated while starting up and sealed once processing starts
+    FrameArena              m_frameArena;
+
+    // A depth/colour pair and everything derived from it, one per frame in the pipeline;
+    // the pixels stay in the acquisition frame rings until the frame retires
+    typedef struct
+    {
+        AcquiredImageFrame  depth;
+        AcquiredImageFrame  color;
+        USHORT*             depthD16;
+        BYTE*               colorRGBX;
+        // whole-frame mappings, only used when most pixels are players: the runtime's, which it writes
+        // as pairs of LONGs, and the built-in registration's
+        ArenaView<LONG>             runtimeCoordinates;
+        ArenaView<ColorCoordinate>  colorCoordinates;
+        ArenaView<PlayerPixel>      playerPixels;
+        LONG                playerPixelCount;
+    } PipelineFrame;
+
+    // Pairs are ingested on the processing thread, then mapped and composited on the work pool
+    WorkPool                m_workPool;
+    StageGraph              m_pipeline;
+    PipelineFrame           m_pipelineFrames[cPipelineFrames];
+    SlotPool                m_freePipelineFrames;
+    volatile LONG           m_pipelineDrops;
+
+    // Built-in depth to colour mapping, used instead of the runtime's when m_bBuiltinRegistration is set
+    DepthRegistration       m_registration;
+    bool                    m_bBuiltinRegistration;
+    LONG                    m_registrationCaptureFrames;    // frames left to look at, counting down
+    LONG                    m_registrationCaptureInterval;
+
+    // Share of the depth pixels up to which the runtime's players are mapped one call per pixel, timed at start
+    float                   m_sparseMappingCoverage;
+
+    // Pairs depth and colour frames by sensor timestamp, owned by the processing thread
+    FrameSynchronizer       m_synchronizer;
+
+    // Holds the player mask steady along the silhouette's edge, on the depth acquisition thread
+    MaskStabilizer          m_maskStabilizer;
+    int                     m_maskHoldFrames;
+
+    // Sensor frames arrive through the acquisition threads and are processed on m_hProcessingThread
+    FrameAcquisition        m_acquisition;
+    HANDLE                  m_hProcessingThread;
+    HANDLE                  m_hStopProcessing;
+
+    // Composited frames go to the render thread through the mailbox, whose slots own the output images;
+    // the overlay has its own so skeleton frames can be drawn without recompositing
+    RenderMailbox           m_renderMailbox;
+    OverlayMailbox          m_overlayMailbox;
+    Point2f                 m_publishedFeetPoints[4];
+    BYTE                    m_publishedKeyStates[FloorPiano::cKeyCount];
+    RenderThread            m_renderThread;
+
+    // Status text handed from the processing thread to the UI thread
+    CRITICAL_SECTION        m_statusLock;
+    WCHAR                   m_postedStatus[cStatusMessageMaxLen];
+
+    // Motion-to-sound latency
+    LatencyMonitor          m_latency;
+    LONGLONG                m_skeletonSensorTicks;
+
+    // Turns foot hits into notes
+    FloorPiano              m_piano;
+
+    // Per-stage frame timing, shown by the renderer's HUD
+    FrameTimer              m_frameTimer;
+
+    // Records what the renderer draws, fed by its readback
+    VideoRecorder           m_recorder;
+
+    // Publishes what the renderer draws to other processes when m_bSharedOutput is set, fed by its readback
+    SharedFrameOutput       m_sharedOutput;
+    bool                    m_bSharedOutput;
+
+    // Draw with the software renderer from the start, not only when OpenGL fails
+    bool                    m_bSoftwareRenderer;
+
+    // Frames are injected rather than acquired from a sensor, for StartReplay, and mapped by their source
+    bool                    m_bReplay;
+    const SyntheticFrameSource* m_pReplayMapping;
+
+    // The moving background to add to the renderer's set, if any, and the background of the set shown
+    char                    m_videoBackgroundPath[MAX_PATH];
+    int                     m_selectedBackground;
 
-    LARGE_INTEGER           m_depthTimeStamp;
-    LARGE_INTEGER           m_colorTimeStamp;
+    /// <summary>
+    /// Main processing function
+    /// </summary>
+    void                    Update();
 
     /// <summary>
-    /// Load an image from a resource into a buffer
+    /// Starts the acquisition threads and the processing thread
     /// </summary>
-    /// <param name="resourceName">name of image resource to load</param>
-    /// <param name="resourceType">type of resource to load</param>
-    /// <param name="cOutputBuffer">size of output buffer, in bytes</param>
-    /// <param name="outputBuffer">buffer that will hold the loaded image</param>
     /// <returns>S_OK on success, otherwise failure code</returns>
-    HRESULT                 LoadResourceImage(PCWSTR resourceName, PCWSTR resourceType, DWORD cOutputBuffer, BYTE* outputBuffer);
+    HRESULT                 StartProcessing();
 
     /// <summary>
-    /// Main processing function
+    /// Stops processing, the pipeline, rendering and acquisition, in that order
     /// </summary>
-    void                    Update();
+    void                    StopProcessing();
+
+    /// <summary>
+    /// Processing thread entry point, runs Update whenever a stream has queued a frame
+    /// </summary>
+    /// <param name="lpParameter">the CGreenScreen instance</param>
+    static DWORD WINAPI     ProcessingThread(LPVOID lpParameter);
 
     /// <summary>
     /// Create the first connected Kinect found 
@@ -135,16 +304,45 @@ private:
     HRESULT                 CreateFirstConnected();
 
     /// <summary>
-    /// Handle new depth data
+    /// Ingests a matched depth/colour pair into a free pipeline frame and submits it
     /// </summary>
-    /// <returns>S_OK on success, otherwise failure code</returns>
-    HRESULT                 ProcessDepth();
+    /// <param name="depth">depth frame, released here or when the pipeline frame retires</param>
+    /// <param name="color">color frame, released here or when the pipeline frame retires</param>
+    void                    SubmitFrames(AcquiredImageFrame& depth, AcquiredImageFrame& color);
 
     /// <summary>
-    /// Handle new color data
+    /// Pipeline stage: lists the player pixels and maps them to colour
     /// </summary>
-    /// <returns>S_OK on success, otherwise failure code</returns>
-    HRESULT                 ProcessColor();
+    /// <param name="context">the CGreenScreen instance</param>
+    /// <param name="item">the PipelineFrame</param>
+    static void             MapStage(void* context, void* item);
+
+    /// <summary>
+    /// Pipeline stage: composites the players and publishes the result to the render thread
+    /// </summary>
+    /// <param name="context">the CGreenScreen instance</param>
+    /// <param name="item">the PipelineFrame</param>
+    static void             CompositeStage(void* context, void* item);
+
+    /// <summary>
+    /// Returns a pipeline frame to the free pool once it leaves the pipeline
+    /// </summary>
+    /// <param name="context">the CGreenScreen instance</param>
+    /// <param name="item">the PipelineFrame</param>
+    /// <param name="completed">false if the frame was dropped as stale</param>
+    static void             RetireFrame(void* context, void* item, bool completed);
+
+    /// <summary>
+    /// Writes a snapshot read back from the renderer to snapshot.bmp, on the readback thread
+    /// </summary>
+    /// <param name="context">the CGreenScreen instance</param>
+    /// <param name="pixels">top row of BGRA pixels</param>
+    /// <param name="width">width in pixels</param>
+    /// <param name="height">height in pixels</param>
+    /// <param name="stride">bytes from one row to the next</param>
+    /// <param name="frame">renderer frame number</param>
+    /// <param name="presentTicks">when the frame was presented</param>
+    static void             SnapshotReady(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks);
 
     /// <summary>
     /// Set the status bar message
@@ -152,11 +350,19 @@ private:
     /// <param name="szMessage">message to display</param>
     void                    SetStatusMessage(WCHAR* szMessage);
 
+    /// <summary>
+    /// Set the status bar message from a thread other than the UI thread
+    /// </summary>
+    /// <param name="szMessage">message to display, copied</param>
+    void                    PostStatusMessage(const WCHAR* szMessage);
+
 	// FROM SKELETONBASICS.H
 	    /// <summary>
     /// Handle new skeleton data
     /// </summary>
-    void                    ProcessSkeleton();
+    /// <param name="skeleton">frame popped from the skeleton queue</param>
+    /// <returns>S_OK on success, otherwise failure code</returns>
+    HRESULT                 ProcessSkeleton(AcquiredSkeletonFrame& skeleton);
 
     /// <summary>
     /// Draws a bone line between two joints
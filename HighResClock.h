@@ -0,0 +1,53 @@
+/*
+
+High resolution monotonic clock shared by the instrumentation code
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+class HighResClock
+{
+public:
+	/// <summary>
+	/// Current value of the performance counter, in ticks
+	/// </summary>
+	static LONGLONG Now()
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return now.QuadPart;
+	}
+
+	/// <summary>
+	/// Performance counter frequency, in ticks per second
+	/// </summary>
+	static LONGLONG Frequency()
+	{
+		static LONGLONG frequency = 0;
+		if ( frequency == 0 )
+		{
+			LARGE_INTEGER f;
+			QueryPerformanceFrequency(&f);
+			frequency = f.QuadPart;
+		}
+		return frequency;
+	}
+
+	static LONGLONG TicksToMicroseconds(LONGLONG ticks)
+	{
+		return (ticks * 1000000) / Frequency();
+	}
+
+	static LONGLONG MillisecondsToTicks(LONGLONG ms)
+	{
+		return (ms * Frequency()) / 1000;
+	}
+
+	static double TicksToMilliseconds(LONGLONG ticks)
+	{
+		return (double)ticks * 1000.0 / (double)Frequency();
+	}
+};
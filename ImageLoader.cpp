@@ -0,0 +1,1061 @@
+#include "stdafx.h"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <math.h>
+#include "ImageLoader.h"
+#include "HighResClock.h"
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef HINST_THISCOMPONENT
+#ifdef _WIN32
+EXTERN_C IMAGE_DOS_HEADER __ImageBase;
+#define HINST_THISCOMPONENT ((HINSTANCE)&__ImageBase)
+#endif
+#endif
+
+using namespace std;
+
+// "GSIC"
+static const DWORD g_cacheMagic = 0x43495347;
+
+// bump when the decoder or scaler changes what they produce, so old caches miss
+static const DWORD g_cacheVersion = 1;
+
+// the pixels start on their own cache line
+typedef struct
+{
+	DWORD		magic;
+	DWORD		version;
+	LONG		width;
+	LONG		height;
+	ULONGLONG	sourceHash;
+	BYTE		reserved[40];
+} ImageCacheHeader;
+
+//------------------------------------------------------------------------------
+// Inflate
+
+// Huffman codes up to this long are decoded with one table lookup, longer ones canonically
+static const int g_fastBits = 9;
+static const int g_maxCodeLength = 15;
+
+typedef struct
+{
+	USHORT	fast[1 << g_fastBits];		// (length << 9) | symbol, 0 for a longer code
+	USHORT	firstCode[16];
+	int		maxCode[17];				// first code of the next length, left-aligned to 16 bits
+	USHORT	firstSymbol[16];
+	BYTE	lengths[288];				// by canonical order
+	USHORT	values[288];				// by canonical order
+} HuffmanTable;
+
+static const USHORT g_lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE g_lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const USHORT g_distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE g_distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const BYTE g_codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static int ReverseBits(int code, int length)
+{
+	int reversed = 0;
+	for ( int i = 0; i < length; ++i )
+	{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+static bool BuildHuffman(HuffmanTable& table, const BYTE* lengths, int count)
+{
+	int counts[16] = { 0 };
+	int nextCode[16];
+
+	memset(table.fast, 0, sizeof(table.fast));
+	for ( int i = 0; i < count; ++i )
+	{
+		++counts[lengths[i]];
+	}
+	counts[0] = 0;
+
+	int code = 0;
+	int symbol = 0;
+	for ( int length = 1; length <= g_maxCodeLength; ++length )
+	{
+		nextCode[length] = code;
+		table.firstCode[length] = (USHORT)code;
+		table.firstSymbol[length] = (USHORT)symbol;
+		code += counts[length];
+
+		// more codes of this length than there is room for
+		if ( counts[length] && code - 1 >= (1 << length) )
+		{
+			return false;
+		}
+		table.maxCode[length] = code << (16 - length);
+		code <<= 1;
+		symbol += counts[length];
+	}
+	table.maxCode[16] = 0x10000;
+
+	for ( int i = 0; i < count; ++i )
+	{
+		int length = lengths[i];
+		if ( length == 0 )
+		{
+			continue;
+		}
+
+		int canonical = nextCode[length] - table.firstCode[length] + table.firstSymbol[length];
+		table.lengths[canonical] = (BYTE)length;
+		table.values[canonical] = (USHORT)i;
+
+		// deflate sends codes most significant bit first into a least significant first stream
+		if ( length <= g_fastBits )
+		{
+			USHORT entry = (USHORT)((length << g_fastBits) | i);
+			for ( int j = ReverseBits(nextCode[length], length); j < (1 << g_fastBits); j += 1 << length )
+			{
+				table.fast[j] = entry;
+			}
+		}
+		++nextCode[length];
+	}
+
+	return true;
+}
+
+class Inflater
+{
+public:
+	Inflater(const BYTE* input, size_t inputBytes, BYTE* output, size_t outputBytes) :
+		m_pInput(input),
+		m_pInputEnd(input + inputBytes),
+		m_bits(0),
+		m_bitCount(0),
+		m_pOutputStart(output),
+		m_pOutput(output),
+		m_pOutputEnd(output + outputBytes)
+	{
+	}
+
+	/// <summary>
+	/// Inflates a zlib stream until its last block or the output is full
+	/// </summary>
+	HRESULT Run()
+	{
+		if ( m_pInputEnd - m_pInput < 2 )
+		{
+			return E_FAIL;
+		}
+
+		// deflate, no preset dictionary; the Adler-32 at the end is not checked
+		BYTE method = m_pInput[0];
+		BYTE flags = m_pInput[1];
+		if ( (method & 15) != 8 || ((method << 8) | flags) % 31 != 0 || (flags & 32) )
+		{
+			return E_FAIL;
+		}
+		m_pInput += 2;
+
+		bool last = false;
+		while ( !last )
+		{
+			last = Bits(1) != 0;
+			int type = (int)Bits(2);
+
+			bool ok = false;
+			if ( type == 0 )
+			{
+				ok = Stored();
+			}
+			else if ( type == 1 )
+			{
+				ok = BuildFixed() && Compressed();
+			}
+			else if ( type == 2 )
+			{
+				ok = BuildDynamic() && Compressed();
+			}
+			if ( !ok )
+			{
+				return E_FAIL;
+			}
+		}
+
+		return ( m_pOutput == m_pOutputEnd ) ? S_OK : E_FAIL;
+	}
+
+private:
+	const BYTE*		m_pInput;
+	const BYTE*		m_pInputEnd;
+	ULONGLONG		m_bits;
+	int				m_bitCount;
+
+	BYTE*			m_pOutputStart;
+	BYTE*			m_pOutput;
+	BYTE*			m_pOutputEnd;
+
+	HuffmanTable	m_literals;
+	HuffmanTable	m_distances;
+
+	void Refill()
+	{
+		// past the end of the input the stream reads as zeros, and decoding fails on what it makes of them
+		while ( m_bitCount <= 56 )
+		{
+			ULONGLONG byte = ( m_pInput < m_pInputEnd ) ? *m_pInput++ : 0;
+			m_bits |= byte << m_bitCount;
+			m_bitCount += 8;
+		}
+	}
+
+	DWORD Bits(int count)
+	{
+		if ( m_bitCount < count )
+		{
+			Refill();
+		}
+		DWORD value = (DWORD)(m_bits & ((1u << count) - 1));
+		m_bits >>= count;
+		m_bitCount -= count;
+		return value;
+	}
+
+	int Decode(const HuffmanTable& table)
+	{
+		if ( m_bitCount < 16 )
+		{
+			Refill();
+		}
+
+		USHORT entry = table.fast[m_bits & ((1 << g_fastBits) - 1)];
+		if ( entry )
+		{
+			int length = entry >> g_fastBits;
+			m_bits >>= length;
+			m_bitCount -= length;
+			return entry & ((1 << g_fastBits) - 1);
+		}
+
+		// longer than the table: find the length whose codes the next 16 bits fall under
+		int reversed = ReverseBits((int)(m_bits & 0xffff), 16);
+		int length = g_fastBits + 1;
+		while ( reversed >= table.maxCode[length] )
+		{
+			++length;
+		}
+		if ( length > g_maxCodeLength )
+		{
+			return -1;
+		}
+
+		int canonical = (reversed >> (16 - length)) - table.firstCode[length] + table.firstSymbol[length];
+		if ( canonical >= 288 || table.lengths[canonical] != length )
+		{
+			return -1;
+		}
+		m_bits >>= length;
+		m_bitCount -= length;
+		return table.values[canonical];
+	}
+
+	bool Stored()
+	{
+		// to the byte boundary, then whatever whole bytes are already in the buffer go back to the input
+		Bits(m_bitCount & 7);
+		while ( m_bitCount > 0 )
+		{
+			--m_pInput;
+			m_bitCount -= 8;
+		}
+		m_bits = 0;
+		m_bitCount = 0;
+
+		if ( m_pInputEnd - m_pInput < 4 )
+		{
+			return false;
+		}
+		size_t length = m_pInput[0] | (m_pInput[1] << 8);
+		size_t complement = m_pInput[2] | (m_pInput[3] << 8);
+		m_pInput += 4;
+		if ( (length ^ 0xffff) != complement || (size_t)(m_pInputEnd - m_pInput) < length || (size_t)(m_pOutputEnd - m_pOutput) < length )
+		{
+			return false;
+		}
+
+		memcpy(m_pOutput, m_pInput, length);
+		m_pOutput += length;
+		m_pInput += length;
+		return true;
+	}
+
+	bool BuildFixed()
+	{
+		BYTE lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+
+		BYTE distanceLengths[32];
+		memset(distanceLengths, 5, sizeof(distanceLengths));
+		return BuildHuffman(m_literals, lengths, 288) && BuildHuffman(m_distances, distanceLengths, 32);
+	}
+
+	bool BuildDynamic()
+	{
+		int literalCount = (int)Bits(5) + 257;
+		int distanceCount = (int)Bits(5) + 1;
+		int codeLengthCount = (int)Bits(4) + 4;
+
+		BYTE codeLengthLengths[19];
+		memset(codeLengthLengths, 0, sizeof(codeLengthLengths));
+		for ( int i = 0; i < codeLengthCount; ++i )
+		{
+			codeLengthLengths[g_codeLengthOrder[i]] = (BYTE)Bits(3);
+		}
+
+		HuffmanTable codeLengths;
+		if ( !BuildHuffman(codeLengths, codeLengthLengths, 19) )
+		{
+			return false;
+		}
+
+		// the literal and distance lengths are one run-length coded sequence
+		BYTE lengths[286 + 32];
+		int total = literalCount + distanceCount;
+		int count = 0;
+		while ( count < total )
+		{
+			int symbol = Decode(codeLengths);
+			if ( symbol < 0 )
+			{
+				return false;
+			}
+
+			if ( symbol < 16 )
+			{
+				lengths[count++] = (BYTE)symbol;
+				continue;
+			}
+
+			BYTE repeated = 0;
+			int repeat;
+			if ( symbol == 16 )
+			{
+				if ( count == 0 )
+				{
+					return false;
+				}
+				repeated = lengths[count - 1];
+				repeat = 3 + (int)Bits(2);
+			}
+			else if ( symbol == 17 )
+			{
+				repeat = 3 + (int)Bits(3);
+			}
+			else
+			{
+				repeat = 11 + (int)Bits(7);
+			}
+
+			if ( count + repeat > total )
+			{
+				return false;
+			}
+			memset(lengths + count, repeated, repeat);
+			count += repeat;
+		}
+
+		return BuildHuffman(m_literals, lengths, literalCount) &&
+			BuildHuffman(m_distances, lengths + literalCount, distanceCount);
+	}
+
+	bool Compressed()
+	{
+		BYTE* pOutput = m_pOutput;
+		for ( ;; )
+		{
+			int symbol = Decode(m_literals);
+			if ( symbol < 256 )
+			{
+				if ( symbol < 0 || pOutput == m_pOutputEnd )
+				{
+					return false;
+				}
+				*pOutput++ = (BYTE)symbol;
+				continue;
+			}
+			if ( symbol == 256 )
+			{
+				m_pOutput = pOutput;
+				return true;
+			}
+
+			symbol -= 257;
+			if ( symbol >= 29 )
+			{
+				return false;
+			}
+			int length = g_lengthBase[symbol] + (int)Bits(g_lengthExtra[symbol]);
+
+			int distanceSymbol = Decode(m_distances);
+			if ( distanceSymbol < 0 || distanceSymbol >= 30 )
+			{
+				return false;
+			}
+			size_t distance = g_distanceBase[distanceSymbol] + Bits(g_distanceExtra[distanceSymbol]);
+
+			if ( (size_t)(pOutput - m_pOutputStart) < distance || m_pOutputEnd - pOutput < length )
+			{
+				return false;
+			}
+
+			// the copy may overlap what it writes, so byte by byte unless the source is far enough back
+			const BYTE* pSource = pOutput - distance;
+			if ( distance >= (size_t)length )
+			{
+				memcpy(pOutput, pSource, length);
+				pOutput += length;
+			}
+			else
+			{
+				for ( int i = 0; i < length; ++i )
+				{
+					*pOutput++ = pSource[i];
+				}
+			}
+		}
+	}
+};
+
+//------------------------------------------------------------------------------
+// PNG
+
+static DWORD ReadBigEndian(const BYTE* p)
+{
+	return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3];
+}
+
+static BYTE Paeth(int left, int up, int upLeft)
+{
+	int estimate = left + up - upLeft;
+	int toLeft = abs(estimate - left);
+	int toUp = abs(estimate - up);
+	int toUpLeft = abs(estimate - upLeft);
+	if ( toLeft <= toUp && toLeft <= toUpLeft ) return (BYTE)left;
+	if ( toUp <= toUpLeft ) return (BYTE)up;
+	return (BYTE)upLeft;
+}
+
+/// <summary>
+/// Undoes a row's filter in place, given the row above already unfiltered (zeros above the first)
+/// </summary>
+static bool Unfilter(BYTE filter, BYTE* row, const BYTE* above, size_t rowBytes, int pixelBytes)
+{
+	switch ( filter )
+	{
+	case 0:
+		break;
+
+	case 1:
+		for ( size_t i = pixelBytes; i < rowBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + row[i - pixelBytes]);
+		}
+		break;
+
+	case 2:
+		for ( size_t i = 0; i < rowBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + above[i]);
+		}
+		break;
+
+	case 3:
+		for ( size_t i = 0; i < (size_t)pixelBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + (above[i] >> 1));
+		}
+		for ( size_t i = pixelBytes; i < rowBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + ((row[i - pixelBytes] + above[i]) >> 1));
+		}
+		break;
+
+	case 4:
+		for ( size_t i = 0; i < (size_t)pixelBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + above[i]);
+		}
+		for ( size_t i = pixelBytes; i < rowBytes; ++i )
+		{
+			row[i] = (BYTE)(row[i] + Paeth(row[i - pixelBytes], above[i], above[i - pixelBytes]));
+		}
+		break;
+
+	default:
+		return false;
+	}
+	return true;
+}
+
+HRESULT DecodePng(const BYTE* png, size_t bytes, vector<BYTE>& bgra, int& width, int& height)
+{
+	TRACE_SCOPE("DecodePng");
+	static const BYTE signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	if ( bytes < 8 + 25 || memcmp(png, signature, 8) != 0 )
+	{
+		return E_FAIL;
+	}
+
+	// the chunks; CRCs are not checked
+	int bitDepth = 0, colorType = 0, interlace = 0;
+	width = height = 0;
+	BYTE palette[256][4];
+	memset(palette, 255, sizeof(palette));
+	vector<BYTE> compressed;
+	size_t offset = 8;
+	while ( offset + 12 <= bytes )
+	{
+		size_t length = ReadBigEndian(png + offset);
+		const BYTE* type = png + offset + 4;
+		const BYTE* data = png + offset + 8;
+		if ( length > bytes - offset - 12 )
+		{
+			return E_FAIL;
+		}
+
+		if ( memcmp(type, "IHDR", 4) == 0 && length >= 13 )
+		{
+			width = (int)ReadBigEndian(data);
+			height = (int)ReadBigEndian(data + 4);
+			bitDepth = data[8];
+			colorType = data[9];
+			interlace = data[12];
+		}
+		else if ( memcmp(type, "PLTE", 4) == 0 )
+		{
+			for ( size_t i = 0; i < length / 3 && i < 256; ++i )
+			{
+				palette[i][0] = data[i * 3];
+				palette[i][1] = data[i * 3 + 1];
+				palette[i][2] = data[i * 3 + 2];
+			}
+		}
+		else if ( memcmp(type, "tRNS", 4) == 0 && colorType == 3 )
+		{
+			for ( size_t i = 0; i < length && i < 256; ++i )
+			{
+				palette[i][3] = data[i];
+			}
+		}
+		else if ( memcmp(type, "IDAT", 4) == 0 )
+		{
+			compressed.insert(compressed.end(), data, data + length);
+		}
+		else if ( memcmp(type, "IEND", 4) == 0 )
+		{
+			break;
+		}
+		offset += length + 12;
+	}
+
+	int channels;
+	switch ( colorType )
+	{
+	case 0:		channels = 1;	break;
+	case 2:		channels = 3;	break;
+	case 3:		channels = 1;	break;
+	case 4:		channels = 2;	break;
+	case 6:		channels = 4;	break;
+	default:	return E_FAIL;
+	}
+	if ( width <= 0 || height <= 0 || width > 16384 || height > 16384 || compressed.empty() )
+	{
+		return E_FAIL;
+	}
+	if ( interlace != 0 || !(bitDepth == 8 || (bitDepth == 16 && colorType != 3)) )
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	}
+
+	// each row is a filter byte and the row
+	int pixelBytes = channels * bitDepth / 8;
+	size_t rowBytes = (size_t)width * pixelBytes;
+	vector<BYTE> filtered((rowBytes + 1) * height);
+	{
+		TRACE_SCOPE("Inflate");
+		Inflater inflater(&compressed[0], compressed.size(), &filtered[0], filtered.size());
+		HRESULT hr = inflater.Run();
+		if ( FAILED(hr) )
+		{
+			return hr;
+		}
+	}
+
+	// unfiltered in place, each row against the one before, then converted
+	bgra.resize((size_t)width * height * 4);
+	vector<BYTE> zeros(rowBytes, 0);
+	const int sampleStep = bitDepth / 8;
+	for ( int y = 0; y < height; ++y )
+	{
+		BYTE* row = &filtered[y * (rowBytes + 1) + 1];
+		const BYTE* above = ( y > 0 ) ? row - (rowBytes + 1) : &zeros[0];
+		if ( !Unfilter(row[-1], row, above, rowBytes, pixelBytes) )
+		{
+			return E_FAIL;
+		}
+
+		// the first byte of a 16-bit sample is its high byte
+		BYTE* out = &bgra[(size_t)y * width * 4];
+		for ( int x = 0; x < width; ++x, out += 4 )
+		{
+			const BYTE* pixel = row + x * pixelBytes;
+			switch ( colorType )
+			{
+			case 0:
+				out[0] = out[1] = out[2] = pixel[0];
+				out[3] = 255;
+				break;
+			case 2:
+				out[0] = pixel[2 * sampleStep];
+				out[1] = pixel[sampleStep];
+				out[2] = pixel[0];
+				out[3] = 255;
+				break;
+			case 3:
+				out[0] = palette[pixel[0]][2];
+				out[1] = palette[pixel[0]][1];
+				out[2] = palette[pixel[0]][0];
+				out[3] = palette[pixel[0]][3];
+				break;
+			case 4:
+				out[0] = out[1] = out[2] = pixel[0];
+				out[3] = pixel[sampleStep];
+				break;
+			case 6:
+				out[0] = pixel[2 * sampleStep];
+				out[1] = pixel[sampleStep];
+				out[2] = pixel[0];
+				out[3] = pixel[3 * sampleStep];
+				break;
+			}
+		}
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------
+// Scaling
+
+// Keys' cubic with a = -0.5 (Catmull-Rom), the kernel of WIC's cubic mode
+static float Cubic(float x)
+{
+	x = fabsf(x);
+	if ( x < 1.0f ) return (1.5f * x - 2.5f) * x * x + 1.0f;
+	if ( x < 2.0f ) return ((-0.5f * x + 2.5f) * x - 4.0f) * x + 2.0f;
+	return 0.0f;
+}
+
+typedef struct
+{
+	int		first;			// first of the four source pixels
+	float	weights[4];
+} CubicTaps;
+
+/// <summary>
+/// The taps of each output pixel, pixel centres mapped onto each other, clamped at the edges
+/// </summary>
+static void CubicTapsFor(int sourceSize, int size, vector<CubicTaps>& taps, vector<int>& clamped)
+{
+	taps.resize(size);
+	float scale = (float)sourceSize / size;
+	for ( int i = 0; i < size; ++i )
+	{
+		float center = (i + 0.5f) * scale - 0.5f;
+		int first = (int)floorf(center) - 1;
+		float sum = 0.0f;
+		for ( int t = 0; t < 4; ++t )
+		{
+			taps[i].weights[t] = Cubic(center - (first + t));
+			sum += taps[i].weights[t];
+		}
+		for ( int t = 0; t < 4; ++t )
+		{
+			taps[i].weights[t] /= sum;
+		}
+		taps[i].first = first;
+	}
+
+	// source index of every tap position, clamped to the image
+	clamped.resize(sourceSize + 4);
+	for ( int i = 0; i < sourceSize + 4; ++i )
+	{
+		int index = i - 2;
+		clamped[i] = ( index < 0 ) ? 0 : ( index >= sourceSize ) ? sourceSize - 1 : index;
+	}
+}
+
+static BYTE ClampToByte(float value)
+{
+	return ( value <= 0.0f ) ? 0 : ( value >= 255.0f ) ? 255 : (BYTE)(value + 0.5f);
+}
+
+// rows then columns
+void ScaleImage(const BYTE* source, int sourceWidth, int sourceHeight, BYTE* output, int width, int height)
+{
+	TRACE_SCOPE("ScaleImage");
+	vector<CubicTaps> columnTaps, rowTaps;
+	vector<int> columnIndex, rowIndex;
+	CubicTapsFor(sourceWidth, width, columnTaps, columnIndex);
+	CubicTapsFor(sourceHeight, height, rowTaps, rowIndex);
+
+	// each source row across to the new width
+	vector<float> across((size_t)width * sourceHeight * 4);
+	for ( int y = 0; y < sourceHeight; ++y )
+	{
+		const BYTE* row = source + (size_t)y * sourceWidth * 4;
+		float* out = &across[(size_t)y * width * 4];
+		for ( int x = 0; x < width; ++x, out += 4 )
+		{
+			const CubicTaps& taps = columnTaps[x];
+			out[0] = out[1] = out[2] = out[3] = 0.0f;
+			for ( int t = 0; t < 4; ++t )
+			{
+				const BYTE* pixel = row + columnIndex[taps.first + t + 2] * 4;
+				for ( int c = 0; c < 4; ++c )
+				{
+					out[c] += pixel[c] * taps.weights[t];
+				}
+			}
+		}
+	}
+
+	// then down each column
+	for ( int y = 0; y < height; ++y )
+	{
+		const CubicTaps& taps = rowTaps[y];
+		const float* rows[4];
+		for ( int t = 0; t < 4; ++t )
+		{
+			rows[t] = &across[(size_t)rowIndex[taps.first + t + 2] * width * 4];
+		}
+
+		BYTE* out = output + (size_t)y * width * 4;
+		for ( int i = 0; i < width * 4; ++i )
+		{
+			out[i] = ClampToByte(rows[0][i] * taps.weights[0] + rows[1][i] * taps.weights[1] +
+				rows[2][i] * taps.weights[2] + rows[3][i] * taps.weights[3]);
+		}
+	}
+}
+
+/// <summary>
+/// Colour times alpha, rounded, as WIC's conversion to 32bppPBGRA
+/// </summary>
+static void Premultiply(BYTE* bgra, size_t pixels)
+{
+	for ( size_t i = 0; i < pixels; ++i, bgra += 4 )
+	{
+		DWORD alpha = bgra[3];
+		if ( alpha == 255 )
+		{
+			continue;
+		}
+		for ( int c = 0; c < 3; ++c )
+		{
+			DWORD t = bgra[c] * alpha + 128;
+			bgra[c] = (BYTE)((t + (t >> 8)) >> 8);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Cache
+
+ULONGLONG HashImageSource(const BYTE* encoded, size_t bytes)
+{
+	// a word at a time, so hashing costs less than the cache read it guards; the tail byte by byte.
+	// A multiply only carries bits upwards, so each step folds the high half back down, or a word's
+	// top bits would never reach the bits below them
+	ULONGLONG hash = 14695981039346656037ULL;
+	size_t words = bytes / 8;
+	for ( size_t i = 0; i < words; ++i )
+	{
+		ULONGLONG word;
+		memcpy(&word, encoded + i * 8, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+		hash ^= hash >> 32;
+	}
+	for ( size_t i = words * 8; i < bytes; ++i )
+	{
+		hash = (hash ^ encoded[i]) * 1099511628211ULL;
+	}
+	hash ^= bytes;
+
+	// murmur3's finalizer, so every input bit reaches every bit of the key
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+string ImageCachePath(const char* cachePrefix, ULONGLONG sourceHash, int width, int height)
+{
+	char name[64];
+	sprintf(name, "_%08x%08x_%dx%d.bgra", (unsigned int)(sourceHash >> 32), (unsigned int)sourceHash, width, height);
+	return string(cachePrefix) + name;
+}
+
+/// <summary>
+/// Maps the cache file and copies its pixels out if it is the image wanted
+/// </summary>
+/// <returns>true on a hit</returns>
+static bool ReadCache(const string& path, ULONGLONG sourceHash, int width, int height, BYTE* output)
+{
+	size_t pixelBytes = (size_t)width * height * 4;
+	size_t fileBytes = sizeof(ImageCacheHeader) + pixelBytes;
+	const BYTE* pView = NULL;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if ( INVALID_HANDLE_VALUE == hFile )
+	{
+		return false;
+	}
+	HANDLE hMapping = NULL;
+	if ( GetFileSize(hFile, NULL) == fileBytes )
+	{
+		hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if ( hMapping )
+	{
+		pView = static_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+	{
+		return false;
+	}
+	struct stat status;
+	if ( fstat(fd, &status) == 0 && (size_t)status.st_size == fileBytes )
+	{
+		void* pMapped = mmap(NULL, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		pView = ( pMapped == MAP_FAILED ) ? NULL : static_cast<const BYTE*>(pMapped);
+	}
+#endif
+
+	bool hit = false;
+	if ( pView )
+	{
+		const ImageCacheHeader* pHeader = reinterpret_cast<const ImageCacheHeader*>(pView);
+		hit = pHeader->magic == g_cacheMagic && pHeader->version == g_cacheVersion &&
+			pHeader->width == width && pHeader->height == height && pHeader->sourceHash == sourceHash;
+		if ( hit )
+		{
+			memcpy(output, pView + sizeof(ImageCacheHeader), pixelBytes);
+		}
+	}
+
+#ifdef _WIN32
+	if ( pView )
+	{
+		UnmapViewOfFile(pView);
+	}
+	if ( hMapping )
+	{
+		CloseHandle(hMapping);
+	}
+	CloseHandle(hFile);
+#else
+	if ( pView )
+	{
+		munmap(const_cast<BYTE*>(pView), fileBytes);
+	}
+	close(fd);
+#endif
+
+	return hit;
+}
+
+/// <summary>
+/// Writes the cache file whole under a temporary name, then renames it into place, so a reader never
+/// maps half of one
+/// </summary>
+static void WriteCache(const string& path, ULONGLONG sourceHash, int width, int height, const BYTE* pixels)
+{
+	ImageCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = g_cacheMagic;
+	header.version = g_cacheVersion;
+	header.width = width;
+	header.height = height;
+	header.sourceHash = sourceHash;
+
+	string temporary = path + ".tmp";
+	{
+		ofstream file(temporary.c_str(), ios::binary | ios::trunc);
+		if ( !file )
+		{
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(pixels), (streamsize)width * height * 4);
+		if ( !file )
+		{
+			file.close();
+			remove(temporary.c_str());
+			return;
+		}
+	}
+
+#ifdef _WIN32
+	if ( !MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) )
+#else
+	if ( rename(temporary.c_str(), path.c_str()) != 0 )
+#endif
+	{
+		remove(temporary.c_str());
+	}
+}
+
+//------------------------------------------------------------------------------
+
+#ifndef _WIN32
+// GreenScreen.rc's image resources and the files it builds them from, which are next to the executable here
+typedef struct
+{
+	PCWSTR		name;
+	PCWSTR		type;
+	const char*	fileName;
+} ImageResourceFile;
+
+static const ImageResourceFile g_imageResourceFiles[] =
+{
+	{ L"Background", L"Image", "Background.png" },
+};
+#endif
+
+HRESULT ReadImageResource(PCWSTR resourceName, PCWSTR resourceType, vector<BYTE>& storage, const BYTE*& data, size_t& bytes)
+{
+#ifdef _WIN32
+	// the resource stays mapped with the executable, so its bytes are used where they are
+	HRSRC hResource = FindResourceW(HINST_THISCOMPONENT, resourceName, resourceType);
+	HGLOBAL hData = hResource ? LoadResource(HINST_THISCOMPONENT, hResource) : NULL;
+	data = hData ? static_cast<const BYTE*>(LockResource(hData)) : NULL;
+	bytes = data ? SizeofResource(HINST_THISCOMPONENT, hResource) : 0;
+	return ( data && bytes ) ? S_OK : E_FAIL;
+#else
+	// resource names and types are case-insensitive, as the resource compiler upper-cases them
+	const char* fileName = NULL;
+	for ( size_t i = 0; i < sizeof(g_imageResourceFiles) / sizeof(g_imageResourceFiles[0]); ++i )
+	{
+		if ( 0 == wcscasecmp(resourceName, g_imageResourceFiles[i].name) && 0 == wcscasecmp(resourceType, g_imageResourceFiles[i].type) )
+		{
+			fileName = g_imageResourceFiles[i].fileName;
+			break;
+		}
+	}
+	if ( NULL == fileName )
+	{
+		return E_FAIL;
+	}
+
+	ifstream file(fileName, ios::binary);
+	if ( !file )
+	{
+		return E_FAIL;
+	}
+	file.seekg(0, ios::end);
+	storage.resize((size_t)file.tellg());
+	file.seekg(0, ios::beg);
+	if ( storage.empty() || !file.read(reinterpret_cast<char*>(&storage[0]), storage.size()) )
+	{
+		return E_FAIL;
+	}
+	data = &storage[0];
+	bytes = storage.size();
+	return S_OK;
+#endif
+}
+
+HRESULT LoadImageScaled(const BYTE* encoded, size_t bytes, int width, int height, const char* cachePrefix,
+	BYTE* output, ImageLoadStats* pStats)
+{
+	TRACE_SCOPE("LoadImageScaled");
+	ImageLoadStats stats;
+	memset(&stats, 0, sizeof(stats));
+	LONGLONG start = HighResClock::Now();
+	LONGLONG mark = start;
+
+	ULONGLONG sourceHash = 0;
+	string path;
+	if ( cachePrefix )
+	{
+		sourceHash = HashImageSource(encoded, bytes);
+		LONGLONG now = HighResClock::Now();
+		stats.hashMs = HighResClock::TicksToMilliseconds(now - mark);
+		mark = now;
+
+		path = ImageCachePath(cachePrefix, sourceHash, width, height);
+		stats.cacheHit = ReadCache(path, sourceHash, width, height, output);
+		now = HighResClock::Now();
+		stats.cacheReadMs = HighResClock::TicksToMilliseconds(now - mark);
+		mark = now;
+	}
+
+	HRESULT hr = S_OK;
+	if ( !stats.cacheHit )
+	{
+		vector<BYTE> decoded;
+		int sourceWidth, sourceHeight;
+		hr = DecodePng(encoded, bytes, decoded, sourceWidth, sourceHeight);
+		LONGLONG now = HighResClock::Now();
+		stats.decodeMs = HighResClock::TicksToMilliseconds(now - mark);
+		mark = now;
+
+		if ( SUCCEEDED(hr) )
+		{
+			if ( sourceWidth == width && sourceHeight == height )
+			{
+				memcpy(output, &decoded[0], decoded.size());
+			}
+			else
+			{
+				ScaleImage(&decoded[0], sourceWidth, sourceHeight, output, width, height);
+			}
+			Premultiply(output, (size_t)width * height);
+			now = HighResClock::Now();
+			stats.scaleMs = HighResClock::TicksToMilliseconds(now - mark);
+			mark = now;
+
+			if ( cachePrefix )
+			{
+				WriteCache(path, sourceHash, width, height, output);
+				now = HighResClock::Now();
+				stats.cacheWriteMs = HighResClock::TicksToMilliseconds(now - mark);
+			}
+		}
+	}
+
+	stats.totalMs = HighResClock::TicksToMilliseconds(HighResClock::Now() - start);
+	if ( pStats )
+	{
+		*pStats = stats;
+	}
+	return hr;
+}
@@ -0,0 +1,80 @@
+/*
+
+Image loader
+
+Loads an image scaled to the size it is drawn at, as premultiplied BGRA: the
+background, which used to go through WIC on every start-up. The PNG decoder
+is our own and portable: it inflates the IDAT stream with table-driven
+Huffman decoding straight into the filtered rows, unfilters them in place
+and converts to BGRA in one pass. It reads the 8 and 16-bit, non-interlaced
+images a background is saved as (grey, grey and alpha, RGB, RGBA and
+palette); anything else fails with ERROR_NOT_SUPPORTED. Scaling, when the
+size differs, is separable cubic, as WIC's cubic mode.
+
+The result is cached on disk, keyed by a hash of the encoded bytes and the
+target size, so a start-up after the first maps the cached pixels and skips
+decoding and scaling altogether. A changed image or size just misses the
+cache; a cache that cannot be written only costs the next start-up the
+decode.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <string>
+
+/// <summary>
+/// Where an image load spent its time
+/// </summary>
+typedef struct
+{
+	bool		cacheHit;
+	double		hashMs;			// hashing the encoded image for the cache key
+	double		cacheReadMs;	// mapping and copying the cached pixels, hit or not
+	double		decodeMs;
+	double		scaleMs;		// scaling and premultiplying
+	double		cacheWriteMs;
+	double		totalMs;
+} ImageLoadStats;
+
+/// <summary>
+/// The encoded bytes of an image resource: from the executable on Windows, and elsewhere from the file
+/// GreenScreen.rc builds it from, in the working directory
+/// </summary>
+/// <param name="storage">holds the bytes when they are read from the file</param>
+/// <param name="data">the bytes, in storage or in the resource</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT ReadImageResource(PCWSTR resourceName, PCWSTR resourceType, std::vector<BYTE>& storage, const BYTE*& data, size_t& bytes);
+
+/// <summary>
+/// Decodes a PNG to straight-alpha BGRA, top row first
+/// </summary>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT DecodePng(const BYTE* png, size_t bytes, std::vector<BYTE>& bgra, int& width, int& height);
+
+/// <summary>
+/// Cubic scaling of BGRA to another size, as LoadImageScaled scales
+/// </summary>
+void ScaleImage(const BYTE* source, int sourceWidth, int sourceHeight, BYTE* output, int width, int height);
+
+/// <summary>
+/// Decodes an image and scales it to the given size as premultiplied BGRA, or takes it from the cache
+/// </summary>
+/// <param name="cachePrefix">path and name start of the cache files, NULL for no cache</param>
+/// <param name="output">width * height * 4 bytes</param>
+/// <param name="pStats">where the time went, or NULL</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT LoadImageScaled(const BYTE* encoded, size_t bytes, int width, int height, const char* cachePrefix,
+	BYTE* output, ImageLoadStats* pStats);
+
+/// <summary>
+/// Name of the cache file for an image of this hash at this size
+/// </summary>
+std::string ImageCachePath(const char* cachePrefix, ULONGLONG sourceHash, int width, int height);
+
+/// <summary>
+/// FNV-1a hash of the encoded image, taken over 64-bit words, its cache key
+/// </summary>
+ULONGLONG HashImageSource(const BYTE* encoded, size_t bytes);
@@ -0,0 +1,25 @@
+/*
+
+Background load benchmark
+
+Times loading the background the way a start-up does, at 640x480 and
+1280x960: once cold, with the cache file deleted, so the PNG is decoded,
+scaled and the cache written, then several times warm, mapped from the
+cache. Each row splits the time into reading the resource, hashing, the
+cache read, decoding, scaling and the cache write, and checks the warm
+pixels against the cold ones. The cache files are named apart from the
+app's, so its cache is left alone. Run with /benchbackground; results go to
+background_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per load
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunImageLoaderBenchmark(const char* path);
@@ -7,24 +7,238 @@
 #include "stdafx.h"
 #include "ImageRenderer.h"
 #include "SimpleMIDIPlayer.h"
+#include "FloorPiano.h"
+#include "Trace.h"
+#include "ImageLoader.h"
 #include <iostream>
 #include <sstream>
 #include <cwchar>
-#include <Wincodec.h>
+#include <cstddef>
 
 using namespace std;
 
-#ifndef HINST_THISCOMPONENT
-EXTERN_C IMAGE_DOS_HEADER __ImageBase;
-#define HINST_THISCOMPONENT ((HINSTANCE)&__ImageBase)
-#endif
+// The unit quad, as a triangle strip
+static const GLfloat g_quadCorners[] = { 0.0f, 0.0f,  1.0f, 0.0f,  0.0f, 1.0f,  1.0f, 1.0f };
+
+// Background and players: the quad across the whole view, image row 0 at the top
+static const char* g_textureVertexShader =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 corner;\n"
+	"out vec2 uv;\n"
+	"void main() {\n"
+	"	uv = corner;\n"
+	"	gl_Position = vec4(corner.x * 2.0 - 1.0, 1.0 - corner.y * 2.0, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* g_textureFragmentShader =
+	"#version 330 core\n"
+	"uniform sampler2D image;\n"
+	"in vec2 uv;\n"
+	"out vec4 color;\n"
+	"void main() {\n"
+	"	color = texture(image, uv);\n"
+	"}\n";
+
+// Overlay shapes: the quad placed by a ShapeInstance, in view pixels
+static const char* g_shapeVertexShader =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 corner;\n"
+	"layout(location = 1) in vec4 rect;\n"
+	"layout(location = 2) in vec4 fill;\n"
+	"layout(location = 3) in float disc;\n"
+	"uniform vec2 viewSize;\n"
+	"out vec2 local;\n"
+	"out vec4 shade;\n"
+	"flat out float isDisc;\n"
+	"void main() {\n"
+	"	vec2 position = rect.xy + corner * rect.zw;\n"
+	"	local = corner * 2.0 - 1.0;\n"
+	"	shade = fill;\n"
+	"	isDisc = disc;\n"
+	"	gl_Position = vec4(position.x * 2.0 / viewSize.x - 1.0, 1.0 - position.y * 2.0 / viewSize.y, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* g_shapeFragmentShader =
+	"#version 330 core\n"
+	"in vec2 local;\n"
+	"in vec4 shade;\n"
+	"flat in float isDisc;\n"
+	"out vec4 color;\n"
+	"void main() {\n"
+	"	if ( isDisc > 0.5 && dot(local, local) > 1.0 ) discard;\n"
+	"	color = shade;\n"
+	"}\n";
+
+// Keyboard: key gl_InstanceID of keyCount across the keyboard rectangle, coloured by its KeyState
+// (0 up, 1 under a foot, 2 down)
+static const char* g_keyVertexShader =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 corner;\n"
+	"layout(location = 1) in float state;\n"
+	"uniform vec2 viewSize;\n"
+	"uniform vec4 keyboard;\n"
+	"uniform int keyCount;\n"
+	"uniform int firstNote;\n"
+	"out vec4 shade;\n"
+	"void main() {\n"
+	"	float keyWidth = keyboard.z / float(keyCount);\n"
+	"	vec2 position = vec2(keyboard.x + (float(gl_InstanceID) + 0.05 + corner.x * 0.9) * keyWidth, keyboard.y + corner.y * keyboard.w);\n"
+	"	int note = (firstNote + gl_InstanceID) % 12;\n"
+	"	bool black = note == 1 || note == 3 || note == 6 || note == 8 || note == 10;\n"
+	"	vec3 key = black ? vec3(0.1) : vec3(0.95);\n"
+	"	if ( state > 1.5 ) shade = vec4(1.0, 0.5, 0.1, 0.85);\n"
+	"	else if ( state > 0.5 ) shade = vec4(mix(key, vec3(1.0, 0.85, 0.2), 0.6), 0.6);\n"
+	"	else shade = vec4(key, 0.35);\n"
+	"	gl_Position = vec4(position.x * 2.0 / viewSize.x - 1.0, 1.0 - position.y * 2.0 / viewSize.y, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* g_keyFragmentShader =
+	"#version 330 core\n"
+	"in vec4 shade;\n"
+	"out vec4 color;\n"
+	"void main() {\n"
+	"	color = shade;\n"
+	"}\n";
+
+// The keyboard lies across the bottom of the view, where the feet are
+static const float g_keyboardTop = 0.85f;
+
+/// <summary>
+/// Key index of keyCount across the keyboard rectangle as a shape, placed and coloured as g_keyVertexShader does
+/// </summary>
+static void KeyShape(int index, int keyCount, int firstNote, BYTE state, float left, float top, float width, float height, ShapeInstance& shape)
+{
+	float keyWidth = width / keyCount;
+	shape.left = left + (index + 0.05f) * keyWidth;
+	shape.top = top;
+	shape.width = keyWidth * 0.9f;
+	shape.height = height;
+	shape.disc = 0.0f;
+
+	int note = (firstNote + index) % 12;
+	bool black = note == 1 || note == 3 || note == 6 || note == 8 || note == 10;
+	float key = black ? 0.1f : 0.95f;
+	if ( state == KeyStateDown )
+	{
+		shape.red = 1.0f; shape.green = 0.5f; shape.blue = 0.1f; shape.alpha = 0.85f;
+	}
+	else if ( state == KeyStateUnderFoot )
+	{
+		shape.red = key + (1.0f - key) * 0.6f; shape.green = key + (0.85f - key) * 0.6f; shape.blue = key + (0.2f - key) * 0.6f; shape.alpha = 0.6f;
+	}
+	else
+	{
+		shape.red = key; shape.green = key; shape.blue = key; shape.alpha = 0.35f;
+	}
+}
+
+// HUD frame time graph: a line strip in view pixels
+static const char* g_lineVertexShader =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 position;\n"
+	"uniform vec2 viewSize;\n"
+	"void main() {\n"
+	"	gl_Position = vec4(position.x * 2.0 / viewSize.x - 1.0, 1.0 - position.y * 2.0 / viewSize.y, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* g_lineFragmentShader =
+	"#version 330 core\n"
+	"uniform vec4 fill;\n"
+	"out vec4 color;\n"
+	"void main() {\n"
+	"	color = fill;\n"
+	"}\n";
+
+/// <summary>
+/// Compiles and links a vertex and fragment shader
+/// </summary>
+/// <returns>the program, or 0 if either shader failed to compile or the program failed to link</returns>
+static GLuint CompileProgram(const char* vertexSource, const char* fragmentSource)
+{
+	const char* sources[2] = { vertexSource, fragmentSource };
+	const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	GLuint program = glCreateProgram();
+	GLint ok = GL_TRUE;
+
+	for ( int i = 0; i < 2 && ok; ++i )
+	{
+		GLuint shader = glCreateShader(types[i]);
+		glShaderSource(shader, 1, &sources[i], NULL);
+		glCompileShader(shader);
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+		glAttachShader(program, shader);
+
+		// deleted once the program is, which still holds it
+		glDeleteShader(shader);
+	}
+
+	if ( ok )
+	{
+		glLinkProgram(program);
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	}
+
+	if ( !ok )
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
 
 /// <summary>
 /// Constructor
 /// </summary>
-ImageRenderer::ImageRenderer()
+ImageRenderer::ImageRenderer() :
+	m_hWnd(NULL),
+	m_hDC(NULL),
+	m_hRC(NULL),
+	m_bHaveContext(false),
+	m_bOffscreen(false),
+	m_framebuffer(0),
+	m_colorBuffer(0),
+	m_viewWidth(0),
+	m_viewHeight(0),
+	m_frameNumber(0),
+	m_bSoftware(false),
+	m_softwareFramesDelivered(0),
+	m_frameTexture(0),
+	m_bgTexture(0),
+	pboId(0),
+	m_pPixelBuffer(NULL),
+	m_pArena(NULL),
+	m_backgroundCount(0),
+	m_selectedBackground(0),
+	m_drawnBackground(0),
+	m_bHavePlayers(false),
+	m_bMaskInAlpha(false),
+	m_quadBuffer(0),
+	m_textureArray(0),
+	m_textureProgram(0),
+	m_shapeArray(0),
+	m_shapeBuffer(0),
+	m_shapeProgram(0),
+	m_keyArray(0),
+	m_keyStateBuffer(0),
+	m_keyProgram(0),
+	m_keyCount(0),
+	m_firstNote(0),
+	m_bKeyStatesUploaded(false),
+	m_lineArray(0),
+	m_lineBuffer(0),
+	m_lineProgram(0),
+	m_shapeCount(0),
+	m_frameDrawCalls(0),
+	m_drawCalls(0),
+	m_pFrameTimer(NULL),
+	m_showTimingHud(0),
+	m_lastPresentTicks(0)
 {
-	
+	InitializeCriticalSection(&m_readbackLock);
+	ZeroMemory(m_streamTargets, sizeof(m_streamTargets));
+	m_streamTargetCount = 0;
+	ZeroMemory(&m_snapshotTarget, sizeof(m_snapshotTarget));
+	ZeroMemory(m_backgrounds, sizeof(m_backgrounds));
 }
 
 /// <summary>
@@ -32,25 +246,166 @@ ImageRenderer::ImageRenderer()
 /// </summary>
 ImageRenderer::~ImageRenderer()
 {
+	// the decoders stop before their sources go, and before the buffers they decode into
+	for ( int i = 0; i < m_backgroundCount; ++i )
+	{
+		delete m_backgrounds[i].pStream;
+		delete m_backgrounds[i].pSource;
+	}
 
+	// whichever thread drew last left the context detached; it is made current here to delete what
+	// was made on it, then destroyed, as is a context a failed Initialize left current
+	if ( m_bHaveContext )
+	{
+		AttachContext();
+		releaseGL();
+	}
+	if ( m_bOffscreen )
+	{
+		m_offscreenContext.Destroy();
+	}
+#ifdef _WIN32
+	else if ( m_hRC )
+	{
+		DisableOpenGL();
+	}
+	else if ( m_hDC )
+	{
+		ReleaseDC( m_hWnd, m_hDC );
+	}
+#endif
+	DeleteCriticalSection(&m_readbackLock);
 }
 
-HRESULT ImageRenderer::Initialize( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride ){
+#ifdef _WIN32
+HRESULT ImageRenderer::Initialize( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena ){
 	m_hWnd = hWnd;
 	EnableOpenGL();
+	if ( NULL == m_hRC )
+	{
+		return E_FAIL;
+	}
+	m_bHaveContext = true;
+
+	HRESULT hr = initializeGL( sourceWidth, sourceHeight, sourceStride, pArena );
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
 
+	// sized for the window as it is; a read of a bigger one grows its buffer
+	RECT rct;
+	GetClientRect( m_hWnd, &rct );
+	return m_readback.Initialize( rct.right, rct.bottom );
+}
+#endif
+
+HRESULT ImageRenderer::InitializeOffscreen( int viewWidth, int viewHeight, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena ){
+	m_bOffscreen = true;
+	m_viewWidth = viewWidth;
+	m_viewHeight = viewHeight;
+
+	HRESULT hr = m_offscreenContext.Create();
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	m_bHaveContext = true;
+
+	hr = initializeGL( sourceWidth, sourceHeight, sourceStride, pArena );
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	// the framebuffer stays bound, in place of the window's
+	glGenRenderbuffers( 1, &m_colorBuffer );
+	glBindRenderbuffer( GL_RENDERBUFFER, m_colorBuffer );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, m_viewWidth, m_viewHeight );
+	glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+	glGenFramebuffers( 1, &m_framebuffer );
+	glBindFramebuffer( GL_FRAMEBUFFER, m_framebuffer );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer );
+	if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+	{
+		return E_FAIL;
+	}
+
+	return m_readback.Initialize( m_viewWidth, m_viewHeight );
+}
+
+HRESULT ImageRenderer::InitializeSoftware( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena ){
+	m_bSoftware = true;
+
+	// without a window, as always off Windows, the frames only go to the sinks
+	m_hWnd = hWnd;
+#ifdef _WIN32
+	if ( m_hWnd )
+	{
+		m_hDC = GetDC( m_hWnd );
+		SetStretchBltMode( m_hDC, COLORONCOLOR );
+	}
+#endif
+
+	HRESULT hr = loadBackground( sourceWidth, sourceHeight, sourceStride, pArena );
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	return m_software.Initialize( m_sourceWidth, m_sourceHeight, m_backgroundRGBX, 0, pArena );
+}
+
+HRESULT ImageRenderer::loadBackground( int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena ){
     m_sourceWidth  = sourceWidth;
     m_sourceHeight = sourceHeight;
     m_sourceStride = sourceStride;
 
+	m_backgroundRGBX = pArena->Allocate<BYTE>(m_sourceWidth*m_sourceHeight*sizeof(long));
+	if ( NULL == m_backgroundRGBX.Data() )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// the first of the set; moving backgrounds keep their rings in the same arena
+	m_pArena = pArena;
+	m_backgrounds[0].pixels = m_backgroundRGBX;
+	m_backgroundCount = 1;
+
+	// decoded and scaled once, then mapped from the cache in the working directory on later start-ups
+	vector<BYTE> storage;
+	const BYTE* pEncoded;
+	size_t encodedBytes;
+	HRESULT hr = ReadImageResource(L"Background", L"Image", storage, pEncoded, encodedBytes);
+	if ( SUCCEEDED(hr) )
+	{
+		hr = LoadImageScaled(pEncoded, encodedBytes, m_sourceWidth, m_sourceHeight, "Background", m_backgroundRGBX, NULL);
+	}
+	return hr;
+}
+
+HRESULT ImageRenderer::initializeGL( int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena ){
+	// the renderer is built on the 3.3 core profile: shaders, vertex arrays and instancing. Off
+	// Windows the context is created 3.3 core or not at all
+#ifdef _WIN32
+	if ( !GLEW_VERSION_3_3 )
+	{
+		return E_FAIL;
+	}
+#endif
+
 	// Load the background image into a texture
-	m_backgroundRGBX = new BYTE[m_sourceWidth*m_sourceHeight*sizeof(long)];
-	LoadResourceImage(L"Background", L"Image", m_sourceWidth*m_sourceHeight*sizeof(long), m_backgroundRGBX);
+	HRESULT hr = loadBackground( sourceWidth, sourceHeight, sourceStride, pArena );
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
 	glGenTextures( 1, &m_bgTexture );
     glBindTexture(GL_TEXTURE_2D, m_bgTexture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_sourceWidth, m_sourceHeight, 0,  GL_BGRA, GL_UNSIGNED_BYTE, m_backgroundRGBX);
-
+	m_backgrounds[0].textures[0] = m_bgTexture;
 
 	// Create a texture for rendering frames to
 	glGenTextures( 1, &m_frameTexture );
@@ -63,161 +418,889 @@ HRESULT ImageRenderer::Initialize( HWND hWnd, int sourceWidth, int sourceHeight,
     glBindTexture(GL_TEXTURE_2D, 0);
 
 	// Create a pixel buffer for the frame texture
-	glewInit();
-	glGenBuffers(0, &pboId);
+	glGenBuffers(1, &pboId);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
 	glBufferData(GL_PIXEL_UNPACK_BUFFER, m_sourceWidth*m_sourceHeight*sizeof(long),0,GL_STREAM_DRAW);
-	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	
     // OpenGL setup
     glClearColor(0,0,0,0);
     glClearDepth(1.0f);
-    glEnable(GL_TEXTURE_2D);
-
-    // Initial camera setup
-    glViewport(0, 0, m_sourceWidth, m_sourceHeight);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0,  m_sourceWidth, m_sourceHeight, 0, 1, -1);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-	
-	return S_OK;
+
+	return createPipeline();
+}
+
+void ImageRenderer::releaseGL(){
+	m_readback.Release();
+
+	// names never generated are 0, which the deletes skip
+	for ( int i = 1; i < m_backgroundCount; ++i )
+	{
+		glDeleteTextures( 2, m_backgrounds[i].textures );
+		glDeleteBuffers( BackgroundStream::cRingFrames, m_backgrounds[i].buffers );
+	}
+
+	const GLuint textures[] = { m_bgTexture, m_frameTexture };
+	glDeleteTextures( sizeof(textures) / sizeof(textures[0]), textures );
+
+	const GLuint buffers[] = { pboId, m_quadBuffer, m_shapeBuffer, m_keyStateBuffer, m_lineBuffer };
+	glDeleteBuffers( sizeof(buffers) / sizeof(buffers[0]), buffers );
+
+	const GLuint arrays[] = { m_textureArray, m_shapeArray, m_keyArray, m_lineArray };
+	glDeleteVertexArrays( sizeof(arrays) / sizeof(arrays[0]), arrays );
+
+	glDeleteProgram( m_textureProgram );
+	glDeleteProgram( m_shapeProgram );
+	glDeleteProgram( m_keyProgram );
+	glDeleteProgram( m_lineProgram );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glDeleteFramebuffers( 1, &m_framebuffer );
+	glDeleteRenderbuffers( 1, &m_colorBuffer );
+}
+
+HRESULT ImageRenderer::createPipeline(){
+	m_textureProgram = CompileProgram( g_textureVertexShader, g_textureFragmentShader );
+	m_shapeProgram = CompileProgram( g_shapeVertexShader, g_shapeFragmentShader );
+	m_lineProgram = CompileProgram( g_lineVertexShader, g_lineFragmentShader );
+	m_keyProgram = CompileProgram( g_keyVertexShader, g_keyFragmentShader );
+	if ( !m_textureProgram || !m_shapeProgram || !m_lineProgram || !m_keyProgram )
+	{
+		return E_FAIL;
+	}
+	m_shapeViewSize = glGetUniformLocation( m_shapeProgram, "viewSize" );
+	m_keyViewSize = glGetUniformLocation( m_keyProgram, "viewSize" );
+	m_keyKeyboard = glGetUniformLocation( m_keyProgram, "keyboard" );
+	m_keyKeyCount = glGetUniformLocation( m_keyProgram, "keyCount" );
+	m_keyFirstNote = glGetUniformLocation( m_keyProgram, "firstNote" );
+	m_lineViewSize = glGetUniformLocation( m_lineProgram, "viewSize" );
+	m_lineColor = glGetUniformLocation( m_lineProgram, "fill" );
+
+	// the quad never changes
+	glGenBuffers( 1, &m_quadBuffer );
+	glBindBuffer( GL_ARRAY_BUFFER, m_quadBuffer );
+	glBufferData( GL_ARRAY_BUFFER, sizeof(g_quadCorners), g_quadCorners, GL_STATIC_DRAW );
+
+	glGenVertexArrays( 1, &m_textureArray );
+	glBindVertexArray( m_textureArray );
+	glEnableVertexAttribArray( 0 );
+	glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+
+	// shapes: the quad per vertex, a ShapeInstance per instance
+	glGenBuffers( 1, &m_shapeBuffer );
+	glGenVertexArrays( 1, &m_shapeArray );
+	glBindVertexArray( m_shapeArray );
+	glEnableVertexAttribArray( 0 );
+	glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+
+	glBindBuffer( GL_ARRAY_BUFFER, m_shapeBuffer );
+	glBufferData( GL_ARRAY_BUFFER, sizeof(m_shapes), NULL, GL_STREAM_DRAW );
+	glEnableVertexAttribArray( 1 );
+	glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (const GLvoid*)offsetof(ShapeInstance, left) );
+	glVertexAttribDivisor( 1, 1 );
+	glEnableVertexAttribArray( 2 );
+	glVertexAttribPointer( 2, 4, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (const GLvoid*)offsetof(ShapeInstance, red) );
+	glVertexAttribDivisor( 2, 1 );
+	glEnableVertexAttribArray( 3 );
+	glVertexAttribPointer( 3, 1, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (const GLvoid*)offsetof(ShapeInstance, disc) );
+	glVertexAttribDivisor( 3, 1 );
+
+	// keys: the quad per vertex, a KeyState byte per instance
+	glGenBuffers( 1, &m_keyStateBuffer );
+	glGenVertexArrays( 1, &m_keyArray );
+	glBindVertexArray( m_keyArray );
+	glBindBuffer( GL_ARRAY_BUFFER, m_quadBuffer );
+	glEnableVertexAttribArray( 0 );
+	glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+
+	glBindBuffer( GL_ARRAY_BUFFER, m_keyStateBuffer );
+	glBufferData( GL_ARRAY_BUFFER, cMaxKeys, NULL, GL_DYNAMIC_DRAW );
+	glEnableVertexAttribArray( 1 );
+	glVertexAttribPointer( 1, 1, GL_UNSIGNED_BYTE, GL_FALSE, 1, 0 );
+	glVertexAttribDivisor( 1, 1 );
+
+	// the graph, rewritten whenever the HUD is drawn
+	glGenBuffers( 1, &m_lineBuffer );
+	glGenVertexArrays( 1, &m_lineArray );
+	glBindVertexArray( m_lineArray );
+	glBindBuffer( GL_ARRAY_BUFFER, m_lineBuffer );
+	glBufferData( GL_ARRAY_BUFFER, cGraphFrames * 2 * sizeof(GLfloat), NULL, GL_STREAM_DRAW );
+	glEnableVertexAttribArray( 0 );
+	glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+
+	glBindVertexArray( 0 );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	return ( glGetError() == GL_NO_ERROR ) ? S_OK : E_FAIL;
 }
 
 /// <summary>
 /// Draws a 32 bit per pixel image of previously specified width, height, and stride to the associated hwnd
 /// </summary>
-/// <param name="pImage">image data in RGBX format</param>
-/// <param name="cbImage">size of image data in bytes</param>
+/// <param name="pImage">image data in RGBX format, or NULL to draw the players already in the texture</param>
+/// <param name="feetPoints">foot marker positions</param>
+/// <param name="keyStates">KeyState of the first keys, or NULL to keep the last ones</param>
+/// <param name="keyStateCount">entries in keyStates</param>
 /// <returns>indicates success or failure</returns>
 HRESULT ImageRenderer::Draw(
-	BYTE* pImage, Point2f feetPoints[4] 
+	BYTE* pImage, Point2f feetPoints[4], const BYTE* keyStates, int keyStateCount
 	)
 {
-	RECT rct;
-	GetClientRect( m_hWnd, &rct);
-	int width = rct.right;
-	int height = rct.bottom;
+	TRACE_SCOPE("ImageRenderer::Draw");
+	LONGLONG drawStart = HighResClock::Now();
+
+	// everything past here reads m_keyCount states, so fewer are padded out with keys up
+	if ( keyStates && keyStateCount < m_keyCount )
+	{
+		int count = ( keyStateCount < 0 ) ? 0 : keyStateCount;
+		memcpy( m_paddedKeyStates, keyStates, count );
+		memset( m_paddedKeyStates + count, KeyStateUp, m_keyCount - count );
+		keyStates = m_paddedKeyStates;
+	}
+
+	int width = m_viewWidth;
+	int height = m_viewHeight;
+	if ( m_bSoftware && !m_hWnd )
+	{
+		width = m_sourceWidth;
+		height = m_sourceHeight;
+	}
+#ifdef _WIN32
+	else if ( !m_bOffscreen )
+	{
+		RECT rct;
+		GetClientRect( m_hWnd, &rct);
+		width = rct.right;
+		height = rct.bottom;
+	}
+#endif
+
+	// the overlay is queued and uploaded before anything is drawn, so no buffer this frame
+	// draws from is written after drawing starts
+	m_shapeCount = 0;
+	addFootMarkers( feetPoints );
+
+	bool showHud = m_showTimingHud && m_pFrameTimer;
+	if ( showHud )
+	{
+		addTimingHud();
+	}
+
+	bool backgroundChanged;
+	const BYTE* background = updateBackground( backgroundChanged );
+
+	m_frameDrawCalls = 0;
+	if ( m_bSoftware )
+	{
+		composeSoftware( pImage, backgroundChanged ? background : NULL, keyStates, showHud, width, height );
+	}
+	else
+	{
+		drawLayers( pImage, keyStates, showHud, width, height );
+	}
+	m_drawCalls = m_frameDrawCalls;
+
+	// finished, swap buffers
+	TRACE_SCOPE("SwapBuffers");
+	if ( !m_pFrameTimer )
+	{
+		present( width, height );
+		return S_OK;
+	}
+
+	LONGLONG swapStart = m_pFrameTimer->End( FrameStageDraw, drawStart );
+	present( width, height );
+	LONGLONG presented = m_pFrameTimer->End( FrameStageSwap, swapStart );
+
+	if ( m_lastPresentTicks != 0 )
+	{
+		m_pFrameTimer->Record( FrameStageFrame, presented - m_lastPresentTicks );
+	}
+	m_lastPresentTicks = presented;
+
+	return S_OK;
+}
+
+void ImageRenderer::drawLayers( BYTE* pImage, const BYTE* keyStates, bool showHud, int width, int height ){
+	if ( showHud )
+	{
+		uploadTimingGraph();
+	}
+	uploadShapes();
+	uploadKeyStates( keyStates );
 
-	// set the orthogonal projection
 	glViewport(0, 0, width, height);
-	glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, width, height, 0, 1, -1);
 
 	// clear the buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glColor4f( 1.0f, 1.0f, 1.0f, 1.0f );
 
-	// requires the orthogonal projection
-	drawBG( width, height );
+	{
+		TRACE_SCOPE("drawBG");
+		drawBG();
+	}
 
-	// also requires the orthogonal projection
-	drawPlayers( pImage, width, height );
+	if ( pImage || m_bHavePlayers )
+	{
+		TRACE_SCOPE("drawPlayers");
+		drawPlayers( pImage );
+	}
 
-	drawFootMarkers( feetPoints );
-	
-	// finished, swap buffers
-	SwapBuffers( m_hDC );
+	// the keys are one instanced draw whatever their number, and the rest of the overlay but the graph another
+	drawKeyboard( width, height );
+	drawShapes( width, height );
+
+	if ( showHud )
+	{
+		drawTimingGraph( width, height );
+	}
+
+	if ( m_bMaskInAlpha )
+	{
+		drawMask();
+	}
+}
+
+void ImageRenderer::composeSoftware( BYTE* pImage, const BYTE* background, const BYTE* keyStates, bool showHud, int viewWidth, int viewHeight ){
+	// the layers GL draws, in its order: keys, then the shapes queued, then the graph. The frame is
+	// the source size, so the overlay is scaled to it from the view's
+	int width = m_sourceWidth;
+	int height = m_sourceHeight;
+	float scaleX = (float)width / viewWidth;
+	float scaleY = (float)height / viewHeight;
+	if ( keyStates )
+	{
+		memcpy( m_keyStates, keyStates, m_keyCount );
+	}
+
+	int shapeCount = 0;
+	float top = height * g_keyboardTop;
+	for ( int key = 0; key < m_keyCount; ++key )
+	{
+		KeyShape( key, m_keyCount, m_firstNote, m_keyStates[key], 0.0f, top, (float)width, height - top, m_softwareShapes[shapeCount++] );
+	}
+	for ( int i = 0; i < m_shapeCount; ++i )
+	{
+		ShapeInstance& shape = m_softwareShapes[shapeCount++];
+		shape = m_shapes[i];
+		shape.left *= scaleX;
+		shape.width *= scaleX;
+		shape.top *= scaleY;
+		shape.height *= scaleY;
+	}
+
+	GLfloat points[cGraphFrames * 2];
+	SoftwareFrame frame;
+	frame.playersRGBX = pImage;
+	frame.backgroundRGBX = background;
+	frame.shapes = m_softwareShapes;
+	frame.shapeCount = shapeCount;
+	frame.linePoints = NULL;
+	frame.linePointCount = 0;
+	frame.maskInAlpha = m_bMaskInAlpha;
+	if ( showHud )
+	{
+		timingGraphPoints( points );
+		for ( int i = 0; i < cGraphFrames; ++i )
+		{
+			points[i * 2] *= scaleX;
+			points[i * 2 + 1] *= scaleY;
+		}
+		frame.linePoints = points;
+		frame.linePointCount = cGraphFrames;
+		frame.lineColor[0] = 1.0f;
+		frame.lineColor[1] = 1.0f;
+		frame.lineColor[2] = 1.0f;
+		frame.lineColor[3] = 0.9f;
+	}
+
+	m_software.Compose( frame );
+}
+
+void ImageRenderer::presentSoftware( const FrameTarget* targets, int targetCount, LONGLONG presentTicks ){
+	const BYTE* pixels = m_software.Pixels();
+	int width = m_software.Width();
+	int height = m_software.Height();
+
+	// the frame is already in memory, so there is nothing to wait for
+	for ( int i = 0; i < targetCount; ++i )
+	{
+		targets[i].sink( targets[i].context, pixels, width, height, width * 4, m_frameNumber, presentTicks );
+	}
+	if ( targetCount > 0 )
+	{
+		++m_softwareFramesDelivered;
+	}
+	++m_frameNumber;
+
+#ifdef _WIN32
+	if ( m_hWnd )
+	{
+		TRACE_SCOPE("StretchDIBits");
+		BITMAPINFO info;
+		ZeroMemory( &info, sizeof(info) );
+		info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		info.bmiHeader.biWidth = width;
+		info.bmiHeader.biHeight = -height;		// top-down
+		info.bmiHeader.biPlanes = 1;
+		info.bmiHeader.biBitCount = 32;
+		info.bmiHeader.biCompression = BI_RGB;
+
+		RECT rct;
+		GetClientRect( m_hWnd, &rct );
+		StretchDIBits( m_hDC, 0, 0, rct.right, rct.bottom, 0, 0, width, height, pixels, &info, DIB_RGB_COLORS, SRCCOPY );
+	}
+#endif
+}
+
+void ImageRenderer::present( int width, int height ){
+	FrameTarget targets[FrameReadback::cMaxTargets];
+	int targetCount = 0;
+	LONGLONG presentTicks = HighResClock::Now();
+
+	EnterCriticalSection( &m_readbackLock );
+	for ( int i = 0; i < m_streamTargetCount; ++i )
+	{
+		targets[targetCount++] = m_streamTargets[i];
+	}
+	if ( m_snapshotTarget.sink )
+	{
+		targets[targetCount++] = m_snapshotTarget;
+		m_snapshotTarget.sink = NULL;
+	}
+	LeaveCriticalSection( &m_readbackLock );
+
+	if ( m_bSoftware )
+	{
+		presentSoftware( targets, targetCount, presentTicks );
+		return;
+	}
+
+	// the read of the back buffer is queued before the swap; the frame only pays for queueing it
+	if ( m_bOffscreen || targetCount > 0 )
+	{
+		m_readback.Queue( m_frameNumber, presentTicks, width, height, targets, targetCount );
+	}
+	++m_frameNumber;
+
+#ifdef _WIN32
+	if ( !m_bOffscreen )
+	{
+		SwapBuffers( m_hDC );
+	}
+#endif
 
+	// hand over whichever earlier reads have landed
+	m_readback.Collect( false );
+}
+
+bool ImageRenderer::AddFrameSink( FrameSink sink, void* context ){
+	EnterCriticalSection( &m_readbackLock );
+	bool added = ( m_streamTargetCount < cMaxFrameSinks );
+	if ( added )
+	{
+		m_streamTargets[m_streamTargetCount].sink = sink;
+		m_streamTargets[m_streamTargetCount].context = context;
+		++m_streamTargetCount;
+	}
+	LeaveCriticalSection( &m_readbackLock );
+	return added;
+}
+
+void ImageRenderer::RemoveFrameSink( FrameSink sink, void* context ){
+	EnterCriticalSection( &m_readbackLock );
+	for ( int i = 0; i < m_streamTargetCount; ++i )
+	{
+		if ( m_streamTargets[i].sink == sink && m_streamTargets[i].context == context )
+		{
+			// keep the rest in the order they were added
+			for ( int j = i + 1; j < m_streamTargetCount; ++j )
+			{
+				m_streamTargets[j - 1] = m_streamTargets[j];
+			}
+			--m_streamTargetCount;
+			break;
+		}
+	}
+	LeaveCriticalSection( &m_readbackLock );
+}
+
+void ImageRenderer::RequestSnapshot( FrameSink sink, void* context ){
+	EnterCriticalSection( &m_readbackLock );
+	m_snapshotTarget.sink = sink;
+	m_snapshotTarget.context = context;
+	LeaveCriticalSection( &m_readbackLock );
+}
+
+void ImageRenderer::FlushReadback(){
+	// software frames are handed over as they are drawn
+	if ( !m_bSoftware )
+	{
+		m_readback.Collect( true );
+	}
+}
+
+HRESULT ImageRenderer::AddBackground( BackgroundSource* pSource, int& index ){
+	if ( m_backgroundCount == cMaxBackgrounds || NULL == m_pArena )
+	{
+		delete pSource;
+		return E_FAIL;
+	}
+
+	BackgroundLayer& layer = m_backgrounds[m_backgroundCount];
+	layer.pSource = pSource;
+	layer.pStream = new BackgroundStream();
+	HRESULT hr = S_OK;
+	if ( m_bSoftware )
+	{
+		// the frames are blended where they are, so the ring is in the arena
+		hr = layer.pStream->Start( pSource, m_sourceWidth, m_sourceHeight, m_pArena );
+	}
+	else
+	{
+		BYTE* slotMemory[BackgroundStream::cRingFrames];
+		glGenBuffers( BackgroundStream::cRingFrames, layer.buffers );
+		for ( int i = 0; i < BackgroundStream::cRingFrames && SUCCEEDED(hr); ++i )
+		{
+			slotMemory[i] = mapBackgroundBuffer( layer.buffers[i] );
+			if ( NULL == slotMemory[i] )
+			{
+				hr = E_FAIL;
+			}
+		}
+		if ( SUCCEEDED(hr) )
+		{
+			hr = layer.pStream->Start( pSource, m_sourceWidth, m_sourceHeight, slotMemory );
+		}
+	}
+	if ( FAILED(hr) )
+	{
+		// the decoder is stopped before its buffers go, and deleting one unmaps it
+		delete layer.pStream;
+		if ( !m_bSoftware )
+		{
+			glDeleteBuffers( BackgroundStream::cRingFrames, layer.buffers );
+		}
+		delete layer.pSource;
+		ZeroMemory( &layer, sizeof(layer) );
+		return hr;
+	}
+	layer.pixels = layer.pStream->Current();
+
+	if ( !m_bSoftware )
+	{
+		glGenTextures( 2, layer.textures );
+		for ( int i = 0; i < 2; ++i )
+		{
+			glBindTexture( GL_TEXTURE_2D, layer.textures[i] );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+			glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, m_sourceWidth, m_sourceHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL );
+		}
+		glBindTexture( GL_TEXTURE_2D, 0 );
+		uploadBackground( layer );
+	}
+
+	index = m_backgroundCount++;
 	return S_OK;
 }
 
-void ImageRenderer::drawBG(int width, int height){
-	glBindTexture(GL_TEXTURE_2D, m_bgTexture);
-    glBegin(GL_QUADS);
-       glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(0, 0, 0);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(width, 0, 0);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(width, height, 0.0f);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(0, height, 0.0f);
-    glEnd();
-	glBindTexture(GL_TEXTURE_2D, 0);
+void ImageRenderer::SelectBackground( int index ){
+	if ( index >= 0 && index < m_backgroundCount )
+	{
+		InterlockedExchange( &m_selectedBackground, index );
+	}
 }
 
-void ImageRenderer::drawPlayers(BYTE* pImage, int width, int height){
-	// use a pixel buffer to copy frame data using DMA
-	glBindTexture(GL_TEXTURE_2D, m_frameTexture);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+bool ImageRenderer::GetBackgroundStats( int index, BackgroundStreamStats& stats ) const{
+	if ( index <= 0 || index >= m_backgroundCount )
+	{
+		return false;
+	}
+	m_backgrounds[index].pStream->GetStats( stats );
+	return true;
+}
 
-    // copy pixels from buffer to texture
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_sourceWidth, m_sourceHeight, GL_BGRA_EXT, GL_UNSIGNED_BYTE, 0);
+const BYTE* ImageRenderer::updateBackground( bool& changed ){
+	int selected = m_selectedBackground;
+	BackgroundLayer& layer = m_backgrounds[selected];
+	LONGLONG now = HighResClock::Now();
 
-	// bind PBO to update pixel values
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
-	glBufferData(GL_PIXEL_UNPACK_BUFFER, m_sourceWidth*m_sourceHeight*sizeof(long), 0, GL_STREAM_DRAW);
-	
-	GLubyte* ptr = (GLubyte*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-    if(ptr)
-    {
-        // update data directly on the mapped buffer
-		int size = m_sourceWidth*m_sourceHeight;
-        for(int i=0;i<size;i++){
-			((long*)ptr)[i] = ((long*)pImage)[i];
+	// a moving background switched to picks up its clock at the frame it was left at
+	changed = ( selected != m_drawnBackground );
+	m_drawnBackground = selected;
+	if ( NULL == layer.pStream )
+	{
+		return layer.pixels;
+	}
+	if ( changed )
+	{
+		layer.pStream->Resume( now );
+	}
+
+	bool newFrame;
+	layer.pixels = layer.pStream->Frame( now, newFrame );
+	if ( newFrame )
+	{
+		changed = true;
+		if ( !m_bSoftware )
+		{
+			uploadBackground( layer );
 		}
-		
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER); // release pointer to mapping buffer
-    }
+	}
+	return layer.pixels;
+}
+
+void ImageRenderer::uploadBackground( BackgroundLayer& layer ){
+	TRACE_SCOPE("uploadBackground");
+	GLuint buffer = layer.buffers[layer.pStream->CurrentSlot()];
+
+	// the decoder wrote the frame into the buffer while it was mapped, so unmapped, the GPU copies it to
+	// the texture not on show. A buffer whose contents were lost leaves the frame before up
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+	if ( glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER ) )
+	{
+		layer.shown ^= 1;
+		glBindTexture( GL_TEXTURE_2D, layer.textures[layer.shown] );
+		glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, m_sourceWidth, m_sourceHeight, GL_BGRA, GL_UNSIGNED_BYTE, 0 );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+	// mapped again at once, ready for whichever frame the decoder writes to the slot next. If it cannot
+	// be, the slot cannot go back to the decoder, so the stream stops on the frame on show
+	BYTE* pMemory = mapBackgroundBuffer( buffer );
+	if ( pMemory )
+	{
+		layer.pStream->RemapCurrent( pMemory );
+	}
+	else
+	{
+		layer.pStream->Stop();
+	}
+}
+
+BYTE* ImageRenderer::mapBackgroundBuffer( GLuint buffer ){
+	GLsizeiptr bytes = (GLsizeiptr)m_sourceWidth * m_sourceHeight * 4;
+
+	// orphaned, and invalidated as it is mapped, so the map never waits for the GPU to finish copying
+	// the last frame out: the driver gives the buffer fresh storage instead
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+	glBufferData( GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW );
+	void* pMemory = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	return static_cast<BYTE*>(pMemory);
+}
+
+void ImageRenderer::SetFrameTimer( FrameTimer* pFrameTimer ){
+	m_pFrameTimer = pFrameTimer;
+}
+
+void ImageRenderer::SetMaskInAlpha( bool maskInAlpha ){
+	m_bMaskInAlpha = maskInAlpha;
+}
+
+void ImageRenderer::SetTimingHudVisible( bool visible ){
+	InterlockedExchange( &m_showTimingHud, visible ? 1 : 0 );
+}
+
+void ImageRenderer::SetKeyboard( int keyCount, int firstNote ){
+	m_keyCount = ( keyCount < 0 ) ? 0 : ( keyCount > cMaxKeys ) ? cMaxKeys : keyCount;
+	m_firstNote = firstNote;
+
+	// all up, written to the buffer whole with the first states drawn
+	ZeroMemory( m_keyStates, sizeof(m_keyStates) );
+	m_bKeyStatesUploaded = false;
+}
+
+void ImageRenderer::AttachContext(){
+	if ( m_bSoftware )
+	{
+		return;
+	}
+	if ( m_bOffscreen )
+	{
+		m_offscreenContext.MakeCurrent();
+		return;
+	}
+#ifdef _WIN32
+	wglMakeCurrent( m_hDC, m_hRC );
+#endif
+}
+
+void ImageRenderer::DetachContext(){
+	if ( m_bSoftware )
+	{
+		return;
+	}
+	if ( m_bOffscreen )
+	{
+		m_offscreenContext.Release();
+		return;
+	}
+#ifdef _WIN32
+	wglMakeCurrent( NULL, NULL );
+#endif
+}
+
+void ImageRenderer::drawBG(){
+	const BackgroundLayer& layer = m_backgrounds[m_drawnBackground];
+	glUseProgram(m_textureProgram);
+	glBindVertexArray(m_textureArray);
+	glBindTexture(GL_TEXTURE_2D, layer.textures[layer.shown]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	++m_frameDrawCalls;
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ImageRenderer::drawPlayers(BYTE* pImage){
+	glBindTexture(GL_TEXTURE_2D, m_frameTexture);
+
+	// the players only change with a new composite, an overlay-only redraw reuses the texture as it is
+	if ( pImage ){
+		uploadPlayers( pImage );
+	}
 
 	// Use transparency to implement the 'greenscreen' 
 	glEnable(GL_BLEND);
 	glBlendFunc (GL_ONE_MINUS_SRC_ALPHA,GL_SRC_ALPHA);
-	
-    glBegin(GL_QUADS);
-       glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(0, 0, 0);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(width, 0, 0);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(width, height, 0.0f);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(0, height, 0.0f);
-    glEnd(); 
+
+	glUseProgram(m_textureProgram);
+	glBindVertexArray(m_textureArray);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	++m_frameDrawCalls;
 
 	glDisable(GL_BLEND);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 }
 
-void ImageRenderer::drawFootMarkers( Point2f feetPoints[4] ){
+void ImageRenderer::uploadPlayers(BYTE* pImage){
+	// use a pixel buffer to copy frame data using DMA
+	size_t bytes = m_sourceWidth*m_sourceHeight*4;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+
+	// orphan the buffer, so filling it never waits for the last upload from it
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+
+	// fill it with this composite first, then upload from it, so the texture holds the composite being drawn
+	bool filled = false;
+	GLubyte* ptr = (GLubyte*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if ( ptr ){
+		memcpy( ptr, pImage, bytes );
+
+		// false if the buffer's contents were lost while it was mapped
+		filled = ( glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_FALSE );
+	}
+	if ( filled ){
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_sourceWidth, m_sourceHeight, GL_BGRA_EXT, GL_UNSIGNED_BYTE, 0);
+		m_bHavePlayers = true;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void ImageRenderer::drawMask(){
+	// alpha only, straight from the players' texture: 0 where there is a player, 1 elsewhere
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_TRUE);
+
+	if ( m_bHavePlayers ){
+		glUseProgram(m_textureProgram);
+		glBindVertexArray(m_textureArray);
+		glBindTexture(GL_TEXTURE_2D, m_frameTexture);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		++m_frameDrawCalls;
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	else{
+		glClearColor(0, 0, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(0, 0, 0, 0);
+	}
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void ImageRenderer::addFootMarkers( Point2f feetPoints[4] ){
+	const float radius = 10.0f;
+
 	for ( int i=0; i<4; i++ ){
 		if ( feetPoints[i].x != 0.0f && feetPoints[i].y != 0.0f ){
-			circle( feetPoints[i].x, feetPoints[i].y, 10.0f, 10, 1.0f, 0.0f, 0.0f );
+			addShape( feetPoints[i].x - radius, feetPoints[i].y - radius, 2.0f * radius, 2.0f * radius, 1.0f, 0.0f, 0.0f, 1.0f, true );
 		}
 	}
-	//circle( 100.0f, 100.0f, 10.0f, 10, 1.0f, 0.0f, 0.0f );
 }
 
+void ImageRenderer::addShape(float left, float top, float width, float height, float red, float green, float blue, float alpha, bool disc){
+	if ( m_shapeCount == cMaxShapes ){
+		return;
+	}
+
+	ShapeInstance& shape = m_shapes[m_shapeCount++];
+	shape.left = left;
+	shape.top = top;
+	shape.width = width;
+	shape.height = height;
+	shape.red = red;
+	shape.green = green;
+	shape.blue = blue;
+	shape.alpha = alpha;
+	shape.disc = disc ? 1.0f : 0.0f;
+}
+
+void ImageRenderer::uploadShapes(){
+	if ( m_shapeCount == 0 ){
+		return;
+	}
+
+	// orphan the last frame's instances rather than wait for the GPU to finish with them
+	glBindBuffer(GL_ARRAY_BUFFER, m_shapeBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(m_shapes), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, m_shapeCount * sizeof(ShapeInstance), m_shapes);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ImageRenderer::uploadKeyStates(const BYTE* keyStates){
+	if ( m_keyCount == 0 ){
+		return;
+	}
+
+	// only the runs of keys that changed since the last upload are written, a few bytes a frame
+	const BYTE* states = keyStates ? keyStates : m_keyStates;
+	glBindBuffer(GL_ARRAY_BUFFER, m_keyStateBuffer);
+
+	int key = 0;
+	while ( key < m_keyCount ){
+		if ( m_bKeyStatesUploaded && states[key] == m_keyStates[key] ){
+			++key;
+			continue;
+		}
+
+		int first = key;
+		while ( key < m_keyCount && ( !m_bKeyStatesUploaded || states[key] != m_keyStates[key] ) ){
+			m_keyStates[key] = states[key];
+			++key;
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, first, key - first, m_keyStates + first);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	m_bKeyStatesUploaded = true;
+}
+
+void ImageRenderer::drawKeyboard(int width, int height){
+	if ( m_keyCount == 0 ){
+		return;
+	}
+
+	float top = height * g_keyboardTop;
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(m_keyProgram);
+	glUniform2f(m_keyViewSize, (float)width, (float)height);
+	glUniform4f(m_keyKeyboard, 0.0f, top, (float)width, height - top);
+	glUniform1i(m_keyKeyCount, m_keyCount);
+	glUniform1i(m_keyFirstNote, m_firstNote);
+	glBindVertexArray(m_keyArray);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_keyCount);
+	++m_frameDrawCalls;
+
+	glDisable(GL_BLEND);
+}
+
+void ImageRenderer::drawShapes(int width, int height){
+	if ( m_shapeCount == 0 ){
+		return;
+	}
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(m_shapeProgram);
+	glUniform2f(m_shapeViewSize, (float)width, (float)height);
+	glBindVertexArray(m_shapeArray);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_shapeCount);
+	++m_frameDrawCalls;
+
+	glDisable(GL_BLEND);
+}
+
+// Stage bars (averaged over the last 30 frames) and a graph of the last 128 frame times.
+// Bar colours: depth blue, mapping cyan, composite green, draw yellow, swap magenta.
+// The red line across the graph is the 33 ms budget of a 30 fps sensor.
+static const float g_hudLeft = 8.0f, g_hudTop = 8.0f;
+static const float g_hudPixelsPerMs = 6.0f;
+static const float g_hudBarHeight = 6.0f;
+static const float g_hudGraphHeight = 60.0f, g_hudGraphMaxMs = 50.0f;
+static const float g_hudGraphTop = g_hudTop + (FrameStageSwap + 1) * (g_hudBarHeight + 2.0f) + 6.0f;
+static const float g_hudPanelWidth = 50.0f * g_hudPixelsPerMs / 1.5f;
+
+void ImageRenderer::addTimingHud(){
+	static const float stageColors[FrameStageSwap + 1][3] = {
+		{ 0.2f, 0.4f, 1.0f }, { 0.0f, 0.9f, 0.9f }, { 0.2f, 0.9f, 0.2f }, { 1.0f, 0.9f, 0.1f }, { 0.9f, 0.2f, 0.9f }
+	};
+
+	// backing panel
+	addShape( g_hudLeft - 4.0f, g_hudTop - 4.0f, g_hudPanelWidth + 8.0f, g_hudGraphTop + g_hudGraphHeight - g_hudTop + 8.0f,
+		0.0f, 0.0f, 0.0f, 0.5f, false );
+
+	// one bar per stage
+	for ( int s = 0; s <= FrameStageSwap; s++ ){
+		float length = m_pFrameTimer->Average( (FrameStage)s, 30 ) * g_hudPixelsPerMs;
+		if ( length > g_hudPanelWidth ) length = g_hudPanelWidth;
+		float y = g_hudTop + s * (g_hudBarHeight + 2.0f);
+		addShape( g_hudLeft, y, length, g_hudBarHeight, stageColors[s][0], stageColors[s][1], stageColors[s][2], 0.9f, false );
+	}
+
+	// the budget line, under the graph
+	float budgetY = g_hudGraphTop + g_hudGraphHeight - (1000.0f / 30.0f) * g_hudGraphHeight / g_hudGraphMaxMs;
+	addShape( g_hudLeft, budgetY - 0.5f, g_hudPanelWidth, 1.0f, 1.0f, 0.0f, 0.0f, 0.7f, false );
+}
+
+void ImageRenderer::uploadTimingGraph(){
+	GLfloat points[cGraphFrames * 2];
+	timingGraphPoints( points );
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_lineBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(points), points, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ImageRenderer::timingGraphPoints(GLfloat points[]){
+	// frame time graph, newest on the right
+	float step = g_hudPanelWidth / cGraphFrames;
+	for ( int i = 0; i < cGraphFrames; i++ ){
+		float ms = m_pFrameTimer->Sample( FrameStageFrame, cGraphFrames - 1 - i );
+		if ( ms > g_hudGraphMaxMs ) ms = g_hudGraphMaxMs;
+		points[i * 2] = g_hudLeft + i * step;
+		points[i * 2 + 1] = g_hudGraphTop + g_hudGraphHeight - ms * g_hudGraphHeight / g_hudGraphMaxMs;
+	}
+}
+
+void ImageRenderer::drawTimingGraph(int width, int height){
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(m_lineProgram);
+	glUniform2f(m_lineViewSize, (float)width, (float)height);
+	glUniform4f(m_lineColor, 1.0f, 1.0f, 1.0f, 0.9f);
+	glBindVertexArray(m_lineArray);
+	glDrawArrays(GL_LINE_STRIP, 0, cGraphFrames);
+	++m_frameDrawCalls;
+
+	glDisable(GL_BLEND);
+}
+
+#ifdef _WIN32
+
 // Enable OpenGL
 
 void ImageRenderer::EnableOpenGL()
 {
-	PIXELFORMATDESCRIPTOR pfd;
-	int format;
-	
 	// get the device context (DC)
 	m_hDC = GetDC( m_hWnd );
-	
-	// set the pixel format for the DC
-	ZeroMemory( &pfd, sizeof( pfd ) );
-	pfd.nSize = sizeof( pfd );
-	pfd.nVersion = 1;
-	pfd.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
-	pfd.iPixelType = PFD_TYPE_RGBA;
-	pfd.cColorBits = 24;
-	pfd.cDepthBits = 16;
-	pfd.iLayerType = PFD_MAIN_PLANE;
-	format = ChoosePixelFormat( m_hDC, &pfd );
-	SetPixelFormat( m_hDC, format, &pfd );
-	
-	// create and enable the render context (RC)
-	m_hRC = wglCreateContext( m_hDC );
-	wglMakeCurrent( m_hDC, m_hRC );
-	
+
+	// create and enable the render context (RC), core profile if the driver has it
+	m_hRC = CreateCoreContext( m_hDC );
 }
 
 // Disable OpenGL
@@ -229,161 +1312,4 @@ void ImageRenderer::DisableOpenGL()
 	ReleaseDC( m_hWnd, m_hDC );
 }
 
-
-HRESULT ImageRenderer::LoadResourceImage(
-    PCWSTR resourceName,
-    PCWSTR resourceType,
-    DWORD cOutputBuffer,
-    BYTE* outputBuffer
-    )
-{
-    HRESULT hr = S_OK;
-
-    IWICImagingFactory* pIWICFactory = NULL;
-    IWICBitmapDecoder* pDecoder = NULL;
-    IWICBitmapFrameDecode* pSource = NULL;
-    IWICStream* pStream = NULL;
-    IWICFormatConverter* pConverter = NULL;
-    IWICBitmapScaler* pScaler = NULL;
-
-    HRSRC imageResHandle = NULL;
-    HGLOBAL imageResDataHandle = NULL;
-    void *pImageFile = NULL;
-    DWORD imageFileSize = 0;
-
-    hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&pIWICFactory);
-    if ( FAILED(hr) ) return hr;
-
-    // Locate the resource.
-    imageResHandle = FindResourceW(HINST_THISCOMPONENT, resourceName, resourceType);
-    hr = imageResHandle ? S_OK : E_FAIL;
-
-    if (SUCCEEDED(hr))
-    {
-        // Load the resource.
-        imageResDataHandle = LoadResource(HINST_THISCOMPONENT, imageResHandle);
-        hr = imageResDataHandle ? S_OK : E_FAIL;
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Lock it to get a system memory pointer.
-        pImageFile = LockResource(imageResDataHandle);
-        hr = pImageFile ? S_OK : E_FAIL;
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Calculate the size.
-        imageFileSize = SizeofResource(HINST_THISCOMPONENT, imageResHandle);
-        hr = imageFileSize ? S_OK : E_FAIL;
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Create a WIC stream to map onto the memory.
-        hr = pIWICFactory->CreateStream(&pStream);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Initialize the stream with the memory pointer and size.
-        hr = pStream->InitializeFromMemory(
-            reinterpret_cast<BYTE*>(pImageFile),
-            imageFileSize
-            );
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Create a decoder for the stream.
-        hr = pIWICFactory->CreateDecoderFromStream(
-            pStream,
-            NULL,
-            WICDecodeMetadataCacheOnLoad,
-            &pDecoder
-            );
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Create the initial frame.
-        hr = pDecoder->GetFrame(0, &pSource);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Convert the image format to 32bppPBGRA
-        // (DXGI_FORMAT_B8G8R8A8_UNORM + D2D1_ALPHA_MODE_PREMULTIPLIED).
-        hr = pIWICFactory->CreateFormatConverter(&pConverter);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pIWICFactory->CreateBitmapScaler(&pScaler);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pScaler->Initialize(
-            pSource,
-            m_sourceWidth,
-            m_sourceHeight,
-            WICBitmapInterpolationModeCubic
-            );
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pConverter->Initialize(
-            pScaler,
-            GUID_WICPixelFormat32bppPBGRA,
-            WICBitmapDitherTypeNone,
-            NULL,
-            0.f,
-            WICBitmapPaletteTypeMedianCut
-            );
-    }
-
-    UINT width = 0;
-    UINT height = 0;
-    if (SUCCEEDED(hr))
-    {
-        hr = pConverter->GetSize(&width, &height);
-    }
-
-    // make sure the output buffer is large enough
-    if (SUCCEEDED(hr))
-    {
-        if ( width*height*sizeof(long) > cOutputBuffer )
-        {
-            hr = E_FAIL;
-        }
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pConverter->CopyPixels(NULL, width*sizeof(long), cOutputBuffer, outputBuffer);
-    }
-
-    SafeRelease(pScaler);
-    SafeRelease(pConverter);
-    SafeRelease(pSource);
-    SafeRelease(pDecoder);
-    SafeRelease(pStream);
-    SafeRelease(pIWICFactory);
-
-    return hr;
-}
-
-void ImageRenderer::circle(float x, float y, float r, int segments, float red, float green, float blue)
-{
-    glBegin( GL_TRIANGLE_FAN );
-		glColor4f(red,green,blue, 1.0f);
-        glVertex2f(x, y);
-        for( int n = 0; n <= segments ; ++n ) {
-            float const t = 2*3.14159*(float)n/(float)segments;
-            glVertex2f(x + sin(t)*r, y + cos(t)*r);
-        }
-    glEnd();
-}
\ No newline at end of file
+#endif
@@ -10,29 +10,191 @@
 
 #include "resource.h"
 #include "NuiApi.h"
-#include "gl/glew.h"
+#include "GlApi.h"
+#ifdef _WIN32
 #include "gl/GLU.h"
 #include "gl/glut.h"
 
 #include "gl/GL.h"
+#endif
 
 #include "types.h"
+#include "FrameTimer.h"
+#include "FrameArena.h"
+#include "GlContext.h"
+#include "FrameReadback.h"
+#include "SoftwareRenderer.h"
+#include "BackgroundStream.h"
+#include "CacheAligned.h"
 
 #define TRANSPARENCY	0x00000000ff000000
 
-class ImageRenderer
+// the readback queue is cache-line aligned, and the window makes renderers with new
+class ImageRenderer : public CacheAligned
 {
+	// overlay shapes drawn per frame: foot markers and the timing HUD's panel and bars
+	static const int cMaxShapes = 64;
+
+	// frames shown in the HUD's frame time graph
+	static const int cGraphFrames = 128;
 
 public:
+	// most keys the keyboard overlay can show, the MIDI note range
+	static const int cMaxKeys = 128;
+
+	// sinks every frame can be read back to at once, leaving the readback a target for a snapshot
+	static const int cMaxFrameSinks = FrameReadback::cMaxTargets - 1;
+
+	// backgrounds in the set, the still image among them
+	static const int cMaxBackgrounds = 8;
+
     /// <summary>
     /// Constructor
     /// </summary>
     ImageRenderer();
 
-	HRESULT Initialize( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride );
+#ifdef _WIN32
+	/// <summary>
+	/// Sets up OpenGL and loads the background, scaled to the source size; there are only windows on Windows,
+	/// elsewhere frames are drawn offscreen or in software
+	/// </summary>
+	/// <param name="pArena">arena the background is kept in</param>
+	HRESULT Initialize( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena );
+#endif
+
+	/// <summary>
+	/// Sets up OpenGL without a window, drawing into a framebuffer of the view size that is read
+	/// back after every Draw, and loads the background
+	/// </summary>
+	/// <param name="viewWidth">width of the framebuffer, in place of the window's client area</param>
+	/// <param name="viewHeight">height of the framebuffer</param>
+	/// <param name="pArena">arena the background is kept in</param>
+	HRESULT InitializeOffscreen( int viewWidth, int viewHeight, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena );
+
+	/// <summary>
+	/// Draws on the CPU instead of with OpenGL, for machines without a usable driver: frames are the
+	/// source size and are stretched to the window. Sinks get each frame straight after its Draw, on
+	/// the drawing thread
+	/// </summary>
+	/// <param name="hWnd">window to show the frames in, or NULL to only hand them to sinks</param>
+	/// <param name="pArena">arena the background and the frame are kept in</param>
+	HRESULT InitializeSoftware( HWND hWnd, int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena );
 
+	/// <summary>
+	/// Reads every frame drawn from now on back to the sink, on the readback thread a frame or two after
+	/// its Draw, along with any other sinks added. Offscreen frames are read back whether there is a sink
+	/// or not. Callable from any thread
+	/// </summary>
+	/// <returns>false if cMaxFrameSinks are already added</returns>
+	bool AddFrameSink( FrameSink sink, void* context );
+
+	/// <summary>
+	/// Stops reading frames back to a sink added with the same context. Frames already being read back
+	/// are still handed to it. Callable from any thread
+	/// </summary>
+	void RemoveFrameSink( FrameSink sink, void* context );
+
+	/// <summary>
+	/// Reads the next frame drawn back to the sink, once, on the readback thread. Callable from any thread;
+	/// a request not yet taken by a Draw is replaced
+	/// </summary>
+	void RequestSnapshot( FrameSink sink, void* context );
+
+	/// <summary>
+	/// Waits for the frames still being read back to be handed to their sinks, on the drawing thread
+	/// </summary>
+	void FlushReadback();
+
+	/// <summary>
+	/// Draws the background, the players and the overlay, then presents
+	/// </summary>
+	/// <param name="pImage">new composite, or NULL to reuse the player texture from the last one</param>
+	/// <param name="feetPoints">foot marker positions</param>
+	/// <param name="keyStates">KeyState of the first keys of the keyboard, or NULL to keep the last ones</param>
+	/// <param name="keyStateCount">entries in keyStates; keys past them are drawn up</param>
 	HRESULT Draw(BYTE* pImage, 
-		Point2f feetPoints[4]);
+		Point2f feetPoints[4], const BYTE* keyStates, int keyStateCount);
+
+	/// <summary>
+	/// Lays the keyboard overlay out across the bottom of the view, all keys up
+	/// </summary>
+	/// <param name="keyCount">number of keys, up to cMaxKeys; 0 hides the keyboard</param>
+	/// <param name="firstNote">pitch class of the leftmost key, 0 for C</param>
+	void SetKeyboard( int keyCount, int firstNote );
+
+	/// <summary>
+	/// Adds a moving background to the set and starts decoding it ahead, on a thread of its own. Its
+	/// first frame is uploaded now, so drawing it from SelectBackground on costs no more than the
+	/// still one. On the drawing thread, after Initialize
+	/// </summary>
+	/// <param name="pSource">source of its frames, not yet open; the renderer deletes it, added or not</param>
+	/// <param name="index">the background's number for SelectBackground</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT AddBackground( BackgroundSource* pSource, int& index );
+
+	/// <summary>
+	/// Draws another background of the set from the next Draw on: 0 is the still image, the others
+	/// numbered by AddBackground. A moving one carries on from the frame it was left at. Callable
+	/// from any thread
+	/// </summary>
+	void SelectBackground( int index );
+
+	/// <summary>
+	/// Backgrounds in the set, the still image included
+	/// </summary>
+	int BackgroundCount() const { return m_backgroundCount; }
+
+	/// <summary>
+	/// Decoding and playback counters of a moving background
+	/// </summary>
+	/// <returns>false for the still image or a number not in the set</returns>
+	bool GetBackgroundStats( int index, BackgroundStreamStats& stats ) const;
+
+	/// <summary>
+	/// Draw and swap times are recorded here, and the HUD draws from it
+	/// </summary>
+	void SetFrameTimer( FrameTimer* pFrameTimer );
+
+	/// <summary>
+	/// Leaves the player mask in the alpha of every frame drawn, as in the composite: 0 where there is
+	/// a player, 255 elsewhere. Otherwise the alpha is whatever blending left
+	/// </summary>
+	void SetMaskInAlpha( bool maskInAlpha );
+
+	/// <summary>
+	/// Shows or hides the frame timing overlay
+	/// </summary>
+	void SetTimingHudVisible( bool visible );
+
+	/// <summary>
+	/// Makes the OpenGL context current on the calling thread, the one that will draw
+	/// </summary>
+	void AttachContext();
+
+	/// <summary>
+	/// Releases the OpenGL context from the calling thread so another can attach it
+	/// </summary>
+	void DetachContext();
+
+	/// <summary>
+	/// Draw calls made by the last Draw
+	/// </summary>
+	LONG DrawCalls() const { return m_drawCalls; }
+
+	/// <summary>
+	/// Whether frames are drawn on the CPU, the source size
+	/// </summary>
+	bool IsSoftware() const { return m_bSoftware; }
+
+	/// <summary>
+	/// Offscreen frames whose Draw had to wait for an earlier frame's readback
+	/// </summary>
+	LONG ReadbackStalls() const { return m_readback.Stalls(); }
+
+	/// <summary>
+	/// Frames handed to a sink so far
+	/// </summary>
+	LONG FramesReadBack() const { return m_bSoftware ? m_softwareFramesDelivered : m_readback.Delivered(); }
 
     /// <summary>
     /// Destructor
@@ -44,6 +206,32 @@ private:
 	HDC			m_hDC;
 	HGLRC		m_hRC;
 
+	// set once a context exists, windowed or offscreen, so the destructor knows there are GL objects to delete
+	bool		m_bHaveContext;
+
+	// Offscreen: a context without a window, and the framebuffer drawn into instead of one
+	bool				m_bOffscreen;
+	OffscreenContext	m_offscreenContext;
+	GLuint				m_framebuffer;
+	GLuint				m_colorBuffer;
+	int					m_viewWidth;
+	int					m_viewHeight;
+	LONG				m_frameNumber;
+
+	// Software: the CPU draws each frame, from the same layers, and the window shows it with GDI
+	bool				m_bSoftware;
+	SoftwareRenderer	m_software;
+	ShapeInstance		m_softwareShapes[cMaxKeys + cMaxShapes];
+	LONG				m_softwareFramesDelivered;
+
+	// Frames read back: to the stream targets every frame, and to the snapshot target once. The
+	// targets are set from any thread, under the lock
+	FrameReadback		m_readback;
+	CRITICAL_SECTION	m_readbackLock;
+	FrameTarget			m_streamTargets[cMaxFrameSinks];
+	int					m_streamTargetCount;
+	FrameTarget			m_snapshotTarget;
+
 	int m_sourceWidth;
 	int m_sourceHeight;
 	int m_sourceStride;
@@ -55,21 +243,130 @@ private:
 	GLuint pboId;
 	GLubyte* m_pPixelBuffer;
 
-	BYTE* m_backgroundRGBX;
+	ArenaView<BYTE> m_backgroundRGBX;
+	FrameArena* m_pArena;
+
+	// The background set: the still image first, then the moving ones. Each has textures of its
+	// own, which a moving one's frames are uploaded to as they come due, so switching only binds another.
+	// A moving one has two, and a new frame goes to the one not on show, so the upload never waits for
+	// draws still reading the frame before. With OpenGL, its decoder writes frames straight into pixel
+	// buffers mapped for it, one per slot of its ring, and the upload is only the GPU's copy
+	typedef struct
+	{
+		BackgroundSource*	pSource;
+		BackgroundStream*	pStream;		// NULL for the still image
+		GLuint				textures[2];
+		int					shown;			// the texture with the frame on show
+		const BYTE*			pixels;			// the frame on show, for the software renderer
+		GLuint				buffers[BackgroundStream::cRingFrames];
+	} BackgroundLayer;
+
+	BackgroundLayer m_backgrounds[cMaxBackgrounds];
+	int m_backgroundCount;
+	volatile LONG m_selectedBackground;
+	int m_drawnBackground;
+
+	// set once a composite has been uploaded to m_frameTexture
+	bool m_bHavePlayers;
+
+	// the last pass writes the player mask into the framebuffer's alpha
+	bool m_bMaskInAlpha;
+
+	// GL 3.3 core profile objects. Every layer is the same unit quad: drawn across the
+	// view for the background and players, and instanced for the overlay shapes
+	GLuint m_quadBuffer;
+	GLuint m_textureArray;
+	GLuint m_textureProgram;
+
+	GLuint m_shapeArray;
+	GLuint m_shapeBuffer;
+	GLuint m_shapeProgram;
+	GLint m_shapeViewSize;
+
+	// the keyboard: one instance of the quad per key, laid out by the shader from the
+	// instance index, with a byte of KeyState per key as its only instance data
+	GLuint m_keyArray;
+	GLuint m_keyStateBuffer;
+	GLuint m_keyProgram;
+	GLint m_keyViewSize;
+	GLint m_keyKeyboard;
+	GLint m_keyKeyCount;
+	GLint m_keyFirstNote;
+	int m_keyCount;
+	int m_firstNote;
+
+	// key states as last uploaded, so only keys that change are written to m_keyStateBuffer
+	BYTE m_keyStates[cMaxKeys];
+	// the caller's key states padded out to m_keyCount when it passes fewer
+	BYTE m_paddedKeyStates[cMaxKeys];
+	bool m_bKeyStatesUploaded;
 
+	GLuint m_lineArray;
+	GLuint m_lineBuffer;
+	GLuint m_lineProgram;
+	GLint m_lineViewSize;
+	GLint m_lineColor;
+
+	// overlay shapes queued for this frame, drawn with one instanced call
+	ShapeInstance m_shapes[cMaxShapes];
+	int m_shapeCount;
+
+	// draw calls so far in this frame, and in the last whole one
+	int m_frameDrawCalls;
+	volatile LONG m_drawCalls;
+
+	// Frame timing
+	FrameTimer* m_pFrameTimer;
+	volatile LONG m_showTimingHud;	// set by the UI thread, read by the drawing one
+	LONGLONG m_lastPresentTicks;
+
+#ifdef _WIN32
 	// OpenGL initialization & cleanup
 	void EnableOpenGL();
 
 	void DisableOpenGL();
+#endif
 
-	// Drawing components
-	void drawBG(int width, int height);
-	void drawPlayers(BYTE* pImage, int width, int height);
-	void drawFootMarkers(Point2f feetPoints[4]);
+	// Everything after the context: textures, pixel buffer, background and pipeline
+	HRESULT initializeGL(int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena);
+
+	// Deletes everything initializeGL, AddBackground and the offscreen framebuffer created, on the current context
+	void releaseGL();
 
-	// Draw basic stuff
-	void circle(float x, float y, float r, int segments, float red, float green, float blue);
+	// The background, scaled to the source size
+	HRESULT loadBackground(int sourceWidth, int sourceHeight, int sourceStride, FrameArena* pArena);
+
+	// The selected background's frame for this Draw, uploaded if it is a new one
+	const BYTE* updateBackground(bool& changed);
+	void uploadBackground(BackgroundLayer& layer);
+	BYTE* mapBackgroundBuffer(GLuint buffer);
+
+	// Reads the frame back if anything wants it, then swaps
+	void present(int width, int height);
+
+	// The software path's Draw and present
+	void composeSoftware(BYTE* pImage, const BYTE* background, const BYTE* keyStates, bool showHud, int viewWidth, int viewHeight);
+	void presentSoftware(const FrameTarget* targets, int targetCount, LONGLONG presentTicks);
+
+	// Shader programs and the buffers and vertex arrays they draw from
+	HRESULT createPipeline();
+
+	// Drawing components
+	void drawLayers(BYTE* pImage, const BYTE* keyStates, bool showHud, int width, int height);
+	void drawBG();
+	void drawPlayers(BYTE* pImage);
+	void drawMask();
+	void uploadPlayers(BYTE* pImage);
+	void addFootMarkers(Point2f feetPoints[4]);
+	void addTimingHud();
+	void uploadShapes();
+	void uploadKeyStates(const BYTE* keyStates);
+	void drawKeyboard(int width, int height);
+	void uploadTimingGraph();
+	void timingGraphPoints(GLfloat points[]);
+	void drawShapes(int width, int height);
+	void drawTimingGraph(int width, int height);
 
-	// Loading the background...
-	HRESULT LoadResourceImage( PCWSTR resourceName, PCWSTR resourceType, DWORD cOutputBuffer, BYTE* outputBuffer );
-};
\ No newline at end of file
+	// Queue a shape for drawShapes
+	void addShape(float left, float top, float width, float height, float red, float green, float blue, float alpha, bool disc);
+};
\ No newline at end of file
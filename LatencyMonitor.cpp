@@ -0,0 +1,209 @@
+#include "stdafx.h"
+#include <strsafe.h>
+#include <intrin.h>
+#include "LatencyMonitor.h"
+
+using namespace std;
+
+// once a second the status bar summary is refreshed and a CSV row per stage is appended
+static const LONGLONG cReportIntervalMs = 1000;
+
+static const char* g_stageNames[LatencyStageCount] = { "wake", "skeleton", "hit", "enqueue", "send" };
+
+LatencyHistogram::LatencyHistogram() :
+	m_max(0)
+{
+	ZeroMemory((void*)m_buckets, sizeof(m_buckets));
+	ZeroMemory(m_previous, sizeof(m_previous));
+}
+
+int LatencyHistogram::BucketIndex(LONGLONG value)
+{
+	if ( value < cSubBuckets )
+	{
+		return value < 0 ? 0 : (int)value;
+	}
+
+	// clamp to 32 bits (~35 minutes) so the bit scan works on x86 too
+	DWORD v = value > 0x7fffffff ? 0x7fffffff : (DWORD)value;
+	DWORD exponent;
+	_BitScanReverse(&exponent, v);
+
+	int index = ((int)exponent - cSubBucketBits + 1) * cSubBuckets + (int)((v >> (exponent - cSubBucketBits)) & (cSubBuckets - 1));
+	return index < cBucketCount ? index : cBucketCount - 1;
+}
+
+LONGLONG LatencyHistogram::BucketUpperBound(int index)
+{
+	if ( index < cSubBuckets )
+	{
+		return index;
+	}
+
+	int shift = index / cSubBuckets - 1;
+	LONGLONG lower = (LONGLONG)(cSubBuckets + index % cSubBuckets) << shift;
+	return lower + (1LL << shift) - 1;
+}
+
+void LatencyHistogram::Record(LONGLONG microseconds)
+{
+	InterlockedIncrement(&m_buckets[BucketIndex(microseconds)]);
+
+	LONG sample = microseconds > 0x7fffffff ? 0x7fffffff : (LONG)microseconds;
+	LONG current = m_max;
+	while ( sample > current )
+	{
+		LONG seen = InterlockedCompareExchange(&m_max, sample, current);
+		if ( seen == current )
+		{
+			break;
+		}
+		current = seen;
+	}
+}
+
+void LatencyHistogram::Snapshot(LatencySummary& summary)
+{
+	// counts only ever grow, so the interval histogram is the difference to the last snapshot
+	LONG interval[cBucketCount];
+	LONG count = 0;
+	for ( int i = 0; i < cBucketCount; ++i )
+	{
+		LONG now = m_buckets[i];
+		interval[i] = now - m_previous[i];
+		m_previous[i] = now;
+		count += interval[i];
+	}
+
+	summary.count = count;
+	summary.p50 = 0.0;
+	summary.p99 = 0.0;
+	summary.max = InterlockedExchange(&m_max, 0) / 1000.0;
+
+	if ( count == 0 )
+	{
+		return;
+	}
+
+	LONG p50Rank = (count + 1) / 2;
+	LONG p99Rank = count - count / 100;
+	LONG seen = 0;
+	for ( int i = 0; i < cBucketCount; ++i )
+	{
+		if ( interval[i] == 0 )
+		{
+			continue;
+		}
+
+		LONG before = seen;
+		seen += interval[i];
+		if ( before < p50Rank && seen >= p50Rank )
+		{
+			summary.p50 = BucketUpperBound(i) / 1000.0;
+		}
+		if ( before < p99Rank && seen >= p99Rank )
+		{
+			summary.p99 = BucketUpperBound(i) / 1000.0;
+			break;
+		}
+	}
+
+	// bucket bounds are coarser than the exact maximum
+	if ( summary.p50 > summary.max ) summary.p50 = summary.max;
+	if ( summary.p99 > summary.max ) summary.p99 = summary.max;
+}
+
+LatencyMonitor::LatencyMonitor() :
+	m_sensorOffsetMs(0),
+	m_haveSensorOffset(false)
+{
+	ZeroMemory(m_lastSummary, sizeof(m_lastSummary));
+	m_summary[0] = L'\0';
+
+	m_startTicks = HighResClock::Now();
+	m_lastReportTicks = m_startTicks;
+
+	m_csv.open("latency.csv", ios::out | ios::trunc);
+	if ( m_csv.is_open() )
+	{
+		m_csv << "elapsed_s,stage,count,p50_ms,p99_ms,max_ms" << endl;
+	}
+}
+
+LatencyMonitor::~LatencyMonitor()
+{
+	if ( m_csv.is_open() )
+	{
+		m_csv.close();
+	}
+}
+
+LONGLONG LatencyMonitor::SensorTimeToTicks(LARGE_INTEGER sensorTimeStamp, LONGLONG arrivalTicks)
+{
+	// The sensor clock has an unknown origin, so we track the smallest arrival offset and treat it
+	// as zero transport delay. Latencies are therefore relative to the best case delivery.
+	LONGLONG arrivalMs = (LONGLONG)HighResClock::TicksToMilliseconds(arrivalTicks);
+	LONGLONG offsetMs = arrivalMs - sensorTimeStamp.QuadPart;
+	if ( !m_haveSensorOffset || offsetMs < m_sensorOffsetMs )
+	{
+		m_sensorOffsetMs = offsetMs;
+		m_haveSensorOffset = true;
+	}
+
+	return HighResClock::MillisecondsToTicks(sensorTimeStamp.QuadPart + m_sensorOffsetMs);
+}
+
+void LatencyMonitor::Stamp(LatencyStage stage, LONGLONG sensorTicks)
+{
+	Stamp(stage, sensorTicks, HighResClock::Now());
+}
+
+void LatencyMonitor::Stamp(LatencyStage stage, LONGLONG sensorTicks, LONGLONG stageTicks)
+{
+	m_histograms[stage].Record(HighResClock::TicksToMicroseconds(stageTicks - sensorTicks));
+}
+
+bool LatencyMonitor::Report()
+{
+	LONGLONG now = HighResClock::Now();
+	if ( HighResClock::TicksToMilliseconds(now - m_lastReportTicks) < cReportIntervalMs )
+	{
+		return false;
+	}
+	m_lastReportTicks = now;
+
+	for ( int i = 0; i < LatencyStageCount; ++i )
+	{
+		m_histograms[i].Snapshot(m_lastSummary[i]);
+	}
+
+	WriteCsv(now);
+
+	const LatencySummary& wake = m_lastSummary[LatencyStageWake];
+	const LatencySummary& hit = m_lastSummary[LatencyStageHit];
+	const LatencySummary& send = m_lastSummary[LatencyStageSend];
+	StringCchPrintfW(m_summary, cSummaryMaxLen,
+		L"Latency p50/p99/max ms - wake %.1f/%.1f/%.1f  hit %.1f/%.1f/%.1f  sound %.1f/%.1f/%.1f",
+		wake.p50, wake.p99, wake.max,
+		hit.p50, hit.p99, hit.max,
+		send.p50, send.p99, send.max);
+
+	return true;
+}
+
+void LatencyMonitor::WriteCsv(LONGLONG now)
+{
+	if ( !m_csv.is_open() )
+	{
+		return;
+	}
+
+	double elapsed = HighResClock::TicksToMilliseconds(now - m_startTicks) / 1000.0;
+	for ( int i = 0; i < LatencyStageCount; ++i )
+	{
+		const LatencySummary& s = m_lastSummary[i];
+		m_csv << elapsed << ',' << g_stageNames[i] << ',' << s.count << ','
+			<< s.p50 << ',' << s.p99 << ',' << s.max << '\n';
+	}
+	m_csv.flush();
+}
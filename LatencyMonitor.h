@@ -0,0 +1,124 @@
+/*
+
+Motion-to-sound latency instrumentation
+
+Every stage between a skeleton frame leaving the sensor and the note leaving
+midiOutShortMsg is stamped with the high resolution clock. The time since the
+sensor captured the frame is recorded into a lock-free histogram per stage, so
+the stamps can come from any thread (the MIDI thread records the last one).
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <fstream>
+#include "HighResClock.h"
+
+typedef enum
+{
+	LatencyStageWake,			// the skeleton acquisition thread woke up for the frame
+	LatencyStageSkeleton,		// ProcessSkeleton finished
+	LatencyStageHit,			// a foot hit was detected
+	LatencyStageEnqueue,		// the note was queued for the MIDI thread
+	LatencyStageSend,			// midiOutShortMsg returned
+	LatencyStageCount
+} LatencyStage;
+
+/// <summary>
+/// Summary of one histogram over a reporting interval, in milliseconds
+/// </summary>
+typedef struct
+{
+	LONG	count;
+	double	p50;
+	double	p99;
+	double	max;
+} LatencySummary;
+
+/// <summary>
+/// Log-linear histogram of microsecond samples (8 sub-buckets per power of two, ~12% resolution)
+/// </summary>
+class LatencyHistogram
+{
+public:
+	static const int cSubBucketBits = 3;
+	static const int cSubBuckets = 1 << cSubBucketBits;
+	static const int cBucketCount = 24 * cSubBuckets;	// up to 2^24 us (~16s)
+
+	LatencyHistogram();
+
+	/// <summary>
+	/// Record one sample. Lock-free, may be called from any thread
+	/// </summary>
+	void Record(LONGLONG microseconds);
+
+	/// <summary>
+	/// Summarize the samples recorded since the previous call. Only one thread may call this
+	/// </summary>
+	void Snapshot(LatencySummary& summary);
+
+private:
+	static int BucketIndex(LONGLONG value);
+	static LONGLONG BucketUpperBound(int index);
+
+	volatile LONG	m_buckets[cBucketCount];
+	volatile LONG	m_max;
+
+	// bucket counts at the previous snapshot, owned by the reporting thread
+	LONG			m_previous[cBucketCount];
+};
+
+class LatencyMonitor
+{
+public:
+	static const int cSummaryMaxLen = 256;
+
+	LatencyMonitor();
+	~LatencyMonitor();
+
+	/// <summary>
+	/// Converts a sensor frame timestamp (milliseconds, sensor clock) to performance counter ticks
+	/// </summary>
+	/// <param name="sensorTimeStamp">liTimeStamp of the frame</param>
+	/// <param name="arrivalTicks">when the frame was received on the host</param>
+	/// <returns>estimated capture time in ticks</returns>
+	LONGLONG SensorTimeToTicks(LARGE_INTEGER sensorTimeStamp, LONGLONG arrivalTicks);
+
+	/// <summary>
+	/// Records that a stage was reached for the frame captured at sensorTicks. Lock-free
+	/// </summary>
+	void Stamp(LatencyStage stage, LONGLONG sensorTicks);
+
+	/// <summary>
+	/// Same as above, for a stage that was reached at stageTicks rather than now
+	/// </summary>
+	void Stamp(LatencyStage stage, LONGLONG sensorTicks, LONGLONG stageTicks);
+
+	/// <summary>
+	/// Refreshes the summary and appends to the CSV file once per interval
+	/// </summary>
+	/// <returns>true if the summary text changed</returns>
+	bool Report();
+
+	/// <summary>
+	/// Human readable p50/p99/max summary for the status bar
+	/// </summary>
+	WCHAR* GetSummary() { return m_summary; }
+
+private:
+	LatencyHistogram	m_histograms[LatencyStageCount];
+	LatencySummary		m_lastSummary[LatencyStageCount];
+
+	// the smallest host-minus-sensor offset seen, i.e. the best case delivery
+	LONGLONG			m_sensorOffsetMs;
+	bool				m_haveSensorOffset;
+
+	LONGLONG			m_startTicks;
+	LONGLONG			m_lastReportTicks;
+
+	std::ofstream		m_csv;
+	WCHAR				m_summary[cSummaryMaxLen];
+
+	void WriteCsv(LONGLONG now);
+};
@@ -0,0 +1,167 @@
+#include "stdafx.h"
+#include "NuiApi.h"
+#include "MaskStabilizer.h"
+#include "Trace.h"
+
+#ifdef MASK_STABILIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+// a pixel's state: the index passed on in bits 0-2, the last raw index in bits 3-5 and the frames it
+// has been seen in bits 6-7; a settled pixel has both indices the same and no run, index * 9
+static const int g_seenShift = 3;
+static const int g_runShift = 6;
+
+static inline BYTE SettledState(int index)
+{
+	return (BYTE)(index | (index << g_seenShift));
+}
+
+/// <summary>
+/// Stabilizes one pixel, and counts it unless it is settled with its raw index unchanged
+/// </summary>
+static inline USHORT StabilizePixel(USHORT depth, BYTE& state, int holdFrames, MaskStabilizerStats& stats)
+{
+	int raw = depth & NUI_IMAGE_PLAYER_INDEX_MASK;
+	if ( SettledState(raw) == state )
+	{
+		return depth;
+	}
+
+	int shown = state & NUI_IMAGE_PLAYER_INDEX_MASK;
+	int seen = (state >> g_seenShift) & NUI_IMAGE_PLAYER_INDEX_MASK;
+	int run = state >> g_runShift;
+	++stats.touched;
+
+	// a new raw index starts its run over; back to the one shown, the pixel settles again
+	if ( raw != seen )
+	{
+		++stats.rawChanged;
+		seen = raw;
+		run = 0;
+	}
+	if ( seen != shown )
+	{
+		if ( run < MaskStabilizer::cMaxHoldFrames )
+		{
+			++run;
+		}
+		if ( run >= holdFrames )
+		{
+			shown = seen;
+			++stats.maskChanged;
+		}
+	}
+
+	state = ( seen == shown ) ? SettledState(shown) : (BYTE)(shown | (seen << g_seenShift) | (run << g_runShift));
+	return (USHORT)((depth & ~NUI_IMAGE_PLAYER_INDEX_MASK) | shown);
+}
+
+MaskStabilizer::MaskStabilizer() :
+	m_pixels(0),
+	m_holdFrames(cDefaultHoldFrames),
+	m_bPrimed(false),
+	m_rawChanged(0),
+	m_maskChanged(0),
+	m_touched(0)
+{
+}
+
+HRESULT MaskStabilizer::Initialize(FrameArena& arena, LONG pixels, int holdFrames)
+{
+	if ( holdFrames < 1 || holdFrames > cMaxHoldFrames )
+	{
+		return E_INVALIDARG;
+	}
+
+	if ( m_state.Count() < (size_t)pixels )
+	{
+		m_state = arena.Allocate<BYTE>(pixels);
+		if ( NULL == m_state.Data() )
+		{
+			return E_OUTOFMEMORY;
+		}
+	}
+	m_pixels = pixels;
+	m_holdFrames = holdFrames;
+	m_bPrimed = false;
+	return S_OK;
+}
+
+void MaskStabilizer::Prime(const USHORT* depthD16, USHORT* stabilizedD16)
+{
+	BYTE* pState = m_state;
+	for ( LONG i = 0; i < m_pixels; ++i )
+	{
+		USHORT depth = depthD16[i];
+		pState[i] = SettledState(depth & NUI_IMAGE_PLAYER_INDEX_MASK);
+		stabilizedD16[i] = depth;
+	}
+	m_bPrimed = true;
+}
+
+void MaskStabilizer::Ingest(const USHORT* depthD16, USHORT* stabilizedD16, MaskStabilizerStats& stats)
+{
+	TRACE_SCOPE("MaskStabilizer::Ingest");
+	stats.pixels = m_pixels;
+	stats.rawChanged = 0;
+	stats.maskChanged = 0;
+	stats.touched = 0;
+
+	if ( !m_bPrimed )
+	{
+		Prime(depthD16, stabilizedD16);
+	}
+	else
+	{
+		BYTE* pState = m_state;
+		int holdFrames = m_holdFrames;
+		LONG i = 0;
+
+#ifdef MASK_STABILIZER_SSE2
+		// eight pixels at a time are copied as they are, then the ones not settled on their raw index redone
+		const __m128i indexMask = _mm_set1_epi16(NUI_IMAGE_PLAYER_INDEX_MASK);
+		LONG vectorPixels = m_pixels & ~7;
+		for ( ; i < vectorPixels; i += 8 )
+		{
+			__m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depthD16 + i));
+			__m128i index = _mm_and_si128(depth, indexMask);
+			__m128i settled = _mm_add_epi16(_mm_slli_epi16(index, g_seenShift), index);
+			settled = _mm_packus_epi16(settled, settled);
+			__m128i state = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pState + i));
+
+			int settledPixels = _mm_movemask_epi8(_mm_cmpeq_epi8(settled, state)) & 0xff;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(stabilizedD16 + i), depth);
+			if ( settledPixels == 0xff )
+			{
+				continue;
+			}
+
+			for ( int j = 0; j < 8; ++j )
+			{
+				if ( !(settledPixels & (1 << j)) )
+				{
+					stabilizedD16[i + j] = StabilizePixel(depthD16[i + j], pState[i + j], holdFrames, stats);
+				}
+			}
+		}
+#endif
+
+		for ( ; i < m_pixels; ++i )
+		{
+			stabilizedD16[i] = StabilizePixel(depthD16[i], pState[i], holdFrames, stats);
+		}
+	}
+
+	m_rawChanged = stats.rawChanged;
+	m_maskChanged = stats.maskChanged;
+	m_touched = stats.touched;
+}
+
+void MaskStabilizer::GetStats(MaskStabilizerStats& stats) const
+{
+	stats.pixels = m_pixels;
+	stats.rawChanged = m_rawChanged;
+	stats.maskChanged = m_maskChanged;
+	stats.touched = m_touched;
+}
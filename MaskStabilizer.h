@@ -0,0 +1,91 @@
+/*
+
+Player mask stabilizer
+
+The runtime's player index flickers along the silhouette's edge: a pixel is
+a player one frame, background the next, and back again. Composited, the
+edge shimmers, and everything downstream sees pixels change that did not.
+The stabilizer holds each pixel's player index until a new one has been seen
+in holdFrames frames running, so a label that flickers never gets through,
+and a real change does, holdFrames - 1 frames late.
+
+It runs as the depth frame is copied out of the runtime. Each pixel has one
+byte of state, the index passed on, the last raw index and how many frames
+it has been seen; a pixel whose raw index is the one passed on, and was last
+frame too, is copied as it is, and only pixels whose raw index changed, or
+whose change is still being held, are looked at one by one. The scan uses
+SSE2 where it is available. Only the player index bits are held; the depth
+of a held pixel is the frame's own.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "FrameArena.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define MASK_STABILIZER_SSE2 1
+#endif
+
+/// <summary>
+/// What the last frame changed, in pixels
+/// </summary>
+typedef struct
+{
+	LONG	pixels;			// in the frame
+	LONG	rawChanged;		// whose raw player index is not the last frame's
+	LONG	maskChanged;	// whose player index as passed on changed
+	LONG	touched;		// looked at one by one: the raw index changed or a change is being held
+} MaskStabilizerStats;
+
+class MaskStabilizer
+{
+public:
+	// the state keeps two bits of run length
+	static const int cMaxHoldFrames = 3;
+	static const int cDefaultHoldFrames = 2;
+
+	MaskStabilizer();
+
+	/// <summary>
+	/// Allocates the per-pixel state from the arena
+	/// </summary>
+	/// <param name="pixels">pixels in a depth frame</param>
+	/// <param name="holdFrames">frames a new player index must be seen before it is passed on, 1 to pass every frame as it is</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(FrameArena& arena, LONG pixels, int holdFrames);
+
+	/// <summary>
+	/// Forgets the frames seen; the next one is passed on as it is
+	/// </summary>
+	void Reset() { m_bPrimed = false; }
+
+	/// <summary>
+	/// Copies a depth frame with its player indices stabilized, on one thread, frames in order
+	/// </summary>
+	/// <param name="depthD16">the frame as the runtime gives it</param>
+	/// <param name="stabilizedD16">where the frame goes, which may be depthD16</param>
+	/// <param name="stats">what the frame changed</param>
+	void Ingest(const USHORT* depthD16, USHORT* stabilizedD16, MaskStabilizerStats& stats);
+
+	/// <summary>
+	/// The last frame's changes, from any thread
+	/// </summary>
+	void GetStats(MaskStabilizerStats& stats) const;
+
+	LONG Pixels() const { return m_pixels; }
+	int HoldFrames() const { return m_holdFrames; }
+
+private:
+	ArenaView<BYTE>	m_state;
+	LONG			m_pixels;
+	int				m_holdFrames;
+	bool			m_bPrimed;
+
+	volatile LONG	m_rawChanged;
+	volatile LONG	m_maskChanged;
+	volatile LONG	m_touched;
+
+	void Prime(const USHORT* depthD16, USHORT* stabilizedD16);
+};
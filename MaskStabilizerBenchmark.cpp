@@ -0,0 +1,185 @@
+#include "stdafx.h"
+#include <fstream>
+#include <vector>
+#include "NuiApi.h"
+#include "MaskStabilizerBenchmark.h"
+#include "MaskStabilizer.h"
+#include "SyntheticFrameSource.h"
+#include "FrameArena.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const LONG g_sizes[][2] = { { 320, 240 }, { 640, 480 } };
+static const int g_sizeCount = sizeof(g_sizes) / sizeof(g_sizes[0]);
+
+// chance an edge pixel flips each frame
+static const float g_flickers[] = { 0.0f, 0.05f, 0.25f, 0.5f };
+static const int g_flickerCount = sizeof(g_flickers) / sizeof(g_flickers[0]);
+
+// a walk across the view and back
+static const int g_frames = 300;
+
+/// <summary>
+/// Whether an edge pixel flips in a frame, the same for every hold setting
+/// </summary>
+static bool Flickers(LONG index, int frame, float chance)
+{
+	DWORD hash = (DWORD)index * 2654435761u ^ (DWORD)frame * 2246822519u;
+	hash ^= hash >> 15;
+	hash *= 2246822519u;
+	hash ^= hash >> 13;
+	return (hash & 0xffff) < (DWORD)(chance * 65536.0f);
+}
+
+/// <summary>
+/// Adds flicker along the silhouette: pixels with a 4-neighbour of another index swap player and background
+/// </summary>
+static void AddEdgeFlicker(const USHORT* clean, USHORT* noisy, LONG width, LONG height, int frame, float chance)
+{
+	for ( LONG y = 0; y < height; ++y )
+	{
+		for ( LONG x = 0; x < width; ++x )
+		{
+			LONG index = x + y * width;
+			USHORT pixel = clean[index];
+			int player = pixel & NUI_IMAGE_PLAYER_INDEX_MASK;
+			bool edge =
+				( x > 0 && (clean[index - 1] & NUI_IMAGE_PLAYER_INDEX_MASK) != player ) ||
+				( x < width - 1 && (clean[index + 1] & NUI_IMAGE_PLAYER_INDEX_MASK) != player ) ||
+				( y > 0 && (clean[index - width] & NUI_IMAGE_PLAYER_INDEX_MASK) != player ) ||
+				( y < height - 1 && (clean[index + width] & NUI_IMAGE_PLAYER_INDEX_MASK) != player );
+			if ( edge && Flickers(index, frame, chance) )
+			{
+				pixel = (USHORT)((pixel & ~NUI_IMAGE_PLAYER_INDEX_MASK) | (player ? 0 : 1));
+			}
+			noisy[index] = pixel;
+		}
+	}
+}
+
+HRESULT RunMaskStabilizerBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	csv << "width,height,edge_flicker,hold_frames,frames,copy_ms,ingest_ms,overhead_ms,raw_changed_pct,mask_changed_pct,touched_pct,clean_changed_pct,wrong_pct" << endl;
+
+	FrameArena arena;
+	for ( int s = 0; s < g_sizeCount; ++s )
+	{
+		CompositeLayout layout;
+		layout.depthWidth = g_sizes[s][0];
+		layout.depthHeight = g_sizes[s][1];
+		layout.colorWidth = 640;
+		layout.colorHeight = 480;
+		layout.colorToDepthDivisor = 1;
+
+		SyntheticFrameSource source;
+		source.Initialize(layout);
+
+		LONG pixels = layout.depthWidth * layout.depthHeight;
+		vector<USHORT> clean(pixels);
+		vector<USHORT> lastClean(pixels);
+		vector<USHORT> noisy(pixels);
+		vector<USHORT> copied(pixels);
+		vector<USHORT> stabilized(pixels);
+
+		for ( int f = 0; f < g_flickerCount; ++f )
+		{
+			for ( int hold = 1; hold <= MaskStabilizer::cMaxHoldFrames; ++hold )
+			{
+				MaskStabilizer stabilizer;
+				HRESULT hr = stabilizer.Initialize(arena, pixels, hold);
+				if ( FAILED(hr) )
+				{
+					return hr;
+				}
+
+				LONGLONG copyTicks = 0;
+				LONGLONG ingestTicks = 0;
+				LONGLONG rawChanged = 0;
+				LONGLONG maskChanged = 0;
+				LONGLONG touched = 0;
+				LONGLONG cleanChanged = 0;
+				LONGLONG wrong = 0;
+
+				for ( int frame = 0; frame < g_frames; ++frame )
+				{
+					source.GenerateDepth(frame, &clean[0]);
+					AddEdgeFlicker(&clean[0], &noisy[0], layout.depthWidth, layout.depthHeight, frame, g_flickers[f]);
+
+					// in turns, so neither gets the frame warm in the cache from the other
+					MaskStabilizerStats stats;
+					LONGLONG t0, t1, t2;
+					if ( frame & 1 )
+					{
+						t0 = HighResClock::Now();
+						memcpy(&copied[0], &noisy[0], pixels * sizeof(USHORT));
+						t1 = HighResClock::Now();
+						stabilizer.Ingest(&noisy[0], &stabilized[0], stats);
+						t2 = HighResClock::Now();
+						copyTicks += t1 - t0;
+						ingestTicks += t2 - t1;
+					}
+					else
+					{
+						t0 = HighResClock::Now();
+						stabilizer.Ingest(&noisy[0], &stabilized[0], stats);
+						t1 = HighResClock::Now();
+						memcpy(&copied[0], &noisy[0], pixels * sizeof(USHORT));
+						t2 = HighResClock::Now();
+						ingestTicks += t1 - t0;
+						copyTicks += t2 - t1;
+					}
+
+					// the first frame primes the state, it has nothing to change from
+					if ( frame > 0 )
+					{
+						rawChanged += stats.rawChanged;
+						maskChanged += stats.maskChanged;
+						touched += stats.touched;
+						for ( LONG i = 0; i < pixels; ++i )
+						{
+							if ( (clean[i] ^ lastClean[i]) & NUI_IMAGE_PLAYER_INDEX_MASK )
+							{
+								++cleanChanged;
+							}
+						}
+					}
+					for ( LONG i = 0; i < pixels; ++i )
+					{
+						if ( (clean[i] ^ stabilized[i]) & NUI_IMAGE_PLAYER_INDEX_MASK )
+						{
+							++wrong;
+						}
+					}
+					clean.swap(lastClean);
+				}
+
+				double copyMs = HighResClock::TicksToMilliseconds(copyTicks) / g_frames;
+				double ingestMs = HighResClock::TicksToMilliseconds(ingestTicks) / g_frames;
+				double changedPercent = 100.0 / ((double)pixels * (g_frames - 1));
+
+				csv << layout.depthWidth << ","
+					<< layout.depthHeight << ","
+					<< g_flickers[f] << ","
+					<< hold << ","
+					<< g_frames << ","
+					<< copyMs << ","
+					<< ingestMs << ","
+					<< ingestMs - copyMs << ","
+					<< rawChanged * changedPercent << ","
+					<< maskChanged * changedPercent << ","
+					<< touched * changedPercent << ","
+					<< cleanChanged * changedPercent << ","
+					<< wrong * 100.0 / ((double)pixels * g_frames) << endl;
+			}
+		}
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,28 @@
+/*
+
+Player mask stabilizer benchmark
+
+Feeds the synthetic player walking past through the mask stabilizer at
+320x240 and 640x480 depth, with the pixels along the silhouette's edge
+flickering: each flips between player and background with a given chance
+every frame. For every hold setting, 1 being the runtime's mask as it is,
+a row times the stabilizing copy against a plain one and gives the share of
+pixels per frame whose raw index changed, whose stabilized index changed
+and that were looked at one by one. Against the silhouette without the
+flicker, it also gives the share whose index really changed and the share
+the stabilized mask has wrong, the flicker let through plus the hold's lag.
+
+Run with /benchmask on the command line; results go to mask_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per size, flicker and hold setting
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunMaskStabilizerBenchmark(const char* path);
@@ -0,0 +1,367 @@
+#include "stdafx.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "OffscreenRender.h"
+#include "ImageRenderer.h"
+#include "SyntheticFrameSource.h"
+#include "FloorPiano.h"
+#include "FrameArena.h"
+#include "FrameTimer.h"
+#include "HighResClock.h"
+#include "BackgroundSource.h"
+
+using namespace std;
+
+// the depth stream the composites are made from, scaled up to each view size
+static const LONG g_depthWidth = 320;
+static const LONG g_depthHeight = 240;
+
+static const int g_viewSizes[][2] = { { 640, 480 }, { 1280, 960 } };
+
+// composites are made before timing and drawn in turn; the player moves between them
+static const int g_composites = 8;
+static const int g_warmupFrames = 30;
+static const int g_frames = 600;
+
+// every frame a new composite, as at the sensor's 30 fps; the others redraw the overlay only
+static const int g_compositeEvery = 2;
+
+// a channel off by this much between the renderers is rounding, not a different picture
+static const int g_roundingDifference = 2;
+
+// the moving background's rows switch between it and the still image this often
+static const int g_switchEvery = 150;
+
+// frames of the synthetic video before it loops
+static const LONG g_videoFrames = 60;
+
+/// <summary>
+/// Stripes drifting across the view and a pulsing tint, worked out per pixel as a decoder would
+/// </summary>
+class SyntheticVideo : public BackgroundSource
+{
+public:
+	SyntheticVideo() : m_width(0), m_height(0) {}
+
+	virtual HRESULT Open(int width, int height)
+	{
+		m_width = width;
+		m_height = height;
+		return S_OK;
+	}
+	virtual LONG FrameCount() const { return g_videoFrames; }
+	virtual double FramesPerSecond() const { return 30.0; }
+
+	virtual HRESULT ReadFrame(LONG index, BYTE* pixels)
+	{
+		DWORD* out = reinterpret_cast<DWORD*>(pixels);
+		int tint = (int)(index % g_videoFrames) * 255 / g_videoFrames;
+		for ( int y = 0; y < m_height; ++y )
+		{
+			for ( int x = 0; x < m_width; ++x )
+			{
+				int stripe = ((x + y + index * 8) >> 4) & 1;
+				DWORD blue = (DWORD)(stripe ? 200 : 60);
+				DWORD green = (DWORD)((y * 255 / m_height + tint) & 255);
+				DWORD red = (DWORD)(tint / 2 + (stripe ? 100 : 0));
+				*out++ = 0xff000000 | (red << 16) | (green << 8) | blue;
+			}
+		}
+		return S_OK;
+	}
+
+private:
+	int		m_width;
+	int		m_height;
+};
+
+// What the sink keeps of the frames read back
+typedef struct
+{
+	ULONGLONG	hash;
+	LONG		frames;
+	ofstream*	pFile;
+	LONGLONG	ticks;		// spent in the sink
+} ReadbackTally;
+
+static void TallyFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG, LONGLONG)
+{
+	ReadbackTally* pTally = (ReadbackTally*)context;
+	LONGLONG start = HighResClock::Now();
+
+	// FNV-1a over the rows, top first
+	ULONGLONG hash = pTally->hash;
+	for ( int y = 0; y < height; ++y )
+	{
+		const BYTE* pRow = pixels + y * stride;
+		for ( int i = 0; i < width * 4; ++i )
+		{
+			hash = (hash ^ pRow[i]) * 1099511628211ULL;
+		}
+		if ( pTally->pFile )
+		{
+			pTally->pFile->write((const char*)pRow, width * 4);
+		}
+	}
+	pTally->hash = hash;
+	++pTally->frames;
+	pTally->ticks += HighResClock::Now() - start;
+}
+
+/// <summary>
+/// Keeps a copy of the frame, top-down, in the vector
+/// </summary>
+static void CopyFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG, LONGLONG)
+{
+	vector<BYTE>& copy = *(vector<BYTE>*)context;
+	copy.resize((size_t)width * height * 4);
+	for ( int y = 0; y < height; ++y )
+	{
+		memcpy(&copy[(size_t)y * width * 4], pixels + y * stride, width * 4);
+	}
+}
+
+/// <summary>
+/// Foot markers stepping along the bottom of the view, and keys pressed under them
+/// </summary>
+static void SyntheticOverlay(int frame, int width, int height, Point2f feetPoints[4], BYTE keyStates[FloorPiano::cKeyCount])
+{
+	float step = (float)((frame / 10) % 20) / 20.0f;
+	float y = height * 0.92f;
+
+	feetPoints[0] = Point2f(width * (0.1f + 0.8f * step), y);
+	feetPoints[1] = Point2f(width * (0.15f + 0.8f * step), y - 10.0f);
+	feetPoints[2] = Point2f(0.0f, 0.0f);
+	feetPoints[3] = Point2f(0.0f, 0.0f);
+
+	ZeroMemory(keyStates, FloorPiano::cKeyCount);
+	for ( int i = 0; i < 2; ++i )
+	{
+		int key = (int)(feetPoints[i].x * FloorPiano::cKeyCount / width);
+		if ( key >= 0 && key < FloorPiano::cKeyCount )
+		{
+			keyStates[key] = ( (frame % 10) < 3 ) ? KeyStateDown : KeyStateUnderFoot;
+		}
+	}
+}
+
+/// <param name="video">draw a moving background, switching to the still one and back as a show would</param>
+/// <param name="reference">the GL renderer's reference frame, filled by the GL run and compared with by the software one</param>
+static HRESULT RenderSize(int width, int height, bool software, bool video, bool writeFrames, vector<BYTE>& reference, ofstream& csv)
+{
+	CompositeLayout layout;
+	layout.depthWidth = g_depthWidth;
+	layout.depthHeight = g_depthHeight;
+	layout.colorWidth = width;
+	layout.colorHeight = height;
+	layout.colorToDepthDivisor = width / g_depthWidth;
+
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	FrameArena arena;
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	LONG colorPixels = layout.colorWidth * layout.colorHeight;
+
+	// sized as the renderer reads them, as GreenScreen's are
+	ArenaView<USHORT> depthD16 = arena.Allocate<USHORT>(depthPixels);
+	ArenaView<ColorCoordinate> colorCoordinates = arena.Allocate<ColorCoordinate>(depthPixels);
+	ArenaView<BYTE> colorRGBX = arena.Allocate<BYTE>(colorPixels * sizeof(long));
+	ArenaView<BYTE> composites = arena.Allocate<BYTE>(colorPixels * sizeof(long) * g_composites);
+	if ( NULL == composites.Data() || NULL == colorRGBX.Data() || NULL == colorCoordinates.Data() || NULL == depthD16.Data() )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for ( int i = 0; i < g_composites; ++i )
+	{
+		source.GenerateDepth(i * 4, depthD16);
+		source.GenerateColor(i * 4, colorRGBX);
+
+		// the renderer blends on the X byte, which shows the players where it is 0 as the sensor leaves it
+		for ( LONG p = 0; p < colorPixels; ++p )
+		{
+			colorRGBX[p * 4 + 3] = 0;
+		}
+		source.MapColorCoordinates(depthD16, colorCoordinates, 0, layout.depthHeight);
+		CompositePlayers(layout, depthD16, colorCoordinates, colorRGBX, composites + colorPixels * sizeof(long) * i, 0, layout.colorHeight);
+	}
+
+	ImageRenderer renderer;
+	FrameTimer timer;
+	HRESULT hr = software ?
+		renderer.InitializeSoftware(NULL, width, height, width * sizeof(long), &arena) :
+		renderer.InitializeOffscreen(width, height, width, height, width * sizeof(long), &arena);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+	renderer.SetKeyboard(FloorPiano::cKeyCount, 0);
+	renderer.SetFrameTimer(&timer);
+
+	int videoBackground = 0;
+	if ( video )
+	{
+		hr = renderer.AddBackground(new SyntheticVideo(), videoBackground);
+		if ( FAILED(hr) )
+		{
+			return hr;
+		}
+		renderer.SelectBackground(videoBackground);
+	}
+
+	ofstream frameFile;
+	ReadbackTally tally;
+	tally.hash = 14695981039346656037ULL;
+	tally.frames = 0;
+	tally.pFile = NULL;
+	tally.ticks = 0;
+	if ( writeFrames )
+	{
+		ostringstream path;
+		path << (software ? "software_" : "offscreen_") << (video ? "video_" : "") << width << "x" << height << ".bgra";
+		frameFile.open(path.str().c_str(), ios::binary);
+		tally.pFile = frameFile ? &frameFile : NULL;
+	}
+	renderer.AddFrameSink(TallyFrame, &tally);
+
+	Point2f feetPoints[4];
+	BYTE keyStates[FloorPiano::cKeyCount];
+	LONGLONG drawTicks = 0;
+	LONGLONG switchTicks = 0;
+	int switches = 0;
+	LONGLONG start = 0;
+
+	for ( int frame = 0; frame < g_warmupFrames + g_frames; ++frame )
+	{
+		if ( frame == g_warmupFrames )
+		{
+			start = HighResClock::Now();
+			drawTicks = 0;
+		}
+
+		SyntheticOverlay(frame, width, height, feetPoints, keyStates);
+		BYTE* pImage = NULL;
+		if ( frame % g_compositeEvery == 0 )
+		{
+			pImage = composites + colorPixels * sizeof(long) * ((frame / g_compositeEvery) % g_composites);
+		}
+
+		// away to the still image and back, both preloaded
+		bool switching = video && frame > 0 && frame % g_switchEvery == 0;
+		if ( switching )
+		{
+			renderer.SelectBackground(( frame / g_switchEvery ) % 2 ? 0 : videoBackground);
+		}
+
+		LONGLONG drawStart = HighResClock::Now();
+		renderer.Draw(pImage, feetPoints, keyStates, FloorPiano::cKeyCount);
+		LONGLONG drawn = HighResClock::Now() - drawStart;
+		drawTicks += drawn;
+		if ( switching && frame >= g_warmupFrames )
+		{
+			switchTicks += drawn;
+			++switches;
+		}
+	}
+	renderer.FlushReadback();
+
+	double seconds = HighResClock::TicksToMilliseconds(HighResClock::Now() - start) / 1000.0;
+
+	// the software renderer hands frames to the sink inside Draw, GL on the readback thread
+	if ( software )
+	{
+		drawTicks -= tally.ticks;
+	}
+
+	BackgroundStreamStats videoStats;
+	ZeroMemory(&videoStats, sizeof(videoStats));
+	renderer.GetBackgroundStats(videoBackground, videoStats);
+
+	// the reference frame: the first composite over the still background, drawn once, as a frame's
+	// composite is drawn in the frame it arrives with
+	renderer.RemoveFrameSink(TallyFrame, &tally);
+	renderer.SelectBackground(0);
+	vector<BYTE> frameCopy;
+	SyntheticOverlay(0, width, height, feetPoints, keyStates);
+	renderer.RequestSnapshot(CopyFrame, &frameCopy);
+	renderer.Draw(composites, feetPoints, keyStates, FloorPiano::cKeyCount);
+	renderer.FlushReadback();
+
+	LONG mismatches = 0;
+	int maxDifference = 0;
+	if ( !software )
+	{
+		reference = frameCopy;
+	}
+	else if ( reference.size() == frameCopy.size() )
+	{
+		for ( size_t p = 0; p < frameCopy.size(); p += 4 )
+		{
+			int difference = 0;
+			for ( int c = 0; c < 4; ++c )
+			{
+				int channel = abs((int)frameCopy[p + c] - (int)reference[p + c]);
+				if ( channel > difference ) difference = channel;
+			}
+			if ( difference > maxDifference ) maxDifference = difference;
+			if ( difference > g_roundingDifference ) ++mismatches;
+		}
+	}
+
+	csv << (software ? "software" : "gl") << ","
+		<< (video ? "video" : "still") << ","
+		<< width << ","
+		<< height << ","
+		<< g_frames << ","
+		<< seconds << ","
+		<< ( seconds > 0.0 ? g_frames / seconds : 0.0 ) << ","
+		<< HighResClock::TicksToMilliseconds(drawTicks) / g_frames << ","
+		<< ( switches > 0 ? HighResClock::TicksToMilliseconds(switchTicks) / switches : 0.0 ) << ","
+		<< renderer.DrawCalls() << ","
+		<< renderer.ReadbackStalls() << ","
+		<< tally.frames << ","
+		<< videoStats.shown << ","
+		<< videoStats.skipped << ","
+		<< videoStats.undrawn << ","
+		<< videoStats.late << ","
+		<< videoStats.decodeMs << ","
+		<< hex << tally.hash << dec << ","
+		<< mismatches << ","
+		<< maxDifference << endl;
+
+	return S_OK;
+}
+
+HRESULT RunOffscreenRender(const char* csvPath, bool writeFrames)
+{
+	ofstream csv(csvPath);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	// draw_ms leaves out the time spent in the sink, which GL spends on its readback thread; switch_ms
+	// is the average of the Draws that switched background
+	csv << "renderer,background,width,height,frames,seconds,fps,draw_ms,switch_ms,draw_calls,readback_stalls,frames_read_back,"
+		"video_frames,skipped_frames,undrawn_frames,late_frames,decode_ms,hash,mismatched_pixels,max_difference" << endl;
+
+	for ( size_t i = 0; i < sizeof(g_viewSizes) / sizeof(g_viewSizes[0]); ++i )
+	{
+		for ( int video = 0; video < 2; ++video )
+		{
+			vector<BYTE> reference;
+			for ( int software = 0; software < 2; ++software )
+			{
+				HRESULT hr = RenderSize(g_viewSizes[i][0], g_viewSizes[i][1], software != 0, video != 0, writeFrames, reference, csv);
+				if ( FAILED(hr) )
+				{
+					return hr;
+				}
+			}
+		}
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,47 @@
+/*
+
+Headless render benchmark
+
+Draws synthetic composites through the renderer without a window or a
+sensor: an offscreen context (EGL on machines without a display, a hidden
+window on Windows) drawing into a framebuffer object that is read back
+asynchronously after every frame. The player walks past at 640x480 and
+1280x960 with the foot markers and keyboard moving, so every layer is drawn
+as in a live session. Each size gets a CSV row with the frame rate, the CPU
+time spent in Draw, readback stalls and a hash of every frame read back,
+which stays the same from run to run on one driver and so catches rendering
+changes.
+
+Each size is then drawn again by the software renderer, the CPU path for
+machines without a usable driver, for a row to compare. Both renderers end
+on the same reference frame, and the software row counts the pixels of it
+that differ from GL's by more than rounding, and the largest difference.
+
+Both renderers then draw each size over a moving background, a synthetic
+30 fps video decoded ahead by a BackgroundStream, switching to the still
+image and back every 150 frames; its frame rate should match the still
+row's. Those rows add the time of the Draws that switch and the video frames
+shown, skipped by the ring, undrawn because drawing was slower than the
+video, and late. Which video frame each draw gets depends on the clock, so
+their hashes change from run to run.
+
+Run with /headless on the command line; results go to headless_render.csv.
+Off Windows, CMakeLists.txt builds it on its own as the headless executable,
+which runs the same way from the working directory it writes to.
+With /headless:frames each frame read back is also appended to
+offscreen_WxH.bgra (software_WxH.bgra for the software renderer,
+offscreen_video_WxH.bgra and so on over the video), raw top-down BGRA.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Renders the synthetic session at each size and writes one CSV row per size
+/// </summary>
+/// <param name="csvPath">CSV file to write</param>
+/// <param name="writeFrames">also write every frame read back to a raw file per size</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunOffscreenRender(const char* csvPath, bool writeFrames);
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include <fstream>
+#include "NuiApi.h"
+#include "PipelineBenchmark.h"
+#include "StageGraph.h"
+#include "SlotPool.h"
+#include "SyntheticFrameSource.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const int g_stageDepths[] = { 1, 2, 3, 4, 6, 8 };
+static const int g_stageDepthCount = sizeof(g_stageDepths) / sizeof(g_stageDepths[0]);
+
+// distinct synthetic inputs, cycled through so the source costs nothing during the runs
+static const int g_sourceFrames = 8;
+
+static const int g_queueCapacity = 2;
+static const int g_saturatedFrames = 600;
+static const int g_pacedFrames = 90;
+static const int g_pacedFps = 30;
+
+static const char* g_bandNames[StageGraph::cMaxStages] =
+{
+	"Band 0", "Band 1", "Band 2", "Band 3", "Band 4", "Band 5", "Band 6", "Band 7"
+};
+
+typedef struct
+{
+	USHORT*		depthD16;
+	BYTE*		colorRGBX;
+} SourceFrame;
+
+typedef struct
+{
+	const SourceFrame*	pSource;
+	ColorCoordinate*	colorCoordinates;
+	BYTE*				outputRGBX;
+	int					slot;
+} BenchFrame;
+
+typedef struct
+{
+	const SyntheticFrameSource*	pSource;
+	const CompositeLayout*		pLayout;
+	LONG						firstDepthRow;
+	LONG						endDepthRow;
+} BandContext;
+
+typedef struct
+{
+	SlotPool	freeFrames;
+} BenchRetire;
+
+/// <summary>
+/// One stage of the split frame: maps a band of depth rows and composites the colour rows over them
+/// </summary>
+static void BandStage(void* context, void* item)
+{
+	const BandContext* pBand = static_cast<const BandContext*>(context);
+	BenchFrame* pFrame = static_cast<BenchFrame*>(item);
+	LONG divisor = pBand->pLayout->colorToDepthDivisor;
+
+	pBand->pSource->MapColorCoordinates(pFrame->pSource->depthD16, pFrame->colorCoordinates, pBand->firstDepthRow, pBand->endDepthRow);
+
+	CompositePlayers(*pBand->pLayout,
+		pFrame->pSource->depthD16, pFrame->colorCoordinates, pFrame->pSource->colorRGBX,
+		pFrame->outputRGBX, pBand->firstDepthRow * divisor, pBand->endDepthRow * divisor);
+}
+
+static void RetireBenchFrame(void* context, void* item, bool)
+{
+	static_cast<BenchRetire*>(context)->freeFrames.Release(static_cast<BenchFrame*>(item)->slot);
+}
+
+/// <summary>
+/// Submits one frame, waiting for a free frame and for room in the graph
+/// </summary>
+static void SubmitFrame(StageGraph& graph, BenchRetire& retire, BenchFrame* frames, const SourceFrame* pSource)
+{
+	for (;;)
+	{
+		int slot = retire.freeFrames.Acquire();
+		if ( slot >= 0 )
+		{
+			frames[slot].pSource = pSource;
+			if ( graph.Submit(&frames[slot]) )
+			{
+				return;
+			}
+			retire.freeFrames.Release(slot);
+		}
+		SwitchToThread();
+	}
+}
+
+HRESULT RunPipelineBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	CompositeLayout layout;
+	layout.depthWidth = 320;
+	layout.depthHeight = 240;
+	layout.colorWidth = 640;
+	layout.colorHeight = 480;
+	layout.colorToDepthDivisor = layout.colorWidth / layout.depthWidth;
+
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	LONG colorPixels = layout.colorWidth * layout.colorHeight;
+
+	SourceFrame sources[g_sourceFrames];
+	for ( int i = 0; i < g_sourceFrames; ++i )
+	{
+		sources[i].depthD16 = new USHORT[depthPixels];
+		sources[i].colorRGBX = new BYTE[colorPixels * 4];
+		source.GenerateDepth(i * 10, sources[i].depthD16);
+		source.GenerateColor(i * 10, sources[i].colorRGBX);
+	}
+
+	// enough frames that the source is never short of one: every queue full and every stage busy
+	BenchFrame frames[SlotPool::cMaxSlots];
+	for ( int i = 0; i < SlotPool::cMaxSlots; ++i )
+	{
+		frames[i].colorCoordinates = new ColorCoordinate[depthPixels];
+		frames[i].outputRGBX = new BYTE[colorPixels * 4];
+		frames[i].slot = i;
+	}
+
+	csv << "stages,workers,throughput_fps,paced_p50_ms,paced_p99_ms,paced_max_ms,work_ms,added_p50_ms,rejected,steals" << endl;
+
+	for ( int d = 0; d < g_stageDepthCount; ++d )
+	{
+		int stages = g_stageDepths[d];
+
+		WorkPool* pPool = new WorkPool();
+		StageGraph* pGraph = new StageGraph();
+		BenchRetire retire;
+		BandContext bands[StageGraph::cMaxStages];
+
+		if ( FAILED(pPool->Start(0)) )
+		{
+			delete pGraph;
+			delete pPool;
+			continue;
+		}
+
+		for ( int s = 0; s < stages; ++s )
+		{
+			bands[s].pSource = &source;
+			bands[s].pLayout = &layout;
+			bands[s].firstDepthRow = s * layout.depthHeight / stages;
+			bands[s].endDepthRow = (s + 1) * layout.depthHeight / stages;
+			pGraph->AddStage(g_bandNames[s], BandStage, &bands[s], g_queueCapacity, 0.0);
+		}
+		pGraph->SetRetire(RetireBenchFrame, &retire);
+		retire.freeFrames.Reset(SlotPool::cMaxSlots);
+		pGraph->Start(pPool);
+
+		// throughput: keep the graph full
+		LONGLONG start = HighResClock::Now();
+		for ( int i = 0; i < g_saturatedFrames; ++i )
+		{
+			SubmitFrame(*pGraph, retire, frames, &sources[i % g_sourceFrames]);
+		}
+		pGraph->WaitIdle();
+		double throughput = g_saturatedFrames * 1000.0 / HighResClock::TicksToMilliseconds(HighResClock::Now() - start);
+
+		// start the latency run with empty histograms
+		LatencySummary total;
+		StageStats stats;
+		pGraph->GetTotalLatency(total);
+		for ( int s = 0; s < stages; ++s )
+		{
+			pGraph->GetStageStats(s, stats);
+		}
+
+		// latency: frames arrive at the sensor rate, so they only wait on each other's hand-offs
+		LONG rejectedBefore = pGraph->Rejected();
+		LONGLONG period = HighResClock::Frequency() / g_pacedFps;
+		LONGLONG next = HighResClock::Now();
+		for ( int i = 0; i < g_pacedFrames; ++i )
+		{
+			LONGLONG now;
+			while ( (now = HighResClock::Now()) < next )
+			{
+				if ( next - now > HighResClock::MillisecondsToTicks(2) )
+				{
+					Sleep(1);
+				}
+			}
+			next += period;
+
+			int slot = retire.freeFrames.Acquire();
+			if ( slot >= 0 )
+			{
+				frames[slot].pSource = &sources[i % g_sourceFrames];
+				if ( !pGraph->Submit(&frames[slot]) )
+				{
+					retire.freeFrames.Release(slot);
+				}
+			}
+		}
+		pGraph->WaitIdle();
+
+		pGraph->GetTotalLatency(total);
+		double work = 0.0;
+		for ( int s = 0; s < stages; ++s )
+		{
+			pGraph->GetStageStats(s, stats);
+			work += stats.service.p50;
+		}
+
+		csv << stages << ","
+			<< pPool->WorkerCount() << ","
+			<< throughput << ","
+			<< total.p50 << ","
+			<< total.p99 << ","
+			<< total.max << ","
+			<< work << ","
+			<< (total.p50 - work) << ","
+			<< (pGraph->Rejected() - rejectedBefore) << ","
+			<< pPool->Steals() << endl;
+
+		pPool->Stop();
+		delete pGraph;
+		delete pPool;
+	}
+
+	for ( int i = 0; i < g_sourceFrames; ++i )
+	{
+		delete[] sources[i].depthD16;
+		delete[] sources[i].colorRGBX;
+	}
+	for ( int i = 0; i < SlotPool::cMaxSlots; ++i )
+	{
+		delete[] frames[i].colorCoordinates;
+		delete[] frames[i].outputRGBX;
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,26 @@
+/*
+
+Stage graph benchmark
+
+Runs synthetic frames (mapping plus compositing, the per-frame work of the
+real pipeline) through the stage graph with the work split over 1 to 8
+stages. For each depth it measures throughput with the source submitting as
+fast as the graph accepts frames, and submit-to-retire latency with the
+source paced at the sensor's 30 fps. Added latency is the paced latency
+minus the time spent in the stage functions, i.e. the cost of queueing,
+scheduling and hand-offs between workers.
+
+Run with /benchpipeline on the command line; results go to pipeline_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per stage depth
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunPipelineBenchmark(const char* path);
@@ -0,0 +1,337 @@
+#include "stdafx.h"
+#include <fstream>
+#include <math.h>
+#include "NuiApi.h"
+#include "RegistrationBenchmark.h"
+#include "DepthRegistration.h"
+#include "SyntheticFrameSource.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const int g_syntheticFrames = 8;
+static const int g_iterations = 50;
+
+// One sensor's calibration as published by N. Burrus (2011): both cameras at 640x480, colour = R depth + T
+// with T in metres. Nothing in the built-in registration comes from it; the synthetic frames use it as a real
+// unit's geometry to hold the nominal model against. The axes are as published, and the runtime's images are
+// mirrored, so the offsets may point the other way on the runtime's; their sizes are what the rows show
+static const double g_unitDepthFocal[2] = { 594.214, 591.041 };
+static const double g_unitDepthCenter[2] = { 339.308, 242.739 };
+static const double g_unitColorFocal[2] = { 529.215, 525.564 };
+static const double g_unitColorCenter[2] = { 328.943, 267.481 };
+static const double g_unitRotation[9] =
+{
+	0.999846, 0.001264, -0.017487,
+	-0.001478, 0.999924, -0.012251,
+	0.017470, 0.012275, 0.999772
+};
+static const double g_unitTranslation[3] = { 0.019985, -0.000744, -0.010917 };
+
+// the error over every frame of one source
+typedef struct
+{
+	int		frames;
+	double	scalarMs;
+	double	simdMs;
+	LONG	compared;
+	LONG	within;
+	double	totalError;
+	double	maxError;
+	LONG	mismatches;
+} RegistrationError;
+
+HRESULT AppendRegistrationCapture(const char* path, const CompositeLayout& layout, const USHORT* depthD16, const LONG* colorCoordinates)
+{
+	ofstream capture(path, ios::binary | ios::app);
+	if ( !capture )
+	{
+		return E_FAIL;
+	}
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	capture.write(reinterpret_cast<const char*>(&layout), sizeof(layout));
+	capture.write(reinterpret_cast<const char*>(depthD16), depthPixels * sizeof(USHORT));
+	capture.write(reinterpret_cast<const char*>(colorCoordinates), depthPixels * 2 * sizeof(LONG));
+
+	return capture ? S_OK : E_FAIL;
+}
+
+/// <summary>
+/// The published unit's calibration for the layout's resolutions
+/// </summary>
+static void PublishedUnitCalibration(const CompositeLayout& layout, RegistrationCalibration& calibration)
+{
+	double depthScale = layout.depthWidth / 640.0;
+	double colorScale = layout.colorWidth / 640.0;
+
+	calibration.depthFocalX = (float)(g_unitDepthFocal[0] * depthScale);
+	calibration.depthFocalY = (float)(g_unitDepthFocal[1] * depthScale);
+	calibration.depthCenterX = (float)(g_unitDepthCenter[0] * depthScale);
+	calibration.depthCenterY = (float)(g_unitDepthCenter[1] * depthScale);
+	calibration.colorFocalX = (float)(g_unitColorFocal[0] * colorScale);
+	calibration.colorFocalY = (float)(g_unitColorFocal[1] * colorScale);
+	calibration.colorCenterX = (float)(g_unitColorCenter[0] * colorScale);
+	calibration.colorCenterY = (float)(g_unitColorCenter[1] * colorScale);
+	for ( int i = 0; i < 9; ++i )
+	{
+		calibration.rotation[i] = (float)g_unitRotation[i];
+	}
+	for ( int i = 0; i < 3; ++i )
+	{
+		calibration.translation[i] = (float)(g_unitTranslation[i] * 1000.0);
+	}
+}
+
+/// <summary>
+/// Maps a frame straight from a calibration in double precision, in the runtime's layout: the reference
+/// for synthetic frames, with none of the engine's tables
+/// </summary>
+static void MapReference(const RegistrationCalibration& calibration, const CompositeLayout& layout, const USHORT* depthD16, LONG* reference)
+{
+	const float* R = calibration.rotation;
+	const float* T = calibration.translation;
+
+	for ( LONG y = 0; y < layout.depthHeight; ++y )
+	{
+		for ( LONG x = 0; x < layout.depthWidth; ++x )
+		{
+			LONG index = x + y * layout.depthWidth;
+			USHORT depth = NuiDepthPixelToDepth(depthD16[index]);
+			if ( depth == 0 )
+			{
+				reference[index * 2] = x * layout.colorToDepthDivisor;
+				reference[index * 2 + 1] = y * layout.colorToDepthDivisor;
+				continue;
+			}
+
+			double z = depth;
+			double px = (x - calibration.depthCenterX) * z / calibration.depthFocalX;
+			double py = (y - calibration.depthCenterY) * z / calibration.depthFocalY;
+			double cx = R[0] * px + R[1] * py + R[2] * z + T[0];
+			double cy = R[3] * px + R[4] * py + R[5] * z + T[1];
+			double cz = R[6] * px + R[7] * py + R[8] * z + T[2];
+
+			reference[index * 2] = (LONG)(calibration.colorFocalX * cx / cz + calibration.colorCenterX);
+			reference[index * 2 + 1] = (LONG)(calibration.colorFocalY * cy / cz + calibration.colorCenterY);
+		}
+	}
+}
+
+/// <summary>
+/// Writes a source's row over all of its frames
+/// </summary>
+static void WriteTotal(ofstream& csv, const char* sourceName, const RegistrationError& total)
+{
+	double scalarMs = total.frames > 0 ? total.scalarMs / total.frames : 0.0;
+	double simdMs = total.frames > 0 ? total.simdMs / total.frames : 0.0;
+
+	csv << sourceName << ","
+		<< "all,"
+		<< scalarMs << ","
+		<< simdMs << ","
+		<< (simdMs > 0.0 ? scalarMs / simdMs : 0.0) << ","
+		<< total.compared << ","
+		<< (total.compared > 0 ? total.totalError / total.compared : 0.0) << ","
+		<< total.maxError << ","
+		<< (total.compared > 0 ? 100.0 * total.within / total.compared : 0.0) << ","
+		<< total.mismatches << endl;
+}
+
+/// <summary>
+/// Times both paths over one frame, compares the SSE2 output with the reference and adds the frame to the total
+/// </summary>
+static void MeasureFrame(ofstream& csv, const char* sourceName, int frame,
+	DepthRegistration& registration, const CompositeLayout& layout,
+	const USHORT* depthD16, const LONG* reference, ColorCoordinate* scalar, ColorCoordinate* simd,
+	RegistrationError& total)
+{
+	LONGLONG start = HighResClock::Now();
+	for ( int i = 0; i < g_iterations; ++i )
+	{
+		registration.MapFrameScalar(depthD16, scalar, 0, layout.depthHeight);
+	}
+	LONGLONG scalarTicks = HighResClock::Now() - start;
+
+	start = HighResClock::Now();
+	for ( int i = 0; i < g_iterations; ++i )
+	{
+		registration.MapFrame(depthD16, simd, 0, layout.depthHeight);
+	}
+	LONGLONG simdTicks = HighResClock::Now() - start;
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	LONG compared = 0;
+	LONG within = 0;
+	LONG mismatches = 0;
+	double totalError = 0.0;
+	double maxError = 0.0;
+
+	for ( LONG i = 0; i < depthPixels; ++i )
+	{
+		if ( simd[i].x != scalar[i].x || simd[i].y != scalar[i].y )
+		{
+			++mismatches;
+		}
+
+		// pixels without depth are mapped straight across by both, they say nothing about the model
+		if ( NuiDepthPixelToDepth(depthD16[i]) == 0 )
+		{
+			continue;
+		}
+
+		double dx = (double)(simd[i].x - reference[i * 2]);
+		double dy = (double)(simd[i].y - reference[i * 2 + 1]);
+		double error = sqrt(dx * dx + dy * dy);
+
+		++compared;
+		totalError += error;
+		if ( error > maxError )
+		{
+			maxError = error;
+		}
+		if ( error <= 1.0 )
+		{
+			++within;
+		}
+	}
+
+	double scalarMs = HighResClock::TicksToMilliseconds(scalarTicks) / g_iterations;
+	double simdMs = HighResClock::TicksToMilliseconds(simdTicks) / g_iterations;
+
+	csv << sourceName << ","
+		<< frame << ","
+		<< scalarMs << ","
+		<< simdMs << ","
+		<< (simdMs > 0.0 ? scalarMs / simdMs : 0.0) << ","
+		<< compared << ","
+		<< (compared > 0 ? totalError / compared : 0.0) << ","
+		<< maxError << ","
+		<< (compared > 0 ? 100.0 * within / compared : 0.0) << ","
+		<< mismatches << endl;
+
+	++total.frames;
+	total.scalarMs += scalarMs;
+	total.simdMs += simdMs;
+	total.compared += compared;
+	total.within += within;
+	total.totalError += totalError;
+	total.mismatches += mismatches;
+	if ( maxError > total.maxError )
+	{
+		total.maxError = maxError;
+	}
+}
+
+HRESULT RunRegistrationBenchmark(const char* capturePath, const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	csv << "source,frame,scalar_ms,simd_ms,speedup,compared_pixels,mean_error_px,max_error_px,within_1px_pct,simd_scalar_mismatches" << endl;
+
+	DepthRegistration registration;
+	RegistrationCalibration calibration;
+	CompositeLayout layout;
+	RegistrationError total;
+	ZeroMemory(&total, sizeof(total));
+
+	ifstream capture(capturePath, ios::binary);
+	if ( capture )
+	{
+		// every recorded frame, against what the runtime mapped it to
+		int frame = 0;
+		while ( capture.read(reinterpret_cast<char*>(&layout), sizeof(layout)) )
+		{
+			LONG depthPixels = layout.depthWidth * layout.depthHeight;
+			if ( depthPixels <= 0 || layout.colorToDepthDivisor <= 0 )
+			{
+				return E_FAIL;
+			}
+
+			USHORT* depthD16 = new USHORT[depthPixels];
+			LONG* reference = new LONG[depthPixels * 2];
+			ColorCoordinate* scalar = new ColorCoordinate[depthPixels];
+			ColorCoordinate* simd = new ColorCoordinate[depthPixels];
+
+			capture.read(reinterpret_cast<char*>(depthD16), depthPixels * sizeof(USHORT));
+			capture.read(reinterpret_cast<char*>(reference), depthPixels * 2 * sizeof(LONG));
+
+			HRESULT hr = E_FAIL;
+			if ( capture )
+			{
+				DepthRegistration::DefaultCalibration(layout, calibration);
+				hr = registration.Initialize(layout, calibration);
+				if ( SUCCEEDED(hr) )
+				{
+					MeasureFrame(csv, "capture", frame++, registration, layout, depthD16, reference, scalar, simd, total);
+				}
+			}
+
+			delete[] depthD16;
+			delete[] reference;
+			delete[] scalar;
+			delete[] simd;
+
+			if ( FAILED(hr) )
+			{
+				return hr;
+			}
+		}
+
+		WriteTotal(csv, "capture", total);
+		return frame > 0 ? S_OK : E_FAIL;
+	}
+
+	layout.depthWidth = 320;
+	layout.depthHeight = 240;
+	layout.colorWidth = 640;
+	layout.colorHeight = 480;
+	layout.colorToDepthDivisor = layout.colorWidth / layout.depthWidth;
+
+	DepthRegistration::DefaultCalibration(layout, calibration);
+	HRESULT hr = registration.Initialize(layout, calibration);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	USHORT* depthD16 = new USHORT[depthPixels];
+	LONG* reference = new LONG[depthPixels * 2];
+	ColorCoordinate* scalar = new ColorCoordinate[depthPixels];
+	ColorCoordinate* simd = new ColorCoordinate[depthPixels];
+
+	// the engine against the nominal model it was built from, which checks the tables and the SIMD path and
+	// nothing else, then against the published unit, which is how far the nominal model can land from a real one
+	RegistrationCalibration unitCalibration;
+	PublishedUnitCalibration(layout, unitCalibration);
+	const RegistrationCalibration* references[] = { &calibration, &unitCalibration };
+	const char* referenceNames[] = { "nominal", "published_unit" };
+
+	for ( int r = 0; r < 2; ++r )
+	{
+		ZeroMemory(&total, sizeof(total));
+		for ( int frame = 0; frame < g_syntheticFrames; ++frame )
+		{
+			source.GenerateDepth(frame * 20, depthD16);
+			MapReference(*references[r], layout, depthD16, reference);
+			MeasureFrame(csv, referenceNames[r], frame, registration, layout, depthD16, reference, scalar, simd, total);
+		}
+		WriteTotal(csv, referenceNames[r], total);
+	}
+
+	delete[] depthD16;
+	delete[] reference;
+	delete[] scalar;
+	delete[] simd;
+
+	// nothing was checked against the runtime
+	return S_FALSE;
+}
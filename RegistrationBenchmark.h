@@ -0,0 +1,46 @@
+/*
+
+Registration accuracy and throughput
+
+Checks the built-in registration against the runtime's own mapping and times
+it. /recordregistration makes the running application append one frame a
+second of depth, and the runtime's colour coordinates for it, to
+registration_capture.bin, a few megabytes; /benchregistration then maps the
+recorded depth with the built-in engine and reports, per frame and over the
+whole capture, the scalar and SSE2 times and how far the result lands from
+the runtime's (mean, max and share within one colour pixel, over pixels with
+depth). A capture checked in beside the project is what it validates against.
+
+Without a capture only the engine can be checked, on synthetic frames: the
+"nominal" rows hold it against a double-precision projection of the nominal
+model it is built from, which finds table and SIMD errors and says nothing
+about accuracy, and the "published_unit" rows against a projection of one
+real sensor's published calibration, which is how far the nominal model can
+land from a real unit. Neither is the runtime, so the run returns S_FALSE.
+
+Results go to registration_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "Compositor.h"
+
+/// <summary>
+/// Appends one frame of depth and the runtime's mapping of it to a capture file
+/// </summary>
+/// <param name="path">capture file</param>
+/// <param name="layout">frame sizes</param>
+/// <param name="depthD16">depth frame with player indices</param>
+/// <param name="colorCoordinates">the runtime's colour x,y for each depth pixel</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT AppendRegistrationCapture(const char* path, const CompositeLayout& layout, const USHORT* depthD16, const LONG* colorCoordinates);
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per frame
+/// </summary>
+/// <param name="capturePath">capture file, synthetic frames are used if it can't be opened</param>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK if checked against a capture, S_FALSE if only on synthetic frames, otherwise failure code</returns>
+HRESULT RunRegistrationBenchmark(const char* capturePath, const char* path);
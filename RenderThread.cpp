@@ -0,0 +1,91 @@
+#include "stdafx.h"
+#include "RenderThread.h"
+#include "Trace.h"
+#include "AllocationAudit.h"
+
+RenderThread::RenderThread() :
+	m_pRenderer(NULL),
+	m_pMailbox(NULL),
+	m_pOverlay(NULL),
+	m_fullFrames(0),
+	m_overlayFrames(0),
+	m_hThread(NULL)
+{
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_hFramePublished = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+RenderThread::~RenderThread()
+{
+	Stop();
+
+	CloseHandle(m_hStop);
+	CloseHandle(m_hFramePublished);
+}
+
+HRESULT RenderThread::Start(ImageRenderer* pRenderer, RenderMailbox* pMailbox, OverlayMailbox* pOverlay)
+{
+	if ( NULL == pRenderer || NULL == pMailbox || NULL == pOverlay )
+	{
+		return E_POINTER;
+	}
+
+	m_pRenderer = pRenderer;
+	m_pMailbox = pMailbox;
+	m_pOverlay = pOverlay;
+
+	ResetEvent(m_hStop);
+	m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	return m_hThread ? S_OK : E_FAIL;
+}
+
+void RenderThread::Stop()
+{
+	if ( m_hThread )
+	{
+		SetEvent(m_hStop);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+	}
+}
+
+DWORD WINAPI RenderThread::ThreadProc(LPVOID lpParameter)
+{
+	static_cast<RenderThread*>(lpParameter)->Run();
+	return 0;
+}
+
+void RenderThread::Run()
+{
+	Trace::SetThreadName("Render");
+	m_pRenderer->AttachContext();
+
+	HANDLE events[2] = { m_hStop, m_hFramePublished };
+	while ( WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+	{
+		// anything published while we were presenting has replaced older frames, draw only the newest
+		bool newComposite;
+		bool newOverlay;
+		{
+			AUDIT_SCOPE(AuditStageRenderPrep);
+			newComposite = m_pMailbox->Acquire();
+			newOverlay = m_pOverlay->Acquire();
+		}
+
+		if ( !newComposite && !newOverlay )
+		{
+			continue;
+		}
+
+		// without a new composite the renderer reuses the player texture it already has
+		AUDIT_SCOPE(AuditStageDraw);
+		OverlayFrame& overlay = m_pOverlay->Front();
+		m_pRenderer->Draw(newComposite ? m_pMailbox->Front().pImage : NULL, overlay.feetPoints, overlay.keyStates, FloorPiano::cKeyCount);
+		InterlockedIncrement(newComposite ? &m_fullFrames : &m_overlayFrames);
+	}
+
+	// whatever is still being read back is delivered before the context goes
+	m_pRenderer->FlushReadback();
+	m_pRenderer->DetachContext();
+}
@@ -0,0 +1,87 @@
+/*
+
+Render thread
+
+Owns the OpenGL context and presents the newest frame published to its
+mailboxes. Processing publishes and moves on; SwapBuffers blocking on vsync
+only ever stalls this thread.
+
+The picture is drawn in layers. The player composite only changes with new
+depth/colour and is uploaded to a texture once; the overlay (foot markers and keys)
+changes with every skeleton frame and has its own mailbox. A skeleton-only
+update redraws the overlay over the cached player texture without touching
+the composite, and a wake-up with nothing new in either mailbox draws nothing.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "ImageRenderer.h"
+#include "TripleBuffer.h"
+#include "FloorPiano.h"
+#include "types.h"
+
+/// <summary>
+/// Player layer: one composite
+/// </summary>
+typedef struct
+{
+	BYTE*		pImage;			// composited players, RGBX with TRANSPARENCY where there is no player
+} RenderFrame;
+
+/// <summary>
+/// Overlay layer: everything drawn on top of the players
+/// </summary>
+typedef struct
+{
+	Point2f		feetPoints[4];
+	BYTE		keyStates[FloorPiano::cKeyCount];	// KeyState of each piano key
+} OverlayFrame;
+
+typedef TripleBuffer<RenderFrame> RenderMailbox;
+typedef TripleBuffer<OverlayFrame> OverlayMailbox;
+
+class RenderThread
+{
+public:
+	RenderThread();
+	~RenderThread();
+
+	/// <summary>
+	/// Starts presenting frames from the mailboxes. The renderer's context must not be current on any other thread
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(ImageRenderer* pRenderer, RenderMailbox* pMailbox, OverlayMailbox* pOverlay);
+
+	/// <summary>
+	/// Stops the thread, which releases the context
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// Called by a writer after publishing to either mailbox
+	/// </summary>
+	void Notify() { SetEvent(m_hFramePublished); }
+
+	/// <summary>
+	/// Presents that uploaded a new composite, and presents that only redrew the overlay
+	/// </summary>
+	LONG FullFrames() const { return m_fullFrames; }
+	LONG OverlayFrames() const { return m_overlayFrames; }
+
+private:
+	ImageRenderer*	m_pRenderer;
+	RenderMailbox*	m_pMailbox;
+	OverlayMailbox*	m_pOverlay;
+
+	volatile LONG	m_fullFrames;
+	volatile LONG	m_overlayFrames;
+
+	HANDLE			m_hThread;
+	HANDLE			m_hStop;
+	HANDLE			m_hFramePublished;
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Run();
+};
@@ -0,0 +1,195 @@
+#include "stdafx.h"
+#include <fstream>
+#include "ResolutionBenchmark.h"
+#include "SyntheticFrameSource.h"
+#include "DepthRegistration.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const int g_iterations = 100;
+
+// far enough into the walk that the player is off centre
+static const int g_frameIndex = 40;
+
+/// <summary>
+/// Number of LONGs that differ between two buffers
+/// </summary>
+static LONG CountMismatches(const LONG* a, const LONG* b, LONG count)
+{
+	LONG mismatches = 0;
+	for ( LONG i = 0; i < count; ++i )
+	{
+		if ( a[i] != b[i] )
+		{
+			++mismatches;
+		}
+	}
+	return mismatches;
+}
+
+static double Speedup(double baselineMs, double ms)
+{
+	return ms > 0.0 ? baselineMs / ms : 0.0;
+}
+
+HRESULT RunResolutionBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	csv << "depth_width,depth_height,color_width,color_height,player_pixels,"
+		"generic_composite_ms,fixed_composite_ms,composite_speedup,"
+		"generic_collect_ms,fixed_collect_ms,collect_speedup,"
+		"generic_map_ms,fixed_map_ms,map_speedup,"
+		"generic_sparse_composite_ms,fixed_sparse_composite_ms,sparse_composite_speedup,"
+		"mismatches" << endl;
+
+	for ( int s = 0; s < cSpecializedLayouts; ++s )
+	{
+		LONG depthWidth = 0;
+		LONG divisor = 0;
+		SpecializedLayoutSize(s, depthWidth, divisor);
+
+		CompositeLayout layout;
+		layout.depthWidth = depthWidth;
+		layout.depthHeight = depthWidth * 3 / 4;
+		layout.colorWidth = depthWidth * divisor;
+		layout.colorHeight = layout.depthHeight * divisor;
+		layout.colorToDepthDivisor = divisor;
+
+		CompositeKernels generic;
+		CompositeKernels fixed;
+		GenericCompositeKernels(generic);
+		if ( !SelectCompositeKernels(layout, fixed) )
+		{
+			return E_UNEXPECTED;
+		}
+
+		SyntheticFrameSource source;
+		source.Initialize(layout);
+
+		RegistrationCalibration calibration;
+		DepthRegistration::DefaultCalibration(layout, calibration);
+		DepthRegistration registration;
+		HRESULT hr = registration.Initialize(layout, calibration);
+		if ( FAILED(hr) )
+		{
+			return hr;
+		}
+
+		LONG depthPixels = layout.depthWidth * layout.depthHeight;
+		LONG colorPixels = layout.colorWidth * layout.colorHeight;
+
+		USHORT* depthD16 = new USHORT[depthPixels];
+		BYTE* colorRGBX = new BYTE[colorPixels * 4];
+		ColorCoordinate* colorCoordinates = new ColorCoordinate[depthPixels];
+		PlayerPixel* genericPixels = new PlayerPixel[depthPixels];
+		PlayerPixel* fixedPixels = new PlayerPixel[depthPixels];
+		BYTE* genericRGBX = new BYTE[colorPixels * 4];
+		BYTE* fixedRGBX = new BYTE[colorPixels * 4];
+
+		source.GenerateDepth(g_frameIndex, depthD16);
+		source.GenerateColor(g_frameIndex, colorRGBX);
+		registration.MapFrame(depthD16, colorCoordinates, 0, layout.depthHeight);
+
+		LONGLONG genericComposite = 0;
+		LONGLONG fixedComposite = 0;
+		LONGLONG genericCollect = 0;
+		LONGLONG fixedCollect = 0;
+		LONGLONG genericMap = 0;
+		LONGLONG fixedMap = 0;
+		LONGLONG genericSparse = 0;
+		LONGLONG fixedSparse = 0;
+		LONG genericCount = 0;
+		LONG fixedCount = 0;
+		LONG mismatches = 0;
+
+		// whole-frame composite
+		for ( int i = 0; i < g_iterations; ++i )
+		{
+			LONGLONG t0 = HighResClock::Now();
+			generic.compositePlayers(layout, depthD16, colorCoordinates, colorRGBX, genericRGBX, 0, layout.colorHeight);
+			LONGLONG t1 = HighResClock::Now();
+			fixed.compositePlayers(layout, depthD16, colorCoordinates, colorRGBX, fixedRGBX, 0, layout.colorHeight);
+			LONGLONG t2 = HighResClock::Now();
+
+			genericComposite += t1 - t0;
+			fixedComposite += t2 - t1;
+		}
+		mismatches += CountMismatches((const LONG *)genericRGBX, (const LONG *)fixedRGBX, colorPixels);
+
+		// sparse path
+		for ( int i = 0; i < g_iterations; ++i )
+		{
+			LONGLONG t0 = HighResClock::Now();
+			genericCount = generic.collectPlayerPixels(layout, depthD16, genericPixels);
+			LONGLONG t1 = HighResClock::Now();
+			fixedCount = fixed.collectPlayerPixels(layout, depthD16, fixedPixels);
+			LONGLONG t2 = HighResClock::Now();
+			registration.MapPlayerPixelsGeneric(depthD16, genericPixels, genericCount);
+			LONGLONG t3 = HighResClock::Now();
+			registration.MapPlayerPixels(depthD16, fixedPixels, fixedCount);
+			LONGLONG t4 = HighResClock::Now();
+			generic.compositePlayerPixels(layout, genericPixels, genericCount, colorRGBX, genericRGBX);
+			LONGLONG t5 = HighResClock::Now();
+			fixed.compositePlayerPixels(layout, fixedPixels, fixedCount, colorRGBX, fixedRGBX);
+			LONGLONG t6 = HighResClock::Now();
+
+			genericCollect += t1 - t0;
+			fixedCollect += t2 - t1;
+			genericMap += t3 - t2;
+			fixedMap += t4 - t3;
+			genericSparse += t5 - t4;
+			fixedSparse += t6 - t5;
+		}
+		if ( genericCount != fixedCount )
+		{
+			mismatches += genericCount > fixedCount ? genericCount - fixedCount : fixedCount - genericCount;
+		}
+		LONG count = genericCount < fixedCount ? genericCount : fixedCount;
+		mismatches += CountMismatches((const LONG *)genericPixels, (const LONG *)fixedPixels, count * sizeof(PlayerPixel) / sizeof(LONG));
+		mismatches += CountMismatches((const LONG *)genericRGBX, (const LONG *)fixedRGBX, colorPixels);
+
+		double genericCompositeMs = HighResClock::TicksToMilliseconds(genericComposite) / g_iterations;
+		double fixedCompositeMs = HighResClock::TicksToMilliseconds(fixedComposite) / g_iterations;
+		double genericCollectMs = HighResClock::TicksToMilliseconds(genericCollect) / g_iterations;
+		double fixedCollectMs = HighResClock::TicksToMilliseconds(fixedCollect) / g_iterations;
+		double genericMapMs = HighResClock::TicksToMilliseconds(genericMap) / g_iterations;
+		double fixedMapMs = HighResClock::TicksToMilliseconds(fixedMap) / g_iterations;
+		double genericSparseMs = HighResClock::TicksToMilliseconds(genericSparse) / g_iterations;
+		double fixedSparseMs = HighResClock::TicksToMilliseconds(fixedSparse) / g_iterations;
+
+		csv << layout.depthWidth << ","
+			<< layout.depthHeight << ","
+			<< layout.colorWidth << ","
+			<< layout.colorHeight << ","
+			<< fixedCount << ","
+			<< genericCompositeMs << ","
+			<< fixedCompositeMs << ","
+			<< Speedup(genericCompositeMs, fixedCompositeMs) << ","
+			<< genericCollectMs << ","
+			<< fixedCollectMs << ","
+			<< Speedup(genericCollectMs, fixedCollectMs) << ","
+			<< genericMapMs << ","
+			<< fixedMapMs << ","
+			<< Speedup(genericMapMs, fixedMapMs) << ","
+			<< genericSparseMs << ","
+			<< fixedSparseMs << ","
+			<< Speedup(genericSparseMs, fixedSparseMs) << ","
+			<< mismatches << endl;
+
+		delete[] depthD16;
+		delete[] colorRGBX;
+		delete[] colorCoordinates;
+		delete[] genericPixels;
+		delete[] fixedPixels;
+		delete[] genericRGBX;
+		delete[] fixedRGBX;
+	}
+
+	return S_OK;
+}
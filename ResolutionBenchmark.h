@@ -0,0 +1,26 @@
+/*
+
+Resolution kernel benchmark
+
+Times each FixedLayout specialization of the compositing and mapping kernels
+against the RuntimeLayout kernel it replaces, one row per supported
+depth/colour pair, on a synthetic frame of the player walking past. The
+whole-frame composite, the player pixel collection, the built-in
+registration's player pixel mapping and the sparse composite are timed
+separately. Both kernels must produce the same output; the mismatch column
+counts pixels and coordinates where they differ.
+
+Run with /benchresolutions on the command line; results go to resolution_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per specialized layout
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunResolutionBenchmark(const char* path);
@@ -0,0 +1,269 @@
+#include "stdafx.h"
+#include <fstream>
+#include <vector>
+#include "SharedFrameBenchmark.h"
+#include "SharedFrameOutput.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+const char* g_sharedFrameName = "GreenScreenFrames";
+
+static const char* g_benchName = "GreenScreenFramesBench";
+
+static const int g_sizes[][2] = { { 640, 480 }, { 1280, 960 } };
+static const int g_sizeCount = sizeof(g_sizes) / sizeof(g_sizes[0]);
+
+static const int g_benchFrames = 600;
+
+// the renderer's pace; the benchmark also runs flat out to get the bare publish cost
+static const int g_pacedFps = 30;
+
+static const DWORD g_readerSeconds = 10;
+
+typedef struct
+{
+	SharedFrameReader	reader;
+	volatile LONG		stop;
+	LONG				framesRead;
+	LONG				tornReads;
+	LONGLONG			ageTicks;
+	LONGLONG			presentAgeTicks;
+	LONGLONG			maskedPixels;
+	LONGLONG			pixelsSeen;
+	DWORD				checksum;
+} ReaderState;
+
+/// <summary>
+/// Takes the newest frame if there is a new one: sums it in place, counts the masked pixels, and
+/// checks it was not overwritten meanwhile
+/// </summary>
+/// <returns>true if there was a new frame</returns>
+static bool ReadFrame(ReaderState& state, LONG& lastSequence)
+{
+	LONG sequence;
+	const BYTE* pixels;
+	const SharedFrameSlot* pSlot;
+	if ( !state.reader.Latest(lastSequence, sequence, pixels, pSlot) )
+	{
+		return false;
+	}
+	LONGLONG publishedTicks = pSlot->publishedTicks;
+	LONGLONG presentedTicks = pSlot->presentedTicks;
+
+	const SharedFrameHeader* pHeader = state.reader.Header();
+	const DWORD* pPixels = reinterpret_cast<const DWORD*>(pixels);
+	LONG pixelCount = pHeader->width * pHeader->height;
+	DWORD sum = 0;
+	LONG masked = 0;
+	for ( LONG i = 0; i < pixelCount; ++i )
+	{
+		sum += pPixels[i];
+		masked += ( pPixels[i] >> 24 ) == 0;
+	}
+
+	lastSequence = sequence;
+	if ( !state.reader.IsCurrent(sequence) )
+	{
+		++state.tornReads;
+		return true;
+	}
+
+	++state.framesRead;
+	LONGLONG now = HighResClock::Now();
+	state.ageTicks += now - publishedTicks;
+	state.presentAgeTicks += now - presentedTicks;
+	state.checksum += sum;
+	if ( pHeader->flags & cSharedFrameMaskInAlpha )
+	{
+		state.maskedPixels += masked;
+		state.pixelsSeen += pixelCount;
+	}
+	return true;
+}
+
+static DWORD WINAPI ReaderThreadProc(LPVOID lpParameter)
+{
+	ReaderState& state = *static_cast<ReaderState*>(lpParameter);
+	LONG lastSequence = 0;
+	while ( !state.stop )
+	{
+		if ( !ReadFrame(state, lastSequence) )
+		{
+			YieldProcessor();
+		}
+	}
+	return 0;
+}
+
+/// <summary>
+/// Publishes the frames, flat out or paced, with or without a reader, and writes a row
+/// </summary>
+static HRESULT MeasureSize(int width, int height, const vector<BYTE>& source, bool paced, bool withReader, ofstream& csv)
+{
+	SharedFrameOutput output;
+	HRESULT hr = output.Create(g_benchName, width, height, false);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	ReaderState state;
+	state.stop = 0;
+	state.framesRead = 0;
+	state.tornReads = 0;
+	state.ageTicks = 0;
+	state.presentAgeTicks = 0;
+	state.maskedPixels = 0;
+	state.pixelsSeen = 0;
+	state.checksum = 0;
+
+	HANDLE hReader = NULL;
+	if ( withReader )
+	{
+		hr = state.reader.Open(g_benchName);
+		if ( FAILED(hr) )
+		{
+			return hr;
+		}
+		hReader = CreateThread(NULL, 0, ReaderThreadProc, &state, 0, NULL);
+		if ( NULL == hReader )
+		{
+			return E_FAIL;
+		}
+	}
+
+	// bottom-up, as the readback hands frames over
+	int stride = width * 4;
+	const BYTE* topRow = &source[0] + (size_t)(height - 1) * stride;
+	LONGLONG framePeriod = HighResClock::Frequency() / g_pacedFps;
+
+	LONGLONG start = HighResClock::Now();
+	for ( int frame = 0; frame < g_benchFrames; ++frame )
+	{
+		if ( paced )
+		{
+			LONGLONG due = start + frame * framePeriod;
+			while ( HighResClock::Now() < due )
+			{
+				Sleep(1);
+			}
+		}
+		output.Publish(topRow, width, height, -stride, frame, HighResClock::Now());
+	}
+
+	if ( hReader )
+	{
+		// let the reader get to the last frame
+		Sleep(50);
+		InterlockedExchange(&state.stop, 1);
+		WaitForSingleObject(hReader, INFINITE);
+		CloseHandle(hReader);
+		state.reader.Close();
+	}
+
+	double publishMs = output.PublishMs();
+	double megabytesPerSecond = publishMs > 0.0 ? (double)width * height * 4 / (publishMs * 1000.0) : 0.0;
+
+	csv << width << ","
+		<< height << ","
+		<< (paced ? "paced" : "flat_out") << ","
+		<< (withReader ? 1 : 0) << ","
+		<< output.Published() << ","
+		<< publishMs << ","
+		<< megabytesPerSecond << ","
+		<< state.framesRead << ","
+		<< state.tornReads << ","
+		<< (state.framesRead > 0 ? HighResClock::TicksToMilliseconds(state.ageTicks) / state.framesRead : 0.0)
+		<< endl;
+
+	return S_OK;
+}
+
+HRESULT RunSharedFrameBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	csv << "width,height,pace,reader,frames,publish_ms,publish_mb_s,frames_read,torn_reads,read_age_ms" << endl;
+
+	for ( int s = 0; s < g_sizeCount; ++s )
+	{
+		int width = g_sizes[s][0];
+		int height = g_sizes[s][1];
+
+		// a gradient, so the copy moves distinct bytes
+		vector<BYTE> source((size_t)width * height * 4);
+		for ( size_t i = 0; i < source.size(); ++i )
+		{
+			source[i] = (BYTE)(i * 7 + i / 4093);
+		}
+
+		for ( int run = 0; run < 4; ++run )
+		{
+			HRESULT hr = MeasureSize(width, height, source, run >= 2, run % 2 == 1, csv);
+			if ( FAILED(hr) )
+			{
+				return hr;
+			}
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT RunSharedFrameReader(const char* name, const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	ReaderState state;
+	state.stop = 0;
+	state.framesRead = 0;
+	state.tornReads = 0;
+	state.ageTicks = 0;
+	state.presentAgeTicks = 0;
+	state.maskedPixels = 0;
+	state.pixelsSeen = 0;
+	state.checksum = 0;
+
+	HRESULT hr = state.reader.Open(name);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	LONG lastSequence = 0;
+	LONGLONG start = HighResClock::Now();
+	LONGLONG end = start + HighResClock::MillisecondsToTicks(g_readerSeconds * 1000);
+	while ( HighResClock::Now() < end )
+	{
+		if ( !ReadFrame(state, lastSequence) )
+		{
+			Sleep(1);
+		}
+	}
+	double seconds = HighResClock::TicksToMilliseconds(HighResClock::Now() - start) / 1000.0;
+
+	const SharedFrameHeader* pHeader = state.reader.Header();
+	csv << "width,height,mask,frames_read,fps,torn_reads,read_age_ms,present_age_ms,masked_pct" << endl;
+	csv << pHeader->width << ","
+		<< pHeader->height << ","
+		<< ((pHeader->flags & cSharedFrameMaskInAlpha) ? 1 : 0) << ","
+		<< state.framesRead << ","
+		<< state.framesRead / seconds << ","
+		<< state.tornReads << ","
+		<< (state.framesRead > 0 ? HighResClock::TicksToMilliseconds(state.ageTicks) / state.framesRead : 0.0) << ","
+		<< (state.framesRead > 0 ? HighResClock::TicksToMilliseconds(state.presentAgeTicks) / state.framesRead : 0.0) << ","
+		<< (state.pixelsSeen > 0 ? 100.0 * state.maskedPixels / state.pixelsSeen : 0.0)
+		<< endl;
+
+	state.reader.Close();
+	return S_OK;
+}
@@ -0,0 +1,41 @@
+/*
+
+Shared frame output benchmark and sample reader
+
+The benchmark publishes frames through SharedFrameOutput at 640x480 and
+1280x960, bottom-up as the readback hands them over, first with nobody
+reading and then with a reader thread that takes every new frame and sums
+its pixels in place, as a consumer process would. Each row has the publish
+cost per frame, the copy rate, and how many frames the reader took, how many
+it found overwritten once it had read them, and how old they were when it
+got to them. Run with /benchshared; results go to shared_bench.csv.
+
+The sample reader is the same consumer against a real ring: start the app
+with /shared, then run it again with /readshared. It follows the ring for
+ten seconds and writes shared_reader.csv with the frames it got, their rate,
+their age since they were published and since the renderer presented them,
+and the share of each frame the player mask covers.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+// name /shared publishes under and /readshared opens
+extern const char* g_sharedFrameName;
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per size and reader setting
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunSharedFrameBenchmark(const char* path);
+
+/// <summary>
+/// Follows a running instance's shared frames for a while and writes one CSV row
+/// </summary>
+/// <param name="name">name of the shared memory</param>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunSharedFrameReader(const char* name, const char* path);
@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include <string>
+#include "SharedFrameOutput.h"
+#include "HighResClock.h"
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const size_t g_slotAlignment = 64;
+
+static size_t AlignUp(size_t bytes)
+{
+	return (bytes + g_slotAlignment - 1) & ~(g_slotAlignment - 1);
+}
+
+SharedFrameOutput::SharedFrameOutput() :
+	m_pView(NULL),
+	m_viewBytes(0),
+	m_pHeader(NULL),
+	m_pSlots(NULL),
+	m_pPixels(NULL),
+#ifdef _WIN32
+	m_hMapping(NULL),
+#endif
+	m_sequence(0),
+	m_skipped(0),
+	m_publishTicks(0)
+{
+#ifndef _WIN32
+	m_name[0] = 0;
+#endif
+}
+
+SharedFrameOutput::~SharedFrameOutput()
+{
+	Close();
+}
+
+HRESULT SharedFrameOutput::Create(const char* name, int width, int height, bool maskInAlpha)
+{
+	size_t slotTableOffset = AlignUp(sizeof(SharedFrameHeader));
+	size_t pixelOffset = AlignUp(slotTableOffset + cSlots * sizeof(SharedFrameSlot));
+	size_t slotBytes = AlignUp((size_t)width * height * 4);
+	m_viewBytes = pixelOffset + cSlots * slotBytes;
+
+#ifdef _WIN32
+	string mappingName = string("Local\\") + name;
+	m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)m_viewBytes, mappingName.c_str());
+	if ( NULL == m_hMapping )
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	m_pView = static_cast<BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_viewBytes));
+#else
+	m_name[0] = '/';
+	strncpy(m_name + 1, name, MAX_PATH - 2);
+	m_name[MAX_PATH - 1] = 0;
+
+	int fd = shm_open(m_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if ( fd < 0 )
+	{
+		return E_FAIL;
+	}
+	if ( ftruncate(fd, (off_t)m_viewBytes) == 0 )
+	{
+		void* pView = mmap(NULL, m_viewBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		m_pView = ( pView == MAP_FAILED ) ? NULL : static_cast<BYTE*>(pView);
+	}
+	close(fd);
+#endif
+	if ( NULL == m_pView )
+	{
+		Close();
+		return E_FAIL;
+	}
+
+	m_pHeader = reinterpret_cast<SharedFrameHeader*>(m_pView);
+	m_pSlots = reinterpret_cast<SharedFrameSlot*>(m_pView + slotTableOffset);
+	m_pPixels = m_pView + pixelOffset;
+
+	// the mapping starts zeroed, so every slot reads as being written until it is published
+	m_pHeader->width = width;
+	m_pHeader->height = height;
+	m_pHeader->stride = width * 4;
+	m_pHeader->slotCount = cSlots;
+	m_pHeader->slotBytes = (LONG)slotBytes;
+	m_pHeader->pixelOffset = (LONG)pixelOffset;
+	m_pHeader->flags = maskInAlpha ? cSharedFrameMaskInAlpha : 0;
+	m_pHeader->version = cSharedFrameVersion;
+
+	// readers check the magic last
+	MemoryBarrier();
+	m_pHeader->magic = cSharedFrameMagic;
+
+	m_sequence = 0;
+	m_skipped = 0;
+	m_publishTicks = 0;
+	return S_OK;
+}
+
+void SharedFrameOutput::Close()
+{
+#ifdef _WIN32
+	if ( m_pView )
+	{
+		UnmapViewOfFile(m_pView);
+	}
+	if ( m_hMapping )
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+#else
+	if ( m_pView )
+	{
+		munmap(m_pView, m_viewBytes);
+	}
+	if ( m_name[0] )
+	{
+		shm_unlink(m_name);
+		m_name[0] = 0;
+	}
+#endif
+	m_pView = NULL;
+	m_pHeader = NULL;
+	m_pSlots = NULL;
+	m_pPixels = NULL;
+}
+
+void SharedFrameOutput::OnFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks)
+{
+	static_cast<SharedFrameOutput*>(context)->Publish(pixels, width, height, stride, frame, presentTicks);
+}
+
+void SharedFrameOutput::Publish(const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks)
+{
+	if ( NULL == m_pHeader || width != m_pHeader->width || height != m_pHeader->height )
+	{
+		++m_skipped;
+		return;
+	}
+
+	TRACE_SCOPE("SharedFrameOutput::Publish");
+	LONGLONG start = HighResClock::Now();
+
+	LONG sequence = m_sequence + 1;
+	int index = sequence % cSlots;
+	SharedFrameSlot& slot = m_pSlots[index];
+	BYTE* pSlotPixels = m_pPixels + (size_t)index * m_pHeader->slotBytes;
+
+	// a reader still on the frame that was here sees the slot change under it and drops it
+	InterlockedExchange(&slot.sequence, 0);
+
+	int rowBytes = width * 4;
+	if ( stride == rowBytes )
+	{
+		memcpy(pSlotPixels, pixels, (size_t)rowBytes * height);
+	}
+	else
+	{
+		for ( int y = 0; y < height; ++y )
+		{
+			memcpy(pSlotPixels + y * rowBytes, pixels + y * stride, rowBytes);
+		}
+	}
+
+	slot.frame = frame;
+	slot.presentedTicks = presentTicks;
+	slot.publishedTicks = HighResClock::Now();
+	InterlockedExchange(&slot.sequence, sequence);
+	InterlockedExchange(&m_pHeader->latest, sequence);
+
+	m_sequence = sequence;
+	m_publishTicks += HighResClock::Now() - start;
+}
+
+double SharedFrameOutput::PublishMs() const
+{
+	return m_sequence > 0 ? HighResClock::TicksToMilliseconds(m_publishTicks) / m_sequence : 0.0;
+}
+
+SharedFrameReader::SharedFrameReader() :
+	m_pView(NULL),
+	m_viewBytes(0),
+	m_pHeader(NULL),
+	m_pSlots(NULL)
+#ifdef _WIN32
+	, m_hMapping(NULL)
+#endif
+{
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+	Close();
+}
+
+HRESULT SharedFrameReader::Open(const char* name)
+{
+#ifdef _WIN32
+	string mappingName = string("Local\\") + name;
+	m_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mappingName.c_str());
+	if ( NULL == m_hMapping )
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	// the whole mapping, whatever its size
+	m_pView = static_cast<const BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	string path = string("/") + name;
+	int fd = shm_open(path.c_str(), O_RDONLY, 0);
+	if ( fd < 0 )
+	{
+		return E_FAIL;
+	}
+	struct stat status;
+	if ( fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(SharedFrameHeader) )
+	{
+		m_viewBytes = (size_t)status.st_size;
+		void* pView = mmap(NULL, m_viewBytes, PROT_READ, MAP_SHARED, fd, 0);
+		m_pView = ( pView == MAP_FAILED ) ? NULL : static_cast<const BYTE*>(pView);
+	}
+	close(fd);
+#endif
+	if ( NULL == m_pView )
+	{
+		Close();
+		return E_FAIL;
+	}
+
+	m_pHeader = reinterpret_cast<const SharedFrameHeader*>(m_pView);
+	if ( m_pHeader->magic != cSharedFrameMagic || m_pHeader->version != cSharedFrameVersion )
+	{
+		Close();
+		return E_FAIL;
+	}
+	MemoryBarrier();
+	m_pSlots = reinterpret_cast<const SharedFrameSlot*>(m_pView + AlignUp(sizeof(SharedFrameHeader)));
+	return S_OK;
+}
+
+void SharedFrameReader::Close()
+{
+#ifdef _WIN32
+	if ( m_pView )
+	{
+		UnmapViewOfFile(m_pView);
+	}
+	if ( m_hMapping )
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+#else
+	if ( m_pView )
+	{
+		munmap(const_cast<BYTE*>(m_pView), m_viewBytes);
+	}
+#endif
+	m_pView = NULL;
+	m_pHeader = NULL;
+	m_pSlots = NULL;
+}
+
+bool SharedFrameReader::Latest(LONG lastSequence, LONG& sequence, const BYTE*& pixels, const SharedFrameSlot*& slot) const
+{
+	sequence = m_pHeader->latest;
+	if ( sequence == 0 || sequence == lastSequence )
+	{
+		return false;
+	}
+
+	int index = sequence % m_pHeader->slotCount;
+	slot = &m_pSlots[index];
+	if ( slot->sequence != sequence )
+	{
+		// already being overwritten
+		return false;
+	}
+
+	// the pixels are read after the sequence number that vouches for them
+	MemoryBarrier();
+	pixels = m_pView + m_pHeader->pixelOffset + (size_t)index * m_pHeader->slotBytes;
+	return true;
+}
+
+bool SharedFrameReader::IsCurrent(LONG sequence) const
+{
+	MemoryBarrier();
+	return m_pSlots[sequence % m_pHeader->slotCount].sequence == sequence;
+}
@@ -0,0 +1,161 @@
+/*
+
+Shared-memory frame output
+
+Publishes the frames the renderer reads back into a named shared memory
+ring, so another process (an encoder, a second display, an analysis tool)
+can take the composited picture without copying it: a reader maps the ring
+and works on the pixels where they lie. Publishing is the one copy, from
+the mapped pack buffer into the ring.
+
+The ring is a SharedFrameHeader, a SharedFrameSlot per slot and then the
+slots' pixels, BGRA with the top row first and every slot 64-byte aligned.
+The writer fills the slot after the last one published, then stores the
+frame's sequence number in the slot and then in the header. While a slot is
+being written its sequence number is 0, so a reader compares it before and
+after using the pixels and drops the frame if the writer came round to the
+slot in between. Readers never hold the writer up; with cSlots slots a
+reader has two frame times to use a frame before it can be overwritten.
+
+With the mask option the renderer leaves the player mask in the alpha (see
+ImageRenderer::SetMaskInAlpha): 0 where there is a player, 255 elsewhere.
+
+The ring is a file mapping named Local\<name> on Windows and a POSIX shared
+memory object /<name> elsewhere. SharedFrameReader is the reading side, and
+/readshared runs it against a running /shared instance as a sample.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+// "GSFR"
+static const DWORD cSharedFrameMagic = 0x52465347;
+static const DWORD cSharedFrameVersion = 2;
+
+// SharedFrameHeader flags
+static const DWORD cSharedFrameMaskInAlpha = 1;
+
+typedef struct
+{
+	DWORD			magic;
+	DWORD			version;
+	LONG			width;
+	LONG			height;
+	LONG			stride;			// bytes from one row to the next
+	LONG			slotCount;
+	LONG			slotBytes;		// bytes from one slot's pixels to the next
+	LONG			pixelOffset;	// bytes from the header to the first slot's pixels
+	DWORD			flags;
+	volatile LONG	latest;			// sequence number of the newest frame published, 0 before the first
+} SharedFrameHeader;
+
+typedef struct
+{
+	volatile LONG	sequence;		// of the frame in the slot, 0 while it is being written
+	LONG			frame;			// renderer frame number
+	LONGLONG		presentedTicks;	// HighResClock time the renderer presented it, for pacing
+	LONGLONG		publishedTicks;	// HighResClock time it was published
+} SharedFrameSlot;
+
+class SharedFrameOutput
+{
+public:
+	// the one being written, the newest, and the one before it for a reader still using it
+	static const int cSlots = 3;
+
+	SharedFrameOutput();
+	~SharedFrameOutput();
+
+	/// <summary>
+	/// Creates the ring for frames of the given size
+	/// </summary>
+	/// <param name="name">name of the shared memory, without a prefix</param>
+	/// <param name="maskInAlpha">the frames will carry the player mask in their alpha</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Create(const char* name, int width, int height, bool maskInAlpha);
+
+	/// <summary>
+	/// Unmaps and removes the ring; readers that have it mapped keep it until they close it
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// Copies a frame into the next slot and publishes it. Frames of another size are skipped
+	/// </summary>
+	/// <param name="stride">bytes from one row to the next, negative for bottom-up rows</param>
+	/// <param name="presentTicks">HighResClock time the frame was presented</param>
+	void Publish(const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks);
+
+	/// <summary>
+	/// FrameSink for the renderer's readback; the context is the SharedFrameOutput
+	/// </summary>
+	static void OnFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks);
+
+	LONG Published() const { return m_sequence; }
+	LONG Skipped() const { return m_skipped; }
+
+	/// <summary>
+	/// Average time Publish took per frame published
+	/// </summary>
+	double PublishMs() const;
+
+private:
+	BYTE*				m_pView;
+	size_t				m_viewBytes;
+	SharedFrameHeader*	m_pHeader;
+	SharedFrameSlot*	m_pSlots;
+	BYTE*				m_pPixels;
+#ifdef _WIN32
+	HANDLE				m_hMapping;
+#else
+	char				m_name[MAX_PATH];
+#endif
+
+	LONG				m_sequence;
+	LONG				m_skipped;
+	LONGLONG			m_publishTicks;
+};
+
+class SharedFrameReader
+{
+public:
+	SharedFrameReader();
+	~SharedFrameReader();
+
+	/// <summary>
+	/// Maps a ring created by SharedFrameOutput, read only
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Open(const char* name);
+
+	void Close();
+
+	const SharedFrameHeader* Header() const { return m_pHeader; }
+
+	/// <summary>
+	/// The newest frame, if there is one after lastSequence. The pixels are in the ring: check
+	/// IsCurrent once done with them
+	/// </summary>
+	/// <param name="lastSequence">sequence number of the last frame taken, 0 for none</param>
+	/// <param name="sequence">the frame's sequence number</param>
+	/// <param name="pixels">its top row</param>
+	/// <param name="slot">its slot header</param>
+	/// <returns>true if there was a newer frame</returns>
+	bool Latest(LONG lastSequence, LONG& sequence, const BYTE*& pixels, const SharedFrameSlot*& slot) const;
+
+	/// <summary>
+	/// Whether the frame taken with Latest is still in its slot, so whatever was read from it is whole
+	/// </summary>
+	bool IsCurrent(LONG sequence) const;
+
+private:
+	const BYTE*					m_pView;
+	size_t						m_viewBytes;
+	const SharedFrameHeader*	m_pHeader;
+	const SharedFrameSlot*		m_pSlots;
+#ifdef _WIN32
+	HANDLE						m_hMapping;
+#endif
+};
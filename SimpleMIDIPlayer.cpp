@@ -1,13 +1,30 @@
 #include "stdafx.h"
 #include "SimpleMIDIPlayer.h"
+#include "Trace.h"
+#include "AllocationAudit.h"
 
-SimpleMIDIPlayer::SimpleMIDIPlayer(){
+SimpleMIDIPlayer::SimpleMIDIPlayer() :
+	latencyMonitor(NULL)
+{
 	midiOutOpen(&outHandle, (UINT)-1, 0, 0, CALLBACK_WINDOW);
 
 	selectInstrument( 0 );
+
+	eventQueued = CreateEvent(NULL, FALSE, FALSE, NULL);
+	stopThread = CreateEvent(NULL, TRUE, FALSE, NULL);
+	thread = CreateThread(NULL, 0, _SimpleMIDIPlayerThread, this, 0, NULL);
+
+	// notes are what the players hear, don't let rendering starve them
+	SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
 }
 
 SimpleMIDIPlayer::~SimpleMIDIPlayer(){
+	SetEvent(stopThread);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	CloseHandle(stopThread);
+	CloseHandle(eventQueued);
+
 	midiOutClose(outHandle);
 }
 
@@ -49,6 +66,50 @@ void SimpleMIDIPlayer::stopAll(){
 void SimpleMIDIPlayer::selectInstrument( BYTE i ){
 	sendMIDIEvent(	outHandle, 0xC0, i , (BYTE)0 );
 }
+
+void SimpleMIDIPlayer::setLatencyMonitor( LatencyMonitor* latency ){
+	latencyMonitor = latency;
+}
+
+bool SimpleMIDIPlayer::queueNote( NotesEnum note, int octave, bool on, LONGLONG sensorTicks ){
+	AUDIT_SCOPE(AuditStageMidi);
+
+	SimpleMIDIPlayerEvent e;
+	e.status = on ? 0x90 : 0x80;
+	e.data1 = getNote(note, octave);
+	e.data2 = 127;
+	e.sensorTicks = sensorTicks;
+
+	if ( !eventQueue.Push(e) )
+		return false;
+	AllocationAudit::RecordCopy(sizeof(e));
+
+	SetEvent(eventQueued);
+	return true;
+}
+
+void SimpleMIDIPlayer::threadLoop(){
+	HANDLE events[2] = { stopThread, eventQueued };
+
+	Trace::SetThreadName("MIDI");
+
+	while ( WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 ){
+		SimpleMIDIPlayerEvent e;
+		while ( eventQueue.Pop(e) ){
+			TRACE_SCOPE("MIDI dispatch");
+			sendMIDIEvent( outHandle, e.status, e.data1, e.data2 );
+
+			// only note-on matters for motion-to-sound latency
+			if ( latencyMonitor && e.status == 0x90 )
+				latencyMonitor->Stamp( LatencyStageSend, e.sensorTicks );
+		}
+	}
+}
+
+DWORD WINAPI _SimpleMIDIPlayerThread( LPVOID lpParameter ){
+	static_cast<SimpleMIDIPlayer*>(lpParameter)->threadLoop();
+	return 0;
+}
 /*
 void SimpleMIDIPlayer::_playMajorBarChord( int n, BYTE intensity ){
 	//int s = 50 - (40 * (intensity/127));
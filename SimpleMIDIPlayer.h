@@ -2,8 +2,12 @@
 
 #include <Windows.h>
 #include <MMSystem.h>
+#include "SpscQueue.h"
+#include "CacheAligned.h"
+#include "LatencyMonitor.h"
 
-class SimpleMIDIPlayer
+// made with new, and the event queue is cache-line aligned
+class SimpleMIDIPlayer : public CacheAligned
 {
 public:
 	SimpleMIDIPlayer();
@@ -17,6 +21,13 @@ public:
 		BYTE intensity;
 	} SimpleMIDIPlayerThreadStruct;
 
+	typedef struct {
+		BYTE status;
+		BYTE data1;
+		BYTE data2;
+		LONGLONG sensorTicks;	// capture time of the frame that triggered the event
+	} SimpleMIDIPlayerEvent;
+
 	/**
 	 * These are used to play music...
 	 */
@@ -25,10 +36,32 @@ public:
 	void stopAll();
 	void selectInstrument( BYTE i );
 
+	/**
+	 * Queues a note for the MIDI thread, so the caller never blocks on the
+	 * driver. Returns false if the queue is full and the note was dropped.
+	 */
+	bool queueNote( NotesEnum note, int octave, bool on, LONGLONG sensorTicks );
+
+	/**
+	 * Note-on events sent by the MIDI thread are stamped here
+	 */
+	void setLatencyMonitor( LatencyMonitor* latency );
+
+	/**
+	 * Drains the event queue until the player is destroyed
+	 */
+	void threadLoop();
+
 private:
 	UINT sendMIDIEvent(HMIDIOUT hmo, BYTE bStatus, BYTE bData1, BYTE bData2);
 	HMIDIOUT	outHandle;
 	BYTE getNote( int note, int octave );
+
+	SpscQueue<SimpleMIDIPlayerEvent, 64> eventQueue;
+	HANDLE		eventQueued;
+	HANDLE		stopThread;
+	HANDLE		thread;
+	LatencyMonitor* latencyMonitor;
 };
 
 DWORD WINAPI _SimpleMIDIPlayerThread(
@@ -0,0 +1,73 @@
+/*
+
+Lock-free pool of up to 32 preallocated slots
+
+A bit per free slot. Any thread may take or return a slot, which is what the
+stage graph needs: frames are taken by the source thread and returned by
+whichever worker retires them.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <intrin.h>
+
+class SlotPool
+{
+public:
+	static const int cMaxSlots = 32;
+
+	SlotPool() : m_free(0)
+	{
+	}
+
+	/// <summary>
+	/// Marks slots 0 to count-1 free
+	/// </summary>
+	void Reset(int count)
+	{
+		m_free = (count >= cMaxSlots) ? (LONG)0xffffffff : (LONG)((1UL << count) - 1);
+	}
+
+	/// <summary>
+	/// Takes the lowest free slot
+	/// </summary>
+	/// <returns>slot index, or -1 if every slot is in use</returns>
+	int Acquire()
+	{
+		for (;;)
+		{
+			LONG free = m_free;
+			if ( free == 0 )
+			{
+				return -1;
+			}
+
+			unsigned long index;
+			_BitScanForward(&index, (unsigned long)free);
+			if ( InterlockedCompareExchange(&m_free, free & ~(1L << index), free) == free )
+			{
+				return (int)index;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns a slot taken with Acquire
+	/// </summary>
+	void Release(int index)
+	{
+		for (;;)
+		{
+			LONG free = m_free;
+			if ( InterlockedCompareExchange(&m_free, free | (1L << index), free) == free )
+			{
+				return;
+			}
+		}
+	}
+
+private:
+	volatile LONG	m_free;
+};
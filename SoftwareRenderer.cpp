@@ -0,0 +1,382 @@
+#include "stdafx.h"
+#include <math.h>
+#include "SoftwareRenderer.h"
+#include "Trace.h"
+
+#ifdef SOFTWARE_RENDERER_SSE2
+#include <emmintrin.h>
+#endif
+
+// bands per worker, so a worker that finishes early steals the rest of a slow one's
+static const int g_bandsPerWorker = 2;
+
+/// <summary>
+/// src * weight + dst * (255 - weight), over 255 and rounded, as the blend unit does it in 8 bits
+/// </summary>
+static inline DWORD BlendChannel(DWORD src, DWORD dst, DWORD weight)
+{
+	DWORD t = src * weight + dst * (255 - weight) + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline DWORD BlendPixel(DWORD src, DWORD dst, DWORD weight)
+{
+	return BlendChannel(src & 0xff, dst & 0xff, weight) |
+		(BlendChannel((src >> 8) & 0xff, (dst >> 8) & 0xff, weight) << 8) |
+		(BlendChannel((src >> 16) & 0xff, (dst >> 16) & 0xff, weight) << 16) |
+		(BlendChannel(src >> 24, dst >> 24, weight) << 24);
+}
+
+#ifdef SOFTWARE_RENDERER_SSE2
+
+// 16-bit lanes of t over 255, rounded; t already has the 128 added
+static inline __m128i Divide255(__m128i t)
+{
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+#endif
+
+/// <summary>
+/// Players over the background, as drawPlayers blends them: (ONE_MINUS_SRC_ALPHA, SRC_ALPHA) with the
+/// composite's X byte as the alpha. Written to the base layer and the frame
+/// </summary>
+static void BlendPlayersRow(const DWORD* players, const DWORD* background, DWORD* base, DWORD* frame, int width, bool maskInAlpha)
+{
+	int x = 0;
+
+#ifdef SOFTWARE_RENDERER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+	for ( ; x + 4 <= width; x += 4 )
+	{
+		__m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(players + x));
+		__m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + x));
+
+		__m128i srcLow = _mm_unpacklo_epi8(src, zero);
+		__m128i srcHigh = _mm_unpackhi_epi8(src, zero);
+		__m128i dstLow = _mm_unpacklo_epi8(dst, zero);
+		__m128i dstHigh = _mm_unpackhi_epi8(dst, zero);
+
+		// each pixel's alpha across its four lanes
+		__m128i alphaLow = _mm_shufflehi_epi16(_mm_shufflelo_epi16(srcLow, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i alphaHigh = _mm_shufflehi_epi16(_mm_shufflelo_epi16(srcHigh, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(srcLow, _mm_sub_epi16(full, alphaLow)), _mm_mullo_epi16(dstLow, alphaLow)), round);
+		__m128i high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(srcHigh, _mm_sub_epi16(full, alphaHigh)), _mm_mullo_epi16(dstHigh, alphaHigh)), round);
+		__m128i blended = _mm_packus_epi16(Divide255(low), Divide255(high));
+
+		if ( maskInAlpha )
+		{
+			blended = _mm_or_si128(_mm_andnot_si128(alphaMask, blended), _mm_and_si128(alphaMask, src));
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(base + x), blended);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(frame + x), blended);
+	}
+#endif
+
+	for ( ; x < width; ++x )
+	{
+		DWORD src = players[x];
+		DWORD blended = BlendPixel(src, background[x], 255 - (src >> 24));
+		if ( maskInAlpha )
+		{
+			blended = (blended & 0x00ffffff) | (src & 0xff000000);
+		}
+		base[x] = blended;
+		frame[x] = blended;
+	}
+}
+
+/// <summary>
+/// A solid colour over a run of pixels, as drawShapes blends it: (SRC_ALPHA, ONE_MINUS_SRC_ALPHA)
+/// </summary>
+static void BlendSpan(DWORD* row, int first, int end, DWORD color)
+{
+	DWORD alpha = color >> 24;
+	int x = first;
+
+#ifdef SOFTWARE_RENDERER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	// the colour's share, with the rounding, is the same for every pixel
+	__m128i colorWords = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+	__m128i weight = _mm_set1_epi16((short)alpha);
+	__m128i srcTerm = _mm_add_epi16(_mm_mullo_epi16(colorWords, weight), _mm_set1_epi16(128));
+	__m128i dstWeight = _mm_set1_epi16((short)(255 - alpha));
+	for ( ; x + 4 <= end; x += 4 )
+	{
+		__m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), dstWeight), srcTerm);
+		__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), dstWeight), srcTerm);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_packus_epi16(Divide255(low), Divide255(high)));
+	}
+#endif
+
+	for ( ; x < end; ++x )
+	{
+		row[x] = BlendPixel(color, row[x], alpha);
+	}
+}
+
+/// <summary>
+/// The players' alpha back over whatever the overlay left in the frame's, as drawMask does
+/// </summary>
+static void RestoreMaskRow(const DWORD* base, DWORD* frame, int width)
+{
+	int x = 0;
+
+#ifdef SOFTWARE_RENDERER_SSE2
+	const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+	for ( ; x + 4 <= width; x += 4 )
+	{
+		__m128i alpha = _mm_and_si128(alphaMask, _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + x)));
+		__m128i color = _mm_andnot_si128(alphaMask, _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + x)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(frame + x), _mm_or_si128(color, alpha));
+	}
+#endif
+
+	for ( ; x < width; ++x )
+	{
+		frame[x] = (frame[x] & 0x00ffffff) | (base[x] & 0xff000000);
+	}
+}
+
+static DWORD PackColor(float red, float green, float blue, float alpha)
+{
+	return (DWORD)(blue * 255.0f + 0.5f) | ((DWORD)(green * 255.0f + 0.5f) << 8) |
+		((DWORD)(red * 255.0f + 0.5f) << 16) | ((DWORD)(alpha * 255.0f + 0.5f) << 24);
+}
+
+/// <summary>
+/// First and end pixel of a row whose centres a shape covers, as the quad and the disc test in
+/// g_shapeFragmentShader rasterize
+/// </summary>
+/// <returns>false if the shape covers none of the row</returns>
+static bool ShapeSpan(const ShapeInstance& shape, int y, int width, int& first, int& end)
+{
+	float centerY = y + 0.5f;
+	float left = shape.left;
+	float right = shape.left + shape.width;
+
+	if ( shape.disc > 0.5f )
+	{
+		float local = (centerY - shape.top) / shape.height * 2.0f - 1.0f;
+		float halfWidth = sqrtf(1.0f - local * local) * shape.width * 0.5f;
+		float centerX = shape.left + shape.width * 0.5f;
+		if ( centerX - halfWidth > left ) left = centerX - halfWidth;
+		if ( centerX + halfWidth < right ) right = centerX + halfWidth;
+	}
+
+	first = (int)ceilf(left - 0.5f);
+	end = (int)ceilf(right - 0.5f);
+	if ( first < 0 ) first = 0;
+	if ( end > width ) end = width;
+	return first < end;
+}
+
+SoftwareRenderer::SoftwareRenderer() :
+	m_width(0),
+	m_height(0),
+	m_backgroundRGBX(NULL),
+	m_bHavePlayers(false),
+	m_bandCount(0),
+	m_pFrame(NULL),
+	m_pendingBands(0)
+{
+	m_hBandsDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+	Shutdown();
+	CloseHandle(m_hBandsDone);
+}
+
+HRESULT SoftwareRenderer::Initialize(int width, int height, const BYTE* backgroundRGBX, int workers, FrameArena* pArena)
+{
+	m_width = width;
+	m_height = height;
+	m_backgroundRGBX = backgroundRGBX;
+
+	size_t frameBytes = (size_t)width * height * sizeof(DWORD);
+	m_baseRGBX = pArena->Allocate<BYTE>(frameBytes);
+	m_frameRGBX = pArena->Allocate<BYTE>(frameBytes);
+	m_playersRGBX = pArena->Allocate<BYTE>(frameBytes);
+	if ( NULL == m_baseRGBX.Data() || NULL == m_frameRGBX.Data() || NULL == m_playersRGBX.Data() )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// the background alone until there are players
+	memcpy(m_baseRGBX, backgroundRGBX, frameBytes);
+	memcpy(m_frameRGBX, backgroundRGBX, frameBytes);
+	m_bHavePlayers = false;
+
+	HRESULT hr = m_workers.Start(workers);
+	if ( FAILED(hr) )
+	{
+		return hr;
+	}
+
+	m_bandCount = m_workers.WorkerCount() * g_bandsPerWorker;
+	if ( m_bandCount > cMaxBands ) m_bandCount = cMaxBands;
+	if ( m_bandCount > height ) m_bandCount = height;
+
+	for ( int i = 0; i < m_bandCount; ++i )
+	{
+		m_bands[i].pRenderer = this;
+		m_bands[i].firstRow = height * i / m_bandCount;
+		m_bands[i].endRow = height * (i + 1) / m_bandCount;
+	}
+
+	return S_OK;
+}
+
+void SoftwareRenderer::Shutdown()
+{
+	m_workers.Stop();
+	m_bandCount = 0;
+}
+
+void SoftwareRenderer::Compose(const SoftwareFrame& frame)
+{
+	TRACE_SCOPE("SoftwareRenderer::Compose");
+
+	m_pFrame = &frame;
+	if ( frame.backgroundRGBX )
+	{
+		m_backgroundRGBX = frame.backgroundRGBX;
+	}
+	InterlockedExchange(&m_pendingBands, m_bandCount);
+	for ( int i = 0; i < m_bandCount; ++i )
+	{
+		m_workers.Submit(BandProc, &m_bands[i]);
+	}
+	WaitForSingleObject(m_hBandsDone, INFINITE);
+
+	if ( frame.playersRGBX )
+	{
+		m_bHavePlayers = true;
+	}
+	m_pFrame = NULL;
+}
+
+void SoftwareRenderer::BandProc(void* context)
+{
+	Band* pBand = static_cast<Band*>(context);
+	SoftwareRenderer* pRenderer = pBand->pRenderer;
+
+	pRenderer->ComposeBand(pBand->firstRow, pBand->endRow);
+	if ( InterlockedDecrement(&pRenderer->m_pendingBands) == 0 )
+	{
+		SetEvent(pRenderer->m_hBandsDone);
+	}
+}
+
+void SoftwareRenderer::ComposeBand(int firstRow, int endRow)
+{
+	TRACE_SCOPE("SoftwareRenderer band");
+
+	const SoftwareFrame& frame = *m_pFrame;
+	const DWORD* background = reinterpret_cast<const DWORD*>(m_backgroundRGBX);
+	DWORD* base = reinterpret_cast<DWORD*>(m_baseRGBX.Data());
+	DWORD* pixels = reinterpret_cast<DWORD*>(m_frameRGBX.Data());
+	const int width = m_width;
+
+	// players and background, blended afresh with a new composite or background and copied otherwise
+	size_t bandBytes = (size_t)(endRow - firstRow) * width * sizeof(DWORD);
+	if ( frame.playersRGBX || (frame.backgroundRGBX && m_bHavePlayers) )
+	{
+		DWORD* kept = reinterpret_cast<DWORD*>(m_playersRGBX.Data());
+		if ( frame.playersRGBX )
+		{
+			memcpy(kept + (size_t)firstRow * width, frame.playersRGBX + (size_t)firstRow * width * sizeof(DWORD), bandBytes);
+		}
+		for ( int y = firstRow; y < endRow; ++y )
+		{
+			size_t row = (size_t)y * width;
+			BlendPlayersRow(kept + row, background + row, base + row, pixels + row, width, frame.maskInAlpha);
+		}
+	}
+	else if ( frame.backgroundRGBX )
+	{
+		memcpy(base + (size_t)firstRow * width, background + (size_t)firstRow * width, bandBytes);
+		memcpy(pixels + (size_t)firstRow * width, background + (size_t)firstRow * width, bandBytes);
+	}
+	else
+	{
+		memcpy(pixels + (size_t)firstRow * width, base + (size_t)firstRow * width, bandBytes);
+	}
+
+	// the overlay shapes, in order, clipped to the band
+	for ( int i = 0; i < frame.shapeCount; ++i )
+	{
+		const ShapeInstance& shape = frame.shapes[i];
+		int top = (int)ceilf(shape.top - 0.5f);
+		int bottom = (int)ceilf(shape.top + shape.height - 0.5f);
+		if ( top < firstRow ) top = firstRow;
+		if ( bottom > endRow ) bottom = endRow;
+		if ( top >= bottom )
+		{
+			continue;
+		}
+
+		DWORD color = PackColor(shape.red, shape.green, shape.blue, shape.alpha);
+		for ( int y = top; y < bottom; ++y )
+		{
+			int first, end;
+			if ( ShapeSpan(shape, y, width, first, end) )
+			{
+				BlendSpan(pixels + (size_t)y * width, first, end, color);
+			}
+		}
+	}
+
+	// the HUD graph: a pixel per step along each segment, the joins drawn once
+	if ( frame.linePoints && frame.linePointCount > 1 )
+	{
+		DWORD color = PackColor(frame.lineColor[0], frame.lineColor[1], frame.lineColor[2], frame.lineColor[3]);
+		for ( int i = 0; i + 1 < frame.linePointCount; ++i )
+		{
+			float x0 = frame.linePoints[i * 2], y0 = frame.linePoints[i * 2 + 1];
+			float dx = frame.linePoints[i * 2 + 2] - x0, dy = frame.linePoints[i * 2 + 3] - y0;
+			int steps = (int)ceilf(fabsf(dx) > fabsf(dy) ? fabsf(dx) : fabsf(dy));
+			bool last = ( i + 2 == frame.linePointCount );
+			for ( int s = 0; s < steps + (last ? 1 : 0); ++s )
+			{
+				float t = steps > 0 ? (float)s / steps : 0.0f;
+				int x = (int)floorf(x0 + dx * t);
+				int y = (int)floorf(y0 + dy * t);
+				if ( y >= firstRow && y < endRow && x >= 0 && x < width )
+				{
+					DWORD* pPixel = pixels + (size_t)y * width + x;
+					*pPixel = BlendPixel(color, *pPixel, color >> 24);
+				}
+			}
+		}
+	}
+
+	if ( frame.maskInAlpha )
+	{
+		for ( int y = firstRow; y < endRow; ++y )
+		{
+			size_t row = (size_t)y * width;
+			if ( m_bHavePlayers || frame.playersRGBX )
+			{
+				RestoreMaskRow(base + row, pixels + row, width);
+			}
+			else
+			{
+				// no players anywhere yet
+				for ( int x = 0; x < width; ++x )
+				{
+					pixels[row + x] |= 0xff000000;
+				}
+			}
+		}
+	}
+}
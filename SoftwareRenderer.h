@@ -0,0 +1,115 @@
+/*
+
+Software renderer
+
+Composes the renderer's frame on the CPU, for machines whose OpenGL driver
+is missing or too slow: the players blended over the background as
+drawPlayers blends them (the composite's X byte is the players' alpha, 0
+where there is a player), then the overlay shapes, the keyboard's among
+them, blended over that as drawShapes blends them, and the HUD graph's line.
+
+Frames are the source size, with the background already scaled to it. The
+frame is split into bands of rows, one job each on the renderer's own work
+pool, and each band does every layer for its rows, so a band's pixels stay
+in its core's cache from the players down to the overlay. The blends are
+SSE2, four pixels at a time, where it is available.
+
+A composite is blended into a base layer once; a frame that only moves the
+overlay copies the base and draws the overlay over it. A new background, a
+moving one's next frame, is blended under a copy of the last composite.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "types.h"
+#include "WorkPool.h"
+#include "FrameArena.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define SOFTWARE_RENDERER_SSE2 1
+#endif
+
+/// <summary>
+/// One frame's layers
+/// </summary>
+typedef struct
+{
+	const BYTE*				playersRGBX;	// new composite, or NULL for the last one
+	const BYTE*				backgroundRGBX;	// new background, kept by the caller until the next, or NULL for the last one
+	const ShapeInstance*	shapes;			// in drawing order
+	int						shapeCount;
+	const float*			linePoints;		// x, y of each point of the HUD graph's line strip, or NULL
+	int						linePointCount;
+	float					lineColor[4];
+	bool					maskInAlpha;	// leave the players' alpha in the frame's, as drawMask does
+} SoftwareFrame;
+
+class SoftwareRenderer
+{
+public:
+	static const int cMaxBands = 32;
+
+	SoftwareRenderer();
+	~SoftwareRenderer();
+
+	/// <summary>
+	/// Allocates the frame and starts the band workers
+	/// </summary>
+	/// <param name="backgroundRGBX">background, width x height, kept by the caller until a frame brings another</param>
+	/// <param name="workers">band workers, 0 for one per logical processor</param>
+	/// <param name="pArena">arena the frame, the base layer and the players' copy are allocated from</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(int width, int height, const BYTE* backgroundRGBX, int workers, FrameArena* pArena);
+
+	/// <summary>
+	/// Stops the band workers
+	/// </summary>
+	void Shutdown();
+
+	/// <summary>
+	/// Composes a frame into Pixels, returning once every band is done
+	/// </summary>
+	void Compose(const SoftwareFrame& frame);
+
+	/// <summary>
+	/// The last frame composed, BGRA, top row first and width * 4 bytes a row
+	/// </summary>
+	const BYTE* Pixels() const { return m_frameRGBX; }
+
+	int Width() const { return m_width; }
+	int Height() const { return m_height; }
+	int BandCount() const { return m_bandCount; }
+
+private:
+	typedef struct
+	{
+		SoftwareRenderer*	pRenderer;
+		int					firstRow;
+		int					endRow;
+	} Band;
+
+	int					m_width;
+	int					m_height;
+	const BYTE*			m_backgroundRGBX;
+
+	// the players over the background, with the players' alpha if the frame keeps the mask, and
+	// the players as they came, to blend over the next background
+	ArenaView<BYTE>		m_baseRGBX;
+	ArenaView<BYTE>		m_playersRGBX;
+	ArenaView<BYTE>		m_frameRGBX;
+	bool				m_bHavePlayers;
+
+	WorkPool			m_workers;
+	Band				m_bands[cMaxBands];
+	int					m_bandCount;
+
+	// the frame the bands are composing, and how many are still at it
+	const SoftwareFrame*	m_pFrame;
+	volatile LONG		m_pendingBands;
+	HANDLE				m_hBandsDone;
+
+	static void BandProc(void* context);
+	void ComposeBand(int firstRow, int endRow);
+};
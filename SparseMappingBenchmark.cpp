@@ -0,0 +1,324 @@
+#include "stdafx.h"
+#include <fstream>
+#include "SparseMappingBenchmark.h"
+#include "SyntheticFrameSource.h"
+#include "DepthRegistration.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+static const float g_coverages[] = { 0.0f, 0.01f, 0.05f, 0.1f, 0.2f, 0.35f, 0.5f, 0.75f, 1.0f };
+static const int g_coverageCount = sizeof(g_coverages) / sizeof(g_coverages[0]);
+
+static const int g_iterations = 200;
+
+// a runtime call per pixel at full coverage is tens of thousands of calls, so fewer passes
+static const int g_runtimeIterations = 5;
+
+// MeasureRuntimeMapping's frame: a quarter of the view is player, near where the paths cross
+static const float g_measureCoverage = 0.25f;
+static const int g_measureFrameCalls = 8;
+
+/// <summary>
+/// The mapping stage's sparse runtime path: one call per listed pixel
+/// </summary>
+static HRESULT MapPixelsWithRuntime(INuiSensor* pNuiSensor, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+	const CompositeLayout& layout, const USHORT* depthD16, PlayerPixel* pixels, LONG count)
+{
+	HRESULT hr = S_OK;
+	for ( LONG i = 0; i < count; ++i )
+	{
+		PlayerPixel& pixel = pixels[i];
+		LONG colorX = 0;
+		LONG colorY = 0;
+		hr = pNuiSensor->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+			colorResolution,
+			depthResolution,
+			NULL,
+			pixel.depthX,
+			pixel.depthY,
+			depthD16[pixel.depthX + pixel.depthY * layout.depthWidth],
+			&colorX,
+			&colorY
+			);
+		pixel.color.x = PackCoordinate(colorX);
+		pixel.color.y = PackCoordinate(colorY);
+	}
+	return hr;
+}
+
+/// <summary>
+/// The mapping stage's dense runtime path: the whole-frame call, then the listed pixels read from it
+/// </summary>
+static HRESULT MapFrameWithRuntime(INuiSensor* pNuiSensor, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+	const CompositeLayout& layout, const USHORT* depthD16, LONG* coordinates, PlayerPixel* pixels, LONG count)
+{
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	HRESULT hr = pNuiSensor->NuiImageGetColorPixelCoordinateFrameFromDepthPixelFrameAtResolution(
+		colorResolution,
+		depthResolution,
+		depthPixels,
+		const_cast<USHORT*>(depthD16),
+		depthPixels * 2,
+		coordinates
+		);
+
+	for ( LONG i = 0; i < count; ++i )
+	{
+		PlayerPixel& pixel = pixels[i];
+		LONG depthIndex = pixel.depthX + pixel.depthY * layout.depthWidth;
+		pixel.color.x = PackCoordinate(coordinates[depthIndex * 2]);
+		pixel.color.y = PackCoordinate(coordinates[depthIndex * 2 + 1]);
+	}
+	return hr;
+}
+
+/// <summary>
+/// The first sensor, initialized for depth and colour, or NULL if there is none ready
+/// </summary>
+static INuiSensor* OpenSensor()
+{
+	int sensorCount = 0;
+	INuiSensor* pNuiSensor = NULL;
+	if ( FAILED(NuiGetSensorCount(&sensorCount)) || sensorCount < 1 || FAILED(NuiCreateSensorByIndex(0, &pNuiSensor)) )
+	{
+		return NULL;
+	}
+
+	if ( S_OK != pNuiSensor->NuiStatus() ||
+		FAILED(pNuiSensor->NuiInitialize(NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_COLOR)) )
+	{
+		pNuiSensor->Release();
+		return NULL;
+	}
+	return pNuiSensor;
+}
+
+HRESULT MeasureRuntimeMapping(INuiSensor* pNuiSensor, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+	const CompositeLayout& layout, double& frameMs, double& pixelMs)
+{
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	USHORT* depthD16 = new USHORT[depthPixels];
+	LONG* coordinates = new LONG[depthPixels * 2];
+	PlayerPixel* pixels = new PlayerPixel[depthPixels];
+
+	source.GenerateCoverage(g_measureCoverage, depthD16);
+	LONG count = CollectPlayerPixels(layout, depthD16, pixels);
+
+	HRESULT hr = S_OK;
+	LONGLONG frameTicks = 0;
+	LONGLONG pixelTicks = 0;
+	for ( int i = 0; i < g_measureFrameCalls && SUCCEEDED(hr); ++i )
+	{
+		LONGLONG start = HighResClock::Now();
+		hr = MapFrameWithRuntime(pNuiSensor, colorResolution, depthResolution, layout, depthD16, coordinates, pixels, count);
+		frameTicks += HighResClock::Now() - start;
+	}
+	if ( SUCCEEDED(hr) )
+	{
+		LONGLONG start = HighResClock::Now();
+		hr = MapPixelsWithRuntime(pNuiSensor, colorResolution, depthResolution, layout, depthD16, pixels, count);
+		pixelTicks = HighResClock::Now() - start;
+	}
+
+	delete[] depthD16;
+	delete[] coordinates;
+	delete[] pixels;
+
+	if ( FAILED(hr) || count <= 0 )
+	{
+		return FAILED(hr) ? hr : E_FAIL;
+	}
+
+	frameMs = HighResClock::TicksToMilliseconds(frameTicks) / g_measureFrameCalls;
+	pixelMs = HighResClock::TicksToMilliseconds(pixelTicks) / count;
+	return S_OK;
+}
+
+float SparseMappingCrossover(double frameMs, double pixelMs, LONG depthPixels)
+{
+	if ( pixelMs <= 0.0 || depthPixels <= 0 )
+	{
+		return 1.0f;
+	}
+
+	double coverage = frameMs / (pixelMs * depthPixels);
+	return (float)(coverage < 1.0 ? coverage : 1.0);
+}
+
+HRESULT RunSparseMappingBenchmark(const char* path)
+{
+	ofstream csv(path);
+	if ( !csv )
+	{
+		return E_FAIL;
+	}
+
+	CompositeLayout layout;
+	layout.depthWidth = 320;
+	layout.depthHeight = 240;
+	layout.colorWidth = 640;
+	layout.colorHeight = 480;
+	layout.colorToDepthDivisor = layout.colorWidth / layout.depthWidth;
+
+	SyntheticFrameSource source;
+	source.Initialize(layout);
+
+	LONG depthPixels = layout.depthWidth * layout.depthHeight;
+	LONG colorPixels = layout.colorWidth * layout.colorHeight;
+
+	USHORT* depthD16 = new USHORT[depthPixels];
+	BYTE* colorRGBX = new BYTE[colorPixels * 4];
+	ColorCoordinate* colorCoordinates = new ColorCoordinate[depthPixels];
+	PlayerPixel* pixels = new PlayerPixel[depthPixels];
+	BYTE* denseRGBX = new BYTE[colorPixels * 4];
+	BYTE* sparseRGBX = new BYTE[colorPixels * 4];
+
+	LONG* runtimeCoordinates = new LONG[depthPixels * 2];
+
+	source.GenerateColor(0, colorRGBX);
+
+	DepthRegistration registration;
+	RegistrationCalibration calibration;
+	DepthRegistration::DefaultCalibration(layout, calibration);
+	HRESULT hr = registration.Initialize(layout, calibration);
+
+	// the runtime's calls are timed only when a sensor is there to make them
+	INuiSensor* pNuiSensor = OpenSensor();
+
+	csv << "coverage,player_pixels,dense_map_ms,dense_composite_ms,dense_total_ms,sparse_collect_ms,sparse_map_ms,sparse_composite_ms,sparse_total_ms,speedup,mismatches,"
+		"builtin_frame_ms,builtin_pixels_ms,builtin_speedup,runtime_frame_ms,runtime_pixels_ms,runtime_speedup" << endl;
+
+	for ( int c = 0; c < g_coverageCount && SUCCEEDED(hr); ++c )
+	{
+		source.GenerateCoverage(g_coverages[c], depthD16);
+
+		LONGLONG denseMap = 0;
+		LONGLONG denseComposite = 0;
+		LONGLONG sparseCollect = 0;
+		LONGLONG sparseMap = 0;
+		LONGLONG sparseComposite = 0;
+		LONGLONG builtinFrame = 0;
+		LONGLONG builtinPixels = 0;
+		LONG count = 0;
+
+		for ( int i = 0; i < g_iterations; ++i )
+		{
+			LONGLONG t0 = HighResClock::Now();
+			source.MapColorCoordinates(depthD16, colorCoordinates, 0, layout.depthHeight);
+			LONGLONG t1 = HighResClock::Now();
+			CompositePlayers(layout, depthD16, colorCoordinates, colorRGBX, denseRGBX, 0, layout.colorHeight);
+			LONGLONG t2 = HighResClock::Now();
+			count = CollectPlayerPixels(layout, depthD16, pixels);
+			LONGLONG t3 = HighResClock::Now();
+			source.MapPlayerPixels(depthD16, pixels, count);
+			LONGLONG t4 = HighResClock::Now();
+			CompositePlayerPixels(layout, pixels, count, colorRGBX, sparseRGBX);
+			LONGLONG t5 = HighResClock::Now();
+
+			denseMap += t1 - t0;
+			denseComposite += t2 - t1;
+			sparseCollect += t3 - t2;
+			sparseMap += t4 - t3;
+			sparseComposite += t5 - t4;
+
+			// the listed pixels through the built-in registration, as the mapping stage would take them
+			registration.MapFrame(depthD16, colorCoordinates, 0, layout.depthHeight);
+			for ( LONG p = 0; p < count; ++p )
+			{
+				pixels[p].color = colorCoordinates[pixels[p].depthX + pixels[p].depthY * layout.depthWidth];
+			}
+			LONGLONG t6 = HighResClock::Now();
+			registration.MapPlayerPixels(depthD16, pixels, count);
+			LONGLONG t7 = HighResClock::Now();
+
+			builtinFrame += t6 - t5;
+			builtinPixels += t7 - t6;
+		}
+
+		LONGLONG runtimeFrame = 0;
+		LONGLONG runtimePixels = 0;
+		for ( int i = 0; NULL != pNuiSensor && i < g_runtimeIterations && SUCCEEDED(hr); ++i )
+		{
+			LONGLONG t0 = HighResClock::Now();
+			hr = MapFrameWithRuntime(pNuiSensor, NUI_IMAGE_RESOLUTION_640x480, NUI_IMAGE_RESOLUTION_320x240, layout, depthD16, runtimeCoordinates, pixels, count);
+			LONGLONG t1 = HighResClock::Now();
+			if ( SUCCEEDED(hr) )
+			{
+				hr = MapPixelsWithRuntime(pNuiSensor, NUI_IMAGE_RESOLUTION_640x480, NUI_IMAGE_RESOLUTION_320x240, layout, depthD16, pixels, count);
+			}
+			LONGLONG t2 = HighResClock::Now();
+
+			runtimeFrame += t1 - t0;
+			runtimePixels += t2 - t1;
+		}
+
+		LONG mismatches = 0;
+		const LONG* pDense = (const LONG *)denseRGBX;
+		const LONG* pSparse = (const LONG *)sparseRGBX;
+		for ( LONG i = 0; i < colorPixels; ++i )
+		{
+			if ( pDense[i] != pSparse[i] )
+			{
+				++mismatches;
+			}
+		}
+
+		double denseMapMs = HighResClock::TicksToMilliseconds(denseMap) / g_iterations;
+		double denseCompositeMs = HighResClock::TicksToMilliseconds(denseComposite) / g_iterations;
+		double sparseCollectMs = HighResClock::TicksToMilliseconds(sparseCollect) / g_iterations;
+		double sparseMapMs = HighResClock::TicksToMilliseconds(sparseMap) / g_iterations;
+		double sparseCompositeMs = HighResClock::TicksToMilliseconds(sparseComposite) / g_iterations;
+		double denseTotal = denseMapMs + denseCompositeMs;
+		double sparseTotal = sparseCollectMs + sparseMapMs + sparseCompositeMs;
+		double builtinFrameMs = HighResClock::TicksToMilliseconds(builtinFrame) / g_iterations;
+		double builtinPixelsMs = HighResClock::TicksToMilliseconds(builtinPixels) / g_iterations;
+		double runtimeFrameMs = HighResClock::TicksToMilliseconds(runtimeFrame) / g_runtimeIterations;
+		double runtimePixelsMs = HighResClock::TicksToMilliseconds(runtimePixels) / g_runtimeIterations;
+
+		csv << g_coverages[c] << ","
+			<< count << ","
+			<< denseMapMs << ","
+			<< denseCompositeMs << ","
+			<< denseTotal << ","
+			<< sparseCollectMs << ","
+			<< sparseMapMs << ","
+			<< sparseCompositeMs << ","
+			<< sparseTotal << ","
+			<< (sparseTotal > 0.0 ? denseTotal / sparseTotal : 0.0) << ","
+			<< mismatches << ","
+			<< builtinFrameMs << ","
+			<< builtinPixelsMs << ","
+			<< (builtinPixelsMs > 0.0 ? builtinFrameMs / builtinPixelsMs : 0.0) << ",";
+		if ( NULL != pNuiSensor )
+		{
+			csv << runtimeFrameMs << ","
+				<< runtimePixelsMs << ","
+				<< (runtimePixelsMs > 0.0 ? runtimeFrameMs / runtimePixelsMs : 0.0);
+		}
+		else
+		{
+			csv << ",,";
+		}
+		csv << endl;
+	}
+
+	if ( NULL != pNuiSensor )
+	{
+		pNuiSensor->NuiShutdown();
+		pNuiSensor->Release();
+	}
+
+	delete[] depthD16;
+	delete[] colorRGBX;
+	delete[] colorCoordinates;
+	delete[] pixels;
+	delete[] denseRGBX;
+	delete[] sparseRGBX;
+	delete[] runtimeCoordinates;
+
+	return hr;
+}
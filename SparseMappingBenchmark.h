@@ -0,0 +1,54 @@
+/*
+
+Sparse mapping benchmark
+
+Compares the dense path (map every depth pixel to colour, then composite
+every output pixel) with the sparse one (list the player pixels, map just
+those, composite from the list) on synthetic frames whose player covers from
+none to all of the view. Both paths must produce the same image; the
+mismatch column counts output pixels where they differ.
+
+The synthetic mapping says nothing about what the application's mapping
+costs, so each row also times the two ways the mapping stage can map the
+listed pixels, against each other: with the built-in registration, the
+whole frame through the SIMD path and the coordinates read from it, or the
+list through the player pixel kernel; and with the runtime, which needs a
+sensor, one whole-frame call or one call per listed pixel. The coverage
+where a speedup column crosses 1 is the one the mapping stage should switch
+at. The runtime's columns are empty without a sensor, and the application
+times its calls the same way when it starts (MeasureRuntimeMapping).
+
+Run with /benchsparse on the command line; results go to sparse_bench.csv.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "NuiApi.h"
+#include "Compositor.h"
+
+/// <summary>
+/// Runs the benchmark and writes one CSV row per coverage level
+/// </summary>
+/// <param name="path">CSV file to write</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT RunSparseMappingBenchmark(const char* path);
+
+/// <summary>
+/// Times the runtime's whole-frame mapping call and its per-pixel call on a synthetic frame
+/// </summary>
+/// <param name="pNuiSensor">initialized sensor</param>
+/// <param name="colorResolution">colour stream resolution</param>
+/// <param name="depthResolution">depth stream resolution</param>
+/// <param name="layout">frame sizes for the resolutions</param>
+/// <param name="frameMs">one whole-frame call, with the listed pixels read from it</param>
+/// <param name="pixelMs">one per-pixel call</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT MeasureRuntimeMapping(INuiSensor* pNuiSensor, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+	const CompositeLayout& layout, double& frameMs, double& pixelMs);
+
+/// <summary>
+/// The share of the depth pixels up to which mapping them one call each costs less than the whole-frame call
+/// </summary>
+float SparseMappingCrossover(double frameMs, double pixelMs, LONG depthPixels);
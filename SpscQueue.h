@@ -0,0 +1,83 @@
+/*
+
+Bounded single-producer/single-consumer queue
+
+The producer only writes m_tail and the consumer only writes m_head, so no
+locks are needed; the barriers order the slot write/read against the index
+publish. Capacity must be a power of two.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+template <typename T, int Capacity>
+class SpscQueue
+{
+public:
+	SpscQueue() : m_head(0), m_tail(0), m_drops(0)
+	{
+		static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+	}
+
+	/// <summary>
+	/// Producer side: append an item, fails (and counts a drop) when full
+	/// </summary>
+	bool Push(const T& item)
+	{
+		LONG tail = m_tail;
+		if ( tail - m_head == Capacity )
+		{
+			InterlockedIncrement(&m_drops);
+			return false;
+		}
+
+		m_items[tail & (Capacity - 1)] = item;
+		MemoryBarrier();
+		m_tail = tail + 1;
+		return true;
+	}
+
+	/// <summary>
+	/// Consumer side: remove the oldest item, returns false when empty
+	/// </summary>
+	bool Pop(T& item)
+	{
+		LONG head = m_head;
+		if ( head == m_tail )
+		{
+			return false;
+		}
+
+		MemoryBarrier();
+		item = m_items[head & (Capacity - 1)];
+		MemoryBarrier();
+		m_head = head + 1;
+		return true;
+	}
+
+	/// <summary>
+	/// Approximate number of queued items; exact only on the producer or consumer thread
+	/// </summary>
+	LONG Depth() const
+	{
+		return m_tail - m_head;
+	}
+
+	/// <summary>
+	/// Number of pushes rejected because the queue was full
+	/// </summary>
+	LONG Drops() const
+	{
+		return m_drops;
+	}
+
+private:
+	// keep the two indices on separate cache lines so producer and consumer don't false share
+	__declspec(align(64)) volatile LONG m_head;
+	__declspec(align(64)) volatile LONG m_tail;
+	__declspec(align(64)) volatile LONG m_drops;
+
+	T m_items[Capacity];
+};
@@ -0,0 +1,194 @@
+#include "stdafx.h"
+#include "StageGraph.h"
+#include "HighResClock.h"
+#include "Trace.h"
+
+StageGraph::StageGraph() :
+	m_stageCount(0),
+	m_pPool(NULL),
+	m_retire(NULL),
+	m_retireContext(NULL),
+	m_inFlight(0),
+	m_rejected(0)
+{
+}
+
+int StageGraph::AddStage(const char* name, StageFunction function, void* context, int queueCapacity, double latencyBoundMs)
+{
+	if ( m_stageCount == cMaxStages )
+	{
+		return -1;
+	}
+
+	if ( queueCapacity < 1 ) queueCapacity = 1;
+	if ( queueCapacity > cMaxQueueCapacity ) queueCapacity = cMaxQueueCapacity;
+
+	Stage& stage = m_stages[m_stageCount];
+	stage.pGraph = this;
+	stage.index = m_stageCount;
+	stage.name = name;
+	stage.function = function;
+	stage.context = context;
+	stage.capacity = queueCapacity;
+	stage.latencyBoundTicks = (LONGLONG)(latencyBoundMs * HighResClock::Frequency() / 1000.0);
+	stage.scheduled = 0;
+	stage.processed = 0;
+	stage.late = 0;
+
+	return m_stageCount++;
+}
+
+void StageGraph::SetRetire(RetireFunction function, void* context)
+{
+	m_retire = function;
+	m_retireContext = context;
+}
+
+void StageGraph::Start(WorkPool* pPool)
+{
+	m_pPool = pPool;
+}
+
+bool StageGraph::Submit(void* item)
+{
+	Stage& first = m_stages[0];
+	if ( first.queue.Depth() >= first.capacity )
+	{
+		InterlockedIncrement(&m_rejected);
+		return false;
+	}
+
+	QueuedItem queued;
+	queued.item = item;
+	queued.submitTicks = HighResClock::Now();
+	queued.enqueueTicks = queued.submitTicks;
+
+	InterlockedIncrement(&m_inFlight);
+	first.queue.Push(queued);
+	Schedule(first);
+	return true;
+}
+
+void StageGraph::WaitIdle()
+{
+	while ( m_inFlight > 0 )
+	{
+		Sleep(1);
+	}
+}
+
+void StageGraph::GetStageStats(int stage, StageStats& stats)
+{
+	Stage& s = m_stages[stage];
+	stats.processed = s.processed;
+	stats.late = s.late;
+	stats.queued = s.queue.Depth();
+	s.wait.Snapshot(stats.wait);
+	s.service.Snapshot(stats.service);
+}
+
+void StageGraph::RunStage(void* context)
+{
+	Stage* pStage = static_cast<Stage*>(context);
+	pStage->pGraph->Run(*pStage);
+}
+
+void StageGraph::Run(Stage& stage)
+{
+	bool last = (stage.index + 1 == m_stageCount);
+
+	// keep going while there is work and somewhere to put the result
+	while ( HasRoomAfter(stage) )
+	{
+		QueuedItem queued;
+		if ( !stage.queue.Pop(queued) )
+		{
+			break;
+		}
+
+		// taking a frame made room, the stage before us may have been holding one back
+		if ( stage.index > 0 )
+		{
+			ScheduleIfReady(m_stages[stage.index - 1]);
+		}
+
+		LONGLONG start = HighResClock::Now();
+		LONGLONG waited = start - queued.enqueueTicks;
+		stage.wait.Record(HighResClock::TicksToMicroseconds(waited));
+
+		if ( stage.latencyBoundTicks > 0 && waited > stage.latencyBoundTicks )
+		{
+			InterlockedIncrement(&stage.late);
+			Retire(queued, false, start);
+			continue;
+		}
+
+		{
+			TraceScope scope(stage.name);
+			stage.function(stage.context, queued.item);
+		}
+
+		LONGLONG end = HighResClock::Now();
+		stage.service.Record(HighResClock::TicksToMicroseconds(end - start));
+		InterlockedIncrement(&stage.processed);
+
+		if ( last )
+		{
+			Retire(queued, true, end);
+		}
+		else
+		{
+			Stage& next = m_stages[stage.index + 1];
+			queued.enqueueTicks = end;
+			next.queue.Push(queued);
+			Schedule(next);
+		}
+	}
+
+	// a frame may have arrived, or room opened up, after the loop gave up but
+	// before the flag was cleared; nobody else would have scheduled us for it
+	InterlockedExchange(&stage.scheduled, 0);
+	ScheduleIfReady(stage);
+}
+
+bool StageGraph::HasRoomAfter(const Stage& stage) const
+{
+	if ( stage.index + 1 == m_stageCount )
+	{
+		return true;
+	}
+
+	const Stage& next = m_stages[stage.index + 1];
+	return next.queue.Depth() < next.capacity;
+}
+
+void StageGraph::Schedule(Stage& stage)
+{
+	if ( InterlockedCompareExchange(&stage.scheduled, 1, 0) == 0 )
+	{
+		m_pPool->Submit(RunStage, &stage);
+	}
+}
+
+void StageGraph::ScheduleIfReady(Stage& stage)
+{
+	if ( stage.queue.Depth() > 0 && HasRoomAfter(stage) )
+	{
+		Schedule(stage);
+	}
+}
+
+void StageGraph::Retire(const QueuedItem& queued, bool completed, LONGLONG now)
+{
+	if ( completed )
+	{
+		m_total.Record(HighResClock::TicksToMicroseconds(now - queued.submitTicks));
+	}
+
+	if ( m_retire )
+	{
+		m_retire(m_retireContext, queued.item, completed);
+	}
+
+	InterlockedDecrement(&m_inFlight);
+}
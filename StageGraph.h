@@ -0,0 +1,154 @@
+/*
+
+Frame-pipelined stage graph
+
+A chain of stages joined by bounded queues. Each stage handles one frame at a
+time and frames go through a stage in submission order, but different stages
+run concurrently on the work pool, so while one frame is being composited the
+next can already be mapped. A stage only takes a frame from its queue when the
+next stage's queue has room, so a slow stage holds frames back up the chain
+until Submit starts refusing them, and nothing is ever buffered without bound.
+
+Each stage can have a latency bound: a frame that has waited longer than that
+in front of the stage is stale and is retired without running the rest of the
+chain. Frames leave the graph through the retire callback, processed or not,
+which is where the owner recycles them.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "SpscQueue.h"
+#include "CacheAligned.h"
+#include "LatencyMonitor.h"
+#include "WorkPool.h"
+
+/// <summary>
+/// Stage body, called with the stage's context and the frame
+/// </summary>
+typedef void (*StageFunction)(void* context, void* item);
+
+/// <summary>
+/// Called once per submitted frame when it leaves the graph. Stale frames are
+/// retired by the stage that found them, so this may run on several workers at once
+/// </summary>
+typedef void (*RetireFunction)(void* context, void* item, bool completed);
+
+/// <summary>
+/// Per-stage counters; the summaries cover the time since the previous GetStageStats
+/// </summary>
+typedef struct
+{
+	LONG			processed;		// frames the stage ran on
+	LONG			late;			// frames retired here because they exceeded the latency bound
+	LONG			queued;			// frames waiting in front of the stage
+	LatencySummary	wait;			// time spent in the stage's queue
+	LatencySummary	service;		// time spent in the stage function
+} StageStats;
+
+// the stage queues are cache-line aligned, and the benchmark makes graphs with new
+class StageGraph : public CacheAligned
+{
+public:
+	static const int cMaxStages = 8;
+	static const int cMaxQueueCapacity = 8;
+
+	StageGraph();
+
+	/// <summary>
+	/// Appends a stage. Only before Start
+	/// </summary>
+	/// <param name="name">trace and report name, must outlive the graph</param>
+	/// <param name="function">stage body</param>
+	/// <param name="context">passed to function</param>
+	/// <param name="queueCapacity">frames that may wait in front of the stage, 1 to cMaxQueueCapacity</param>
+	/// <param name="latencyBoundMs">longest a frame may wait for this stage, 0 for no bound</param>
+	/// <returns>stage index, or -1 if the graph is full</returns>
+	int AddStage(const char* name, StageFunction function, void* context, int queueCapacity, double latencyBoundMs);
+
+	/// <summary>
+	/// Sets the callback frames leave the graph through
+	/// </summary>
+	void SetRetire(RetireFunction function, void* context);
+
+	/// <summary>
+	/// Binds the graph to the pool its stages run on
+	/// </summary>
+	void Start(WorkPool* pPool);
+
+	/// <summary>
+	/// Feeds a frame into the first stage. Only one thread may submit
+	/// </summary>
+	/// <returns>false if the first queue is full; the frame was not taken</returns>
+	bool Submit(void* item);
+
+	/// <summary>
+	/// Waits until every submitted frame has been retired
+	/// </summary>
+	void WaitIdle();
+
+	int StageCount() const { return m_stageCount; }
+	const char* StageName(int stage) const { return m_stages[stage].name; }
+
+	/// <summary>
+	/// Counters for a stage. Only one thread may read the stats
+	/// </summary>
+	void GetStageStats(int stage, StageStats& stats);
+
+	/// <summary>
+	/// Submit-to-retire time of completed frames since the previous call
+	/// </summary>
+	void GetTotalLatency(LatencySummary& summary) { m_total.Snapshot(summary); }
+
+	LONG InFlight() const { return m_inFlight; }
+	LONG Rejected() const { return m_rejected; }
+
+private:
+	typedef struct
+	{
+		void*		item;
+		LONGLONG	submitTicks;
+		LONGLONG	enqueueTicks;	// when the frame entered the current queue
+	} QueuedItem;
+
+	struct Stage
+	{
+		StageGraph*			pGraph;
+		int					index;
+		const char*			name;
+		StageFunction		function;
+		void*				context;
+		LONG				capacity;
+		LONGLONG			latencyBoundTicks;
+
+		SpscQueue<QueuedItem, cMaxQueueCapacity>	queue;
+
+		// set while a work item for the stage is queued or running, so the stage never runs twice at once
+		volatile LONG		scheduled;
+
+		volatile LONG		processed;
+		volatile LONG		late;
+		LatencyHistogram	wait;
+		LatencyHistogram	service;
+	};
+
+	Stage				m_stages[cMaxStages];
+	int					m_stageCount;
+
+	WorkPool*			m_pPool;
+	RetireFunction		m_retire;
+	void*				m_retireContext;
+
+	volatile LONG		m_inFlight;
+	volatile LONG		m_rejected;
+	LatencyHistogram	m_total;
+
+	static void RunStage(void* context);
+	void Run(Stage& stage);
+
+	bool HasRoomAfter(const Stage& stage) const;
+	void Schedule(Stage& stage);
+	void ScheduleIfReady(Stage& stage);
+	void Retire(const QueuedItem& queued, bool completed, LONGLONG now);
+};
@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include <math.h>
+#include "NuiApi.h"
+#include "SyntheticFrameSource.h"
+
+// Kinect v1 nominal focal lengths at 320x240 depth and 640x480 colour, and the camera baseline
+static const float g_depthFocal320 = 285.63f;
+static const float g_colorFocal640 = 531.15f;
+static const float g_baselineMm = 25.0f;
+
+static const USHORT g_playerDepthMm = 2000;
+static const USHORT g_backgroundDepthMm = 3500;
+
+// frames for the player to walk from one side to the other
+static const int g_walkFrames = 150;
+
+SyntheticFrameSource::SyntheticFrameSource()
+{
+	ZeroMemory(&m_layout, sizeof(m_layout));
+}
+
+void SyntheticFrameSource::Initialize(const CompositeLayout& layout)
+{
+	m_layout = layout;
+}
+
+void SyntheticFrameSource::GenerateDepth(int frameIndex, USHORT* depthD16) const
+{
+	LONG width = m_layout.depthWidth;
+	LONG height = m_layout.depthHeight;
+
+	// walk back and forth across the middle half of the view
+	int phase = frameIndex % (2 * g_walkFrames);
+	float t = (phase < g_walkFrames ? phase : 2 * g_walkFrames - phase) / (float)g_walkFrames;
+	float centerX = width * (0.25f + 0.5f * t);
+
+	// a body ellipse with a head on top
+	float bodyY = height * 0.6f;
+	float bodyRadiusX = width * 0.1f;
+	float bodyRadiusY = height * 0.35f;
+	float headY = height * 0.17f;
+	float headRadius = width * 0.045f;
+
+	for ( LONG y = 0; y < height; ++y )
+	{
+		for ( LONG x = 0; x < width; ++x )
+		{
+			float bx = (x - centerX) / bodyRadiusX;
+			float by = (y - bodyY) / bodyRadiusY;
+			float hx = (x - centerX) / headRadius;
+			float hy = (y - headY) / headRadius;
+
+			USHORT pixel;
+			if ( bx * bx + by * by <= 1.0f || hx * hx + hy * hy <= 1.0f )
+			{
+				pixel = (USHORT)((g_playerDepthMm << NUI_IMAGE_PLAYER_INDEX_SHIFT) | 1);
+			}
+			else
+			{
+				// the back wall leans away a little towards the top
+				USHORT depth = (USHORT)(g_backgroundDepthMm + (height - y));
+				pixel = (USHORT)(depth << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+			}
+
+			depthD16[x + y * width] = pixel;
+		}
+	}
+}
+
+void SyntheticFrameSource::GenerateColor(int frameIndex, BYTE* colorRGBX) const
+{
+	LONG width = m_layout.colorWidth;
+	LONG height = m_layout.colorHeight;
+
+	for ( LONG y = 0; y < height; ++y )
+	{
+		BYTE* pRow = colorRGBX + y * width * 4;
+		for ( LONG x = 0; x < width; ++x )
+		{
+			pRow[x * 4 + 0] = (BYTE)(x + frameIndex);
+			pRow[x * 4 + 1] = (BYTE)y;
+			pRow[x * 4 + 2] = (BYTE)(x ^ y);
+			pRow[x * 4 + 3] = 0xff;
+		}
+	}
+}
+
+void SyntheticFrameSource::GenerateCoverage(float coverage, USHORT* depthD16) const
+{
+	LONG width = m_layout.depthWidth;
+	LONG height = m_layout.depthHeight;
+
+	// a block with the view's aspect ratio, so its side is the square root of the coverage
+	float side = sqrtf(coverage);
+	LONG blockWidth = (LONG)(width * side + 0.5f);
+	LONG blockHeight = (LONG)(height * side + 0.5f);
+	LONG left = (width - blockWidth) / 2;
+	LONG top = (height - blockHeight) / 2;
+
+	for ( LONG y = 0; y < height; ++y )
+	{
+		for ( LONG x = 0; x < width; ++x )
+		{
+			bool player = x >= left && x < left + blockWidth && y >= top && y < top + blockHeight;
+			depthD16[x + y * width] = player ?
+				(USHORT)((g_playerDepthMm << NUI_IMAGE_PLAYER_INDEX_SHIFT) | 1) :
+				(USHORT)((g_backgroundDepthMm + (height - y)) << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+		}
+	}
+}
+
+void SyntheticFrameSource::MapPixel(LONG x, LONG y, USHORT depthPixel, ColorCoordinate& color) const
+{
+	USHORT depth = NuiDepthPixelToDepth(depthPixel);
+
+	if ( depth == 0 )
+	{
+		// no depth, the runtime maps these straight across
+		color.x = PackCoordinate(x * m_layout.colorToDepthDivisor);
+		color.y = PackCoordinate(y * m_layout.colorToDepthDivisor);
+		return;
+	}
+
+	float depthFocal = g_depthFocal320 * m_layout.depthWidth / 320.0f;
+	float colorFocal = g_colorFocal640 * m_layout.colorWidth / 640.0f;
+
+	// back-project into depth camera space, shift by the baseline, project into the colour camera
+	float z = (float)depth;
+	float worldX = (x - m_layout.depthWidth * 0.5f) * z / depthFocal;
+	float worldY = (y - m_layout.depthHeight * 0.5f) * z / depthFocal;
+
+	color.x = PackCoordinate((LONG)(colorFocal * (worldX + g_baselineMm) / z + m_layout.colorWidth * 0.5f));
+	color.y = PackCoordinate((LONG)(colorFocal * worldY / z + m_layout.colorHeight * 0.5f));
+}
+
+void SyntheticFrameSource::MapColorCoordinates(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const
+{
+	for ( LONG y = firstRow; y < endRow; ++y )
+	{
+		for ( LONG x = 0; x < m_layout.depthWidth; ++x )
+		{
+			LONG index = x + y * m_layout.depthWidth;
+			MapPixel(x, y, depthD16[index], colorCoordinates[index]);
+		}
+	}
+}
+
+void SyntheticFrameSource::MapPlayerPixels(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const
+{
+	for ( LONG i = 0; i < count; ++i )
+	{
+		PlayerPixel& pixel = pixels[i];
+		MapPixel(pixel.depthX, pixel.depthY, depthD16[pixel.depthX + pixel.depthY * m_layout.depthWidth], pixel.color);
+	}
+}
@@ -0,0 +1,59 @@
+/*
+
+Synthetic sensor frames
+
+Generates depth frames with a player silhouette walking across the view, a
+colour frame to go with them, and a depth-to-colour mapping from a fixed
+camera offset, so the processing code can be exercised and benchmarked
+without a Kinect. The output matches the runtime's formats: depth pixels
+carry the player index in their low bits and colour is RGBX; the mapping is
+a packed ColorCoordinate per depth pixel.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include "Compositor.h"
+
+class SyntheticFrameSource
+{
+public:
+	SyntheticFrameSource();
+
+	/// <summary>
+	/// Sets the frame sizes to generate
+	/// </summary>
+	void Initialize(const CompositeLayout& layout);
+
+	/// <summary>
+	/// Depth frame number frameIndex, depthWidth x depthHeight
+	/// </summary>
+	void GenerateDepth(int frameIndex, USHORT* depthD16) const;
+
+	/// <summary>
+	/// Colour frame number frameIndex, colorWidth x colorHeight RGBX
+	/// </summary>
+	void GenerateColor(int frameIndex, BYTE* colorRGBX) const;
+
+	/// <summary>
+	/// Depth to colour mapping for depth rows [firstRow, endRow), the same work per pixel as a
+	/// pinhole reprojection
+	/// </summary>
+	void MapColorCoordinates(const USHORT* depthD16, ColorCoordinate* colorCoordinates, LONG firstRow, LONG endRow) const;
+
+	/// <summary>
+	/// The same mapping for just the pixels in a player pixel list
+	/// </summary>
+	void MapPlayerPixels(const USHORT* depthD16, PlayerPixel* pixels, LONG count) const;
+
+	/// <summary>
+	/// Depth frame with a centred block of player pixels covering the given fraction of the view
+	/// </summary>
+	void GenerateCoverage(float coverage, USHORT* depthD16) const;
+
+private:
+	CompositeLayout		m_layout;
+
+	void MapPixel(LONG x, LONG y, USHORT depthPixel, ColorCoordinate& color) const;
+};
@@ -0,0 +1,172 @@
+#include "stdafx.h"
+#include <fstream>
+#include "Trace.h"
+#include "HighResClock.h"
+
+using namespace std;
+
+// ~6 MB per traced thread, several minutes of the processing loop
+static const LONG cEventsPerThread = 1 << 18;
+
+struct TraceEvent
+{
+	const char*	name;
+	LONGLONG	ticks;
+	char		phase;
+};
+
+struct TraceBuffer
+{
+	TraceBuffer*	next;
+	DWORD			threadId;
+	const char*		threadName;
+	LONG			count;
+	LONG			open;			// recorded begins waiting for their end, each has a slot reserved
+	LONG			droppedOpen;	// dropped begins waiting for their end
+	LONG			dropped;
+	TraceEvent		events[cEventsPerThread];
+};
+
+bool Trace::s_enabled = false;
+
+static LONGLONG s_startTicks = 0;
+
+// every thread's buffer, pushed once when the thread first records
+static TraceBuffer* volatile s_buffers = NULL;
+static __declspec(thread) TraceBuffer* t_buffer = NULL;
+
+static TraceBuffer* ThreadBuffer()
+{
+	if ( t_buffer == NULL )
+	{
+		TraceBuffer* buffer = new TraceBuffer;
+		buffer->threadId = GetCurrentThreadId();
+		buffer->threadName = NULL;
+		buffer->count = 0;
+		buffer->open = 0;
+		buffer->droppedOpen = 0;
+		buffer->dropped = 0;
+
+		TraceBuffer* head;
+		do
+		{
+			head = s_buffers;
+			buffer->next = head;
+		}
+		while ( InterlockedCompareExchangePointer((PVOID volatile*)&s_buffers, buffer, head) != head );
+
+		t_buffer = buffer;
+	}
+	return t_buffer;
+}
+
+void Trace::Enable()
+{
+	s_startTicks = HighResClock::Now();
+	s_enabled = true;
+}
+
+void Trace::SetThreadName(const char* name)
+{
+	if ( s_enabled )
+	{
+		ThreadBuffer()->threadName = name;
+	}
+}
+
+void Trace::Begin(const char* name)
+{
+	TraceBuffer* buffer = ThreadBuffer();
+
+	// keep room for the end of every open scope so the trace stays balanced when the buffer fills.
+	// Once full it stays full, so dropped scopes are always nested inside recorded ones
+	if ( buffer->count + buffer->open + 2 > cEventsPerThread )
+	{
+		buffer->dropped++;
+		buffer->droppedOpen++;
+		return;
+	}
+
+	TraceEvent& e = buffer->events[buffer->count++];
+	e.name = name;
+	e.ticks = HighResClock::Now();
+	e.phase = 'B';
+	buffer->open++;
+}
+
+void Trace::End()
+{
+	TraceBuffer* buffer = ThreadBuffer();
+	if ( buffer->droppedOpen > 0 )
+	{
+		buffer->droppedOpen--;
+		return;
+	}
+	if ( buffer->open == 0 )
+	{
+		return;
+	}
+	buffer->open--;
+
+	TraceEvent& e = buffer->events[buffer->count++];
+	e.name = NULL;
+	e.ticks = HighResClock::Now();
+	e.phase = 'E';
+}
+
+HRESULT Trace::Write(const char* path)
+{
+	if ( !s_enabled )
+	{
+		return S_FALSE;
+	}
+
+	ofstream json(path, ios::out | ios::trunc);
+	if ( !json.is_open() )
+	{
+		return E_FAIL;
+	}
+
+	DWORD pid = GetCurrentProcessId();
+	bool first = true;
+
+	json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	json.setf(ios::fixed);
+	json.precision(3);
+
+	for ( TraceBuffer* buffer = s_buffers; buffer != NULL; buffer = buffer->next )
+	{
+		if ( buffer->threadName )
+		{
+			json << (first ? "" : ",\n")
+				<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer->threadId
+				<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+			first = false;
+		}
+
+		for ( LONG i = 0; i < buffer->count; ++i )
+		{
+			const TraceEvent& e = buffer->events[i];
+			double ts = HighResClock::TicksToMilliseconds(e.ticks - s_startTicks) * 1000.0;
+
+			json << (first ? "" : ",\n") << "{\"ph\":\"" << e.phase << '"';
+			if ( e.name )
+			{
+				json << ",\"name\":\"" << e.name << '"';
+			}
+			json << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << buffer->threadId << '}';
+			first = false;
+		}
+
+		if ( buffer->dropped > 0 )
+		{
+			json << (first ? "" : ",\n")
+				<< "{\"name\":\"trace buffer full\",\"ph\":\"i\",\"s\":\"t\",\"ts\":0,\"pid\":" << pid << ",\"tid\":" << buffer->threadId
+				<< ",\"args\":{\"dropped\":" << buffer->dropped << "}}";
+			first = false;
+		}
+	}
+
+	json << "\n]}\n";
+	return json.good() ? S_OK : E_FAIL;
+}
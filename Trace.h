@@ -0,0 +1,73 @@
+/*
+
+Opt-in Chrome trace-event recording
+
+Scopes marked with TRACE_SCOPE record begin/end events into a buffer owned by
+the calling thread, so recording takes no locks. The buffers are written out
+as trace-event JSON (chrome://tracing, Perfetto) by Trace::Write. Tracing is
+switched on with /trace on the command line; when it is off a scope costs
+one predictable branch on a global flag.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+class Trace
+{
+public:
+	/// <summary>
+	/// Starts recording. Call before any thread enters a traced scope
+	/// </summary>
+	static void Enable();
+
+	static bool IsEnabled() { return s_enabled; }
+
+	/// <summary>
+	/// Names the calling thread in the trace
+	/// </summary>
+	static void SetThreadName(const char* name);
+
+	/// <summary>
+	/// Writes every thread's events as trace-event JSON. Call once the traced threads have stopped
+	/// </summary>
+	/// <param name="path">file to write</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	static HRESULT Write(const char* path);
+
+	static void Begin(const char* name);
+	static void End();
+
+	static bool s_enabled;
+};
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) :
+		m_enabled(Trace::s_enabled)
+	{
+		if ( m_enabled )
+		{
+			Trace::Begin(name);
+		}
+	}
+
+	~TraceScope()
+	{
+		if ( m_enabled )
+		{
+			Trace::End();
+		}
+	}
+
+private:
+	bool m_enabled;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// name must be a string literal, only the pointer is stored
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
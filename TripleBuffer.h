@@ -0,0 +1,94 @@
+/*
+
+Lock-free triple buffer ("latest value" mailbox)
+
+The writer fills the back slot and publishes it; the reader takes whatever was
+published most recently. Neither side ever waits for the other, and a value
+that is overwritten before the reader gets to it is simply dropped. One
+writer thread and one reader thread.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() :
+		m_back(0),
+		m_middle(1),
+		m_front(2),
+		m_published(0),
+		m_dropped(0)
+	{
+	}
+
+	/// <summary>
+	/// Direct access to a slot, only for setting up the slots before the threads start
+	/// </summary>
+	T& Slot(int index) { return m_slots[index]; }
+
+	/// <summary>
+	/// Writer side: the slot to fill before calling Publish
+	/// </summary>
+	T& Back() { return m_slots[m_back]; }
+
+	/// <summary>
+	/// Writer side: makes the back slot the latest value and takes a new back slot
+	/// </summary>
+	void Publish()
+	{
+		LONG previous = InterlockedExchange(&m_middle, m_back | cFresh);
+
+		// the reader never took the previous value, it has been replaced unseen
+		if ( previous & cFresh )
+		{
+			InterlockedIncrement(&m_dropped);
+		}
+
+		m_back = previous & cIndexMask;
+		InterlockedIncrement(&m_published);
+	}
+
+	/// <summary>
+	/// Reader side: swaps in the latest published value if there is one
+	/// </summary>
+	/// <returns>true if Front() changed</returns>
+	bool Acquire()
+	{
+		if ( (m_middle & cFresh) == 0 )
+		{
+			return false;
+		}
+
+		m_front = InterlockedExchange(&m_middle, m_front) & cIndexMask;
+		return true;
+	}
+
+	/// <summary>
+	/// Reader side: the value taken by the last successful Acquire
+	/// </summary>
+	T& Front() { return m_slots[m_front]; }
+
+	/// <summary>
+	/// Values published, and values replaced before the reader saw them
+	/// </summary>
+	LONG Published() const { return m_published; }
+	LONG Dropped() const { return m_dropped; }
+
+private:
+	static const LONG cFresh = 4;
+	static const LONG cIndexMask = 3;
+
+	T				m_slots[3];
+
+	LONG			m_back;		// owned by the writer
+	volatile LONG	m_middle;	// shared, cFresh set when it holds an unread value
+	LONG			m_front;	// owned by the reader
+
+	volatile LONG	m_published;
+	volatile LONG	m_dropped;
+};
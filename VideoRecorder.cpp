@@ -0,0 +1,337 @@
+#include "stdafx.h"
+#include "VideoRecorder.h"
+#include "HighResClock.h"
+#include "Trace.h"
+
+using namespace std;
+
+static const char g_y4mFrameHeader[] = "FRAME\n";
+static const size_t g_y4mFrameHeaderBytes = sizeof(g_y4mFrameHeader) - 1;
+
+/// <summary>
+/// BGRA to planar 4:2:0, BT.601 studio range; each chroma sample is the average of a 2x2 block.
+/// Width and height must be even
+/// </summary>
+static void ConvertToI420(const BYTE* pBGRA, int width, int height, BYTE* pY, BYTE* pU, BYTE* pV)
+{
+	for ( int y = 0; y < height; y += 2 )
+	{
+		const BYTE* pRow0 = pBGRA + y * width * 4;
+		const BYTE* pRow1 = pRow0 + width * 4;
+		BYTE* pY0 = pY + y * width;
+		BYTE* pY1 = pY0 + width;
+
+		for ( int x = 0; x < width; x += 2 )
+		{
+			int sumB = 0;
+			int sumG = 0;
+			int sumR = 0;
+
+			const BYTE* pixels[4] = { pRow0 + x * 4, pRow0 + x * 4 + 4, pRow1 + x * 4, pRow1 + x * 4 + 4 };
+			BYTE* luma[4] = { pY0 + x, pY0 + x + 1, pY1 + x, pY1 + x + 1 };
+			for ( int i = 0; i < 4; ++i )
+			{
+				int b = pixels[i][0];
+				int g = pixels[i][1];
+				int r = pixels[i][2];
+				*luma[i] = (BYTE)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				sumB += b;
+				sumG += g;
+				sumR += r;
+			}
+
+			int b = (sumB + 2) >> 2;
+			int g = (sumG + 2) >> 2;
+			int r = (sumR + 2) >> 2;
+			int chroma = (y / 2) * (width / 2) + x / 2;
+			pU[chroma] = (BYTE)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			pV[chroma] = (BYTE)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+}
+
+VideoRecorder::VideoRecorder() :
+	m_bufferBytes(0),
+	m_pStaging(NULL),
+	m_pLastFrame(NULL),
+	m_lastFrameBytes(0),
+	m_heldBuffer(-1),
+	m_startTicks(0),
+	m_nextPeriod(0),
+	m_format(RecordFormatY4M),
+	m_width(0),
+	m_height(0),
+	m_recording(0),
+	m_inOnFrame(0),
+	m_hThread(NULL),
+	m_offered(0),
+	m_recorded(0),
+	m_repeated(0),
+	m_skipped(0),
+	m_dropped(0),
+	m_bytesWritten(0),
+	m_copyTicks(0)
+{
+	ZeroMemory(m_buffers, sizeof(m_buffers));
+	m_hFilled = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+VideoRecorder::~VideoRecorder()
+{
+	Stop();
+
+	CloseHandle(m_hFilled);
+	CloseHandle(m_hStop);
+}
+
+HRESULT VideoRecorder::Initialize(FrameArena* pArena, int maxWidth, int maxHeight)
+{
+	m_bufferBytes = (size_t)maxWidth * maxHeight * 4;
+
+	for ( int i = 0; i < cBuffers; ++i )
+	{
+		m_buffers[i].pPixels = static_cast<BYTE*>(pArena->AllocateBytes(m_bufferBytes));
+		if ( NULL == m_buffers[i].pPixels )
+		{
+			return E_OUTOFMEMORY;
+		}
+		m_free.Push(i);
+	}
+
+	// a 4:2:0 frame is smaller than a BGRA one, so the BGRA size holds either with its header
+	m_pStaging = static_cast<BYTE*>(pArena->AllocateBytes(m_bufferBytes + g_y4mFrameHeaderBytes));
+	return m_pStaging ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT VideoRecorder::Start(const char* path, RecordFormat format)
+{
+	if ( m_hThread || NULL == m_pStaging )
+	{
+		return E_UNEXPECTED;
+	}
+
+	m_file.open(path, ios::binary | ios::trunc);
+	if ( !m_file )
+	{
+		m_file.clear();
+		return E_FAIL;
+	}
+
+	m_format = format;
+	m_width = 0;
+	m_height = 0;
+	m_offered = 0;
+	m_recorded = 0;
+	m_repeated = 0;
+	m_skipped = 0;
+	m_dropped = 0;
+	m_bytesWritten = 0;
+	m_copyTicks = 0;
+	m_pLastFrame = NULL;
+	m_lastFrameBytes = 0;
+	m_startTicks = 0;
+	m_nextPeriod = 0;
+
+	ResetEvent(m_hStop);
+	m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	if ( NULL == m_hThread )
+	{
+		m_file.close();
+		return E_FAIL;
+	}
+
+	InterlockedExchange(&m_recording, 1);
+	return S_OK;
+}
+
+void VideoRecorder::Stop()
+{
+	if ( NULL == m_hThread )
+	{
+		return;
+	}
+
+	// no frame is queued after this: OnFrame calls that saw the flag set are waited out
+	InterlockedExchange(&m_recording, 0);
+	while ( m_inOnFrame != 0 )
+	{
+		SwitchToThread();
+	}
+
+	// the writer empties the queue before it stops
+	SetEvent(m_hStop);
+	WaitForSingleObject(m_hThread, INFINITE);
+	CloseHandle(m_hThread);
+	m_hThread = NULL;
+
+	m_file.close();
+}
+
+void VideoRecorder::GetStats(VideoRecorderStats& stats) const
+{
+	stats.offered = m_offered;
+	stats.recorded = m_recorded;
+	stats.repeated = m_repeated;
+	stats.skipped = m_skipped;
+	stats.dropped = m_dropped;
+	stats.bytesWritten = m_bytesWritten;
+	stats.copyMs = m_offered > 0 ? HighResClock::TicksToMilliseconds(m_copyTicks) / m_offered : 0.0;
+}
+
+void VideoRecorder::OnFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG, LONGLONG presentTicks)
+{
+	VideoRecorder* pThis = static_cast<VideoRecorder*>(context);
+
+	InterlockedIncrement(&pThis->m_inOnFrame);
+	if ( pThis->m_recording )
+	{
+		pThis->Offer(pixels, width, height, stride, presentTicks);
+	}
+	InterlockedDecrement(&pThis->m_inOnFrame);
+}
+
+void VideoRecorder::Offer(const BYTE* pixels, int width, int height, int stride, LONGLONG presentTicks)
+{
+	TRACE_SCOPE("VideoRecorder::Offer");
+	LONGLONG start = HighResClock::Now();
+	InterlockedIncrement(&m_offered);
+
+	// the period the frame was presented in, counting from the first frame's; a period gets the first frame presented in it
+	if ( 0 == m_startTicks )
+	{
+		m_startTicks = presentTicks;
+	}
+	LONGLONG period = (LONGLONG)(HighResClock::TicksToMilliseconds(presentTicks - m_startTicks) * cFramesPerSecond / 1000.0);
+	if ( period < m_nextPeriod )
+	{
+		InterlockedIncrement(&m_skipped);
+		m_copyTicks += HighResClock::Now() - start;
+		return;
+	}
+
+	// the writer has every buffer: drop rather than wait, the readback thread must keep up with the render.
+	// The periods since the last frame queued are filled in when the next one is
+	int index;
+	if ( (size_t)width * height * 4 > m_bufferBytes || (width & 1) || (height & 1) || !m_free.Pop(index) )
+	{
+		InterlockedIncrement(&m_dropped);
+		m_copyTicks += HighResClock::Now() - start;
+		return;
+	}
+
+	// the periods since the last frame queued showed that frame
+	RecordBuffer& buffer = m_buffers[index];
+	buffer.width = width;
+	buffer.height = height;
+	buffer.repeatLast = (int)(period - m_nextPeriod);
+	m_nextPeriod = period + 1;
+	for ( int y = 0; y < height; ++y )
+	{
+		memcpy(buffer.pPixels + y * width * 4, pixels + y * stride, width * 4);
+	}
+
+	m_filled.Push(index);
+	SetEvent(m_hFilled);
+	m_copyTicks += HighResClock::Now() - start;
+}
+
+DWORD WINAPI VideoRecorder::ThreadProc(LPVOID lpParameter)
+{
+	static_cast<VideoRecorder*>(lpParameter)->Write();
+	return 0;
+}
+
+void VideoRecorder::Write()
+{
+	Trace::SetThreadName("Recorder");
+
+	HANDLE events[2] = { m_hStop, m_hFilled };
+	bool stopping = false;
+	while ( !stopping )
+	{
+		stopping = ( WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1 );
+
+		// on the way out too, so the frames queued before Stop are all written
+		int index;
+		while ( m_filled.Pop(index) )
+		{
+			if ( WriteFrame(m_buffers[index]) )
+			{
+				// the frame written is held for repeats in place of the one before
+				if ( m_heldBuffer >= 0 )
+				{
+					m_free.Push(m_heldBuffer);
+				}
+				m_heldBuffer = index;
+			}
+			else
+			{
+				m_free.Push(index);
+			}
+		}
+	}
+
+	if ( m_heldBuffer >= 0 )
+	{
+		m_free.Push(m_heldBuffer);
+		m_heldBuffer = -1;
+	}
+	m_pLastFrame = NULL;
+}
+
+bool VideoRecorder::WriteFrame(const RecordBuffer& buffer)
+{
+	TRACE_SCOPE("VideoRecorder::WriteFrame");
+
+	// the periods in which nothing new was presented show the frame before, as the screen did
+	for ( int i = 0; m_pLastFrame && i < buffer.repeatLast; ++i )
+	{
+		m_file.write((const char*)m_pLastFrame, m_lastFrameBytes);
+		m_bytesWritten += m_lastFrameBytes;
+		InterlockedIncrement(&m_repeated);
+	}
+
+	// the first frame sets the size; the Y4M header carries it and the rate the frames are paced to
+	if ( m_width == 0 )
+	{
+		m_width = buffer.width;
+		m_height = buffer.height;
+
+		if ( m_format == RecordFormatY4M )
+		{
+			m_file << "YUV4MPEG2 W" << m_width << " H" << m_height << " F" << cFramesPerSecond << ":1 Ip A1:1 C420jpeg\n";
+		}
+	}
+
+	if ( buffer.width != m_width || buffer.height != m_height )
+	{
+		InterlockedIncrement(&m_dropped);
+		return false;
+	}
+
+	// one write per frame, header and all
+	const BYTE* pData = buffer.pPixels;
+	size_t bytes = (size_t)m_width * m_height * 4;
+	if ( m_format == RecordFormatY4M )
+	{
+		size_t lumaBytes = (size_t)m_width * m_height;
+		BYTE* pY = m_pStaging + g_y4mFrameHeaderBytes;
+		BYTE* pU = pY + lumaBytes;
+		BYTE* pV = pU + lumaBytes / 4;
+
+		memcpy(m_pStaging, g_y4mFrameHeader, g_y4mFrameHeaderBytes);
+		ConvertToI420(buffer.pPixels, m_width, m_height, pY, pU, pV);
+
+		pData = m_pStaging;
+		bytes = g_y4mFrameHeaderBytes + lumaBytes * 3 / 2;
+	}
+
+	m_file.write((const char*)pData, bytes);
+	m_bytesWritten += bytes;
+	InterlockedIncrement(&m_recorded);
+
+	m_pLastFrame = pData;
+	m_lastFrameBytes = bytes;
+	return true;
+}
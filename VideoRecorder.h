@@ -0,0 +1,158 @@
+/*
+
+Composited video recorder
+
+Records the frames the renderer reads back (see FrameReadback) to disk
+without ever holding up the render. The readback thread only copies each
+frame into a free buffer and queues it; a writer thread converts it and
+writes it out as one large sequential write. The buffers are allocated from
+the frame arena once, so a recording uses a fixed amount of memory however
+long it runs. When the writer falls behind and every buffer is queued, new
+frames are dropped and counted rather than waited for; frames whose size is
+not the recording's are dropped the same way.
+
+The renderer presents whenever a composite or only the overlay is new, so
+frames arrive at no fixed rate. The recording is paced to the sensor's 30
+fps by the time each frame was presented: of the frames presented within one
+period only the first is recorded, and a period in which none was presented
+repeats the frame before it, as the screen did. A recording plays back in
+the time it was made.
+
+Recordings are YUV4MPEG2 (4:2:0, BT.601 studio range, 30 fps), which most
+players and encoders read directly, or raw top-down BGRA frames back to back.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <fstream>
+#include "FrameArena.h"
+#include "SpscQueue.h"
+
+typedef enum
+{
+	RecordFormatY4M,		// YUV4MPEG2, 4:2:0
+	RecordFormatRaw			// BGRA frames with no header
+} RecordFormat;
+
+/// <summary>
+/// Recorder counters
+/// </summary>
+typedef struct
+{
+	LONG		offered;			// frames handed to the recorder while recording
+	LONG		recorded;			// frames written
+	LONG		repeated;			// periods written with the frame before, none having been presented
+	LONG		skipped;			// frames left out, one having been presented earlier in their period
+	LONG		dropped;			// frames dropped because every buffer was queued, or their size changed
+	LONGLONG	bytesWritten;
+	double		copyMs;				// average time the readback thread spent on an offered frame
+} VideoRecorderStats;
+
+class VideoRecorder
+{
+public:
+	// frames queued for the writer at most, about a quarter second at 30 fps
+	static const int cBuffers = 8;
+
+	// the recording's frame rate, the sensor's
+	static const int cFramesPerSecond = 30;
+
+	VideoRecorder();
+	~VideoRecorder();
+
+	/// <summary>
+	/// Allocates the frame buffers for frames up to the given size
+	/// </summary>
+	/// <param name="pArena">arena the buffers are kept in</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Initialize(FrameArena* pArena, int maxWidth, int maxHeight);
+
+	/// <summary>
+	/// Opens the file and starts the writer; the size is taken from the first frame
+	/// </summary>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(const char* path, RecordFormat format);
+
+	/// <summary>
+	/// Stops taking frames, writes the ones queued and closes the file
+	/// </summary>
+	void Stop();
+
+	bool IsRecording() const { return m_recording != 0; }
+
+	/// <summary>
+	/// Counters of the current or last recording
+	/// </summary>
+	void GetStats(VideoRecorderStats& stats) const;
+
+	/// <summary>
+	/// FrameSink for the renderer's readback; the context is the VideoRecorder
+	/// </summary>
+	static void OnFrame(void* context, const BYTE* pixels, int width, int height, int stride, LONG frame, LONGLONG presentTicks);
+
+private:
+	typedef struct
+	{
+		BYTE*		pPixels;		// top-down BGRA
+		int			width;
+		int			height;
+		int			repeatLast;		// periods to repeat the frame last written for, before this one
+	} RecordBuffer;
+
+	RecordBuffer	m_buffers[cBuffers];
+	size_t			m_bufferBytes;
+
+	// converted frame, with room for the Y4M frame header in front
+	BYTE*			m_pStaging;
+
+	// the frame last written, header and all, kept for repeats: the staging buffer, or the
+	// buffer the writer holds back from the free queue until the next is written
+	const BYTE*		m_pLastFrame;
+	size_t			m_lastFrameBytes;
+	int				m_heldBuffer;
+
+	// readback thread's pacing: when the first frame was presented, and the next period to record
+	LONGLONG		m_startTicks;
+	LONGLONG		m_nextPeriod;
+
+	// buffer indices: free ones go from the writer to the readback thread, filled ones back
+	SpscQueue<int, cBuffers>	m_free;
+	SpscQueue<int, cBuffers>	m_filled;
+
+	RecordFormat	m_format;
+	std::ofstream	m_file;
+	int				m_width;
+	int				m_height;
+
+	// OnFrame only queues while recording, and Stop waits for any call already past the check
+	volatile LONG	m_recording;
+	volatile LONG	m_inOnFrame;
+
+	HANDLE			m_hFilled;
+	HANDLE			m_hStop;
+	HANDLE			m_hThread;
+
+	volatile LONG	m_offered;
+	volatile LONG	m_recorded;
+	volatile LONG	m_repeated;
+	volatile LONG	m_skipped;
+	volatile LONG	m_dropped;
+	LONGLONG		m_bytesWritten;
+	LONGLONG		m_copyTicks;
+
+	/// <summary>
+	/// Copies a frame into a free buffer and queues it, on the readback thread, unless its period already has one
+	/// </summary>
+	void Offer(const BYTE* pixels, int width, int height, int stride, LONGLONG presentTicks);
+
+	/// <summary>
+	/// Writes the repeats a buffer asks for, then converts and writes the buffer, on the writer thread
+	/// </summary>
+	/// <returns>false if the frame was dropped</returns>
+	bool WriteFrame(const RecordBuffer& buffer);
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Write();
+};
@@ -0,0 +1,246 @@
+#include "stdafx.h"
+#include "WorkPool.h"
+#include "Trace.h"
+
+// the worker the current thread is, if it belongs to a pool
+static __declspec(thread) void* t_pWorker = NULL;
+
+static const char* g_workerNames[WorkPool::cMaxWorkers] =
+{
+	"Worker 0", "Worker 1", "Worker 2", "Worker 3", "Worker 4", "Worker 5", "Worker 6", "Worker 7",
+	"Worker 8", "Worker 9", "Worker 10", "Worker 11", "Worker 12", "Worker 13", "Worker 14", "Worker 15"
+};
+
+WorkPool::WorkPool() :
+	m_workerCount(0),
+	m_steals(0)
+{
+	for ( int i = 0; i < cMaxWorkers; ++i )
+	{
+		m_workers[i].pPool = this;
+		m_workers[i].index = i;
+		m_workers[i].hThread = NULL;
+		m_workers[i].queue.head = 0;
+		m_workers[i].queue.tail = 0;
+		InitializeCriticalSection(&m_workers[i].queue.lock);
+	}
+
+	m_injection.head = 0;
+	m_injection.tail = 0;
+	InitializeCriticalSection(&m_injection.lock);
+
+	m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_hWork = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+}
+
+WorkPool::~WorkPool()
+{
+	Stop();
+
+	for ( int i = 0; i < cMaxWorkers; ++i )
+	{
+		DeleteCriticalSection(&m_workers[i].queue.lock);
+	}
+	DeleteCriticalSection(&m_injection.lock);
+
+	CloseHandle(m_hStop);
+	CloseHandle(m_hWork);
+}
+
+HRESULT WorkPool::Start(int workers)
+{
+	if ( workers <= 0 )
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		workers = (int)info.dwNumberOfProcessors;
+	}
+	if ( workers > cMaxWorkers )
+	{
+		workers = cMaxWorkers;
+	}
+
+	ResetEvent(m_hStop);
+
+	for ( m_workerCount = 0; m_workerCount < workers; ++m_workerCount )
+	{
+		Worker& worker = m_workers[m_workerCount];
+		worker.queue.head = 0;
+		worker.queue.tail = 0;
+		worker.hThread = CreateThread(NULL, 0, ThreadProc, &worker, 0, NULL);
+		if ( NULL == worker.hThread )
+		{
+			Stop();
+			return E_FAIL;
+		}
+	}
+
+	return S_OK;
+}
+
+void WorkPool::Stop()
+{
+	SetEvent(m_hStop);
+
+	for ( int i = 0; i < m_workerCount; ++i )
+	{
+		if ( m_workers[i].hThread )
+		{
+			WaitForSingleObject(m_workers[i].hThread, INFINITE);
+			CloseHandle(m_workers[i].hThread);
+			m_workers[i].hThread = NULL;
+		}
+	}
+
+	m_workerCount = 0;
+	m_injection.head = 0;
+	m_injection.tail = 0;
+
+	// drain the semaphore so a restart doesn't wake for discarded work
+	while ( WaitForSingleObject(m_hWork, 0) == WAIT_OBJECT_0 )
+	{
+	}
+}
+
+void WorkPool::Submit(WorkFunction function, void* context)
+{
+	WorkItem item = { function, context };
+	Worker* pWorker = static_cast<Worker*>(t_pWorker);
+
+	bool queued;
+	if ( pWorker && pWorker->pPool == this )
+	{
+		queued = PushTail(pWorker->queue, item);
+	}
+	else
+	{
+		queued = PushTail(m_injection, item);
+	}
+
+	if ( !queued )
+	{
+		// the queues are sized well beyond what the stage graph keeps in flight, but never lose work
+		function(context);
+		return;
+	}
+
+	ReleaseSemaphore(m_hWork, 1, NULL);
+}
+
+DWORD WINAPI WorkPool::ThreadProc(LPVOID lpParameter)
+{
+	Worker* pWorker = static_cast<Worker*>(lpParameter);
+	pWorker->pPool->Run(pWorker);
+	return 0;
+}
+
+void WorkPool::Run(Worker* pWorker)
+{
+	t_pWorker = pWorker;
+	Trace::SetThreadName(g_workerNames[pWorker->index]);
+
+	HANDLE events[2] = { m_hStop, m_hWork };
+	for (;;)
+	{
+		WorkItem item;
+		if ( FindWork(pWorker, item) )
+		{
+			item.function(item.context);
+			continue;
+		}
+
+		// the semaphore count can run ahead of the queued items (stolen work isn't
+		// matched with a wait), which only costs a spurious wake-up
+		if ( WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1 )
+		{
+			break;
+		}
+	}
+
+	t_pWorker = NULL;
+}
+
+bool WorkPool::FindWork(Worker* pWorker, WorkItem& item)
+{
+	if ( PopTail(pWorker->queue, item) )
+	{
+		return true;
+	}
+
+	if ( PopHead(m_injection, item) )
+	{
+		return true;
+	}
+
+	// start with the next worker so thieves spread out rather than all hitting worker 0
+	for ( int i = 1; i < m_workerCount; ++i )
+	{
+		Worker& victim = m_workers[(pWorker->index + i) % m_workerCount];
+		if ( PopHead(victim.queue, item) )
+		{
+			InterlockedIncrement(&m_steals);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool WorkPool::PushTail(WorkQueue& queue, const WorkItem& item)
+{
+	bool pushed = false;
+
+	EnterCriticalSection(&queue.lock);
+	if ( queue.tail - queue.head < cQueueCapacity )
+	{
+		queue.items[queue.tail % cQueueCapacity] = item;
+		++queue.tail;
+		pushed = true;
+	}
+	LeaveCriticalSection(&queue.lock);
+
+	return pushed;
+}
+
+bool WorkPool::PopTail(WorkQueue& queue, WorkItem& item)
+{
+	// peek without the lock, an empty deque is the common case for an idle pool
+	if ( queue.tail == queue.head )
+	{
+		return false;
+	}
+
+	bool popped = false;
+
+	EnterCriticalSection(&queue.lock);
+	if ( queue.tail != queue.head )
+	{
+		--queue.tail;
+		item = queue.items[queue.tail % cQueueCapacity];
+		popped = true;
+	}
+	LeaveCriticalSection(&queue.lock);
+
+	return popped;
+}
+
+bool WorkPool::PopHead(WorkQueue& queue, WorkItem& item)
+{
+	if ( queue.tail == queue.head )
+	{
+		return false;
+	}
+
+	bool popped = false;
+
+	EnterCriticalSection(&queue.lock);
+	if ( queue.tail != queue.head )
+	{
+		item = queue.items[queue.head % cQueueCapacity];
+		++queue.head;
+		popped = true;
+	}
+	LeaveCriticalSection(&queue.lock);
+
+	return popped;
+}
@@ -0,0 +1,96 @@
+/*
+
+Work-stealing thread pool
+
+Each worker owns a small deque of work items. A worker pushes and pops at the
+tail of its own deque (newest first, so a stage handing a frame to the next
+stage tends to keep it on the same core) and, when that is empty, steals from
+the head of the other workers' deques. Work submitted from threads outside the
+pool goes to a shared injection queue. Idle workers sleep on a semaphore.
+
+The deques are short and only touched for a push, pop or steal, so each is
+guarded by its own critical section rather than a lock-free protocol.
+
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+typedef void (*WorkFunction)(void* context);
+
+typedef struct
+{
+	WorkFunction	function;
+	void*			context;
+} WorkItem;
+
+class WorkPool
+{
+public:
+	static const int cMaxWorkers = 16;
+	static const int cQueueCapacity = 64;
+
+	WorkPool();
+	~WorkPool();
+
+	/// <summary>
+	/// Starts the workers
+	/// </summary>
+	/// <param name="workers">number of worker threads, 0 for one per logical processor</param>
+	/// <returns>S_OK on success, otherwise failure code</returns>
+	HRESULT Start(int workers);
+
+	/// <summary>
+	/// Stops the workers. Work still queued is discarded
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// Queues a work item. May be called from any thread, including a worker
+	/// </summary>
+	void Submit(WorkFunction function, void* context);
+
+	int WorkerCount() const { return m_workerCount; }
+
+	/// <summary>
+	/// Items that were taken from another worker's deque
+	/// </summary>
+	LONG Steals() const { return m_steals; }
+
+private:
+	struct WorkQueue
+	{
+		CRITICAL_SECTION	lock;
+		WorkItem			items[cQueueCapacity];
+		volatile LONG		head;
+		volatile LONG		tail;
+	};
+
+	struct Worker
+	{
+		WorkPool*			pPool;
+		int					index;
+		HANDLE				hThread;
+		WorkQueue			queue;
+	};
+
+	Worker			m_workers[cMaxWorkers];
+	int				m_workerCount;
+
+	WorkQueue		m_injection;
+
+	HANDLE			m_hStop;
+	HANDLE			m_hWork;		// semaphore, released once per submitted item
+
+	volatile LONG	m_steals;
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Run(Worker* pWorker);
+
+	bool FindWork(Worker* pWorker, WorkItem& item);
+
+	static bool PushTail(WorkQueue& queue, const WorkItem& item);
+	static bool PopTail(WorkQueue& queue, WorkItem& item);
+	static bool PopHead(WorkQueue& queue, WorkItem& item);
+};
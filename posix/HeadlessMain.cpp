@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#include "CoordinateMapBenchmark.h"
+#include "ImageLoaderBenchmark.h"
+#include "MaskStabilizerBenchmark.h"
+#include "OffscreenRender.h"
+#include "PipelineBenchmark.h"
+#include "RegistrationBenchmark.h"
+#include "ResolutionBenchmark.h"
+#include "SharedFrameBenchmark.h"
+#include "SparseMappingBenchmark.h"
+
+// as GreenScreen.cpp's, where /recordregistration writes it
+static const char* g_registrationCapturePath = "registration_capture.bin";
+
+/// <summary>
+/// Entry point off Windows, where there is no window, sensor or MIDI device: the runs wWinMain makes without
+/// them, taking the same switches. With none, the same run as /headless, with /headless:frames also writing
+/// the frames read back
+/// </summary>
+int main(int argc, char* argv[])
+{
+	bool writeFrames = false;
+	for ( int i = 1; i < argc; ++i )
+	{
+		const char* arg = argv[i];
+
+		if ( 0 == strcmp(arg, "/benchpipeline") )
+		{
+			return SUCCEEDED(RunPipelineBenchmark("pipeline_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchsparse") )
+		{
+			return SUCCEEDED(RunSparseMappingBenchmark("sparse_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchregistration") )
+		{
+			return (S_OK == RunRegistrationBenchmark(g_registrationCapturePath, "registration_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchcoordinates") )
+		{
+			return SUCCEEDED(RunCoordinateMapBenchmark("coordinate_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchresolutions") )
+		{
+			return SUCCEEDED(RunResolutionBenchmark("resolution_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchshared") )
+		{
+			return SUCCEEDED(RunSharedFrameBenchmark("shared_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/readshared") )
+		{
+			return SUCCEEDED(RunSharedFrameReader(g_sharedFrameName, "shared_reader.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchbackground") )
+		{
+			return SUCCEEDED(RunImageLoaderBenchmark("background_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/benchmask") )
+		{
+			return SUCCEEDED(RunMaskStabilizerBenchmark("mask_bench.csv")) ? 0 : 1;
+		}
+		if ( 0 == strcmp(arg, "/headless:frames") )
+		{
+			writeFrames = true;
+		}
+	}
+
+	return SUCCEEDED(RunOffscreenRender("headless_render.csv", writeFrames)) ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "windows.h"
+
+// no MIDI device off Windows: the handle is declared for the headers that hold one, and never opened
+typedef struct HMIDIOUT__* HMIDIOUT;
@@ -0,0 +1,189 @@
+/*
+
+Kinect for Windows SDK, for other platforms
+
+There is no sensor runtime off Windows. This declares the runtime's types,
+constants and interfaces as the SDK does, so the code written against them
+builds and its benchmarks run on synthetic frames. No sensor is ever found:
+NuiGetSensorCount reports none and nothing here implements INuiSensor.
+
+*/
+
+#pragma once
+
+#include "windows.h"
+
+#define NUI_IMAGE_PLAYER_INDEX_SHIFT 3
+#define NUI_IMAGE_PLAYER_INDEX_MASK ((1 << NUI_IMAGE_PLAYER_INDEX_SHIFT) - 1)
+
+
+inline USHORT NuiDepthPixelToDepth(USHORT packedPixel)
+{
+	return (USHORT)(packedPixel >> NUI_IMAGE_PLAYER_INDEX_SHIFT);
+}
+
+inline USHORT NuiDepthPixelToPlayerIndex(USHORT packedPixel)
+{
+	return (USHORT)(packedPixel & NUI_IMAGE_PLAYER_INDEX_MASK);
+}
+
+#define NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX 0x00000001
+#define NUI_INITIALIZE_FLAG_USES_COLOR 0x00000002
+#define NUI_INITIALIZE_FLAG_USES_SKELETON 0x00000008
+#define NUI_INITIALIZE_FLAG_USES_DEPTH 0x00000020
+
+#define NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS (285.63f)
+#define NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS (531.15f)
+
+typedef enum _NUI_IMAGE_RESOLUTION
+{
+	NUI_IMAGE_RESOLUTION_INVALID = -1,
+	NUI_IMAGE_RESOLUTION_80x60 = 0,
+	NUI_IMAGE_RESOLUTION_320x240,
+	NUI_IMAGE_RESOLUTION_640x480,
+	NUI_IMAGE_RESOLUTION_1280x960
+} NUI_IMAGE_RESOLUTION;
+
+typedef enum _NUI_IMAGE_TYPE
+{
+	NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX = 0,
+	NUI_IMAGE_TYPE_COLOR,
+	NUI_IMAGE_TYPE_COLOR_YUV,
+	NUI_IMAGE_TYPE_COLOR_RAW_YUV,
+	NUI_IMAGE_TYPE_DEPTH
+} NUI_IMAGE_TYPE;
+
+typedef struct _Vector4
+{
+	FLOAT x;
+	FLOAT y;
+	FLOAT z;
+	FLOAT w;
+} Vector4;
+
+#define NUI_SKELETON_COUNT 6
+
+typedef enum _NUI_SKELETON_POSITION_INDEX
+{
+	NUI_SKELETON_POSITION_HIP_CENTER = 0,
+	NUI_SKELETON_POSITION_SPINE,
+	NUI_SKELETON_POSITION_SHOULDER_CENTER,
+	NUI_SKELETON_POSITION_HEAD,
+	NUI_SKELETON_POSITION_SHOULDER_LEFT,
+	NUI_SKELETON_POSITION_ELBOW_LEFT,
+	NUI_SKELETON_POSITION_WRIST_LEFT,
+	NUI_SKELETON_POSITION_HAND_LEFT,
+	NUI_SKELETON_POSITION_SHOULDER_RIGHT,
+	NUI_SKELETON_POSITION_ELBOW_RIGHT,
+	NUI_SKELETON_POSITION_WRIST_RIGHT,
+	NUI_SKELETON_POSITION_HAND_RIGHT,
+	NUI_SKELETON_POSITION_HIP_LEFT,
+	NUI_SKELETON_POSITION_KNEE_LEFT,
+	NUI_SKELETON_POSITION_ANKLE_LEFT,
+	NUI_SKELETON_POSITION_FOOT_LEFT,
+	NUI_SKELETON_POSITION_HIP_RIGHT,
+	NUI_SKELETON_POSITION_KNEE_RIGHT,
+	NUI_SKELETON_POSITION_ANKLE_RIGHT,
+	NUI_SKELETON_POSITION_FOOT_RIGHT,
+	NUI_SKELETON_POSITION_COUNT
+} NUI_SKELETON_POSITION_INDEX;
+
+typedef enum _NUI_SKELETON_POSITION_TRACKING_STATE
+{
+	NUI_SKELETON_POSITION_NOT_TRACKED = 0,
+	NUI_SKELETON_POSITION_INFERRED,
+	NUI_SKELETON_POSITION_TRACKED
+} NUI_SKELETON_POSITION_TRACKING_STATE;
+
+typedef enum _NUI_SKELETON_TRACKING_STATE
+{
+	NUI_SKELETON_NOT_TRACKED = 0,
+	NUI_SKELETON_POSITION_ONLY,
+	NUI_SKELETON_TRACKED
+} NUI_SKELETON_TRACKING_STATE;
+
+typedef struct _NUI_SKELETON_DATA
+{
+	NUI_SKELETON_TRACKING_STATE eTrackingState;
+	DWORD dwTrackingID;
+	DWORD dwEnrollmentIndex_NotUsed;
+	DWORD dwUserIndex;
+	Vector4 Position;
+	Vector4 SkeletonPositions[NUI_SKELETON_POSITION_COUNT];
+	NUI_SKELETON_POSITION_TRACKING_STATE eSkeletonPositionTrackingState[NUI_SKELETON_POSITION_COUNT];
+	DWORD dwQualityFlags;
+} NUI_SKELETON_DATA;
+
+typedef struct _NUI_SKELETON_FRAME
+{
+	LARGE_INTEGER liTimeStamp;
+	DWORD dwFrameNumber;
+	DWORD dwFlags;
+	Vector4 vFloorClipPlane;
+	Vector4 vNormalToGravity;
+	NUI_SKELETON_DATA SkeletonData[NUI_SKELETON_COUNT];
+} NUI_SKELETON_FRAME;
+
+typedef struct _NUI_IMAGE_VIEW_AREA
+{
+	int eDigitalZoom;
+	LONG lCenterX;
+	LONG lCenterY;
+} NUI_IMAGE_VIEW_AREA;
+
+typedef struct _NUI_LOCKED_RECT
+{
+	INT Pitch;
+	int size;
+	BYTE* pBits;
+} NUI_LOCKED_RECT;
+
+class INuiFrameTexture
+{
+public:
+	virtual HRESULT LockRect(UINT Level, NUI_LOCKED_RECT* pLockedRect, RECT* pRect, DWORD Flags) = 0;
+	virtual HRESULT UnlockRect(UINT Level) = 0;
+	virtual ULONG Release() = 0;
+};
+
+typedef struct _NUI_IMAGE_FRAME
+{
+	LARGE_INTEGER liTimeStamp;
+	DWORD dwFrameNumber;
+	NUI_IMAGE_TYPE eImageType;
+	NUI_IMAGE_RESOLUTION eResolution;
+	INuiFrameTexture* pFrameTexture;
+	DWORD dwFrameFlags;
+	NUI_IMAGE_VIEW_AREA ViewArea;
+} NUI_IMAGE_FRAME;
+
+class INuiSensor
+{
+public:
+	virtual HRESULT NuiInitialize(DWORD dwFlags) = 0;
+	virtual void NuiShutdown() = 0;
+	virtual HRESULT NuiStatus() = 0;
+	virtual HRESULT NuiImageStreamGetNextFrame(HANDLE hStream, DWORD dwMillisecondsToWait, NUI_IMAGE_FRAME* pImageFrame) = 0;
+	virtual HRESULT NuiImageStreamReleaseFrame(HANDLE hStream, NUI_IMAGE_FRAME* pImageFrame) = 0;
+	virtual HRESULT NuiSkeletonGetNextFrame(DWORD dwMillisecondsToWait, NUI_SKELETON_FRAME* pSkeletonFrame) = 0;
+	virtual HRESULT NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+		NUI_IMAGE_RESOLUTION eColorResolution, NUI_IMAGE_RESOLUTION eDepthResolution, const NUI_IMAGE_VIEW_AREA* pcViewArea,
+		LONG lDepthX, LONG lDepthY, USHORT usDepthValue, LONG* plColorX, LONG* plColorY) = 0;
+	virtual HRESULT NuiImageGetColorPixelCoordinateFrameFromDepthPixelFrameAtResolution(
+		NUI_IMAGE_RESOLUTION eColorResolution, NUI_IMAGE_RESOLUTION eDepthResolution, DWORD cDepthValues,
+		USHORT* pDepthValues, DWORD cColorCoordinates, LONG* pColorCoordinates) = 0;
+	virtual ULONG Release() = 0;
+};
+
+// there is no runtime to find a sensor with
+inline HRESULT NuiGetSensorCount(int* pCount)
+{
+	*pCount = 0;
+	return S_OK;
+}
+
+inline HRESULT NuiCreateSensorByIndex(int, INuiSensor** ppNuiSensor)
+{
+	*ppNuiSensor = NULL;
+	return E_FAIL;
+}
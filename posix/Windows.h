@@ -0,0 +1,4 @@
+#pragma once
+
+// the SDK spells it both ways, and so does the code
+#include "windows.h"
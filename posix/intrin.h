@@ -0,0 +1,41 @@
+#pragma once
+
+#include "windows.h"
+
+inline unsigned char _BitScanForward(unsigned long* pIndex, unsigned long mask)
+{
+	if ( 0 == mask )
+	{
+		return 0;
+	}
+	*pIndex = (unsigned long)__builtin_ctzl(mask);
+	return 1;
+}
+
+inline unsigned char _BitScanReverse(unsigned long* pIndex, unsigned long mask)
+{
+	if ( 0 == mask )
+	{
+		return 0;
+	}
+	*pIndex = (unsigned long)(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(mask));
+	return 1;
+}
+
+// DWORD is unsigned long on Windows, where these take a DWORD too; here it is 32 bits and not the same type
+
+inline unsigned char _BitScanForward(DWORD* pIndex, DWORD mask)
+{
+	unsigned long index = 0;
+	unsigned char found = _BitScanForward(&index, (unsigned long)mask);
+	*pIndex = (DWORD)index;
+	return found;
+}
+
+inline unsigned char _BitScanReverse(DWORD* pIndex, DWORD mask)
+{
+	unsigned long index = 0;
+	unsigned char found = _BitScanReverse(&index, (unsigned long)mask);
+	*pIndex = (DWORD)index;
+	return found;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "windows.h"
+#include <stdarg.h>
+#include <wchar.h>
+
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+
+// always terminated, and truncated to the buffer as strsafe's is
+inline HRESULT StringCchPrintfW(wchar_t* pszDest, size_t cchDest, const wchar_t* pszFormat, ...)
+{
+	if ( 0 == cchDest )
+	{
+		return E_INVALIDARG;
+	}
+
+	va_list args;
+	va_start(args, pszFormat);
+	int written = vswprintf(pszDest, cchDest, pszFormat, args);
+	va_end(args);
+
+	pszDest[cchDest - 1] = L'\0';
+	return ( written < 0 ) ? STRSAFE_E_INSUFFICIENT_BUFFER : S_OK;
+}
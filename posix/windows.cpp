@@ -0,0 +1,276 @@
+#include "windows.h"
+#include <errno.h>
+#include <unistd.h>
+
+typedef enum
+{
+	ObjectEvent,
+	ObjectSemaphore,
+	ObjectThread
+} ObjectKind;
+
+// Every handle is one of these. A thread's is signalled when it returns, and is held by the thread
+// as well as the handle, so either can go first
+typedef struct
+{
+	ObjectKind				kind;
+	bool					bManualReset;
+	bool					bSignalled;		// events and threads
+	LONG					count;			// semaphores
+	LONG					references;
+	LPTHREAD_START_ROUTINE	start;
+	LPVOID					parameter;
+} Object;
+
+// Waits are few and short, so one lock and condition for all objects keeps waiting on several simple
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_changed = PTHREAD_COND_INITIALIZER;
+
+static Object* NewObject(ObjectKind kind)
+{
+	Object* pObject = new Object;
+	ZeroMemory(pObject, sizeof(Object));
+	pObject->kind = kind;
+	pObject->references = 1;
+	return pObject;
+}
+
+/// <summary>
+/// Drops a reference, under the lock
+/// </summary>
+static void ReleaseObject(Object* pObject)
+{
+	if ( --pObject->references == 0 )
+	{
+		delete pObject;
+	}
+}
+
+/// <summary>
+/// Takes the object if it is signalled, under the lock
+/// </summary>
+static bool TryAcquire(Object* pObject)
+{
+	switch ( pObject->kind )
+	{
+	case ObjectSemaphore:
+		if ( pObject->count > 0 )
+		{
+			--pObject->count;
+			return true;
+		}
+		return false;
+
+	case ObjectEvent:
+		if ( pObject->bSignalled && !pObject->bManualReset )
+		{
+			pObject->bSignalled = false;
+			return true;
+		}
+		return pObject->bSignalled;
+
+	default:
+		return pObject->bSignalled;
+	}
+}
+
+HANDLE CreateEventW(LPSECURITY_ATTRIBUTES, BOOL manualReset, BOOL initialState, LPCWSTR)
+{
+	Object* pObject = NewObject(ObjectEvent);
+	pObject->bManualReset = manualReset != FALSE;
+	pObject->bSignalled = initialState != FALSE;
+	return pObject;
+}
+
+HANDLE CreateSemaphoreW(LPSECURITY_ATTRIBUTES, LONG initialCount, LONG, LPCWSTR)
+{
+	Object* pObject = NewObject(ObjectSemaphore);
+	pObject->count = initialCount;
+	return pObject;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+	pthread_mutex_lock(&g_lock);
+	static_cast<Object*>(hEvent)->bSignalled = true;
+	pthread_cond_broadcast(&g_changed);
+	pthread_mutex_unlock(&g_lock);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+	pthread_mutex_lock(&g_lock);
+	static_cast<Object*>(hEvent)->bSignalled = false;
+	pthread_mutex_unlock(&g_lock);
+	return TRUE;
+}
+
+BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG releaseCount, LONG* pPreviousCount)
+{
+	pthread_mutex_lock(&g_lock);
+	Object* pObject = static_cast<Object*>(hSemaphore);
+	if ( pPreviousCount )
+	{
+		*pPreviousCount = pObject->count;
+	}
+	pObject->count += releaseCount;
+	pthread_cond_broadcast(&g_changed);
+	pthread_mutex_unlock(&g_lock);
+	return TRUE;
+}
+
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE* objects, BOOL, DWORD milliseconds)
+{
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	if ( milliseconds != INFINITE )
+	{
+		deadline.tv_sec += milliseconds / 1000;
+		deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+		if ( deadline.tv_nsec >= 1000000000 )
+		{
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&g_lock);
+	DWORD result = WAIT_TIMEOUT;
+	for ( ;; )
+	{
+		for ( DWORD i = 0; i < count; ++i )
+		{
+			if ( TryAcquire(static_cast<Object*>(objects[i])) )
+			{
+				result = WAIT_OBJECT_0 + i;
+				break;
+			}
+		}
+		if ( result != WAIT_TIMEOUT || milliseconds == 0 )
+		{
+			break;
+		}
+
+		if ( milliseconds == INFINITE )
+		{
+			pthread_cond_wait(&g_changed, &g_lock);
+		}
+		else if ( pthread_cond_timedwait(&g_changed, &g_lock, &deadline) == ETIMEDOUT )
+		{
+			// one last look, for a signal that came with the timeout
+			milliseconds = 0;
+		}
+	}
+	pthread_mutex_unlock(&g_lock);
+	return result;
+}
+
+DWORD WaitForSingleObject(HANDLE hObject, DWORD milliseconds)
+{
+	return WaitForMultipleObjects(1, &hObject, FALSE, milliseconds);
+}
+
+static void* ThreadStart(void* parameter)
+{
+	Object* pObject = static_cast<Object*>(parameter);
+	pObject->start(pObject->parameter);
+
+	pthread_mutex_lock(&g_lock);
+	pObject->bSignalled = true;
+	pthread_cond_broadcast(&g_changed);
+	ReleaseObject(pObject);
+	pthread_mutex_unlock(&g_lock);
+	return NULL;
+}
+
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES, SIZE_T stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD, LPDWORD pThreadId)
+{
+	Object* pObject = NewObject(ObjectThread);
+	pObject->bManualReset = true;
+	pObject->references = 2;
+	pObject->start = start;
+	pObject->parameter = parameter;
+
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	if ( stackSize )
+	{
+		pthread_attr_setstacksize(&attributes, stackSize);
+	}
+
+	pthread_t thread;
+	int error = pthread_create(&thread, &attributes, ThreadStart, pObject);
+	pthread_attr_destroy(&attributes);
+	if ( error )
+	{
+		delete pObject;
+		return NULL;
+	}
+
+	if ( pThreadId )
+	{
+		*pThreadId = 0;
+	}
+	return pObject;
+}
+
+BOOL SetThreadPriority(HANDLE, int)
+{
+	// raising a thread's priority needs privileges on Linux; the scheduler is left to it
+	return TRUE;
+}
+
+BOOL CloseHandle(HANDLE hObject)
+{
+	pthread_mutex_lock(&g_lock);
+	ReleaseObject(static_cast<Object*>(hObject));
+	pthread_mutex_unlock(&g_lock);
+	return TRUE;
+}
+
+DWORD GetCurrentThreadId()
+{
+	static __thread DWORD threadId = 0;
+	static volatile LONG lastThreadId = 0;
+	if ( 0 == threadId )
+	{
+		threadId = (DWORD)InterlockedIncrement(&lastThreadId);
+	}
+	return threadId;
+}
+
+DWORD GetCurrentProcessId()
+{
+	return (DWORD)getpid();
+}
+
+void Sleep(DWORD milliseconds)
+{
+	timespec duration;
+	duration.tv_sec = milliseconds / 1000;
+	duration.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+	while ( nanosleep(&duration, &duration) != 0 && errno == EINTR )
+	{
+	}
+}
+
+BOOL SwitchToThread()
+{
+	sched_yield();
+	return TRUE;
+}
+
+void GetSystemInfo(SYSTEM_INFO* pInfo)
+{
+	ZeroMemory(pInfo, sizeof(SYSTEM_INFO));
+	pInfo->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+	pInfo->dwNumberOfProcessors = (DWORD)sysconf(_SC_NPROCESSORS_ONLN);
+	pInfo->dwAllocationGranularity = pInfo->dwPageSize;
+}
+
+DWORD GetLastError()
+{
+	return (DWORD)errno;
+}
@@ -0,0 +1,258 @@
+/*
+
+Win32 for other platforms
+
+The code is written against Win32, and on Windows this directory is not on
+the include path. Elsewhere it stands in for the SDK's headers, so the parts
+that need no window, sensor or MIDI device build as they are: the headless
+renderer, the benchmarks and what they run. It has the types and constants
+they use, the interlocked operations as compiler builtins, QueryPerformanceCounter
+on the monotonic clock, aligned allocation on posix_memalign, and events,
+semaphores, threads and critical sections on pthreads (windows.cpp). Code that does something platform specific, such
+as mapping files or creating a context, does it natively under _WIN32
+itself; nothing here pretends to be a window, a DC or a GL context.
+
+Only what the posix target uses is here, and it behaves as Win32 does
+for the way the code uses it, not in general: handles are only events,
+semaphores and threads, and waits on several are for any one of them.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define WINAPI
+#define CALLBACK
+#define APIENTRY
+#define EXTERN_C extern "C"
+
+#define __forceinline inline __attribute__((always_inline))
+#define __declspec(x) __declspec_##x
+#define __declspec_thread __thread
+#define __declspec_align(n) __attribute__((aligned(n)))
+#define __declspec_noinline __attribute__((noinline))
+
+typedef unsigned char BYTE;
+typedef BYTE* PBYTE;
+typedef BYTE* LPBYTE;
+typedef char CHAR;
+typedef short SHORT;
+typedef unsigned short USHORT;
+typedef unsigned short WORD;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef float FLOAT;
+typedef intptr_t INT_PTR;
+typedef uintptr_t UINT_PTR;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef uintptr_t DWORD_PTR;
+typedef size_t SIZE_T;
+typedef LONG HRESULT;
+typedef wchar_t WCHAR;
+typedef const wchar_t* PCWSTR;
+typedef const wchar_t* LPCWSTR;
+typedef wchar_t* LPWSTR;
+typedef const char* LPCSTR;
+typedef char* LPSTR;
+typedef void VOID;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef const void* LPCVOID;
+typedef void* HANDLE;
+typedef DWORD* LPDWORD;
+
+// opaque on other platforms: nothing here makes one, and code that needs one is Windows only
+typedef struct HWND__* HWND;
+typedef struct HDC__* HDC;
+typedef struct HGLRC__* HGLRC;
+typedef struct HINSTANCE__* HINSTANCE;
+typedef HINSTANCE HMODULE;
+
+typedef union
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct
+{
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+} RECT;
+
+typedef struct
+{
+	DWORD nLength;
+	LPVOID lpSecurityDescriptor;
+	BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES, *LPSECURITY_ATTRIBUTES;
+
+typedef struct
+{
+	DWORD dwPageSize;
+	DWORD dwNumberOfProcessors;
+	DWORD dwAllocationGranularity;
+} SYSTEM_INFO;
+
+typedef DWORD (WINAPI* LPTHREAD_START_ROUTINE)(LPVOID parameter);
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+#define MAXLONG 0x7fffffff
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_PENDING ((HRESULT)0x8000000AL)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+#define ERROR_SUCCESS 0L
+#define ERROR_NOT_SUPPORTED 50L
+#define HRESULT_FROM_WIN32(x) ((HRESULT)(x) <= 0 ? ((HRESULT)(x)) : ((HRESULT)(((x) & 0x0000FFFF) | 0x80070000)))
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+#define THREAD_PRIORITY_BELOW_NORMAL (-1)
+#define THREAD_PRIORITY_NORMAL 0
+#define THREAD_PRIORITY_ABOVE_NORMAL 1
+#define THREAD_PRIORITY_HIGHEST 2
+#define THREAD_PRIORITY_TIME_CRITICAL 15
+
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define CopyMemory(d, s, n) memcpy((d), (s), (n))
+#define _stricmp strcasecmp
+
+// interlocked operations are full barriers, as on Windows
+
+inline LONG InterlockedIncrement(volatile LONG* p) { return __sync_add_and_fetch(p, 1); }
+inline LONG InterlockedDecrement(volatile LONG* p) { return __sync_sub_and_fetch(p, 1); }
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG value) { return __sync_fetch_and_add(p, value); }
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG exchange, LONG comparand) { return __sync_val_compare_and_swap(p, comparand, exchange); }
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG* p) { return __sync_add_and_fetch(p, 1); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG value) { return __sync_fetch_and_add(p, value); }
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p, LONGLONG exchange, LONGLONG comparand) { return __sync_val_compare_and_swap(p, comparand, exchange); }
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile* p, PVOID exchange, PVOID comparand) { return __sync_val_compare_and_swap(p, comparand, exchange); }
+
+// __sync_lock_test_and_set is only an acquire barrier
+inline LONG InterlockedExchange(volatile LONG* p, LONG value) { __sync_synchronize(); return __sync_lock_test_and_set(p, value); }
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* p, LONGLONG value) { __sync_synchronize(); return __sync_lock_test_and_set(p, value); }
+inline PVOID InterlockedExchangePointer(PVOID volatile* p, PVOID value) { __sync_synchronize(); return __sync_lock_test_and_set(p, value); }
+
+inline void MemoryBarrier() { __sync_synchronize(); }
+inline void _ReadWriteBarrier() { __asm__ __volatile__("" ::: "memory"); }
+inline void YieldProcessor() { sched_yield(); }
+
+// malloc.h's aligned allocation; the alignment is a power of two, as it is for the code's callers
+
+inline void* _aligned_malloc(size_t size, size_t alignment)
+{
+	void* p = NULL;
+	return ( 0 == posix_memalign(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) ) ? p : NULL;
+}
+
+inline void _aligned_free(void* p) { free(p); }
+
+// the monotonic clock in nanoseconds
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* pCount)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pCount->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* pFrequency)
+{
+	pFrequency->QuadPart = 1000000000;
+	return TRUE;
+}
+
+inline DWORD GetTickCount()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (DWORD)(now.QuadPart / 1000000);
+}
+
+// critical sections are recursive, as on Windows
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+} CRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+inline void InitializeCriticalSection(LPCRITICAL_SECTION pSection)
+{
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pSection->mutex, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+}
+
+inline BOOL InitializeCriticalSectionAndSpinCount(LPCRITICAL_SECTION pSection, DWORD)
+{
+	InitializeCriticalSection(pSection);
+	return TRUE;
+}
+
+inline void DeleteCriticalSection(LPCRITICAL_SECTION pSection) { pthread_mutex_destroy(&pSection->mutex); }
+inline void EnterCriticalSection(LPCRITICAL_SECTION pSection) { pthread_mutex_lock(&pSection->mutex); }
+inline void LeaveCriticalSection(LPCRITICAL_SECTION pSection) { pthread_mutex_unlock(&pSection->mutex); }
+
+// events, semaphores and threads, in windows.cpp
+
+HANDLE CreateEventW(LPSECURITY_ATTRIBUTES attributes, BOOL manualReset, BOOL initialState, LPCWSTR name);
+HANDLE CreateSemaphoreW(LPSECURITY_ATTRIBUTES attributes, LONG initialCount, LONG maximumCount, LPCWSTR name);
+BOOL SetEvent(HANDLE hEvent);
+BOOL ResetEvent(HANDLE hEvent);
+BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG releaseCount, LONG* pPreviousCount);
+DWORD WaitForSingleObject(HANDLE hObject, DWORD milliseconds);
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE* objects, BOOL waitAll, DWORD milliseconds);
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES attributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags, LPDWORD pThreadId);
+BOOL SetThreadPriority(HANDLE hThread, int priority);
+BOOL CloseHandle(HANDLE hObject);
+DWORD GetCurrentThreadId();
+DWORD GetCurrentProcessId();
+void Sleep(DWORD milliseconds);
+BOOL SwitchToThread();
+void GetSystemInfo(SYSTEM_INFO* pInfo);
+DWORD GetLastError();
+
+#define CreateEvent CreateEventW
+#define CreateSemaphore CreateSemaphoreW
@@ -13,12 +13,14 @@
 // Windows Header Files
 #include <windows.h>
 
+#ifdef _WIN32
 #include <Shlobj.h>
 
 // Direct2D Header Files
 #include <d2d1.h>
 
 #pragma comment ( lib, "d2d1.lib" )
+#endif
 
 #ifdef _UNICODE
 #if defined _M_IX86
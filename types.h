@@ -13,4 +13,12 @@ typedef struct Point2f{
 	float y;
 } Point2f;
 
+// One overlay shape: a filled rectangle, or the disc inscribed in it
+typedef struct
+{
+	float left, top, width, height;		// view pixels
+	float red, green, blue, alpha;
+	float disc;							// 1 for the inscribed disc, 0 for the whole rectangle
+} ShapeInstance;
+
 #define DEG2RAD 3.14159/180.0
\ No newline at end of file